@@ -55,8 +55,9 @@ typedef struct ffconf {
 	char esc[8];
 
 	ffstr val;
-	ffstr3 buf;
+	ffstr3 buf; // storage for a value which can't point to input data
 	ffarr ctxs;
+	uint valbuf :1; // 'val' is stored in 'buf'
 } ffconf;
 
 /** Initialize parser. */
@@ -68,9 +69,15 @@ FF_EXTN void ffconf_parseclose(ffconf *p);
 FF_EXTN const char* ffconf_errmsg(ffconf *p, int r, char *buf, size_t cap);
 
 /** Parse config.
+p->val points to input data if possible,
+ but it's copied to p->buf if the value has escape sequences or is split between input buffers.
 Return enum FFPARS_E. */
 FF_EXTN int ffconf_parse(ffconf *p, const char *data, size_t *len);
 
+/** Return TRUE if p->val points to the input data passed to the last ffconf_parse() call
+ and is valid only while this data is. */
+#define ffconf_val_borrowed(p)  (!(p)->valbuf)
+
 static FFINL int ffconf_parsestr(ffconf *p, ffstr *data)
 {
 	size_t n = data->len;
@@ -220,9 +227,21 @@ struct ffconf_loadfile {
 	const ffpars_arg *args;
 	uint nargs;
 	uint bufsize;
+
+	/** Optional: file name of the binary cache with the parsed tokens of 'fn'. */
+	const char *cache_fn;
+	uint cache_used :1; // output: the data was loaded from the cache
+
 	char errstr[256];
 };
 
 /** Parse data from file using scheme.
+Binary cache (if 'cache_fn' is set):
+ If the cache was created from the same version of the file (size and modification time),
+  it's mapped into memory and the tokens are passed to the scheme without parsing the text.
+ Otherwise (or if the cache file is corrupted), the text is parsed and, on success,
+  the cache is written into "<cache_fn>.tmp" which then replaces the old cache file.
+ The tokens don't depend on the scheme, so the cache is valid for any 'args'.
+ The cache has host byte order and is not portable.
 Return 0 on success or enum FFPARS_E. */
 FF_EXTN int ffconf_loadfile(struct ffconf_loadfile *c);
@@ -0,0 +1,107 @@
+/** CSV, TSV reader.
+Copyright (c) 2019 Simon Zolin
+*/
+
+/*
+RFC 4180:
+ fields are separated by the delimiter, records by LF or CRLF;
+ a field in quotes may contain delimiters, line breaks and escaped quotes ("").
+Input data is processed in 64-byte blocks:
+ bitmasks of quotes, delimiters and line breaks are built with SSE2/NEON,
+ the quoted regions are found with prefix XOR of the quote bitmask,
+ so that the delimiters and line breaks within quotes are cleared from the bitmask at once.
+Fields point to input data except the fields with escaped quotes, which are copied.
+
+Parallel processing:
+ Input data is split into chunks of 'chunk_size' bytes.
+ 1. The workers count quotes in each chunk.
+ 2. The quote state at the beginning of chunk #k is the parity of quotes in the chunks before it,
+   so a worker finds the first record of its chunk:
+   it starts after the first line break outside of quotes at or after the nominal offset.
+ The workers parse the records of the chunks and call the handler directly.
+*/
+
+#pragma once
+
+#include <FF/data/parse.h>
+#include <FF/sys/filemap.h>
+
+
+struct ffcsv_rec {
+	const ffstr *fields;
+	uint nfields;
+	uint header :1; // the first record with the names of the columns
+	uint64 off; // offset of the record in input data
+	int err; // enum FFPARS_E
+	uint worker; // index of the worker thread (0: the calling thread)
+};
+
+/** Process a record.
+Called from several threads at once, except for the header record which is processed before all others.
+The fields are valid only until return.
+On invalid data the handler is called with rec->err set, then processing is stopped.
+Return 0 to continue;  otherwise processing is stopped. */
+typedef int (*ffcsv_handler)(void *udata, const struct ffcsv_rec *rec);
+
+struct ffcsv_conf {
+	ffcsv_handler handler; /** Required. */
+	void *udata;
+	uint threads; /** Number of worker threads including the calling thread.  0: the number of CPUs */
+	uint chunk_size; /** Size of a chunk of data processed by a worker at once */
+	char delim; /** Field delimiter: ',' (default), '\t' for TSV */
+	char quote; /** Quote character: '"' (default);  0: quoting isn't supported */
+	uint header :1; /** The first record is the header */
+};
+
+/** Set default configuration. */
+FF_EXTN void ffcsv_conf_init(struct ffcsv_conf *conf);
+
+struct ffcsv_stat {
+	uint64 records; /** Non-empty records including the header */
+	uint64 chunks;
+};
+
+/** Parse records from memory.
+Empty lines are skipped.
+A record crossing the end of a chunk is parsed by the worker which has started it.
+st: optional;  the values are added to it
+Return 0 on success;
+ the value returned by the handler, if it has stopped processing;
+ enum FFPARS_E on invalid data (after the handler has returned 0);
+ -1 on system error. */
+FF_EXTN int ffcsv_run(const struct ffcsv_conf *conf, const char *data, size_t len, struct ffcsv_stat *st);
+
+/** Parse records from a mapped file region.
+fm: initialized with fffile_mapset();  'blocksize' determines how much data is processed in parallel at once
+ A record crossing the end of a block is copied and parsed separately.
+Return the same as ffcsv_run(). */
+FF_EXTN int ffcsv_runmap(const struct ffcsv_conf *conf, fffilemap *fm, struct ffcsv_stat *st);
+
+
+/** Column binding: fields of a record are set to an object via the scheme arguments. */
+typedef struct ffcsv_cols {
+	const ffpars_arg **map; // column -> argument;  NULL: the column is skipped
+	uint ncols;
+} ffcsv_cols;
+
+enum FFCSV_COLS_F {
+	FFCSV_COLS_SKIPUNK = 1, // skip the columns not found in the scheme
+	FFCSV_COLS_KEYICASE = 2, // case-insensitive column names
+};
+
+/** Bind columns to the arguments.
+header: the names of the columns;  NULL: the first 'ncols' arguments are bound in order
+flags: enum FFCSV_COLS_F
+Return 0 or enum FFPARS_E:
+ FFPARS_EUKNKEY: unknown column
+ FFPARS_EDUPKEY: several columns for 1 argument
+ FFPARS_ENOREQ: no column for a required argument */
+FF_EXTN int ffcsv_cols_init(ffcsv_cols *c, const ffpars_arg *args, uint nargs, const ffstr *header, uint ncols, uint flags);
+
+FF_EXTN void ffcsv_cols_free(ffcsv_cols *c);
+
+/** Set the fields of an object.
+The missing fields of a short record aren't set.
+The functions of the arguments receive NULL for 'ps'.
+Return 0 or enum FFPARS_E. */
+FF_EXTN int ffcsv_cols_bind(const ffcsv_cols *c, const struct ffcsv_rec *rec, void *obj);
@@ -3,6 +3,7 @@ Copyright (c) 2013 Simon Zolin
 */
 
 #include <FF/data/conf.h>
+#include <FF/crc.h>
 
 
 enum FFCONF_SCF {
@@ -17,8 +18,8 @@ enum FFCONF_SCF {
 static int hdlEsc(ffconf *p, int *st, int ch);
 static int unesc(char *dst, size_t cap, const char *text, size_t len);
 static int hdlQuote(ffconf *p, int *st, int *nextst, const char *data);
-static int val_add(ffarr *buf, const char *s, size_t len);
-static int val_store(ffarr *buf, const char *s, size_t len);
+static int val_add(ffconf *p, const char *s, size_t len);
+static int val_store(ffconf *p, const char *s, size_t len);
 
 enum CONF_IDX {
 	FFPARS_IWSPACE, I_ERR,
@@ -57,7 +58,7 @@ static int hdlQuote(ffconf *p, int *st, int *nextst, const char *data)
 		break;
 
 	default:
-		r = val_add(&p->buf, data, 1);
+		r = val_add(p, data, 1);
 	}
 
 	return r;
@@ -107,7 +108,7 @@ static int hdlEsc(ffconf *p, int *st, int ch)
 		return FFPARS_EESC; //invalid escape sequence
 
 	if (r != 0) {
-		r = val_store(&p->buf, buf, r);
+		r = val_store(p, buf, r);
 		if (r != 0)
 			return r; //allocation error
 		p->esc[0] = 0;
@@ -187,31 +188,57 @@ const char* ffconf_errmsg(ffconf *p, int r, char *buf, size_t cap)
 	return (n != 0) ? buf : "";
 }
 
+/* The buffer is kept for the next values. */
 static void conf_cleardata(ffconf *p)
 {
 	ffstr_null(&p->val);
-	ffarr_free(&p->buf);
+	p->buf.len = 0;
+	p->valbuf = 0;
 }
 
-static int val_store(ffarr *buf, const char *s, size_t len)
+/* Copy data to the buffer.
+The first call copies the value gathered so far from input data. */
+static int val_store(ffconf *p, const char *s, size_t len)
 {
-	if (NULL == ffarr_grow(buf, len, 256 | FFARR_GROWQUARTER))
+	if (!p->valbuf) {
+		p->buf.len = 0;
+		if (NULL == ffarr_grow(&p->buf, p->val.len + len, 256 | FFARR_GROWQUARTER))
+			return FFPARS_ESYS;
+		if (p->val.len != 0)
+			ffarr_append(&p->buf, p->val.ptr, p->val.len);
+		p->valbuf = 1;
+
+	} else if (NULL == ffarr_grow(&p->buf, len, 256 | FFARR_GROWQUARTER))
 		return FFPARS_ESYS;
-	ffarr_append(buf, s, len);
+
+	if (len != 0)
+		ffarr_append(&p->buf, s, len);
+	ffstr_set2(&p->val, &p->buf);
 	return 0;
 }
 
-static int val_add(ffarr *buf, const char *s, size_t len)
+/* Add data to the value:
+ extend the value within input data or copy data if the value is stored in the buffer. */
+static int val_add(ffconf *p, const char *s, size_t len)
 {
-	if (buf->cap != 0)
-		return val_store(buf, s, len);
+	if (p->valbuf)
+		return val_store(p, s, len);
 
-	if (buf->len == 0)
-		buf->ptr = (char*)s;
-	buf->len += len;
+	if (p->val.len == 0)
+		p->val.ptr = (char*)s;
+	p->val.len += len;
 	return 0;
 }
 
+/* Get the number of bytes within quotes that don't need special processing. */
+static size_t quot_span(const char *d, const char *end)
+{
+	const char *s = d;
+	while (d != end && *d != '"' && *d != '\\' && *d != '\n')
+		d++;
+	return d - s;
+}
+
 int ffconf_parse(ffconf *p, const char *data, size_t *len)
 {
 	const char *datao = data;
@@ -273,7 +300,6 @@ int ffconf_parse(ffconf *p, const char *data, size_t *len)
 				st = iRmCtx;
 				p->type = FFCONF_TOBJ;
 				r = FFPARS_CLOSE;
-				ffstr_setcz(&p->val, "}");
 
 			} else {
 				st = iKeyBare;
@@ -292,7 +318,7 @@ int ffconf_parse(ffconf *p, const char *data, size_t *len)
 
 		case iValBare:
 			if (!ffchar_iswhitespace(ch) && ch != '/' && ch != '#')
-				r = val_add(&p->buf, data, 1);
+				r = val_add(p, data, 1);
 			else {
 				if (st == iKeyBare)
 					p->type = FFCONF_TKEY;
@@ -316,7 +342,6 @@ int ffconf_parse(ffconf *p, const char *data, size_t *len)
 				p->type = FFCONF_TOBJ;
 				nextst = iValSplit;
 				r = FFPARS_OPEN;
-				ffstr_setcz(&p->val, "{");
 
 			} else {
 				st = iValBare;
@@ -349,9 +374,18 @@ int ffconf_parse(ffconf *p, const char *data, size_t *len)
 			break;
 
 //QUOTE
-		case iQuot:
+		case iQuot: {
+			// add all characters up to the next special one at once
+			size_t n = quot_span(data, end);
+			if (n > 1) {
+				r = val_add(p, data, n);
+				data += n - 1;
+				p->ch += n - 1;
+				break;
+			}
 			r = hdlQuote(p, &st, &nextst, data);
 			break;
+		}
 
 		case iQuotEsc:
 			r = hdlEsc(p, &st, ch);
@@ -400,10 +434,9 @@ int ffconf_parse(ffconf *p, const char *data, size_t *len)
 		}
 	}
 
-	if (r == FFPARS_MORE && p->buf.len != 0)
-		r = val_store(&p->buf, NULL, 0);
+	if (r == FFPARS_MORE && p->val.len != 0 && !p->valbuf)
+		r = val_store(p, NULL, 0); // the next input data won't be contiguous with this one
 
-	ffstr_set2(&p->val, &p->buf);
 	p->state = st;
 	p->nextst = nextst;
 	*len = data - datao;
@@ -943,6 +976,158 @@ int ffconf_ctx_copy(ffconf_ctxcopy *cc, const ffconf *conf)
 }
 
 
+/*
+Binary cache:
+HEADER TOKEN...
+HEADER: "ffconf" 0 VER(1)  SRC_SIZE(8)  SRC_MTIME_SEC(8)  SRC_MTIME_USEC(4)  DATA_CRC(4)  DATA_SIZE(8)
+TOKEN: RET(1) TYPE(1) LINE_DELTA(varint) CH(varint) LEN(varint) VALUE
+RET: -(enum FFPARS_E) returned by ffconf_parse()
+varint: 7 bits per byte, the low bits first;  0x80: more bytes follow
+DATA_CRC: CRC32 of the tokens:  a corrupted cache is never passed to the scheme
+*/
+
+struct conf_cachehdr {
+	char magic[8];
+	uint64 src_size;
+	int64 src_mtime_sec;
+	uint src_mtime_usec;
+	uint data_crc;
+	uint64 data_size;
+};
+
+static const char conf_cache_magic[8] = "ffconf\x00\x02";
+
+static char* conf_varint_put(char *d, uint64 n)
+{
+	while (n >= 0x80) {
+		*d++ = (byte)n | 0x80;
+		n >>= 7;
+	}
+	*d++ = (byte)n;
+	return d;
+}
+
+/* Return NULL on error. */
+static const char* conf_varint_get(const char *d, const char *end, uint64 *n)
+{
+	uint64 r = 0;
+	for (uint sh = 0;  d != end && sh < 64;  sh += 7) {
+		uint b = (byte)*d++;
+		r |= (uint64)(b & 0x7f) << sh;
+		if (!(b & 0x80)) {
+			*n = r;
+			return d;
+		}
+	}
+	return NULL;
+}
+
+/* Add the current token to cache data.
+Return 0 on success. */
+static int conf_cache_add(ffarr *buf, const ffconf *p, uint *line)
+{
+	if (NULL == ffarr_grow(buf, 2 + 3 * 10 + p->val.len, 64 * 1024 | FFARR_GROWQUARTER))
+		return -1;
+	char *d = ffarr_end(buf);
+	*d++ = (char)-p->ret;
+	*d++ = (char)p->type;
+	d = conf_varint_put(d, p->line - *line);
+	d = conf_varint_put(d, p->ch);
+	d = conf_varint_put(d, p->val.len);
+	ffmemcpy(d, p->val.ptr, p->val.len);
+	buf->len = d + p->val.len - buf->ptr;
+	*line = p->line;
+	return 0;
+}
+
+/* Pass the tokens from cache data to the scheme. */
+static int conf_cache_run(ffparser_schem *ps, const char *d, size_t len)
+{
+	ffconf *p = ps->p;
+	const char *end = d + len;
+	uint64 line, ch, n;
+	int r;
+
+	while (d != end) {
+		if (end - d < 2)
+			return FFPARS_EINTL;
+		p->ret = -(int)(byte)d[0];
+		p->type = (byte)d[1];
+		d += 2;
+		if (NULL == (d = conf_varint_get(d, end, &line))
+			|| NULL == (d = conf_varint_get(d, end, &ch))
+			|| NULL == (d = conf_varint_get(d, end, &n))
+			|| n > (size_t)(end - d))
+			return FFPARS_EINTL;
+		p->line += line;
+		p->ch = ch;
+		ffstr_set(&p->val, d, n);
+		d += n;
+
+		r = ffconf_schemrun(ps);
+		if (ffpars_iserr(r)) {
+			// the value is used in error message after the cache file is unmapped
+			if (0 != val_store(p, NULL, 0))
+				ffstr_null(&p->val);
+			return r;
+		}
+	}
+
+	ffstr_null(&p->val);
+	return ffconf_schemfin(ps);
+}
+
+/* Process the tokens from the cache file if it's created for the same version of the source file.
+Return enum FFPARS_E;  -1 if the cache can't be used. */
+static int conf_cache_load(const char *fn, ffparser_schem *ps, const struct conf_cachehdr *src)
+{
+	int r = -1;
+	fffd f, hmap = 0;
+	char *map = NULL;
+	uint64 sz;
+	const struct conf_cachehdr *h;
+
+	if (FF_BADFD == (f = fffile_open(fn, O_RDONLY)))
+		return -1;
+
+	sz = fffile_size(f);
+	if (sz < sizeof(struct conf_cachehdr) || sz != (size_t)sz)
+		goto end;
+
+	if (0 == (hmap = ffmap_create(f, 0, FFMAP_PAGEREAD))
+		|| NULL == (map = ffmap_open(hmap, 0, sz, PROT_READ, MAP_SHARED)))
+		goto end;
+
+	h = (void*)map;
+	if (0 != ffmemcmp(h, src, FFOFF(struct conf_cachehdr, data_crc))
+		|| h->data_size != sz - sizeof(struct conf_cachehdr)
+		|| h->data_crc != ffcrc32_get(map + sizeof(struct conf_cachehdr), h->data_size))
+		goto end;
+
+	r = conf_cache_run(ps, map + sizeof(struct conf_cachehdr), h->data_size);
+
+end:
+	if (map != NULL)
+		ffmap_unmap(map, sz);
+	if (hmap != 0)
+		ffmap_close(hmap);
+	fffile_close(f);
+	return r;
+}
+
+/* Write the cache into a temporary file, then replace the old file with it:
+ another process never sees a partially written cache. */
+static void conf_cache_write(const char *fn, const ffarr *cache)
+{
+	ffarr tmp = {0};
+	if (0 == ffstr_catfmt(&tmp, "%s.tmp%Z", fn))
+		return;
+	if (0 != fffile_writeall(tmp.ptr, cache->ptr, cache->len, 0)
+		|| 0 != fffile_rename(tmp.ptr, fn))
+		fffile_rm(tmp.ptr); // the next time the text will be parsed again
+	ffarr_free(&tmp);
+}
+
 int ffconf_loadfile(struct ffconf_loadfile *c)
 {
 	int r;
@@ -953,6 +1138,9 @@ int ffconf_loadfile(struct ffconf_loadfile *c)
 	ffconf p;
 	ffparser_schem ps;
 	ffpars_ctx ctx = {0};
+	ffarr cache = {0};
+	uint cache_line = 1;
+	struct conf_cachehdr hdr;
 
 	if (c->bufsize == 0)
 		c->bufsize = 4096;
@@ -967,6 +1155,31 @@ int ffconf_loadfile(struct ffconf_loadfile *c)
 		goto done;
 	}
 
+	c->cache_used = 0;
+	if (c->cache_fn != NULL) {
+		fffileinfo fi;
+		if (0 != fffile_info(f, &fi)) {
+			r = FFPARS_ESYS;
+			goto done;
+		}
+		fftime t = fffile_infomtime(&fi);
+		ffmem_tzero(&hdr);
+		ffmemcpy(hdr.magic, conf_cache_magic, sizeof(hdr.magic));
+		hdr.src_size = fffile_infosize(&fi);
+		hdr.src_mtime_sec = fftime_sec(&t);
+		hdr.src_mtime_usec = fftime_usec(&t);
+
+		r = conf_cache_load(c->cache_fn, &ps, &hdr);
+		if (r != -1) {
+			c->cache_used = 1;
+			goto done;
+		}
+
+		// reserve space for the header
+		if (NULL != ffarr_alloc(&cache, 64 * 1024))
+			cache.len = sizeof(struct conf_cachehdr);
+	}
+
 	if (NULL == (buf = ffmem_alloc(c->bufsize))) {
 		r = FFPARS_ESYS;
 		goto done;
@@ -983,6 +1196,9 @@ int ffconf_loadfile(struct ffconf_loadfile *c)
 
 		while (s.len != 0) {
 			r = ffconf_parsestr(&p, &s);
+			if (r < 0 && cache.len != 0
+				&& 0 != conf_cache_add(&cache, &p, &cache_line))
+				ffarr_free(&cache); // continue without cache
 			r = ffconf_schemrun(&ps);
 
 			if (ffpars_iserr(r))
@@ -992,6 +1208,13 @@ int ffconf_loadfile(struct ffconf_loadfile *c)
 
 	r = ffconf_schemfin(&ps);
 
+	if (r == 0 && cache.len != 0) {
+		hdr.data_size = cache.len - sizeof(struct conf_cachehdr);
+		hdr.data_crc = ffcrc32_get(cache.ptr + sizeof(struct conf_cachehdr), hdr.data_size);
+		ffmemcpy(cache.ptr, &hdr, sizeof(struct conf_cachehdr));
+		conf_cache_write(c->cache_fn, &cache);
+	}
+
 done:
 	if (ffpars_iserr(r)) {
 		ffconf_errmsg(&p, r, c->errstr, sizeof(c->errstr));
@@ -999,6 +1222,7 @@ done:
 
 	ffconf_parseclose(&p);
 	ffpars_schemfree(&ps);
+	ffarr_free(&cache);
 	ffmem_safefree(buf);
 	FF_SAFECLOSE(f, FF_BADFD, fffile_close);
 	return r;
@@ -0,0 +1,709 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/data/csv.h>
+#include <FF/sys/thread-util.h>
+
+#ifdef FF_AMD64
+#include <emmintrin.h> //SSE2
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+
+void ffcsv_conf_init(struct ffcsv_conf *conf)
+{
+	ffmem_tzero(conf);
+	conf->chunk_size = 256 * 1024;
+	conf->delim = ',';
+	conf->quote = '"';
+}
+
+
+/** Bitmasks of a 64-byte block: bit #i is set if byte #i matches. */
+struct csv_masks {
+	uint64 quote;
+	uint64 delim; // delimiters and LF
+	uint64 lf;
+	uint64 cr;
+};
+
+#if defined __ARM_NEON
+static FFINL uint neon_mask16(uint8x16_t eq)
+{
+	static const byte bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t t = vandq_u8(eq, vld1q_u8(bits));
+	uint8x8_t p = vpadd_u8(vget_low_u8(t), vget_high_u8(t));
+	p = vpadd_u8(p, p);
+	p = vpadd_u8(p, p);
+	return vget_lane_u16(vreinterpret_u16_u8(p), 0);
+}
+#endif
+
+static FFINL void csv_masks(struct csv_masks *m, const char *d, int delim, int quote)
+{
+#if defined FF_AMD64
+	const __m128i vq = _mm_set1_epi8(quote), vd = _mm_set1_epi8(delim);
+	const __m128i vlf = _mm_set1_epi8('\n'), vcr = _mm_set1_epi8('\r');
+	uint64 q = 0, s = 0, lf = 0, cr = 0;
+	for (uint i = 0;  i != 64;  i += 16) {
+		__m128i v = _mm_loadu_si128((void*)(d + i));
+		__m128i l = _mm_cmpeq_epi8(v, vlf);
+		q |= (uint64)(uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vq)) << i;
+		s |= (uint64)(uint)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, vd), l)) << i;
+		lf |= (uint64)(uint)_mm_movemask_epi8(l) << i;
+		cr |= (uint64)(uint)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vcr)) << i;
+	}
+	m->quote = (quote != 0) ? q : 0;
+	m->delim = s;
+	m->lf = lf;
+	m->cr = cr;
+
+#elif defined __ARM_NEON
+	uint64 q = 0, s = 0, lf = 0, cr = 0;
+	for (uint i = 0;  i != 64;  i += 16) {
+		uint8x16_t v = vld1q_u8((void*)(d + i));
+		uint8x16_t l = vceqq_u8(v, vdupq_n_u8('\n'));
+		q |= (uint64)neon_mask16(vceqq_u8(v, vdupq_n_u8(quote))) << i;
+		s |= (uint64)neon_mask16(vorrq_u8(vceqq_u8(v, vdupq_n_u8(delim)), l)) << i;
+		lf |= (uint64)neon_mask16(l) << i;
+		cr |= (uint64)neon_mask16(vceqq_u8(v, vdupq_n_u8('\r'))) << i;
+	}
+	m->quote = (quote != 0) ? q : 0;
+	m->delim = s;
+	m->lf = lf;
+	m->cr = cr;
+
+#else
+	ffmem_tzero(m);
+	for (uint i = 0;  i != 64;  i++) {
+		uint64 bit = 1ULL << i;
+		int ch = d[i];
+		if (ch == quote && quote != 0)
+			m->quote |= bit;
+		else if (ch == delim)
+			m->delim |= bit;
+		else if (ch == '\n')
+			m->lf |= bit;
+		else if (ch == '\r')
+			m->cr |= bit;
+	}
+	m->delim |= m->lf;
+#endif
+}
+
+/** Get the bitmask of the bytes after an odd number of set bits, including the set bits themselves. */
+static FFINL uint64 prefix_xor(uint64 x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+static FFINL uint parity64(uint64 x)
+{
+	x ^= x >> 32;
+	x ^= x >> 16;
+	x ^= x >> 8;
+	x ^= x >> 4;
+	x ^= x >> 2;
+	x ^= x >> 1;
+	return x & 1;
+}
+
+/** Get the parity of the number of quotes in data. */
+static uint csv_parity(const char *d, size_t len, int quote)
+{
+	struct csv_masks m;
+	uint64 x = 0;
+	const char *end = d + len;
+
+	if (quote == 0)
+		return 0;
+
+	for (;  end - d >= 64;  d += 64) {
+		csv_masks(&m, d, quote, quote);
+		x ^= m.quote;
+	}
+	uint r = parity64(x);
+	for (;  d != end;  d++) {
+		r ^= (*d == quote);
+	}
+	return r;
+}
+
+/** Find the end of the record which contains the byte at 'off'.
+inq: quote state at 'off'
+Return the offset after LF;  'len' if there's no LF outside of quotes. */
+static size_t rec_end(const char *d, size_t off, size_t len, int quote, uint inq)
+{
+	if (quote == 0) {
+		const char *lf = ffs_findc(d + off, len - off, '\n');
+		return (lf != NULL) ? lf - d + 1 : len;
+	}
+
+	for (size_t i = off;  i != len;  i++) {
+		if (d[i] == quote)
+			inq ^= 1;
+		else if (d[i] == '\n' && !inq)
+			return i + 1;
+	}
+	return len;
+}
+
+/** Find the end of the last complete record.
+inq: quote state at 'len'
+Return 0 if there's no LF outside of quotes. */
+static size_t rec_end_last(const char *d, size_t len, int quote, uint inq)
+{
+	for (size_t i = len;  i != 0;  i--) {
+		if (d[i - 1] == quote && quote != 0)
+			inq ^= 1;
+		else if (d[i - 1] == '\n' && !inq)
+			return i;
+	}
+	return 0;
+}
+
+
+typedef struct csv csv;
+
+struct csv_worker {
+	csv *c;
+	ffthd th;
+	uint idx;
+	ffarr fields; //ffstr[]
+	ffarr buf; // data of the fields with escaped quotes
+	ffarr esc; //uint[]: indexes of the fields in 'buf'
+	uint64 records;
+	char pad[FFCPU_CACHELINE];
+};
+
+struct csv {
+	const struct ffcsv_conf *conf;
+	const char *data;
+	size_t len;
+	uint64 base;
+	size_t chunk_size;
+	size_t nchunks;
+	byte *inq; // parity of the number of quotes in each chunk;  then: quote state at the beginning of each chunk
+
+	ffatomic next_count; // the next chunk to count quotes in
+	ffatomic counted; // the number of chunks with counted quotes
+	ffatomic ready; // quote states are set
+	ffatomic next; // the next chunk to parse
+	ffatomic stop; // the value returned by handler;  -1: system error
+
+	struct csv_worker *w;
+	uint nworkers;
+};
+
+static void csv_stop(csv *c, int r)
+{
+	ffatom_cmpset(&c->stop, 0, (size_t)(ssize_t)r);
+}
+
+/** Pass the record to the handler. */
+static int rec_deliver(csv *c, struct csv_worker *w, const char *rstart, uint header)
+{
+	struct ffcsv_rec rec = {};
+	ffstr *f = (void*)w->fields.ptr;
+
+	// the fields with escaped quotes point to the buffer
+	const uint *i;
+	FFARR_WALKT(&w->esc, i, uint) {
+		f[*i].ptr = w->buf.ptr + (size_t)f[*i].ptr;
+	}
+
+	w->records++;
+	rec.fields = f;
+	rec.nfields = w->fields.len;
+	rec.header = header;
+	rec.off = c->base + (rstart - c->data);
+	rec.worker = w->idx;
+	int r = c->conf->handler(c->conf->udata, &rec);
+
+	w->fields.len = 0;
+	w->buf.len = 0;
+	w->esc.len = 0;
+	return r;
+}
+
+/** Report invalid data to the handler. */
+static int rec_error(csv *c, struct csv_worker *w, const char *rstart, int err)
+{
+	struct ffcsv_rec rec = {};
+	rec.off = c->base + (rstart - c->data);
+	rec.err = err;
+	rec.worker = w->idx;
+	int r = c->conf->handler(c->conf->udata, &rec);
+	return (r != 0) ? r : err;
+}
+
+/** Add field to the record.
+eol: the field is the last one in the record */
+static int field_add(csv *c, struct csv_worker *w, const char *d, const char *end, uint eol)
+{
+	ffstr *f;
+	int quote = c->conf->quote;
+
+	if (ffarr_isfull(&w->fields)
+		&& NULL == ffarr_growT(&w->fields, 1, 64 | FFARR_GROWQUARTER, ffstr))
+		return -1;
+	f = (ffstr*)w->fields.ptr + w->fields.len++;
+	ffstr_set(f, d, end - d);
+
+	if (eol && f->len != 0 && f->ptr[f->len - 1] == '\r')
+		f->len--;
+
+	if (f->len != 0 && f->ptr[0] == quote && quote != 0) {
+		if (f->len == 1 || f->ptr[f->len - 1] != quote)
+			return FFPARS_EBADCHAR; // text after the closing quote
+		f->ptr++;
+		f->len -= 2;
+
+		const char *q = ffs_findc(f->ptr, f->len, quote);
+		if (q != NULL) {
+			// "" -> "
+			uint *i = ffarr_pushgrowT(&w->esc, 16, uint);
+			if (i == NULL
+				|| NULL == ffarr_grow(&w->buf, f->len, 256 | FFARR_GROWQUARTER))
+				return -1;
+			*i = f - (ffstr*)w->fields.ptr;
+
+			size_t off = w->buf.len;
+			const char *s = f->ptr, *e = f->ptr + f->len;
+			while (q != NULL) {
+				ffarr_append(&w->buf, s, q + 1 - s);
+				s = q + 2;
+				q = ffs_findc(s, e - s, quote);
+			}
+			ffarr_append(&w->buf, s, e - s);
+			f->len = w->buf.len - off;
+			f->ptr = (char*)off; // the buffer may be reallocated by the next fields
+		}
+	}
+	return 0;
+}
+
+/** Parse the records within [d, end).
+The data starts at the beginning of a record.
+Return 0 on success;  the value returned by the handler;  -1 on system error;  enum FFPARS_E. */
+static int csv_parse(csv *c, struct csv_worker *w, const char *d, const char *end, uint header)
+{
+	const struct ffcsv_conf *conf = c->conf;
+	struct csv_masks m;
+	char tmp[64];
+	uint64 inq = 0; // all bits are set if the block starts within quotes
+	uint64 prev_delim = 1, prev_quote = 0, prev_close = 0; // the last bits of the previous block
+	const char *fstart = d, *rstart = d;
+	uint64 errmask = (uint64)-1; // the bits before invalid character
+	int r;
+
+	w->fields.len = 0;
+	w->buf.len = 0;
+	w->esc.len = 0;
+
+	for (const char *base = d;  base < end;  base += 64) {
+		uint64 valid = (uint64)-1;
+		if (end - base >= 64) {
+			csv_masks(&m, base, conf->delim, conf->quote);
+		} else {
+			// the last block is copied, the rest of it isn't matched by any mask
+			size_t n = end - base;
+			ffmemcpy(tmp, base, n);
+			ffmem_zero(tmp + n, sizeof(tmp) - n);
+			csv_masks(&m, tmp, conf->delim, conf->quote);
+			valid = (1ULL << n) - 1;
+			m.quote &= valid;
+			m.delim &= valid;
+			m.lf &= valid;
+			m.cr &= valid;
+		}
+
+		uint64 s = m.delim;
+		if (m.quote != 0 || inq != 0 || prev_close != 0) {
+			uint64 x = prefix_xor(m.quote) ^ inq; // quoted regions with opening quotes
+			uint64 open = m.quote & x, close = m.quote & ~x;
+			// an opening quote follows a delimiter or a closing quote ("")
+			uint64 bad = open & ~((m.delim << 1) | prev_delim | (m.quote << 1) | prev_quote);
+			// a closing quote is followed by a delimiter, CR or an opening quote
+			bad |= ((close << 1) | prev_close) & ~(m.delim | m.cr | m.quote) & valid;
+			if (bad != 0)
+				errmask = (1ULL << (ffbit_ffs64(bad) - 1)) - 1; // process the records before the error
+			s &= ~x & errmask;
+			inq = (uint64)((int64)x >> 63);
+			prev_close = close >> 63;
+		}
+		prev_delim = m.delim >> 63;
+		prev_quote = m.quote >> 63;
+
+		while (s != 0) {
+			uint i = ffbit_ffs64(s) - 1;
+			s &= s - 1;
+			const char *p = base + i;
+			uint eol = (m.lf >> i) & 1;
+
+			if (eol && w->fields.len == 0
+				&& (p == fstart || (p == fstart + 1 && *fstart == '\r'))) {
+				fstart = p + 1; // empty line
+				rstart = fstart;
+				continue;
+			}
+
+			r = field_add(c, w, fstart, p, eol);
+			fstart = p + 1;
+			if (r != 0) {
+				if (r < 0)
+					return r;
+				return rec_error(c, w, rstart, r);
+			}
+
+			if (eol) {
+				if (0 != (r = rec_deliver(c, w, rstart, header)))
+					return r;
+				header = 0;
+				rstart = p + 1;
+				if (ffatom_get(&c->stop) != 0)
+					return 0;
+			}
+		}
+
+		if (errmask != (uint64)-1)
+			return rec_error(c, w, rstart, FFPARS_EBADCHAR);
+	}
+
+	if (inq != 0)
+		return rec_error(c, w, rstart, FFPARS_EBADVAL); // no closing quote
+
+	if (w->fields.len != 0
+		|| !(fstart == end || (fstart + 1 == end && *fstart == '\r'))) {
+		// the last record without LF
+		r = field_add(c, w, fstart, end, 1);
+		if (r != 0) {
+			if (r < 0)
+				return r;
+			return rec_error(c, w, rstart, r);
+		}
+		if (0 != (r = rec_deliver(c, w, rstart, header)))
+			return r;
+	}
+	return 0;
+}
+
+/** Get offset of the first record of chunk #k. */
+static size_t chunk_start(const csv *c, size_t k)
+{
+	if (k == 0)
+		return 0;
+	size_t off = k * c->chunk_size;
+	if (off >= c->len)
+		return c->len;
+
+	uint inq = c->inq[k];
+
+	// the chunk starts at 'off' if the previous byte is LF outside of quotes
+	if (c->data[off - 1] == '\n' && !inq)
+		return off;
+	return rec_end(c->data, off, c->len, c->conf->quote, inq);
+}
+
+/** Count quotes in the chunks until there are no more chunks, then wait for the other workers.
+The worker which has counted the last chunk sets the quote states. */
+static void work_count(csv *c)
+{
+	size_t k;
+	uint spins = 0;
+
+	for (;;) {
+		k = ffatom_get(&c->next_count);
+		if (k >= c->nchunks)
+			break;
+		if (!ffatom_cmpset(&c->next_count, k, k + 1))
+			continue;
+
+		size_t off = k * c->chunk_size;
+		size_t n = ffmin(c->chunk_size, c->len - off);
+		c->inq[k] = csv_parity(c->data + off, n, c->conf->quote);
+		ffatom_fence_rel();
+		if (ffatom_incret(&c->counted) != c->nchunks)
+			continue;
+
+		ffatom_fence_acq();
+		uint inq = 0;
+		for (size_t i = 0;  i != c->nchunks;  i++) {
+			uint parity = c->inq[i];
+			c->inq[i] = inq;
+			inq ^= parity;
+		}
+		ffatom_fence_rel();
+		ffatom_set(&c->ready, 1);
+	}
+
+	while (ffatom_get(&c->ready) == 0) {
+		ffthd_spinwait(&spins);
+	}
+	ffatom_fence_acq();
+}
+
+/** Take the next chunk and parse it.
+Return 0 if there are no more chunks. */
+static int work(csv *c, struct csv_worker *w)
+{
+	size_t k;
+	for (;;) {
+		if (ffatom_get(&c->stop) != 0)
+			return 0;
+		k = ffatom_get(&c->next);
+		if (k >= c->nchunks)
+			return 0;
+		if (ffatom_cmpset(&c->next, k, k + 1))
+			break;
+	}
+
+	const char *d = c->data + chunk_start(c, k);
+	const char *end = c->data + chunk_start(c, k + 1);
+	int r = csv_parse(c, w, d, end, 0);
+	if (r != 0)
+		csv_stop(c, r);
+	return 1;
+}
+
+static int FFTHDCALL worker_thread(void *param)
+{
+	struct csv_worker *w = param;
+	csv *c = w->c;
+	work_count(c);
+	while (work(c, w)) {
+	}
+	return 0;
+}
+
+static int csv_run(const struct ffcsv_conf *conf, const char *data, size_t len, uint64 base, struct ffcsv_stat *st)
+{
+	csv c = {};
+	int r = 0;
+	uint nthreads = (conf->threads != 0) ? conf->threads : ffsys_ncpu();
+
+	c.conf = conf;
+	c.data = data;
+	c.len = len;
+	c.base = base;
+	c.chunk_size = ffmax(conf->chunk_size, 1);
+
+	if (NULL == (c.w = ffmem_callocT(nthreads, struct csv_worker)))
+		return -1;
+	for (uint i = 0;  i != nthreads;  i++) {
+		c.w[i].c = &c;
+		c.w[i].idx = i;
+	}
+
+	if (conf->header) {
+		// the header is processed before the other records
+		size_t n = rec_end(data, 0, len, conf->quote, 0);
+		r = csv_parse(&c, &c.w[0], data, data + n, 1);
+		if (r != 0)
+			goto end;
+		c.data += n;
+		c.len -= n;
+		c.base += n;
+	}
+
+	c.nchunks = (c.len + c.chunk_size - 1) / c.chunk_size;
+	nthreads = ffmin(nthreads, ffmax(c.nchunks, 1));
+	if (NULL == (c.inq = ffmem_calloc(ffmax(c.nchunks, 1), 1))) {
+		r = -1;
+		goto end;
+	}
+	if (conf->quote == 0 || c.nchunks == 0) {
+		ffatom_set(&c.next_count, c.nchunks);
+		ffatom_set(&c.ready, 1);
+	}
+
+	c.nworkers = 1;
+	for (uint i = 1;  i != nthreads;  i++) {
+		c.w[i].th = ffthd_create(&worker_thread, &c.w[i], 0);
+		if (c.w[i].th == FFTHD_INV)
+			break; // continue with fewer threads
+		c.nworkers++;
+	}
+
+	work_count(&c);
+	while (work(&c, &c.w[0])) {
+	}
+
+	for (uint i = 1;  i != c.nworkers;  i++) {
+		ffthd_join(c.w[i].th, -1, NULL);
+	}
+
+	r = (int)(ssize_t)ffatom_get(&c.stop);
+
+end:
+	for (uint i = 0;  i != nthreads;  i++) {
+		if (st != NULL)
+			st->records += c.w[i].records;
+		ffarr_free(&c.w[i].fields);
+		ffarr_free(&c.w[i].buf);
+		ffarr_free(&c.w[i].esc);
+	}
+	if (st != NULL)
+		st->chunks += c.nchunks;
+	ffmem_safefree(c.inq);
+	ffmem_free(c.w);
+	return r;
+}
+
+int ffcsv_run(const struct ffcsv_conf *conf, const char *data, size_t len, struct ffcsv_stat *st)
+{
+	return csv_run(conf, data, len, 0, st);
+}
+
+int ffcsv_runmap(const struct ffcsv_conf *conf, fffilemap *fm, struct ffcsv_stat *st)
+{
+	ffarr carry = {}; // a record crossing the end of a block
+	uint64 start = fm->foff, carry_off = 0;
+	uint carry_inq = 0; // quote state at the end of 'carry'
+	struct ffcsv_conf conf1 = *conf, conf_carry = *conf;
+	ffstr d;
+	int r = 0;
+
+	conf_carry.threads = 1;
+	conf_carry.header = 0;
+
+	if (fm->fsize == 0)
+		return 0;
+
+	for (;;) {
+		if (0 != fffile_mapbuf(fm, &d)) {
+			r = -1;
+			break;
+		}
+		ffbool last = (d.len == fm->fsize);
+		size_t n;
+
+		if (carry.len != 0) {
+			n = rec_end(d.ptr, 0, d.len, conf->quote, carry_inq);
+			if (NULL == ffarr_append(&carry, d.ptr, n)) {
+				r = -1;
+				break;
+			}
+			carry_inq ^= csv_parity(d.ptr, n, conf->quote);
+			if ((n != 0 && d.ptr[n - 1] == '\n' && !carry_inq) || last) {
+				r = csv_run((conf1.header) ? &conf1 : &conf_carry, carry.ptr, carry.len, carry_off, st);
+				conf1.header = 0;
+				carry.len = 0;
+			}
+
+		} else {
+			n = d.len;
+			if (!last) {
+				// process the complete records only
+				uint inq = csv_parity(d.ptr, d.len, conf->quote);
+				n = rec_end_last(d.ptr, d.len, conf->quote, inq);
+			}
+			if (n != 0) {
+				r = csv_run(&conf1, d.ptr, n, fm->foff - start, st);
+				conf1.header = 0;
+			}
+
+			if (n != d.len) {
+				carry_off = fm->foff + n - start;
+				if (NULL == ffarr_append(&carry, d.ptr + n, d.len - n)) {
+					r = -1;
+					break;
+				}
+				carry_inq = csv_parity(d.ptr + n, d.len - n, conf->quote);
+				n = d.len;
+			}
+		}
+
+		if (r != 0)
+			break;
+		if (!fffile_mapshift(fm, n))
+			break;
+	}
+
+	ffarr_free(&carry);
+	return r;
+}
+
+
+int ffcsv_cols_init(ffcsv_cols *c, const ffpars_arg *args, uint nargs, const ffstr *header, uint ncols, uint flags)
+{
+	ffpars_ctx ctx = {};
+	const ffpars_arg *a;
+	int r = 0;
+
+	ffmem_tzero(c);
+	if (header == NULL)
+		ncols = ffmin(ncols, nargs);
+	if (NULL == (c->map = ffmem_callocT(ffmax(ncols, 1), const ffpars_arg*)))
+		return FFPARS_ESYS;
+	c->ncols = ncols;
+
+	if (header == NULL) {
+		for (uint i = 0;  i != ncols;  i++) {
+			c->map[i] = &args[i];
+		}
+		return 0;
+	}
+
+	if (nargs == 0)
+		return (ncols != 0 && !(flags & FFCSV_COLS_SKIPUNK)) ? FFPARS_EUKNKEY : 0;
+
+	ffpars_setargs(&ctx, NULL, args, nargs);
+	uint f = FFPARS_CTX_FDUP;
+	if (flags & FFCSV_COLS_KEYICASE)
+		f |= FFPARS_CTX_FKEYICASE;
+
+	for (uint i = 0;  i != ncols;  i++) {
+		a = ffpars_ctx_findarg(&ctx, header[i].ptr, header[i].len, f);
+		if (a == (void*)-1) {
+			r = FFPARS_EDUPKEY;
+			goto end;
+		} else if (a == NULL && !(flags & FFCSV_COLS_SKIPUNK)) {
+			r = FFPARS_EUKNKEY;
+			goto end;
+		}
+		c->map[i] = a;
+	}
+
+	for (uint i = 0;  i != nargs;  i++) {
+		if ((args[i].flags & FFPARS_FREQUIRED)
+			&& i < sizeof(ctx.used) * 8
+			&& !ffbit_testarr(ctx.used, i)) {
+			r = FFPARS_ENOREQ;
+			goto end;
+		}
+	}
+
+end:
+	if (r != 0)
+		ffcsv_cols_free(c);
+	return r;
+}
+
+void ffcsv_cols_free(ffcsv_cols *c)
+{
+	ffmem_safefree0(c->map);
+	c->ncols = 0;
+}
+
+int ffcsv_cols_bind(const ffcsv_cols *c, const struct ffcsv_rec *rec, void *obj)
+{
+	int r;
+	uint n = ffmin(c->ncols, rec->nfields);
+	for (uint i = 0;  i != n;  i++) {
+		if (c->map[i] == NULL)
+			continue;
+		r = ffpars_arg_process(c->map[i], &rec->fields[i], obj, NULL);
+		if (r != 0)
+			return r;
+	}
+	return 0;
+}
@@ -0,0 +1,581 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/data/json-tape.h>
+#include <FF/data/utf8.h>
+
+#ifdef FF_AMD64
+#include <emmintrin.h> //SSE2
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+
+/* Character classes of a 64-byte block: bit N is set if byte N belongs to the class. */
+struct blk {
+	uint64 quote, bs, op, ws, nl, slash;
+};
+
+#if defined FF_AMD64
+#define JSON_SIMD
+typedef __m128i json_v;
+#define v_load(p)  _mm_loadu_si128((void*)(p))
+#define v_eq(v, c)  _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define v_or(a, b)  _mm_or_si128(a, b)
+#define v_lower(v)  _mm_or_si128(v, _mm_set1_epi8(0x20))
+#define v_mask(v)  (uint)_mm_movemask_epi8(v)
+
+#elif defined __ARM_NEON
+#define JSON_SIMD
+typedef int8x16_t json_v;
+#define v_load(p)  vld1q_s8((void*)(p))
+#define v_eq(v, c)  vreinterpretq_s8_u8(vceqq_s8(v, vdupq_n_s8(c)))
+#define v_or(a, b)  vorrq_s8(a, b)
+#define v_lower(v)  vorrq_s8(v, vdupq_n_s8(0x20))
+
+static inline uint v_mask(json_v v)
+{
+	static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t m = vandq_u8(vreinterpretq_u8_s8(v), vld1q_u8(bits));
+	uint8x8_t p = vpadd_u8(vget_low_u8(m), vget_high_u8(m));
+	p = vpadd_u8(p, p);
+	p = vpadd_u8(p, p);
+	return vget_lane_u16(vreinterpret_u16_u8(p), 0);
+}
+#endif
+
+static void blk_classify(struct blk *b, const char *d)
+{
+#ifdef JSON_SIMD
+	ffmem_tzero(b);
+	for (uint i = 0;  i != 64;  i += 16) {
+		json_v v = v_load(d + i);
+		json_v lw = v_lower(v); // '[' -> '{', ']' -> '}'
+		json_v nl = v_eq(v, '\n');
+		b->quote |= (uint64)v_mask(v_eq(v, '"')) << i;
+		b->bs |= (uint64)v_mask(v_eq(v, '\\')) << i;
+		b->op |= (uint64)v_mask(v_or(v_or(v_eq(lw, '{'), v_eq(lw, '}'))
+			, v_or(v_eq(v, ':'), v_eq(v, ',')))) << i;
+		b->ws |= (uint64)v_mask(v_or(v_or(v_eq(v, ' '), v_eq(v, '\t'))
+			, v_or(v_eq(v, '\r'), nl))) << i;
+		b->nl |= (uint64)v_mask(nl) << i;
+		b->slash |= (uint64)v_mask(v_eq(v, '/')) << i;
+	}
+
+#else
+	ffmem_tzero(b);
+	for (uint i = 0;  i != 64;  i++) {
+		uint64 bit = 1ULL << i;
+		switch (d[i]) {
+		case '"':
+			b->quote |= bit; break;
+		case '\\':
+			b->bs |= bit; break;
+		case '{': case '}': case '[': case ']': case ':': case ',':
+			b->op |= bit; break;
+		case '\n':
+			b->nl |= bit;
+			// fallthrough
+		case ' ': case '\t': case '\r':
+			b->ws |= bit; break;
+		case '/':
+			b->slash |= bit; break;
+		}
+	}
+#endif
+}
+
+/** Get the mask of characters escaped by backslash.
+'prev_escaped': [in/out] the first character of the next block is escaped */
+static inline uint64 blk_escaped(uint64 bs, uint64 *prev_escaped)
+{
+	const uint64 even = 0x5555555555555555ULL;
+	if (bs == 0) {
+		uint64 r = *prev_escaped;
+		*prev_escaped = 0;
+		return r;
+	}
+	bs &= ~*prev_escaped;
+	uint64 follows_esc = (bs << 1) | *prev_escaped;
+	uint64 odd_starts = bs & ~even & ~follows_esc;
+	// carry propagates through each backslash sequence: the result bit after the sequence depends on its start and length
+	uint64 seq_even = odd_starts + bs;
+	*prev_escaped = (seq_even < bs);
+	return (even ^ (seq_even << 1)) & follows_esc;
+}
+
+/** Set all bits from an opening quote (inclusive) to the closing quote (exclusive). */
+static inline uint64 prefix_xor(uint64 m)
+{
+	m ^= m << 1;
+	m ^= m << 2;
+	m ^= m << 4;
+	m ^= m << 8;
+	m ^= m << 16;
+	m ^= m << 32;
+	return m;
+}
+
+/** Skip comment.
+Return offset after the comment;  -1 on error. */
+static ssize_t cmt_skip(const char *d, size_t len, size_t i)
+{
+	if (i + 1 == len)
+		return -1;
+	if (d[i + 1] == '/') {
+		const char *e = ffs_find(d + i, len - i, '\n');
+		return e - d;
+
+	} else if (d[i + 1] == '*') {
+		const char *e = ffs_finds(d + i + 2, len - (i + 2), "*/", 2);
+		if (e == d + len)
+			return -1;
+		return e + 2 - d;
+	}
+	return -1;
+}
+
+/** Stage 1: save the offsets of structural characters into t->idx. */
+static int json_index(ffjson_tape *t, const char *data, size_t len)
+{
+	uint64 prev_escaped = 0, prev_instr = 0, prev_scalar = 0;
+	struct blk b;
+	char tail[64];
+	size_t pos = 0;
+
+	if (NULL == ffarr_growT(&t->idx, len + 64, 0, uint))
+		return FFPARS_ESYS;
+	uint *out = (void*)t->idx.ptr;
+
+	while (pos < len) {
+		const char *d = data + pos;
+		if (len - pos < 64) {
+			ffmem_fill(tail, ' ', 64);
+			ffmemcpy(tail, d, len - pos);
+			d = tail;
+		}
+		blk_classify(&b, d);
+
+		uint64 esc = blk_escaped(b.bs, &prev_escaped);
+		uint64 quote = b.quote & ~esc;
+		uint64 instr = prefix_xor(quote) ^ prev_instr;
+		prev_instr = (uint64)((int64)instr >> 63);
+
+		uint64 cmt = b.slash & ~instr;
+		uint64 lim = (cmt != 0) ? (cmt & -cmt) - 1 : ~0ULL;
+
+		if (b.nl & instr & lim) {
+			t->err_off = pos + ffbit_ffs64(b.nl & instr & lim) - 1;
+			return FFPARS_EBADCHAR; // newline within quoted value
+		}
+
+		// the first bytes of bare values: true, false, null, numbers;  escape sequences within strings
+		uint64 scalar = ~(b.op | b.ws | quote | instr);
+		uint64 st = ((b.op & ~instr) | quote | (scalar & ~((scalar << 1) | prev_scalar))
+			| (b.bs & ~esc & instr)) & lim;
+		prev_scalar = scalar >> 63;
+
+		while (st != 0) {
+			*out++ = pos + ffbit_ffs64(st) - 1;
+			st &= st - 1;
+		}
+
+		if (cmt != 0) {
+			ssize_t r = cmt_skip(data, len, pos + ffbit_ffs64(cmt) - 1);
+			if (r < 0) {
+				t->err_off = pos + ffbit_ffs64(cmt) - 1;
+				return FFPARS_EBADCMT;
+			}
+			pos = r;
+			prev_escaped = prev_instr = prev_scalar = 0;
+			continue;
+		}
+		pos += 64;
+	}
+
+	t->idx.len = out - (uint*)t->idx.ptr;
+	if (prev_instr != 0) {
+		t->err_off = len;
+		return FFPARS_EBADVAL; // no closing quote
+	}
+	return 0;
+}
+
+
+/* The characters which end a bare value */
+static const byte json_delim[256] = {
+	['\0'] = 1, [' '] = 1, ['\t'] = 1, ['\r'] = 1, ['\n'] = 1,
+	['{'] = 1, ['}'] = 1, ['['] = 1, [']'] = 1, [':'] = 1, [','] = 1, ['"'] = 1, ['/'] = 1,
+};
+
+#define E(tag, pl)  (((uint64)(tag) << 56) | (pl))
+
+/** Parse true, false, null or number.
+Return the number of tape entries written;  <0: error. */
+static int json_scalar(ffjson_tape *t, uint64 *e, size_t off)
+{
+	const char *d = t->data + off, *end = t->data + t->len;
+	const char *s = d;
+	while (s != end && !json_delim[(byte)*s])
+		s++;
+	size_t n = s - d;
+	if (n == 0)
+		return -FFPARS_ENOVAL; // e.g. "[\0]"
+	if (n >= 1 << 24)
+		return -FFPARS_EBIGVAL;
+	uint64 pl = ((uint64)n << 32) | off;
+
+	switch (*d) {
+	case 't':
+		if (!(n == 4 && !ffmemcmp(d, "true", 4)))
+			return -FFPARS_EBADVAL;
+		e[0] = E(FFJSON_TBOOL, pl);
+		return 1;
+	case 'f':
+		if (!(n == 5 && !ffmemcmp(d, "false", 5)))
+			return -FFPARS_EBADVAL;
+		e[0] = E(FFJSON_TBOOL, pl);
+		return 1;
+	case 'n':
+		if (!(n == 4 && !ffmemcmp(d, "null", 4)))
+			return -FFPARS_EBADVAL;
+		e[0] = E(FFJSON_TNULL, pl);
+		return 1;
+	}
+
+	// fast path for short decimal integers
+	size_t i = (*d == '-');
+	if (n - i - 1 < 18) {
+		uint64 v = 0;
+		for (;  i != n;  i++) {
+			uint dig = (byte)d[i] - '0';
+			if (dig > 9)
+				break;
+			v = v * 10 + dig;
+		}
+		if (i == n) {
+			e[0] = E(FFJSON_TINT, pl);
+			e[1] = (*d == '-') ? -v : v;
+			return 2;
+		}
+	}
+
+	union { int64 i; double d; } u;
+	if (n == ffs_toint(d, n, &u.i, FFS_INT64 | FFS_INTSIGN)) {
+		e[0] = E(FFJSON_TINT, pl);
+	} else if (n == ffs_tofloat(d, n, &u.d, 0)) {
+		e[0] = E(FFJSON_TNUM, pl);
+	} else
+		return -FFPARS_EBADVAL;
+	ffmemcpy(&e[1], &u, 8);
+	return 2;
+}
+
+static const char esc_bytes[256] = {
+	['"'] = '"', ['\\'] = '\\', ['/'] = '/',
+	['b'] = '\b', ['f'] = '\f', ['n'] = '\n', ['r'] = '\r', ['t'] = '\t',
+};
+
+/** Unescape string into t->sbuf.
+'esc': offsets of the backslashes in the string
+Return 0 or enum FFPARS_E. */
+static int json_unescape(ffjson_tape *t, size_t off, size_t len, const uint *esc, uint nesc, size_t *dst_off)
+{
+	const char *s = t->data + off, *end = s + len;
+	uint hiword = 0;
+
+	if (NULL == ffarr_grow(&t->sbuf, len, 256 | FFARR_GROWQUARTER))
+		return FFPARS_ESYS;
+	*dst_off = t->sbuf.len;
+	char *d = t->sbuf.ptr + t->sbuf.len;
+
+	for (uint k = 0;  k != nesc;  k++) {
+		const char *bs = t->data + esc[k];
+		if (hiword != 0 && bs != s)
+			return FFPARS_EESC; // UTF-16 escaped char must follow
+		d = ffmem_copy(d, s, bs - s);
+
+		uint uch = (byte)bs[1];
+		if (uch != 'u') {
+			if (esc_bytes[uch] == '\0' || hiword != 0)
+				return FFPARS_EESC;
+			*d++ = esc_bytes[uch];
+			s = bs + 2;
+			continue;
+		}
+
+		// \uXXXX
+		if (end - bs < 6)
+			return FFPARS_EESC;
+		uch = 0;
+		for (uint n = 2;  n != 6;  n++) {
+			int h = ffchar_tohex(bs[n]);
+			if (h < 0)
+				return FFPARS_EESC;
+			uch = (uch << 4) | h;
+		}
+		s = bs + 6;
+
+		if (ffutf16_basic(uch)) {
+			if (hiword != 0)
+				return FFPARS_EESC;
+		} else if (ffutf16_highsurr(uch)) {
+			if (hiword != 0)
+				return FFPARS_EESC; // 2nd high surrogate
+			hiword = uch;
+			continue;
+		} else {
+			if (hiword == 0)
+				return FFPARS_EESC; // low surrogate without previous high surrogate
+			uch = ffutf16_suppl(hiword, uch);
+			hiword = 0;
+		}
+		// "\uXXXX" (6 bytes) -> max. 3 bytes;  surrogate pair (12 bytes) -> 4 bytes
+		d += ffutf8_encode1(d, 4, uch);
+	}
+	if (hiword != 0 && s != end)
+		return FFPARS_EESC;
+	d = ffmem_copy(d, s, end - s);
+	if (hiword != 0)
+		return FFPARS_EESC;
+
+	t->sbuf.len = d - t->sbuf.ptr;
+	return 0;
+}
+
+/** Write string entry.
+'i': index of the opening quote in t->idx;  the backslashes and the closing quote follow
+Return the index of the closing quote;  <0: error. */
+static int json_str(ffjson_tape *t, uint64 *e, uint i, uint flags)
+{
+	const uint *idx = (void*)t->idx.ptr;
+	uint k = i + 1;
+	while (t->data[idx[k]] == '\\')
+		k++;
+	size_t off = idx[i] + 1, n = idx[k] - off;
+
+	if (k != i + 1) {
+		size_t soff = t->sbuf.len;
+		int r = json_unescape(t, off, n, &idx[i + 1], k - (i + 1), &off);
+		if (r != 0) {
+			t->err_off = idx[i];
+			return -r;
+		}
+		n = t->sbuf.len - soff;
+		flags |= FFJSON_TAPE_FESC;
+	}
+
+	e[0] = E(FFJSON_TSTR | flags, off);
+	e[1] = n;
+	return k;
+}
+
+enum {
+	S_VAL, S_VAL_OR_CLOSE, S_KEY, S_KEY_OR_CLOSE, S_COLON, S_AFTER, S_END,
+};
+
+/** Stage 2: walk the structural index and write the tape. */
+static int json_build(ffjson_tape *t)
+{
+	const uint *idx = (void*)t->idx.ptr;
+	uint n = t->idx.len, st = S_VAL, *stk;
+	size_t nstk = 0;
+	int r;
+
+	if (NULL == ffarr_growT(&t->tape, 2 * (size_t)n + 2, 0, uint64)
+		|| NULL == ffarr_growT(&t->stk, n + 1, 0, uint))
+		return FFPARS_ESYS;
+	uint64 *tape = (void*)t->tape.ptr, *e = tape;
+	stk = (void*)t->stk.ptr;
+
+	for (uint i = 0;  i != n;  i++) {
+		size_t off = idx[i];
+		int c = t->data[off];
+
+		switch (st) {
+		case S_VAL_OR_CLOSE:
+			if (c == ']')
+				goto close;
+			// fallthrough
+
+		case S_VAL:
+			switch (c) {
+			case '{':
+			case '[':
+				stk[nstk++] = e - tape;
+				*e++ = E((c == '{') ? FFJSON_TOBJ : FFJSON_TARR, 0);
+				st = (c == '{') ? S_KEY_OR_CLOSE : S_VAL_OR_CLOSE;
+				continue;
+
+			case '"':
+				if ((r = json_str(t, e, i, 0)) < 0)
+					return -r;
+				e += 2;
+				i = r;
+				break;
+
+			case '}': case ']': case ':': case ',':
+				t->err_off = off;
+				return FFPARS_ENOVAL;
+
+			default:
+				r = json_scalar(t, e, off);
+				if (r < 0) {
+					t->err_off = off;
+					return -r;
+				}
+				e += r;
+			}
+			st = (nstk != 0) ? S_AFTER : S_END;
+			break;
+
+		case S_KEY_OR_CLOSE:
+			if (c == '}')
+				goto close;
+			// fallthrough
+
+		case S_KEY:
+			if (c != '"') {
+				t->err_off = off;
+				return FFPARS_EBADCHAR;
+			}
+			if ((r = json_str(t, e, i, FFJSON_TAPE_FKEY)) < 0)
+				return -r;
+			e += 2;
+			i = r;
+			st = S_COLON;
+			break;
+
+		case S_COLON:
+			if (c != ':') {
+				t->err_off = off;
+				return FFPARS_EKVSEP;
+			}
+			st = S_VAL;
+			break;
+
+		case S_AFTER:
+			if (c == ',') {
+				st = (tape[stk[nstk - 1]] >> 56 == FFJSON_TOBJ) ? S_KEY : S_VAL;
+				break;
+			} else if (c == '}' || c == ']')
+				goto close;
+			t->err_off = off;
+			return FFPARS_EBADCHAR;
+
+		case S_END:
+			t->err_off = off;
+			return FFPARS_EBADCHAR; // document finished. no more entities expected
+		}
+		continue;
+
+close: {
+		uint open = stk[--nstk];
+		uint type = (c == '}') ? FFJSON_TOBJ : FFJSON_TARR;
+		if (tape[open] >> 56 != type) {
+			t->err_off = off;
+			return FFPARS_EBADBRACE; // closing brace should match the context type
+		}
+		tape[open] |= e - tape;
+		*e++ = E(type | FFJSON_TAPE_FCLOSE, open);
+		st = (nstk != 0) ? S_AFTER : S_END;
+		}
+	}
+
+	t->tape.len = e - tape;
+	if (nstk != 0 || st != S_END) {
+		t->err_off = t->len;
+		return (nstk != 0) ? FFPARS_ENOBRACE : FFPARS_ENOVAL;
+	}
+	return 0;
+}
+
+#undef E
+
+int ffjson_tape_parse(ffjson_tape *t, const char *data, size_t len)
+{
+	int r;
+	t->data = data;
+	t->len = len;
+	t->tape.len = 0;
+	t->idx.len = 0;
+	t->sbuf.len = 0;
+	t->err_off = 0;
+
+	if (len > (uint)-1 - 64)
+		return FFPARS_EBIGVAL;
+
+	if (0 != (r = json_index(t, data, len)))
+		return r;
+	return json_build(t);
+}
+
+size_t ffjson_tape_find(const ffjson_tape *t, size_t obj, const char *name, size_t len)
+{
+	FF_ASSERT(ffjson_tape_type(t, obj) == FFJSON_TOBJ);
+	for (size_t i = ffjson_tape_child(t, obj);  !ffjson_tape_isclose(t, i);  ) {
+		ffstr k = ffjson_tape_str(t, i);
+		i += 2;
+		if (ffstr_eq(&k, name, len))
+			return i;
+		i = ffjson_tape_next(t, i);
+	}
+	return 0;
+}
+
+int ffjson_tape_schemrun(const ffjson_tape *t, ffparser_schem *ps)
+{
+	ffjson *c = ps->p;
+	size_t n = t->tape.len;
+	int r;
+
+	for (size_t i = 0;  i != n;  ) {
+		uint tag = _ffjson_tape_tag(t, i);
+		c->type = tag & 0x0f;
+
+		if (tag & FFJSON_TAPE_FCLOSE) {
+			c->ret = FFPARS_CLOSE;
+			r = ffjson_schemrun(ps);
+			c->ctxs.len--;
+			i++;
+
+		} else {
+			switch (c->type) {
+			case FFJSON_TOBJ:
+			case FFJSON_TARR:
+				c->ret = FFPARS_OPEN;
+				r = ffjson_schemrun(ps);
+				if (NULL == ffarr_grow(&c->ctxs, 1, 16))
+					return FFPARS_ESYS;
+				*ffarr_end(&c->ctxs) = c->type;
+				c->ctxs.len++;
+				i++;
+				break;
+
+			case FFJSON_TSTR:
+				c->val = ffjson_tape_str(t, i);
+				c->ret = (tag & FFJSON_TAPE_FKEY) ? FFPARS_KEY : FFPARS_VAL;
+				r = ffjson_schemrun(ps);
+				i += 2;
+				break;
+
+			default:
+				// integer, number, boolean, null
+				c->val = ffjson_tape_raw(t, i);
+				c->intval = (c->type == FFJSON_TBOOL) ? ffjson_tape_bool(t, i) : 0;
+				if (c->type == FFJSON_TINT || c->type == FFJSON_TNUM)
+					c->intval = ffjson_tape_int(t, i);
+				c->ret = FFPARS_VAL;
+				r = ffjson_schemrun(ps);
+				i = ffjson_tape_next(t, i);
+			}
+		}
+
+		if (ffpars_iserr(r))
+			return r;
+	}
+
+	c->ch = (uint)t->len;
+	return ffjson_schemfin(ps);
+}
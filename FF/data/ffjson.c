@@ -5,6 +5,21 @@ Copyright (c) 2013 Simon Zolin
 #include <FF/data/json.h>
 #include <FF/data/utf8.h>
 
+#include <math.h>
+
+#ifdef FF_AMD64
+#include <emmintrin.h> //SSE2
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+
+/** Return 1 if any byte is non-zero. */
+static FFINL int neon_any(uint8x16_t v)
+{
+	uint64x2_t q = vreinterpretq_u64_u8(v);
+	return (vgetq_lane_u64(q, 0) | vgetq_lane_u64(q, 1)) != 0;
+}
+#endif
+
 
 static const char *const _ffjson_stypes[] = {
 	"null", "string", "integer", "boolean", "object", "array", "number"
@@ -47,31 +62,81 @@ int ffjson_unescapechar(uint *dst, const char *text, size_t len)
 	return -1;
 }
 
+/* Get the number of characters which don't need to be escaped:
+ not '"', '\\', 0x00..0x1f, 0x7f.
+16 bytes are checked at once. */
+static size_t esc_span(const char *s, size_t len)
+{
+	size_t i = 0;
+
+#if defined FF_AMD64
+	const __m128i quot = _mm_set1_epi8('"'), bslash = _mm_set1_epi8('\\')
+		, del = _mm_set1_epi8(0x7f), ctl = _mm_set1_epi8(0x1f);
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i v = _mm_loadu_si128((void*)(s + i));
+		__m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, bslash))
+			, _mm_or_si128(_mm_cmpeq_epi8(v, del), _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v)));
+		uint mask = (uint)_mm_movemask_epi8(m);
+		if (mask != 0)
+			return i + ffbit_ffs32(mask) - 1;
+	}
+
+#elif defined __ARM_NEON
+	for (;  i + 16 <= len;  i += 16) {
+		uint8x16_t v = vld1q_u8((void*)(s + i));
+		uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('"')), vceqq_u8(v, vdupq_n_u8('\\')))
+			, vorrq_u8(vceqq_u8(v, vdupq_n_u8(0x7f)), vcltq_u8(v, vdupq_n_u8(0x20))));
+		if (neon_any(m))
+			break; // find the position below
+	}
+#endif
+
+	for (;  i != len;  i++) {
+		uint ch = (byte)s[i];
+		if (ch < 0x20 || ch == '"' || ch == '\\' || ch == 0x7f)
+			break;
+	}
+	return i;
+}
+
 size_t ffjson_escape(char *dst, size_t cap, const char *s, size_t len)
 {
-	size_t i;
+	size_t i, n;
 	const char *dstend = dst + cap;
 	const char *dsto = dst;
 	uint nEsc = FFSLEN("\\n");
 
 	if (dst == NULL) {
-		size_t n = 0;
-		for (i = 0; i < len; ++i) {
+		n = 0;
+		for (i = 0;  ;  i++) {
+			size_t k = esc_span(s + i, len - i);
+			n += k;
+			i += k;
+			if (i == len)
+				break;
+
 			if (NULL != ffmemchr(escbyte, (byte)s[i], FFCNT(escbyte) - 1))
 				n += nEsc;
-			else if ((byte)s[i] < 0x20 || s[i] == 0x7f)
-				n += FFSLEN("\\uXXXX");
 			else
-				n++;
+				n += FFSLEN("\\uXXXX");
 		}
 		return n;
 	}
 
-	for (i = 0; i < len; ++i) {
+	for (i = 0;  ;  i++) {
 		char *d;
 
-		if (dst == dstend)
-			return 0;
+		// copy the characters up to the next one to be escaped
+		n = esc_span(s + i, len - i);
+		if (n != 0) {
+			if (n > (size_t)(dstend - dst))
+				return 0;
+			ffmemcpy(dst, s + i, n);
+			dst += n;
+			i += n;
+		}
+		if (i == len)
+			break;
 
 		d = ffmemchr(escbyte, (byte)s[i], FFCNT(escbyte) - 1);
 		if (d != NULL) {
@@ -80,14 +145,13 @@ size_t ffjson_escape(char *dst, size_t cap, const char *s, size_t len)
 			*dst++ = '\\';
 			*dst++ = escchar[d - escbyte];
 
-		} else if ((byte)s[i] < 0x20 || s[i] == 0x7f) {
+		} else {
+			// 0x00..0x1f, 0x7f
 			if (dst + FFSLEN("\\uXXXX") > dstend)
 				return 0;
 			dst = ffmem_copycz(dst, "\\u00");
 			dst += ffs_hexbyte(dst, s[i], ffHEX);
-
-		} else
-			*dst++ = s[i];
+		}
 	}
 
 	return dst - dsto;
@@ -120,9 +184,12 @@ void ffjson_parseclose(ffjson *p)
 	ffarr_free(&p->ctxs);
 }
 
+/* The buffer is kept for the next values. */
 static void json_cleardata(ffjson *p)
 {
-	ffarr_free(&p->buf);
+	ffstr_null(&p->val);
+	p->buf.len = 0;
+	p->valbuf = 0;
 	p->intval = 0;
 }
 
@@ -138,25 +205,49 @@ void ffjson_parsereset(ffjson *p)
 	p->flags = 0;
 }
 
-static int val_store(ffarr *buf, const char *s, size_t len)
+/* Copy data to the buffer.
+The first call copies the value gathered so far from input data. */
+static int val_store(ffjson *p, const char *s, size_t len)
 {
-	if (NULL == ffarr_grow(buf, len, 256 | FFARR_GROWQUARTER))
+	if (!p->valbuf) {
+		p->buf.len = 0;
+		if (NULL == ffarr_grow(&p->buf, p->val.len + len, 256 | FFARR_GROWQUARTER))
+			return FFPARS_ESYS;
+		if (p->val.len != 0)
+			ffarr_append(&p->buf, p->val.ptr, p->val.len);
+		p->valbuf = 1;
+
+	} else if (NULL == ffarr_grow(&p->buf, len, 256 | FFARR_GROWQUARTER))
 		return FFPARS_ESYS;
-	ffarr_append(buf, s, len);
+
+	if (len != 0)
+		ffarr_append(&p->buf, s, len);
+	ffstr_set2(&p->val, &p->buf);
 	return 0;
 }
 
-static int val_add(ffarr *buf, const char *s, size_t len)
+/* Add data to the value:
+ extend the value within input data or copy data if the value is stored in the buffer. */
+static int val_add(ffjson *p, const char *s, size_t len)
 {
-	if (buf->cap != 0)
-		return val_store(buf, s, len);
+	if (p->valbuf)
+		return val_store(p, s, len);
 
-	if (buf->len == 0)
-		buf->ptr = (char*)s;
-	buf->len += len;
+	if (p->val.len == 0)
+		p->val.ptr = (char*)s;
+	p->val.len += len;
 	return 0;
 }
 
+/* Get the number of bytes within quotes that don't need special processing. */
+static size_t quot_span(const char *d, const char *end)
+{
+	const char *s = d;
+	while (d != end && *d != '"' && *d != '\\' && *d != '\n')
+		d++;
+	return d - s;
+}
+
 const char* ffjson_errmsg(ffjson *p, int r, char *buf, size_t cap)
 {
 	char *end = buf + cap;
@@ -192,11 +283,11 @@ static int hdlValBare(ffjson *p, const char *data)
 	int er;
 	uint i = p->bareval_idx;
 
-	er = val_add(&p->buf, data, 1);
+	er = val_add(p, data, 1);
 	if (er != 0)
 		return er;
 
-	size_t len = p->buf.len - 1;
+	size_t len = p->val.len - 1;
 	if (*data != _ffjson_words[i][len])
 		return FFPARS_EBADVAL;
 
@@ -215,8 +306,7 @@ static int hdlValBareNum(ffjson *p, const char *data)
 	int er = 0, ch = *data;
 
 	if (!(ffchar_isdigit(ch) || ch == '-' || ch == '+' || ch == '.' || ffchar_lower(ch) == 'e')) {
-		ffstr v;
-		ffstr_set2(&v, &p->buf);
+		ffstr v = p->val;
 		er = FFPARS_VAL;
 
 		if (v.len == 0)
@@ -232,7 +322,7 @@ static int hdlValBareNum(ffjson *p, const char *data)
 			er = FFPARS_EBADVAL;
 	}
 	else {
-		er = val_add(&p->buf, data, 1);
+		er = val_add(p, data, 1);
 	}
 
 	return er;
@@ -267,7 +357,7 @@ static int hdlQuote(ffjson *p, int *st, int *nextst, const char *data)
 		break;
 
 	default:
-		er = val_add(&p->buf, data, 1);
+		er = val_add(p, data, 1);
 	}
 
 	if ((p->flags & F_ESC_UTF16_2) && *st != iQuotEsc)
@@ -311,7 +401,7 @@ static int hdlEsc(ffjson *p, int *st, int ch)
 	}
 
 	r = ffutf8_encode1(buf, sizeof(buf), uch);
-	r = val_store(&p->buf, buf, r);
+	r = val_store(p, buf, r);
 	if (r != 0)
 		return r; //allocation error
 	*st = iQuot;
@@ -449,6 +539,16 @@ int ffjson_parse(ffjson *p, const char *data, size_t *len)
 			//break;
 
 		case iQuot:
+			if (!(p->flags & F_ESC_UTF16_2)) {
+				// add all characters up to the next special one at once
+				size_t n = quot_span(data, end);
+				if (n > 1) {
+					er = val_add(p, data, n);
+					data += n - 1;
+					p->ch += n - 1;
+					break;
+				}
+			}
 			er = hdlQuote(p, &st, &nextst, data);
 			break;
 
@@ -558,10 +658,9 @@ int ffjson_parse(ffjson *p, const char *data, size_t *len)
 		}
 	}
 
-	if (er == FFPARS_MORE && p->buf.len != 0)
-		er = val_store(&p->buf, NULL, 0);
+	if (er == FFPARS_MORE && p->val.len != 0 && !p->valbuf)
+		er = val_store(p, NULL, 0); // the next input data won't be contiguous with this one
 
-	ffstr_set2(&p->val, &p->buf);
 	p->state = st;
 	p->nextst = nextst;
 	*len = data - datao;
@@ -799,6 +898,7 @@ int ffjson_add(ffjson_cook *c, int f, const void *src)
 		const ffstr *s;
 		const int64 *i64;
 		const int *i32;
+		const double *f64;
 	} un;
 
 	f |= c->gflags;
@@ -858,8 +958,11 @@ int ffjson_add(ffjson_cook *c, int f, const void *src)
 			else
 				s = *un.s;
 			tmp = ffjson_escape(d, end - d, s.ptr, s.len);
-			if (!nobuf)
+			if (!nobuf) {
+				if (tmp == 0 && s.len != 0)
+					return FFJSON_BUFFULL;
 				d += tmp;
+			}
 			len += tmp;
 		}
 
@@ -882,6 +985,17 @@ int ffjson_add(ffjson_cook *c, int f, const void *src)
 		break;
 
 	case FFJSON_TNUM:
+		if ((f & FFJSON_FFLOAT) == FFJSON_FFLOAT) {
+			if (!isfinite(*un.f64)) {
+				// JSON has no representation for NaN and infinity
+				d = ffs_copycz(d, end, "null");
+				len += FFSLEN("null");
+				break;
+			}
+			d += ffs_fromfloat(*un.f64, d, end - d, FFS_FLTSHORT);
+			len += FFS_FLTMAXCHARS;
+			break;
+		}
 		d = ffs_copy(d, end, un.s->ptr, un.s->len);
 		len += un.s->len;
 		break;
@@ -1001,6 +1115,15 @@ int ffjson_bufadd(ffjson_cook *js, int f, const void *src)
 	ffjson_cook tmp;
 
 	tmp = *js;
+	if (js->buf.ptr != NULL) {
+		// write into the free space;  get the size of output data only if it's not enough
+		r = ffjson_add(js, f, src);
+		if (r != FFJSON_BUFFULL)
+			return r;
+		js->st = tmp.st;
+		js->ctxs.len = tmp.ctxs.len;
+	}
+
 	ffarr_null(&js->buf);
 	r = ffjson_add(js, f, src);
 	js->buf = tmp.buf;
@@ -1024,8 +1147,19 @@ int ffjson_bufaddv(ffjson_cook *js, const int *types, size_t ntypes, ...)
 	int r = FFJSON_OK;
 	ffjson_cook tmp;
 
-	// get overall length of data being inserted
 	tmp = *js;
+	if (js->buf.ptr != NULL) {
+		va_start(va, ntypes);
+		r = ffjson_addvv(js, types, ntypes, va);
+		va_end(va);
+		if (r != FFJSON_BUFFULL)
+			return r;
+		js->buf.len = tmp.buf.len;
+		js->st = tmp.st;
+		js->ctxs.len = tmp.ctxs.len;
+	}
+
+	// get overall length of data being inserted
 	ffarr_null(&js->buf);
 	va_start(va, ntypes);
 	r = ffjson_addvv(js, types, ntypes, va);
@@ -0,0 +1,424 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/data/ndjson.h>
+#include <FF/sys/thread-util.h>
+
+
+void ffndjson_conf_init(struct ffndjson_conf *conf)
+{
+	ffmem_tzero(conf);
+	conf->chunk_size = 256 * 1024;
+}
+
+
+/** A parsed line stored for ordered delivery. */
+struct ndj_line {
+	uint64 off;
+	size_t len;
+	size_t tape_off, tape_n;
+	size_t sbuf_off;
+	size_t err_off;
+	int err;
+};
+
+/** A chunk in flight (ordered mode). */
+struct ndj_slot {
+	ffatomic done; // the number of the parsed chunk + 1
+	uint worker;
+	ffarr lines; //struct ndj_line[]
+	ffarr tape; //uint64[]
+	ffarr sbuf;
+};
+
+typedef struct ndj ndj;
+
+struct ndj_worker {
+	ndj *n;
+	ffjson_tape t;
+	ffthd th;
+	uint idx;
+	uint64 lines, errors;
+	char pad[FFCPU_CACHELINE];
+};
+
+struct ndj {
+	const struct ffndjson_conf *conf;
+	const char *data;
+	size_t len;
+	uint64 base;
+	size_t chunk_size;
+	size_t nchunks;
+
+	ffatomic next; // the next chunk to parse
+	ffatomic delivered; // ordered mode: the number of delivered chunks
+	ffatomic stop; // the value returned by handler;  -1: system error
+
+	struct ndj_slot *slots;
+	uint nslots;
+	struct ndj_worker *w;
+	uint nworkers;
+};
+
+/** Get offset of the first line of chunk #k. */
+static size_t chunk_start(const ndj *n, size_t k)
+{
+	if (k == 0)
+		return 0;
+	size_t off = k * n->chunk_size;
+	if (off >= n->len)
+		return n->len;
+	// the chunk starts at 'off' if the previous byte is LF
+	const char *lf = ffs_findc(n->data + off - 1, n->len - (off - 1), '\n');
+	return (lf != NULL) ? lf - n->data + 1 : n->len;
+}
+
+/** Get the next non-empty line.
+Return 0 if there are no more lines. */
+static int line_next(const char **pd, const char *end, ffstr *line)
+{
+	const char *d = *pd;
+	while (d != end) {
+		const char *lf = ffs_findc(d, end - d, '\n');
+		const char *e = (lf != NULL) ? lf : end;
+		ffstr_set(line, d, e - d);
+		d = (lf != NULL) ? lf + 1 : end;
+
+		if (line->len != 0 && line->ptr[line->len - 1] == '\r')
+			line->len--;
+		if (line->len == 0)
+			continue;
+		// a document usually starts with '{' or '['
+		if (line->ptr[0] != '{' && line->ptr[0] != '['
+			&& line->ptr + line->len == ffs_skipof(line->ptr, line->len, " \t\r", 3))
+			continue;
+
+		*pd = d;
+		return 1;
+	}
+	*pd = d;
+	return 0;
+}
+
+static void ndj_stop(ndj *n, int r)
+{
+	ffatom_cmpset(&n->stop, 0, (size_t)(ssize_t)r);
+}
+
+/** Unordered mode: parse and deliver the lines of a chunk. */
+static void chunk_deliver_direct(ndj *n, struct ndj_worker *w, const char *d, const char *end)
+{
+	struct ffndjson_rec rec;
+	ffstr line;
+	rec.worker = w->idx;
+
+	while (line_next(&d, end, &line)) {
+		w->lines++;
+		rec.line = line;
+		rec.off = n->base + (line.ptr - n->data);
+		rec.err = ffjson_tape_parse(&w->t, line.ptr, line.len);
+		rec.tape = &w->t;
+		rec.err_off = 0;
+		if (rec.err != 0) {
+			w->errors++;
+			if (n->conf->skip_errors)
+				continue;
+			rec.tape = NULL;
+			rec.err_off = w->t.err_off;
+		}
+
+		int r = n->conf->handler(n->conf->udata, &rec);
+		if (r != 0) {
+			ndj_stop(n, r);
+			return;
+		}
+	}
+}
+
+/** Ordered mode: parse the lines of a chunk and store the tapes in a slot. */
+static int chunk_store(ndj *n, struct ndj_worker *w, struct ndj_slot *s, const char *d, const char *end)
+{
+	ffstr line;
+	struct ndj_line *l;
+	s->lines.len = 0;
+	s->tape.len = 0;
+	s->sbuf.len = 0;
+	s->worker = w->idx;
+
+	while (line_next(&d, end, &line)) {
+		if (NULL == (l = ffarr_pushgrowT(&s->lines, 256 | FFARR_GROWQUARTER, struct ndj_line)))
+			return -1;
+		l->off = line.ptr - n->data;
+		l->len = line.len;
+		l->tape_off = s->tape.len;
+		l->tape_n = 0;
+		l->sbuf_off = s->sbuf.len;
+		l->err_off = 0;
+		l->err = ffjson_tape_parse(&w->t, line.ptr, line.len);
+		if (l->err != 0) {
+			l->err_off = w->t.err_off;
+			continue;
+		}
+
+		l->tape_n = w->t.tape.len;
+		if (NULL == _ffarr_append(&s->tape, w->t.tape.ptr, w->t.tape.len, sizeof(uint64)))
+			return -1;
+		if (w->t.sbuf.len != 0
+			&& NULL == ffarr_append(&s->sbuf, w->t.sbuf.ptr, w->t.sbuf.len))
+			return -1;
+	}
+	return 0;
+}
+
+/** Ordered mode: deliver the lines of a parsed chunk. */
+static void slot_deliver(ndj *n, struct ndj_slot *s, struct ndj_worker *w)
+{
+	struct ffndjson_rec rec;
+	ffjson_tape t = {};
+	const struct ndj_line *l;
+	rec.worker = s->worker;
+
+	FFARR_WALKT(&s->lines, l, struct ndj_line) {
+		w->lines++;
+		ffstr_set(&rec.line, n->data + l->off, l->len);
+		rec.off = n->base + l->off;
+		rec.err = l->err;
+		rec.err_off = l->err_off;
+		rec.tape = NULL;
+		if (l->err != 0) {
+			w->errors++;
+			if (n->conf->skip_errors)
+				continue;
+		} else {
+			// a read-only view of the line's tape
+			t.tape.ptr = (char*)((uint64*)s->tape.ptr + l->tape_off);
+			t.tape.len = l->tape_n;
+			t.sbuf.ptr = s->sbuf.ptr + l->sbuf_off;
+			t.data = rec.line.ptr;
+			t.len = rec.line.len;
+			rec.tape = &t;
+		}
+
+		int r = n->conf->handler(n->conf->udata, &rec);
+		if (r != 0) {
+			ndj_stop(n, r);
+			return;
+		}
+	}
+}
+
+/** Take the next chunk and process it.
+Return 0 if there's no chunk available now. */
+static int work(ndj *n, struct ndj_worker *w)
+{
+	size_t k;
+	for (;;) {
+		if (ffatom_get(&n->stop) != 0)
+			return 0;
+		k = ffatom_get(&n->next);
+		if (k >= n->nchunks)
+			return 0;
+		if (n->conf->ordered
+			&& k >= ffatom_get(&n->delivered) + n->nslots)
+			return 0; // the window is full
+		if (ffatom_cmpset(&n->next, k, k + 1))
+			break;
+	}
+
+	const char *d = n->data + chunk_start(n, k);
+	const char *end = n->data + chunk_start(n, k + 1);
+
+	if (!n->conf->ordered) {
+		chunk_deliver_direct(n, w, d, end);
+		return 1;
+	}
+
+	struct ndj_slot *s = &n->slots[k % n->nslots];
+	if (0 != chunk_store(n, w, s, d, end))
+		ndj_stop(n, -1);
+	ffatom_fence_rel();
+	ffatom_set(&s->done, k + 1);
+	return 1;
+}
+
+static int FFTHDCALL worker_thread(void *param)
+{
+	struct ndj_worker *w = param;
+	ndj *n = w->n;
+	uint spins = 0;
+	for (;;) {
+		if (work(n, w)) {
+			spins = 0;
+			continue;
+		}
+		if (ffatom_get(&n->stop) != 0
+			|| ffatom_get(&n->next) >= n->nchunks)
+			break;
+		ffthd_spinwait(&spins);
+	}
+	return 0;
+}
+
+/** Ordered mode: the calling thread delivers the chunks in order and parses them while waiting. */
+static void ordered_loop(ndj *n, struct ndj_worker *w)
+{
+	uint spins = 0;
+	for (size_t k = 0;  k != n->nchunks;  ) {
+		if (ffatom_get(&n->stop) != 0)
+			break;
+
+		struct ndj_slot *s = &n->slots[k % n->nslots];
+		if (ffatom_get(&s->done) == k + 1) {
+			ffatom_fence_acq();
+			slot_deliver(n, s, w);
+			ffatom_fence_rel();
+			ffatom_set(&n->delivered, ++k);
+			spins = 0;
+			continue;
+		}
+
+		if (work(n, w))
+			spins = 0;
+		else
+			ffthd_spinwait(&spins);
+	}
+}
+
+static int ndj_run(const struct ffndjson_conf *conf, const char *data, size_t len, uint64 base, struct ffndjson_stat *st)
+{
+	ndj n = {};
+	int r = 0;
+	uint nthreads = (conf->threads != 0) ? conf->threads : ffsys_ncpu();
+
+	n.conf = conf;
+	n.data = data;
+	n.len = len;
+	n.base = base;
+	n.chunk_size = ffmax(conf->chunk_size, 1);
+	n.nchunks = (len + n.chunk_size - 1) / n.chunk_size;
+	nthreads = ffmin(nthreads, ffmax(n.nchunks, 1));
+
+	if (NULL == (n.w = ffmem_callocT(nthreads, struct ndj_worker)))
+		return -1;
+	for (uint i = 0;  i != nthreads;  i++) {
+		n.w[i].n = &n;
+		n.w[i].idx = i;
+		ffjson_tape_init(&n.w[i].t);
+	}
+	n.nworkers = 1;
+
+	if (conf->ordered) {
+		n.nslots = nthreads * 4;
+		if (NULL == (n.slots = ffmem_callocT(n.nslots, struct ndj_slot))) {
+			r = -1;
+			goto end;
+		}
+	}
+
+	for (uint i = 1;  i != nthreads;  i++) {
+		n.w[i].th = ffthd_create(&worker_thread, &n.w[i], 0);
+		if (n.w[i].th == FFTHD_INV)
+			break; // continue with fewer threads
+		n.nworkers++;
+	}
+
+	if (conf->ordered)
+		ordered_loop(&n, &n.w[0]);
+	else
+		while (work(&n, &n.w[0])) {
+		}
+
+	for (uint i = 1;  i != n.nworkers;  i++) {
+		ffthd_join(n.w[i].th, -1, NULL);
+	}
+
+	r = (int)(ssize_t)ffatom_get(&n.stop);
+
+end:
+	for (uint i = 0;  i != nthreads;  i++) {
+		if (st != NULL) {
+			st->lines += n.w[i].lines;
+			st->errors += n.w[i].errors;
+		}
+		ffjson_tape_free(&n.w[i].t);
+	}
+	if (st != NULL)
+		st->chunks += n.nchunks;
+	for (uint i = 0;  i != n.nslots;  i++) {
+		ffarr_free(&n.slots[i].lines);
+		ffarr_free(&n.slots[i].tape);
+		ffarr_free(&n.slots[i].sbuf);
+	}
+	ffmem_safefree(n.slots);
+	ffmem_free(n.w);
+	return r;
+}
+
+int ffndjson_run(const struct ffndjson_conf *conf, const char *data, size_t len, struct ffndjson_stat *st)
+{
+	return ndj_run(conf, data, len, 0, st);
+}
+
+int ffndjson_runmap(const struct ffndjson_conf *conf, fffilemap *fm, struct ffndjson_stat *st)
+{
+	ffarr carry = {}; // a line crossing the end of a block
+	uint64 start = fm->foff, carry_off = 0;
+	struct ffndjson_conf conf1 = *conf;
+	ffstr d;
+	int r = 0;
+
+	conf1.threads = 1;
+
+	if (fm->fsize == 0)
+		return 0;
+
+	for (;;) {
+		if (0 != fffile_mapbuf(fm, &d)) {
+			r = -1;
+			break;
+		}
+		ffbool last = (d.len == fm->fsize);
+		size_t n;
+
+		if (carry.len != 0) {
+			const char *lf = ffs_findc(d.ptr, d.len, '\n');
+			n = (lf != NULL) ? lf - d.ptr + 1 : d.len;
+			if (NULL == ffarr_append(&carry, d.ptr, n)) {
+				r = -1;
+				break;
+			}
+			if (lf != NULL || last) {
+				r = ndj_run(&conf1, carry.ptr, carry.len, carry_off, st);
+				carry.len = 0;
+			}
+
+		} else {
+			n = d.len;
+			if (!last) {
+				// process the complete lines only
+				n = ffs_rfind(d.ptr, d.len, '\n') - d.ptr;
+				n = (n != d.len) ? n + 1 : 0;
+			}
+			if (n != 0)
+				r = ndj_run(conf, d.ptr, n, fm->foff - start, st);
+
+			if (n != d.len) {
+				carry_off = fm->foff + n - start;
+				if (NULL == ffarr_append(&carry, d.ptr + n, d.len - n)) {
+					r = -1;
+					break;
+				}
+				n = d.len;
+			}
+		}
+
+		if (r != 0)
+			break;
+		if (!fffile_mapshift(fm, n))
+			break;
+	}
+
+	ffarr_free(&carry);
+	return r;
+}
@@ -4,6 +4,7 @@ Copyright (c) 2013 Simon Zolin
 
 #include <FF/data/parse.h>
 #include <FF/number.h>
+#include <FF/crc.h>
 
 
 static const char *const _ffpars_serr[] = {
@@ -43,17 +44,126 @@ const char * ffpars_errstr(int code)
 }
 
 
+/* Key index: open-addressing hash table for a wide argument list.
+Slot: HASH(high 16 bits) | ARG_NUMBER+1 (16 bits);  0: empty. */
+struct ffpars_argidx {
+	const ffpars_arg *args;
+	uint nargs;
+	uint icase;
+	uint mask;
+	uint slots[0];
+};
+
+enum {
+	ARGIDX_MIN = 8, // don't index shorter lists: linear search is fast enough
+	ARGIDX_MAX = 0xffff,
+};
+
+static FFINL uint argidx_hash(const char *name, size_t len, uint icase)
+{
+	return (icase) ? ffcrc32_iget(name, len) : ffcrc32_get(name, len);
+}
+
+static FFINL ssize_t argidx_cmp(const char *name, size_t len, const char *argname, uint icase)
+{
+	return (icase) ? ffs_icmpz(name, len, argname) : ffs_cmpz(name, len, argname);
+}
+
+/** Find argument number.  Return -1 if not found. */
+static int argidx_find(const ffpars_argidx *x, const char *name, size_t len)
+{
+	uint h = argidx_hash(name, len, x->icase), s;
+	for (uint k = h & x->mask;  0 != (s = x->slots[k]);  k = (k + 1) & x->mask) {
+		if (((s ^ h) & 0xffff0000) != 0)
+			continue;
+		uint i = (s & 0xffff) - 1;
+		if (0 == argidx_cmp(name, len, x->args[i].name, x->icase))
+			return i;
+	}
+	return -1;
+}
+
+static ffpars_argidx* argidx_create(const ffpars_arg *args, uint nargs, uint icase)
+{
+	ffpars_argidx *x;
+	uint n = ff_align_power2(nargs * 2);
+	if (NULL == (x = ffmem_calloc(1, sizeof(ffpars_argidx) + n * sizeof(uint))))
+		return NULL;
+	x->args = args;
+	x->nargs = nargs;
+	x->icase = icase;
+	x->mask = n - 1;
+
+	for (uint i = 0;  i != nargs;  i++) {
+		const char *name = args[i].name;
+		if (name[0] == '*' && name[1] == '\0')
+			continue; // "*" is a reserved name
+		size_t len = ffsz_len(name);
+		if (argidx_find(x, name, len) >= 0)
+			continue; // the first argument with this name is used
+
+		uint h = argidx_hash(name, len, icase), k;
+		for (k = h & x->mask;  x->slots[k] != 0;  k = (k + 1) & x->mask) {
+		}
+		x->slots[k] = (h & 0xffff0000) | (i + 1);
+	}
+	return x;
+}
+
+/** Get key index from cache or create a new one. */
+static const ffpars_argidx* argidx_get(ffarr *cache, const ffpars_arg *args, uint nargs, uint icase)
+{
+	ffpars_argidx **px, *x;
+	FFARR_WALKT(cache, px, ffpars_argidx*) {
+		x = *px;
+		if (x->args == args && x->nargs == nargs && x->icase == icase)
+			return x;
+	}
+
+	if (NULL == (px = ffarr_pushgrowT(cache, 8, ffpars_argidx*)))
+		return NULL;
+	if (NULL == (x = argidx_create(args, nargs, icase))) {
+		cache->len--;
+		return NULL;
+	}
+	*px = x;
+	return x;
+}
+
+void _ffpars_argidx_free(ffarr *cache)
+{
+	ffpars_argidx **px;
+	FFARR_WALKT(cache, px, ffpars_argidx*) {
+		ffmem_free(*px);
+	}
+	ffarr_free(cache);
+}
+
 const ffpars_arg* ffpars_ctx_findarg(ffpars_ctx *ctx, const char *name, size_t len, uint flags)
 {
 	const ffpars_arg *a = NULL;
 	uint i, nargs = ctx->nargs;
+	uint icase = !!(flags & FFPARS_CTX_FKEYICASE);
 
 	FF_ASSERT(ctx->nargs != 0);
 
 	if ((ctx->args[nargs - 1].flags & FFPARS_FTYPEMASK) == FFPARS_TCLOSE)
 		nargs--;
 
-	if (flags & FFPARS_CTX_FKEYICASE) {
+	const ffpars_argidx *x = ctx->idx;
+	if (x == NULL || x->args != ctx->args || x->nargs != nargs || x->icase != icase) {
+		x = NULL;
+		if (nargs >= ARGIDX_MIN && nargs <= ARGIDX_MAX && ctx->idxcache != NULL)
+			x = ctx->idx = argidx_get(ctx->idxcache, ctx->args, nargs, icase);
+	}
+
+	if (x != NULL) {
+		int r = argidx_find(x, name, len);
+		i = (r >= 0) ? (uint)r : nargs;
+		if (r >= 0)
+			a = &ctx->args[i];
+
+	} else if (icase) {
 		for (i = 0;  i != nargs;  i++) {
 			if (0 == ffs_icmpz(name, len, ctx->args[i].name)) {
 				a = &ctx->args[i];
@@ -568,6 +678,7 @@ int ffpars_setctx(ffparser_schem *ps, void *o, const ffpars_arg *args, uint narg
 		return FFPARS_ESYS;
 	memset(newctx, 0, sizeof(ffpars_ctx));
 	ffpars_setargs(newctx, o, args, nargs);
+	newctx->idxcache = &ps->argidx;
 	return 0;
 }
 
@@ -6,6 +6,22 @@ Copyright (c) 2015 Simon Zolin
 #include <FF/string.h>
 #include <FF/number.h>
 
+#ifdef FF_AMD64
+#include <emmintrin.h> //SSE2
+#ifdef __GNUC__
+#include <immintrin.h> //AVX2
+#endif
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+
+/** Return 1 if any byte is non-zero. */
+static FFINL int neon_any(uint8x16_t v)
+{
+	uint64x2_t q = vreinterpretq_u64_u8(v);
+	return (vgetq_lane_u64(q, 0) | vgetq_lane_u64(q, 1)) != 0;
+}
+#endif
+
 
 static const char *const codestr[] = {
 	"utf8",
@@ -83,16 +99,44 @@ int ffutf8_decode1_64(const char *utf8, size_t len, uint64 *val)
 	return n;
 }
 
+/* Get the number of bytes within 32-byte blocks that have ASCII characters only. */
+static size_t ascii_span32(const char *p, size_t len)
+{
+	size_t i = 0;
+
+#if defined FF_AMD64
+	for (;  i + 32 <= len;  i += 32) {
+		__m128i v = _mm_or_si128(_mm_loadu_si128((void*)(p + i)), _mm_loadu_si128((void*)(p + i + 16)));
+		if (_mm_movemask_epi8(v) != 0)
+			break;
+	}
+
+#elif defined __ARM_NEON
+	for (;  i + 32 <= len;  i += 32) {
+		uint8x16_t v = vorrq_u8(vld1q_u8((void*)(p + i)), vld1q_u8((void*)(p + i + 16)));
+		if (neon_any(vandq_u8(v, vdupq_n_u8(0x80))))
+			break;
+	}
+#endif
+
+	return i;
+}
+
 size_t ffutf8_len(const char *p, size_t len)
 {
 	uint n;
-	size_t nchars = 0;
+	size_t nchars = 0, k;
 	const char *end = p + len;
 	while (p < end) {
 		uint d = (byte)*p;
-		if ((d & 0x80) == 0)
+		if ((d & 0x80) == 0) {
+			if (0 != (k = ascii_span32(p, end - p))) {
+				p += k;
+				nchars += k;
+				continue;
+			}
 			p++;
-		else {
+		} else {
 			n = ffbit_find32(~(d << 24) & 0xfe000000);
 			if (n >= 3 && n != 8)
 				p += n - 1;
@@ -104,11 +148,159 @@ size_t ffutf8_len(const char *p, size_t len)
 	return nchars;
 }
 
+/*
+Validation of UTF-8 by blocks of 16 (SSE2) or 32 (AVX2) bytes.
+The length of a sequence is computed for each byte:
+ 0xxxxxxx:1  10xxxxxx:0  110xxxxx:2  1110xxxx:3  11110xxx:4  111110xx:5  1111110x:6
+ (0xfe and 0xff are invalid).
+The number of bytes left in the current sequence is propagated through the block:
+ x[i] = max(len[i], x[i-1] - 1),
+ which is computed with 3 shifts by 1, 2, 4 bytes (the bytes of the previous block are shifted in).
+A byte must be a continuation byte (10xxxxxx) if and only if x[i-1] >= 2.
+This is the same set of sequences accepted by ffutf8_decode1().
+A block without non-ASCII bytes is skipped if there's no incomplete sequence before it.
+Return the offset at which the scalar validation continues (the start of the last incomplete sequence);
+ -1 if invalid. */
+
+/* Find the start of the sequence which continues after 'i'. */
+static size_t utf8_seq_start(const char *d, size_t i)
+{
+	i--;
+	while ((d[i] & 0xc0) == 0x80)
+		i--;
+	return i;
+}
+
+#if defined FF_AMD64
+
+#define v_ge(v, c) \
+	_mm_cmpgt_epi8(_mm_xor_si128(v, _mm_set1_epi8((char)0x80)), _mm_set1_epi8((char)(((c) - 1) ^ 0x80)))
+#define v_shift(v, prev, n) \
+	_mm_or_si128(_mm_slli_si128(v, n), _mm_srli_si128(prev, 16 - (n)))
+
+static size_t utf8_valid_sse2(const char *d, size_t len)
+{
+	size_t i = 0;
+	__m128i px = _mm_set1_epi8(1), bad = _mm_setzero_si128();
+	const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+	uint pending = 0;
+
+	while (i + 16 <= len) {
+		if (!pending && i + 32 <= len
+			&& 0 == _mm_movemask_epi8(_mm_or_si128(_mm_loadu_si128((void*)(d + i)), _mm_loadu_si128((void*)(d + i + 16))))) {
+			i += 32;
+			continue;
+		}
+
+		__m128i v = _mm_loadu_si128((void*)(d + i));
+		__m128i m80 = v_ge(v, 0x80), mc0 = v_ge(v, 0xc0);
+		__m128i n = _mm_add_epi8(one, m80);
+		n = _mm_sub_epi8(_mm_sub_epi8(n, mc0), mc0);
+		n = _mm_sub_epi8(_mm_sub_epi8(n, v_ge(v, 0xe0)), v_ge(v, 0xf0));
+		n = _mm_sub_epi8(_mm_sub_epi8(n, v_ge(v, 0xf8)), v_ge(v, 0xfc));
+		bad = _mm_or_si128(bad, v_ge(v, 0xfe));
+
+		__m128i x = _mm_max_epu8(n, _mm_subs_epu8(v_shift(n, px, 1), one));
+		x = _mm_max_epu8(x, _mm_subs_epu8(v_shift(x, px, 2), _mm_set1_epi8(2)));
+		x = _mm_max_epu8(x, _mm_subs_epu8(v_shift(x, px, 4), _mm_set1_epi8(4)));
+
+		__m128i need = _mm_cmpeq_epi8(_mm_subs_epu8(v_shift(x, px, 1), one), zero); // x[i-1] < 2
+		__m128i cont = _mm_cmpeq_epi8(n, zero);
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(need, cont));
+		if (_mm_movemask_epi8(bad) != 0)
+			return -1;
+
+		px = x;
+		pending = ((uint)_mm_extract_epi16(x, 7) >> 8) >= 2;
+		i += 16;
+	}
+
+	if (pending)
+		i = utf8_seq_start(d, i);
+	return i;
+}
+
+#undef v_ge
+#undef v_shift
+
+#ifdef __GNUC__
+#define UTF8_AVX2
+
+#define v_ge(v, c) \
+	_mm256_cmpgt_epi8(_mm256_xor_si256(v, _mm256_set1_epi8((char)0x80)), _mm256_set1_epi8((char)(((c) - 1) ^ 0x80)))
+/* Shift bytes of 'v' by 'n' positions up, the bytes of 'prev' are shifted in. */
+#define v_shift(v, prev, n) \
+	_mm256_alignr_epi8(v, _mm256_permute2x128_si256(prev, v, 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static size_t utf8_valid_avx2(const char *d, size_t len)
+{
+	size_t i = 0;
+	__m256i px = _mm256_set1_epi8(1), bad = _mm256_setzero_si256();
+	const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi8(1);
+	uint pending = 0;
+
+	while (i + 32 <= len) {
+		__m256i v = _mm256_loadu_si256((void*)(d + i));
+		if (!pending && 0 == _mm256_movemask_epi8(v)) {
+			i += 32;
+			continue;
+		}
+
+		__m256i m80 = v_ge(v, 0x80), mc0 = v_ge(v, 0xc0);
+		__m256i n = _mm256_add_epi8(one, m80);
+		n = _mm256_sub_epi8(_mm256_sub_epi8(n, mc0), mc0);
+		n = _mm256_sub_epi8(_mm256_sub_epi8(n, v_ge(v, 0xe0)), v_ge(v, 0xf0));
+		n = _mm256_sub_epi8(_mm256_sub_epi8(n, v_ge(v, 0xf8)), v_ge(v, 0xfc));
+		bad = _mm256_or_si256(bad, v_ge(v, 0xfe));
+
+		__m256i x = _mm256_max_epu8(n, _mm256_subs_epu8(v_shift(n, px, 1), one));
+		x = _mm256_max_epu8(x, _mm256_subs_epu8(v_shift(x, px, 2), _mm256_set1_epi8(2)));
+		x = _mm256_max_epu8(x, _mm256_subs_epu8(v_shift(x, px, 4), _mm256_set1_epi8(4)));
+
+		__m256i need = _mm256_cmpeq_epi8(_mm256_subs_epu8(v_shift(x, px, 1), one), zero);
+		__m256i cont = _mm256_cmpeq_epi8(n, zero);
+		bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(need, cont));
+		if (_mm256_movemask_epi8(bad) != 0)
+			return -1;
+
+		px = x;
+		pending = (uint)_mm256_extract_epi8(x, 31) >= 2;
+		i += 32;
+	}
+
+	if (pending)
+		i = utf8_seq_start(d, i);
+	return i;
+}
+
+#undef v_ge
+#undef v_shift
+#endif // __GNUC__
+
+#endif // FF_AMD64
+
 ffbool ffutf8_valid(const char *data, size_t len)
 {
 	int r;
 	uint val;
 	const char *end = data + len;
+	size_t i = 0;
+
+#ifdef UTF8_AVX2
+	if (len >= 64 && __builtin_cpu_supports("avx2"))
+		i = utf8_valid_avx2(data, len);
+	else
+#endif
+#if defined FF_AMD64
+		i = utf8_valid_sse2(data, len);
+#else
+		i = ascii_span32(data, len);
+#endif
+	if (i == (size_t)-1)
+		return 0;
+	data += i;
+
 	for (;  data != end;  data += r) {
 		r = ffutf8_decode1(data, end - data, &val);
 		if (r <= 0)
@@ -223,13 +415,80 @@ uint ffutf8_encode1(char *dst, size_t cap, uint uch)
 	return n;
 }
 
+/* Convert UTF-16 characters 0..0x7f to UTF-8 by blocks of 8.
+n: max. number of characters
+Return the number of characters converted. */
+static size_t utf16_ascii(char *dst, size_t n, const char *src, uint be)
+{
+	size_t i = 0;
+
+#if defined FF_AMD64
+	const __m128i hi = _mm_set1_epi16((short)0xff80);
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm_loadu_si128((void*)(src + i * 2));
+		if (be)
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		if (0xffff != _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, hi), _mm_setzero_si128())))
+			break;
+		_mm_storel_epi64((void*)(dst + i), _mm_packus_epi16(v, v));
+	}
+
+#elif defined __ARM_NEON
+	for (;  i + 8 <= n;  i += 8) {
+		uint16x8_t v = vld1q_u16((void*)(src + i * 2));
+		if (be)
+			v = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v)));
+		if (neon_any(vreinterpretq_u8_u16(vandq_u16(v, vdupq_n_u16(0xff80)))))
+			break;
+		vst1_u8((void*)(dst + i), vmovn_u16(v));
+	}
+#endif
+
+	return i;
+}
+
+/* Get the size of UTF-8 data for UTF-16 characters (by blocks of 8).
+*n: input: max. number of characters;  output: number of characters processed */
+static size_t utf16_utf8size(const char *src, size_t *n, uint be)
+{
+	size_t i = 0, r = 0;
+
+#if defined FF_AMD64
+	const __m128i m80 = _mm_set1_epi16((short)0xff80), m800 = _mm_set1_epi16((short)0xf800);
+	const __m128i zero = _mm_setzero_si128();
+	while (i + 8 <= *n) {
+		// each character takes 3 bytes minus [c < 0x800] minus [c < 0x80];
+		//  the 16-bit counters don't overflow within 4k blocks
+		__m128i acc = zero;
+		size_t end = ffmin(*n & ~(size_t)7, i + 4096 * 8);
+		r += (end - i) * 3;
+		for (;  i != end;  i += 8) {
+			__m128i v = _mm_loadu_si128((void*)(src + i * 2));
+			if (be)
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			acc = _mm_add_epi16(acc, _mm_cmpeq_epi16(_mm_and_si128(v, m80), zero));
+			acc = _mm_add_epi16(acc, _mm_cmpeq_epi16(_mm_and_si128(v, m800), zero));
+		}
+		acc = _mm_madd_epi16(acc, _mm_set1_epi16(1));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		r -= (uint)-_mm_cvtsi128_si32(acc);
+	}
+#endif
+
+	*n = i;
+	return r;
+}
+
 size_t ffutf8_from_utf16le(char *dst, size_t cap, const char *src, size_t *plen, uint flags)
 {
 	size_t r, i, idst = 0, len = *plen;
 	const ushort *us = (void*)src;
 
 	if (dst == NULL) {
-		for (i = 0;  i < len / 2;  i++) {
+		i = len / 2;
+		idst = utf16_utf8size(src, &i, 0);
+		for (;  i < len / 2;  i++) {
 			idst += ffutf8_size(ffint_ltoh16(us + i));
 		}
 		i *= 2;
@@ -243,6 +502,12 @@ size_t ffutf8_from_utf16le(char *dst, size_t cap, const char *src, size_t *plen,
 	}
 
 	for (i = 0;  i < len / 2 && idst < cap;  i++) {
+		if (us[i] < 0x80
+			&& 0 != (r = utf16_ascii(dst + idst, ffmin(len / 2 - i, cap - idst), src + i * 2, 0))) {
+			i += r - 1;
+			idst += r;
+			continue;
+		}
 		r = ffutf8_encode1(dst + idst, cap - idst, us[i]);
 		if (r == 0) {
 			i *= 2;
@@ -271,7 +536,9 @@ size_t ffutf8_from_utf16be(char *dst, size_t cap, const char *src, size_t *plen,
 	const ushort *us = (void*)src;
 
 	if (dst == NULL) {
-		for (i = 0;  i < len / 2;  i++) {
+		i = len / 2;
+		idst = utf16_utf8size(src, &i, 1);
+		for (;  i < len / 2;  i++) {
 			idst += ffutf8_size(ffint_ntoh16(us + i));
 		}
 		i *= 2;
@@ -285,6 +552,12 @@ size_t ffutf8_from_utf16be(char *dst, size_t cap, const char *src, size_t *plen,
 	}
 
 	for (i = 0;  i < len / 2 && idst < cap;  i++) {
+		if (ffhton16(us[i]) < 0x80
+			&& 0 != (r = utf16_ascii(dst + idst, ffmin(len / 2 - i, cap - idst), src + i * 2, 1))) {
+			i += r - 1;
+			idst += r;
+			continue;
+		}
 		r = ffutf8_encode1(dst + idst, cap - idst, ffhton16(us[i]));
 		if (r == 0) {
 			i *= 2;
@@ -402,6 +675,35 @@ size_t ffutf8_strencode(ffstr3 *dst, const char *src, size_t len, uint flags)
 	return r;
 }
 
+/* Convert ASCII characters to UTF-16BE by blocks of 16.
+Return the number of characters converted. */
+static size_t utf8_ascii_utf16be(char *dst, const char *src, size_t len)
+{
+	size_t i = 0;
+
+#if defined FF_AMD64
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i v = _mm_loadu_si128((void*)(src + i));
+		if (_mm_movemask_epi8(v) != 0)
+			break;
+		_mm_storeu_si128((void*)(dst + i * 2), _mm_unpacklo_epi8(_mm_setzero_si128(), v));
+		_mm_storeu_si128((void*)(dst + i * 2 + 16), _mm_unpackhi_epi8(_mm_setzero_si128(), v));
+	}
+
+#elif defined __ARM_NEON
+	for (;  i + 16 <= len;  i += 16) {
+		uint8x16x2_t w;
+		w.val[1] = vld1q_u8((void*)(src + i));
+		if (neon_any(vandq_u8(w.val[1], vdupq_n_u8(0x80))))
+			break;
+		w.val[0] = vdupq_n_u8(0);
+		vst2q_u8((void*)(dst + i * 2), w);
+	}
+#endif
+
+	return i;
+}
+
 size_t ffutf8_to_utf16(char *dst, size_t cap, const char *src, size_t *len, uint flags)
 {
 	const char *d = src, *end = src + *len;
@@ -414,6 +716,11 @@ size_t ffutf8_to_utf16(char *dst, size_t cap, const char *src, size_t *len, uint
 
 	if (dst == NULL) {
 		while (d != end) {
+			if ((byte)*d < 0x80 && 0 != (r = ascii_span32(d, end - d))) {
+				d += r;
+				cnt += r * 2;
+				continue;
+			}
 			r = ffutf8_decode1(d, end - d, &n);
 			if (r <= 0)
 				return 0;
@@ -427,6 +734,11 @@ size_t ffutf8_to_utf16(char *dst, size_t cap, const char *src, size_t *len, uint
 	}
 
 	while (d != end) {
+		if ((byte)*d < 0x80 && 0 != (r = utf8_ascii_utf16be(dst + cnt, d, end - d))) {
+			d += r;
+			cnt += r * 2;
+			continue;
+		}
 		r = ffutf8_decode1(d, end - d, &n);
 		if (r <= 0)
 			return 0;
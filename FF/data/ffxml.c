@@ -3,8 +3,840 @@ Copyright (c) 2014 Simon Zolin
 */
 
 #include <FF/data/xml.h>
+#include <FF/data/utf8.h>
 #include <FF/string.h>
 
+#ifdef FF_AMD64
+#include <emmintrin.h> //SSE2
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+
+/** Return 1 if any byte is non-zero. */
+static FFINL int neon_any(uint8x16_t v)
+{
+	uint64x2_t q = vreinterpretq_u64_u8(v);
+	return (vgetq_lane_u64(q, 0) | vgetq_lane_u64(q, 1)) != 0;
+}
+#endif
+
+
+enum XML_IDX {
+	iTextFirst, iText, iLt, iBang, iCdataOpen, iCdata, iCdataB1, iCdataB2,
+	iCmtOpen, iCmt, iCmtD1, iCmtD2, iDecl, iPI, iPIQ,
+	iTagFirst, iTagName, iAttrWs, iAttrName, iAttrEq, iAttrQ, iAttrVal, iEmptyEnd,
+	iCloseFirst, iCloseName, iCloseEnd,
+	iEnt,
+	I_ERR,
+};
+
+/* Whitespace and control characters */
+#define xml_ws(ch)  ((byte)(ch) <= ' ')
+
+static FFINL int xml_nameend(int ch)
+{
+	return xml_ws(ch) || ch == '>' || ch == '/' || ch == '=' || ch == '<' || ch == '?';
+}
+
+void ffxml_parseinit(ffxml *p)
+{
+	ffmem_tzero(p);
+	p->line = 1;
+	p->state = iTextFirst;
+}
+
+void ffxml_parseclose(ffxml *p)
+{
+	ffarr_free(&p->buf);
+	ffarr_free(&p->tags);
+	ffarr_free(&p->tagoffs);
+}
+
+const char* ffxml_errmsg(ffxml *p, int r, char *buf, size_t cap)
+{
+	char *end = buf + cap;
+	size_t n = ffs_fmt(buf, end, "%u:%u near \"%S\" : %s%Z"
+		, p->line, p->ch, &p->val, ffpars_errstr(r));
+	if (r == FFPARS_ESYS) {
+		if (n != 0)
+			n--;
+		n += ffs_fmt(buf + n, end, " : %E%Z", fferr_last());
+	}
+	return (n != 0) ? buf : "";
+}
+
+/* The buffer is kept for the next values. */
+static void xml_cleardata(ffxml *p)
+{
+	ffstr_null(&p->val);
+	p->buf.len = 0;
+	p->valbuf = 0;
+}
+
+/* Copy data to the buffer.
+The first call copies the value gathered so far from input data. */
+static int val_store(ffxml *p, const char *s, size_t len)
+{
+	if (!p->valbuf) {
+		p->buf.len = 0;
+		if (NULL == ffarr_grow(&p->buf, p->val.len + len, 256 | FFARR_GROWQUARTER))
+			return FFPARS_ESYS;
+		if (p->val.len != 0)
+			ffarr_append(&p->buf, p->val.ptr, p->val.len);
+		p->valbuf = 1;
+
+	} else if (NULL == ffarr_grow(&p->buf, len, 256 | FFARR_GROWQUARTER))
+		return FFPARS_ESYS;
+
+	if (len != 0)
+		ffarr_append(&p->buf, s, len);
+	ffstr_set2(&p->val, &p->buf);
+	return 0;
+}
+
+/* Add data to the value:
+ extend the value within input data if the data is contiguous, otherwise copy it. */
+static int val_add(ffxml *p, const char *s, size_t len)
+{
+	if (!p->valbuf) {
+		if (p->val.len == 0) {
+			ffstr_set(&p->val, s, len);
+			return 0;
+		} else if (p->val.ptr + p->val.len == s) {
+			p->val.len += len;
+			return 0;
+		}
+	}
+	return val_store(p, s, len);
+}
+
+/* Get the number of bytes before '<' or '&'.
+*text: set to 1 if there are non-whitespace characters */
+static size_t text_span(const char *d, const char *end, uint *text)
+{
+	const char *s = d;
+	uint nonws = 0;
+
+#if defined FF_AMD64
+	const __m128i lt = _mm_set1_epi8('<'), amp = _mm_set1_epi8('&');
+	const __m128i x80 = _mm_set1_epi8((char)0x80), sp = _mm_set1_epi8((char)(' ' ^ 0x80));
+	for (;  end - d >= 16;  d += 16) {
+		__m128i v = _mm_loadu_si128((void*)d);
+		uint stop = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, amp)));
+		uint chars = _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_xor_si128(v, x80), sp));
+		if (stop != 0) {
+			uint n = ffbit_ffs32(stop) - 1;
+			nonws |= chars & ((1U << n) - 1);
+			*text |= !!nonws;
+			return d + n - s;
+		}
+		nonws |= chars;
+	}
+
+#elif defined __ARM_NEON
+	for (;  end - d >= 16;  d += 16) {
+		uint8x16_t v = vld1q_u8((void*)d);
+		uint8x16_t stop = vorrq_u8(vceqq_u8(v, vdupq_n_u8('<')), vceqq_u8(v, vdupq_n_u8('&')));
+		if (neon_any(stop))
+			break;
+		nonws |= neon_any(vcgtq_u8(v, vdupq_n_u8(' ')));
+	}
+#endif
+
+	for (;  d != end;  d++) {
+		if (*d == '<' || *d == '&')
+			break;
+		nonws |= !xml_ws(*d);
+	}
+	*text |= !!nonws;
+	return d - s;
+}
+
+static size_t name_span(const char *d, const char *end)
+{
+	const char *s = d;
+	while (d != end && !xml_nameend(*d))
+		d++;
+	return d - s;
+}
+
+static size_t attr_span(const char *d, const char *end, int quote)
+{
+	const char *s = d;
+	while (d != end && *d != quote && *d != '&' && *d != '<')
+		d++;
+	return d - s;
+}
+
+static size_t chr_span(const char *d, const char *end, int ch)
+{
+	const char *pos = ffmemchr(d, ch, end - d);
+	return (pos != NULL) ? (size_t)(pos - d) : (size_t)(end - d);
+}
+
+/* Decode entity name (without '&' and ';').
+Return the number of bytes written;  0: unknown entity;  -1: the character isn't allowed in XML. */
+static int xml_entity(char *dst, const char *s, size_t len)
+{
+	static const char *const names[] = { "amp", "apos", "gt", "lt", "quot" };
+	static const char chars[] = "&'><\"";
+	uint val;
+
+	if (len >= 2 && s[0] == '#') {
+		if (s[1] == 'x') {
+			if (len == 2 || len - 2 != ffs_toint(s + 2, len - 2, &val, FFS_INT32 | FFS_INTHEX))
+				return 0;
+		} else if (len - 1 != ffs_toint(s + 1, len - 1, &val, FFS_INT32))
+			return 0;
+		if (val == 0)
+			return 0;
+		if ((val >= 0xd800 && val <= 0xdfff) // UTF-16 surrogate
+			|| val == 0xfffe || val == 0xffff || val > 0x10ffff)
+			return -1;
+		return ffutf8_encode1(dst, FFUTF8_MAXCHARLEN, val);
+	}
+
+	ssize_t i = ffszarr_findsorted(names, FFCNT(names), s, len);
+	if (i < 0)
+		return 0;
+	dst[0] = chars[i];
+	return 1;
+}
+
+static int tag_push(ffxml *p, const ffstr *name)
+{
+	uint *off = ffarr_pushgrowT(&p->tagoffs, 16, uint);
+	if (off == NULL)
+		return FFPARS_ESYS;
+	*off = p->tags.len;
+	if (NULL == ffarr_grow(&p->tags, name->len, 256 | FFARR_GROWQUARTER))
+		return FFPARS_ESYS;
+	ffarr_append(&p->tags, name->ptr, name->len);
+	return 0;
+}
+
+/* Get the name of the current element. */
+static ffstr tag_last(ffxml *p)
+{
+	ffstr s;
+	uint off = ((uint*)p->tagoffs.ptr)[p->tagoffs.len - 1];
+	ffstr_set(&s, p->tags.ptr + off, p->tags.len - off);
+	return s;
+}
+
+static void tag_pop(ffxml *p)
+{
+	p->tags.len = ((uint*)p->tagoffs.ptr)[--p->tagoffs.len];
+	if (p->tagoffs.len == 0)
+		p->rootclosed = 1;
+}
+
+/* Return FFPARS_VAL if there's text with non-whitespace characters. */
+static int text_ret(ffxml *p)
+{
+	if (!p->text)
+		return 0;
+	if (p->tagoffs.len == 0)
+		return FFPARS_EBADCHAR; // text outside of the root element
+	p->type = FFXML_TTEXT;
+	return FFPARS_VAL;
+}
+
+/* Update line and column numbers for the processed data. */
+static void xml_lines(ffxml *p, const char *d, const char *end)
+{
+	const char *nl;
+
+	if (end - d < 32) {
+		// short range: usually the data of 1 event
+		for (;  d != end;  d++) {
+			p->ch++;
+			if (*d == '\n') {
+				p->line++;
+				p->ch = 0;
+			}
+		}
+		return;
+	}
+
+	while (NULL != (nl = ffmemchr(d, '\n', end - d))) {
+		p->line++;
+		p->ch = 0;
+		d = nl + 1;
+	}
+	p->ch += end - d;
+}
+
+int ffxml_parse(ffxml *p, const char *data, size_t *len)
+{
+	const char *datao = data;
+	const char *end = data + *len;
+	int r = 0;
+	uint st = p->state;
+	size_t n;
+	uint text;
+
+	if (p->ret < 0)
+		xml_cleardata(p); // the value returned by the previous call isn't needed anymore
+
+	while (data != end) {
+		int ch = *data;
+
+		switch (st) {
+
+//TEXT
+		case iTextFirst:
+			xml_cleardata(p);
+			p->text = 0;
+			st = iText;
+			// fallthrough
+
+		case iText:
+			if (ch == '<') {
+				st = iLt;
+				data++;
+				break;
+
+			} else if (ch == '&') {
+				p->esc[0] = 0;
+				p->nextst = iText;
+				st = iEnt;
+				data++;
+				break;
+			}
+
+			text = 0;
+			n = text_span(data, end, &text);
+			p->text |= text;
+			r = val_add(p, data, n);
+			data += n;
+			break;
+
+		case iLt:
+			if (ch == '/') {
+				st = iCloseFirst;
+				data++;
+				r = text_ret(p);
+
+			} else if (ch == '!') {
+				st = iBang;
+				data++;
+
+			} else if (ch == '?') {
+				st = iPI;
+				data++;
+				r = text_ret(p);
+
+			} else {
+				st = iTagFirst;
+				r = text_ret(p);
+			}
+			break;
+
+//COMMENT, CDATA, DECLARATION, PROCESSING INSTRUCTION
+		case iBang:
+			if (ch == '[') {
+				st = iCdataOpen;
+				p->quote = 0;
+				data++;
+
+			} else if (ch == '-') {
+				st = iCmtOpen;
+				data++;
+				r = text_ret(p);
+
+			} else {
+				st = iDecl;
+				p->quote = 0;
+				r = text_ret(p);
+			}
+			break;
+
+		case iCdataOpen:
+			if (ch != "CDATA["[p->quote]) {
+				r = FFPARS_EBADCHAR;
+				break;
+			}
+			data++;
+			if (++p->quote == FFSLEN("CDATA[")) {
+				st = iCdata;
+				p->text = 1;
+			}
+			break;
+
+		case iCdata:
+			if (ch == ']') {
+				st = iCdataB1;
+				data++;
+				break;
+			}
+			n = chr_span(data, end, ']');
+			r = val_add(p, data, n);
+			data += n;
+			break;
+
+		case iCdataB1:
+			if (ch == ']') {
+				st = iCdataB2;
+				data++;
+				break;
+			}
+			r = val_store(p, "]", 1);
+			st = iCdata;
+			break;
+
+		case iCdataB2:
+			if (ch == '>') {
+				st = iText;
+				data++;
+			} else if (ch == ']') {
+				r = val_store(p, "]", 1);
+				data++;
+			} else {
+				r = val_store(p, "]]", 2);
+				st = iCdata;
+			}
+			break;
+
+		case iCmtOpen:
+			if (ch != '-') {
+				r = FFPARS_EBADCMT;
+				break;
+			}
+			st = iCmt;
+			data++;
+			break;
+
+		case iCmt:
+			if (ch == '-') {
+				st = iCmtD1;
+				data++;
+				break;
+			}
+			data += chr_span(data, end, '-');
+			break;
+
+		case iCmtD1:
+			st = (ch == '-') ? iCmtD2 : iCmt;
+			data++;
+			break;
+
+		case iCmtD2:
+			if (ch == '>')
+				st = iTextFirst;
+			else if (ch != '-')
+				st = iCmt;
+			data++;
+			break;
+
+		case iDecl:
+			// skip <!DOCTYPE ... [ ... ]>
+			if (ch == '[')
+				p->quote++;
+			else if (ch == ']')
+				p->quote--;
+			else if (ch == '>' && p->quote == 0)
+				st = iTextFirst;
+			data++;
+			break;
+
+		case iPI:
+			data += chr_span(data, end, '?');
+			if (data != end) {
+				st = iPIQ;
+				data++;
+			}
+			break;
+
+		case iPIQ:
+			if (ch == '>') {
+				st = iTextFirst;
+				data++;
+			} else
+				st = iPI;
+			break;
+
+//START TAG
+		case iTagFirst:
+			xml_cleardata(p);
+			if (xml_nameend(ch)) {
+				r = FFPARS_EBADCHAR;
+				break;
+			}
+			if (p->rootclosed && p->tagoffs.len == 0) {
+				r = FFPARS_EBADVAL; // a second root element
+				break;
+			}
+			st = iTagName;
+			// fallthrough
+
+		case iTagName:
+			n = name_span(data, end);
+			r = val_add(p, data, n);
+			data += n;
+			if (data == end || r != 0)
+				break;
+
+			if (0 != (r = tag_push(p, &p->val)))
+				break;
+			p->type = FFXML_TTAG;
+			r = FFPARS_OPEN;
+			st = iAttrWs;
+			break;
+
+		case iAttrWs:
+			if (xml_ws(ch)) {
+				data++;
+				break;
+			}
+
+			if (ch == '>') {
+				st = iTextFirst;
+				data++;
+
+			} else if (ch == '/') {
+				st = iEmptyEnd;
+				data++;
+
+			} else if (xml_nameend(ch)) {
+				r = FFPARS_EBADCHAR;
+
+			} else {
+				xml_cleardata(p);
+				st = iAttrName;
+			}
+			break;
+
+		case iAttrName:
+			n = name_span(data, end);
+			r = val_add(p, data, n);
+			data += n;
+			if (data == end || r != 0)
+				break;
+
+			p->type = FFXML_TATTR;
+			r = FFPARS_KEY;
+			st = iAttrEq;
+			break;
+
+		case iAttrEq:
+			if (xml_ws(ch)) {
+				data++;
+				break;
+			}
+			if (ch != '=') {
+				r = FFPARS_EKVSEP;
+				break;
+			}
+			st = iAttrQ;
+			data++;
+			break;
+
+		case iAttrQ:
+			if (xml_ws(ch)) {
+				data++;
+				break;
+			}
+			if (ch != '"' && ch != '\'') {
+				r = FFPARS_EBADCHAR;
+				break;
+			}
+			p->quote = ch;
+			xml_cleardata(p);
+			st = iAttrVal;
+			data++;
+			break;
+
+		case iAttrVal:
+			if (ch == (int)p->quote) {
+				p->type = FFXML_TATTRVAL;
+				r = FFPARS_VAL;
+				st = iAttrWs;
+				data++;
+				break;
+
+			} else if (ch == '&') {
+				p->esc[0] = 0;
+				p->nextst = iAttrVal;
+				st = iEnt;
+				data++;
+				break;
+
+			} else if (ch == '<') {
+				r = FFPARS_EBADCHAR;
+				break;
+			}
+
+			n = attr_span(data, end, p->quote);
+			r = val_add(p, data, n);
+			data += n;
+			break;
+
+		case iEmptyEnd:
+			if (ch != '>') {
+				r = FFPARS_EBADCHAR;
+				break;
+			}
+			data++;
+			{
+				ffstr name = tag_last(p);
+				xml_cleardata(p);
+				if (0 != (r = val_store(p, name.ptr, name.len)))
+					break;
+			}
+			tag_pop(p);
+			p->type = FFXML_TTAGCLOSE;
+			r = FFPARS_CLOSE;
+			st = iTextFirst;
+			break;
+
+//END TAG
+		case iCloseFirst:
+			xml_cleardata(p);
+			st = iCloseName;
+			// fallthrough
+
+		case iCloseName:
+			n = name_span(data, end);
+			r = val_add(p, data, n);
+			data += n;
+			if (data == end || r != 0)
+				break;
+
+			if (p->tagoffs.len == 0) {
+				r = FFPARS_EBADBRACE;
+				break;
+			}
+			{
+				ffstr name = tag_last(p);
+				if (!ffstr_eq2(&name, &p->val)) {
+					r = FFPARS_EBADBRACE; // the name doesn't match the opening tag
+					break;
+				}
+			}
+			st = iCloseEnd;
+			break;
+
+		case iCloseEnd:
+			if (xml_ws(ch)) {
+				data++;
+				break;
+			}
+			if (ch != '>') {
+				r = FFPARS_EBADCHAR;
+				break;
+			}
+			data++;
+			tag_pop(p);
+			p->type = FFXML_TTAGCLOSE;
+			r = FFPARS_CLOSE;
+			st = iTextFirst;
+			break;
+
+//ENTITY
+		case iEnt:
+			data++;
+			if (ch == ';') {
+				char buf[FFUTF8_MAXCHARLEN];
+				int k = xml_entity(buf, p->esc + 1, (byte)p->esc[0]);
+				if (k <= 0) {
+					r = (k == 0) ? FFPARS_EESC : FFPARS_EBADVAL;
+					break;
+				}
+				if (0 != (r = val_store(p, buf, k)))
+					break;
+				if (p->nextst == iText)
+					p->text = 1;
+				st = p->nextst;
+				break;
+			}
+
+			if ((byte)p->esc[0] == sizeof(p->esc) - 1) {
+				r = FFPARS_EESC; // too large entity
+				break;
+			}
+			p->esc[(byte)++p->esc[0]] = (char)ch;
+			break;
+
+		case I_ERR:
+			r = FFPARS_ESYS;
+			break;
+		}
+
+		if (r != 0)
+			break;
+	}
+
+	if (r == FFPARS_MORE && p->val.len != 0 && !p->valbuf)
+		r = val_store(p, NULL, 0); // the next input data won't be contiguous with this one
+
+	xml_lines(p, datao, data);
+	p->state = st;
+	*len = data - datao;
+	p->ret = r;
+	FFDBG_PRINTLN(FFDBG_PARSE | 10, "line:%u  r:%d  type:%d  val:%S  level:%u"
+		, p->line, r, p->type, &p->val, p->tagoffs.len);
+	return r;
+}
+
+
+enum XML_SCF {
+	// enum FFPARS_SCHEMFLAG{}
+
+	SCF_SCALAR = 8, // inside an element with a scalar value
+	SCF_SCALARVAL = 0x10, // the text of the element has been processed
+};
+
+int ffxml_scheminit(ffparser_schem *ps, ffxml *p, const ffpars_ctx *ctx)
+{
+	int r;
+	const ffpars_arg top = { NULL, FFPARS_TOBJ | FFPARS_FPTR, FFPARS_DST(ctx) };
+	ffpars_scheminit(ps, p, &top);
+
+	ffxml_parseinit(p);
+
+	r = _ffpars_schemrun(ps, FFPARS_OPEN);
+	if (r != FFPARS_OPEN)
+		return r;
+
+	ps->curarg = NULL;
+	return 0;
+}
+
+int ffxml_schemfin(ffparser_schem *ps)
+{
+	ffxml *p = ps->p;
+	int r;
+
+	if (p->tagoffs.len != 0 || ps->ctxs.len != 1)
+		return FFPARS_ENOBRACE;
+
+	r = _ffpars_schemrun(ps, FFPARS_CLOSE);
+	if (r != FFPARS_CLOSE)
+		return r;
+	return 0;
+}
+
+/* Skip the element with its children. */
+static int xml_schem_skip(ffparser_schem *ps)
+{
+	if (0 != ffpars_setctx(ps, NULL, NULL, 0))
+		return FFPARS_ESYS;
+	ffpars_ctx_skip(&ffarr_back(&ps->ctxs));
+	return FFPARS_OPEN;
+}
+
+/* Process the text of an element with a scalar value. */
+static int xml_schem_scalar(ffparser_schem *ps, ffpars_ctx *ctx)
+{
+	ffxml *p = ps->p;
+	int r;
+
+	switch (p->ret) {
+	case FFPARS_OPEN:
+		if (!(ps->flags & FFXML_SCHEM_FSKIPUNK))
+			return FFPARS_EVALTYPE; // child element
+		return xml_schem_skip(ps);
+
+	case FFPARS_VAL:
+		if (p->type != FFXML_TTEXT)
+			break; // attributes are ignored
+		ps->flags |= SCF_SCALARVAL;
+		r = ffpars_arg_process(ps->curarg, &p->val, ctx->obj, ps);
+		if (r != 0)
+			return r;
+		break;
+
+	case FFPARS_CLOSE:
+		if (!(ps->flags & SCF_SCALARVAL)) {
+			ffstr s = {};
+			r = ffpars_arg_process(ps->curarg, &s, ctx->obj, ps);
+			if (r != 0)
+				return r;
+		}
+		ps->flags &= ~(SCF_SCALAR | SCF_SCALARVAL);
+		ps->curarg = NULL;
+		break;
+	}
+
+	return p->ret;
+}
+
+int ffxml_schemrun(ffparser_schem *ps)
+{
+	ffxml *p = ps->p;
+	const ffpars_arg *arg;
+	ffpars_ctx *ctx;
+	uint f;
+	int r;
+
+	if (p->ret >= 0)
+		return p->ret;
+
+	if (ps->ctxs.len == 0)
+		return FFPARS_ECONF;
+
+	if (0 != (r = _ffpars_skipctx(ps, p->ret)))
+		return r;
+
+	ctx = &ffarr_back(&ps->ctxs);
+
+	if (ps->flags & SCF_SCALAR)
+		return xml_schem_scalar(ps, ctx);
+
+	f = FFPARS_CTX_FDUP;
+	if (ps->flags & FFPARS_KEYICASE)
+		f |= FFPARS_CTX_FKEYICASE;
+
+	switch (p->ret) {
+	case FFPARS_OPEN:
+	case FFPARS_KEY:
+		arg = ffpars_ctx_findarg(ctx, p->val.ptr, p->val.len, FFPARS_CTX_FANY | f);
+		if (arg == (void*)-1)
+			return FFPARS_EDUPKEY;
+		ps->curarg = arg;
+
+		if (arg == NULL) {
+			if (!(ps->flags & FFXML_SCHEM_FSKIPUNK))
+				return FFPARS_EUKNKEY;
+			if (p->ret == FFPARS_OPEN)
+				return xml_schem_skip(ps);
+			return FFPARS_KEY;
+		}
+
+		if (p->ret == FFPARS_KEY)
+			return FFPARS_KEY;
+
+		if ((arg->flags & FFPARS_FTYPEMASK) == FFPARS_TOBJ)
+			return _ffpars_schemrun(ps, FFPARS_OPEN);
+
+		ps->flags |= SCF_SCALAR;
+		return FFPARS_OPEN;
+
+	case FFPARS_VAL:
+		if (p->type == FFXML_TTEXT) {
+			ps->curarg = ffpars_ctx_findarg(ctx, FFSTR("#text"), f);
+			if (ps->curarg == (void*)-1)
+				return FFPARS_EDUPKEY;
+			if (ps->curarg == NULL)
+				return (ps->flags & FFXML_SCHEM_FSKIPUNK) ? FFPARS_VAL : FFPARS_EUKNKEY;
+
+		} else if (ps->curarg == NULL)
+			return FFPARS_VAL; // unknown attribute is skipped
+
+		r = ffpars_arg_process(ps->curarg, &p->val, ctx->obj, ps);
+		ps->curarg = NULL;
+		if (r != 0)
+			return r;
+		return FFPARS_VAL;
+
+	case FFPARS_CLOSE:
+		return _ffpars_schemrun(ps, FFPARS_CLOSE);
+	}
+
+	return FFPARS_EINTL;
+}
+
+
 
 size_t ffxml_escape(char *dst, size_t cap, const char *s, size_t len)
 {
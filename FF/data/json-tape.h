@@ -0,0 +1,141 @@
+/** JSON parser for whole documents: structural index + tape.
+Copyright (c) 2019 Simon Zolin
+*/
+
+/*
+Stage 1: the input is classified by 64-byte blocks (SSE2/NEON):
+ quotes, backslashes, braces, ':', ',', whitespace.
+ Escaped characters and in-string bytes are computed with bit operations on the masks
+ and the offsets of all structural characters (and the first bytes of bare values,
+ and the backslashes within strings) are saved.
+ A comment ("//...", "/ *...* /") is skipped by a scalar loop, then the block processing continues.
+Stage 2: the structural index is walked with a small state machine which checks the syntax
+ and writes the tape.
+
+Tape: uint64[], an entry is TAG(8 bits) PAYLOAD(56 bits);  TAG: enum FFJSON_T | enum FFJSON_TAPE_F
+ {  [  : index of the matching closing entry
+ }  ]  : FFJSON_TAPE_FCLOSE, index of the opening entry
+ string: offset (in input data or in ffjson_tape.sbuf, if FFJSON_TAPE_FESC), [length]
+ integer, number: LEN(24 bits) OFFSET(32 bits) of the text, [int64 | double]
+ true, false, null: LEN(24 bits) OFFSET(32 bits) of the text
+
+Strings without escape sequences aren't copied: they point to the input data,
+ which must be valid while the tape is used.
+*/
+
+#pragma once
+
+#include <FF/data/json.h>
+
+
+enum FFJSON_TAPE_F {
+	FFJSON_TAPE_FKEY = 0x10, // object key
+	FFJSON_TAPE_FCLOSE = 0x20, // the end of object or array
+	FFJSON_TAPE_FESC = 0x40, // unescaped string is stored in ffjson_tape.sbuf
+};
+
+typedef struct ffjson_tape {
+	ffarr tape; //uint64[]
+	ffarr idx; //uint[]: offsets of structural characters
+	ffarr sbuf; // unescaped strings
+	ffarr stk; //uint[]: indexes of the open objects and arrays
+	const char *data;
+	size_t len;
+	size_t err_off; // offset of the error in input data
+} ffjson_tape;
+
+static FFINL void ffjson_tape_init(ffjson_tape *t)
+{
+	ffmem_tzero(t);
+}
+
+static FFINL void ffjson_tape_free(ffjson_tape *t)
+{
+	ffarr_free(&t->tape);
+	ffarr_free(&t->idx);
+	ffarr_free(&t->sbuf);
+	ffarr_free(&t->stk);
+}
+
+/** Parse the whole document.
+The object may be reused for the next document.
+Return 0 on success;  enum FFPARS_E on error (t->err_off is set). */
+FF_EXTN int ffjson_tape_parse(ffjson_tape *t, const char *data, size_t len);
+
+
+/* Cursor: an element is referenced by its index in the tape.  The root element is 0. */
+
+#define _ffjson_tape_e(t, i)  (((uint64*)(t)->tape.ptr)[i])
+#define _ffjson_tape_tag(t, i)  ((uint)(_ffjson_tape_e(t, i) >> 56))
+#define _ffjson_tape_pl(t, i)  (_ffjson_tape_e(t, i) & 0x00ffffffffffffffULL)
+
+/** Get element type: enum FFJSON_T. */
+#define ffjson_tape_type(t, i)  (_ffjson_tape_tag(t, i) & 0x0f)
+
+/** Return TRUE if the element is an object key. */
+#define ffjson_tape_iskey(t, i)  !!(_ffjson_tape_tag(t, i) & FFJSON_TAPE_FKEY)
+
+/** Return TRUE if the element closes an object or array. */
+#define ffjson_tape_isclose(t, i)  !!(_ffjson_tape_tag(t, i) & FFJSON_TAPE_FCLOSE)
+
+/** Get the index of the next element after this one (nested elements are skipped). */
+static FFINL size_t ffjson_tape_next(const ffjson_tape *t, size_t i)
+{
+	switch (_ffjson_tape_tag(t, i)) {
+	case FFJSON_TOBJ:
+	case FFJSON_TARR:
+		return _ffjson_tape_pl(t, i) + 1;
+	case FFJSON_TSTR:
+	case FFJSON_TSTR | FFJSON_TAPE_FKEY:
+	case FFJSON_TSTR | FFJSON_TAPE_FESC:
+	case FFJSON_TSTR | FFJSON_TAPE_FKEY | FFJSON_TAPE_FESC:
+	case FFJSON_TINT:
+	case FFJSON_TNUM:
+		return i + 2;
+	}
+	return i + 1;
+}
+
+/** Get the index of the first element inside object or array.
+If it's empty, the closing element is returned. */
+#define ffjson_tape_child(t, i)  ((i) + 1)
+
+/** Get string value or key name. */
+static FFINL ffstr ffjson_tape_str(const ffjson_tape *t, size_t i)
+{
+	ffstr s;
+	const char *base = (_ffjson_tape_tag(t, i) & FFJSON_TAPE_FESC) ? t->sbuf.ptr : t->data;
+	ffstr_set(&s, base + _ffjson_tape_pl(t, i), _ffjson_tape_e(t, i + 1));
+	return s;
+}
+
+/** Get the text of integer, number, boolean or null value. */
+static FFINL ffstr ffjson_tape_raw(const ffjson_tape *t, size_t i)
+{
+	ffstr s;
+	uint64 pl = _ffjson_tape_pl(t, i);
+	ffstr_set(&s, t->data + (uint)pl, (size_t)(pl >> 32));
+	return s;
+}
+
+#define ffjson_tape_int(t, i)  ((int64)_ffjson_tape_e(t, i + 1))
+
+static FFINL double ffjson_tape_num(const ffjson_tape *t, size_t i)
+{
+	union { uint64 i; double d; } u;
+	u.i = _ffjson_tape_e(t, i + 1);
+	return u.d;
+}
+
+#define ffjson_tape_bool(t, i)  ((t)->data[(uint)_ffjson_tape_pl(t, i)] == 't')
+
+/** Find object member by name.
+Return the index of the value;  0 if not found. */
+FF_EXTN size_t ffjson_tape_find(const ffjson_tape *t, size_t obj, const char *name, size_t len);
+
+
+/** Process the parsed document with a scheme.
+'ps': initialized with ffjson_scheminit() or ffjson_scheminit2();
+ the events are delivered to the scheme in the same way as by ffjson_parse().
+Return 0 or enum FFPARS_E. */
+FF_EXTN int ffjson_tape_schemrun(const ffjson_tape *t, ffparser_schem *ps);
@@ -60,8 +60,9 @@ typedef struct ffjson {
 	};
 
 	ffstr val;
-	ffstr3 buf;
+	ffstr3 buf; // storage for a value which can't point to input data
 	ffarr ctxs;
+	uint valbuf :1; // 'val' is stored in 'buf'
 } ffjson;
 
 /** Initialize parser. */
@@ -88,9 +89,15 @@ Return 0 if there is not enough space in destination buffer. */
 FF_EXTN size_t ffjson_escape(char *dst, size_t cap, const char *s, size_t len);
 
 /** Parse JSON.
+p->val points to input data if possible,
+ but it's copied to p->buf if the value has escape sequences or is split between input buffers.
 Return FFPARS_E.  p->type is set to one of FFJSON_T. */
 FF_EXTN int ffjson_parse(ffjson *p, const char *data, size_t *len);
 
+/** Return TRUE if p->val points to the input data passed to the last ffjson_parse() call
+ and is valid only while this data is. */
+#define ffjson_val_borrowed(p)  (!(p)->valbuf)
+
 static FFINL int ffjson_parsestr(ffjson *p, ffstr *data)
 {
 	size_t n = data->len;
@@ -159,6 +166,7 @@ enum FFJSON_F {
 	, FFJSON_FINTVAL = FFJSON_TINT | (1 << 27) //integer value (int or int64)
 	, FFJSON_F32BIT = 1 << 26 //32-bit integer
 	, FFJSON_FMORE = 1 << 25 //TSTR: don't finalize the object because more data will follow
+	, FFJSON_FFLOAT = FFJSON_TNUM | (1 << 24) //double value, written in the shortest form that is parsed back to the same value;  NaN and infinity are written as null
 };
 
 enum FFJSON_E {
@@ -173,7 +181,7 @@ enum FFJSON_E {
 
 /** Serialize one entity.
 f: enum FFJSON_T [| enum FFJSON_F]
-src: char*, ffstr*, int64*, int*, NULL
+src: char*, ffstr*, int64*, int*, double*, NULL
 If js->buf is empty, return the number of output bytes (negative value).
 Return enum FFJSON_E. */
 FF_EXTN int ffjson_add(ffjson_cook *js, int f, const void *src);
@@ -191,7 +199,9 @@ static FFINL int ffjson_addv(ffjson_cook *js, const int *types, size_t ntypes, .
 	return r;
 }
 
-/** Serialize one entity into a growing buffer. */
+/** Serialize one entity into a growing buffer.
+Data is written at once if there's enough free space,
+ otherwise the buffer grows by the size of output data. */
 FF_EXTN int ffjson_bufadd(ffjson_cook *js, int f, const void *src);
 
 /** Add multiple items into a growing buffer. */
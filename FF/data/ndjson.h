@@ -0,0 +1,65 @@
+/** NDJSON (newline-delimited JSON) reader.
+Copyright (c) 2019 Simon Zolin
+*/
+
+/*
+Input data is split into chunks of about 'chunk_size' bytes aligned to line boundaries:
+ a chunk starts after the first LF found at or after its nominal offset,
+ so every worker computes the bounds of any chunk on its own.
+Worker threads take the next chunk from a shared counter and parse its lines with ffjson_tape_parse().
+Unordered mode: the workers call the handler directly.
+Ordered mode: the parsed lines are stored in one of the slots (a window of chunks in flight),
+ and the calling thread delivers them in input order;
+ while the next chunk isn't ready, the calling thread parses the chunks itself.
+*/
+
+#pragma once
+
+#include <FF/data/json-tape.h>
+#include <FF/sys/filemap.h>
+
+
+struct ffndjson_rec {
+	ffstr line; // the text of the line (without CRLF)
+	uint64 off; // offset of the line in input data
+	const ffjson_tape *tape; // parsed document;  NULL on error
+	int err; // enum FFPARS_E
+	size_t err_off; // offset of the error within the line
+	uint worker; // index of the worker thread (0: the calling thread)
+};
+
+/** Process a record.
+Unordered mode: called from several threads at once.
+The tape and the line are valid only until return.
+Return 0 to continue;  otherwise processing is stopped. */
+typedef int (*ffndjson_handler)(void *udata, const struct ffndjson_rec *rec);
+
+struct ffndjson_conf {
+	ffndjson_handler handler; /** Required. */
+	void *udata;
+	uint threads; /** Number of worker threads including the calling thread.  0: the number of CPUs */
+	uint chunk_size; /** Approximate size of a chunk of lines processed by a worker at once */
+	uint ordered :1; /** Deliver records in input order */
+	uint skip_errors :1; /** Don't call the handler for invalid lines, only count them */
+};
+
+/** Set default configuration. */
+FF_EXTN void ffndjson_conf_init(struct ffndjson_conf *conf);
+
+struct ffndjson_stat {
+	uint64 lines; /** Non-empty lines */
+	uint64 errors; /** Invalid lines */
+	uint64 chunks;
+};
+
+/** Parse lines from memory.
+Empty lines and lines with whitespace only are skipped.
+st: optional;  the values are added to it
+Return 0 on success;  the value returned by the handler, if it has stopped processing;  -1 on system error. */
+FF_EXTN int ffndjson_run(const struct ffndjson_conf *conf, const char *data, size_t len, struct ffndjson_stat *st);
+
+/** Parse lines from a mapped file region.
+fm: initialized with fffile_mapset();  'blocksize' determines how much data is processed in parallel at once
+ A line crossing the end of a block is copied and parsed separately.
+Return the same as ffndjson_run(). */
+FF_EXTN int ffndjson_runmap(const struct ffndjson_conf *conf, fffilemap *fm, struct ffndjson_stat *st);
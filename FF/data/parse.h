@@ -223,12 +223,16 @@ FF_EXTN int ffpars_arg_process(const ffpars_arg *a, const ffstr *val, void *obj,
 FF_EXTN int _ffpars_arg_process2(const ffpars_arg *a, const void *val, void *obj, void *ps);
 
 
+typedef struct ffpars_argidx ffpars_argidx;
+
 struct ffpars_ctx {
 	void *obj;
 	const ffpars_arg *args;
 	uint nargs;
 	const char * (*errfunc)(int ercod);
 	uint used[2];
+	const ffpars_argidx *idx; // key index for 'args'
+	ffarr *idxcache; // ffparser_schem.argidx
 };
 
 /** Set object and argument list. */
@@ -246,6 +250,8 @@ enum FFPARS_CTX_FIND {
 
 /** Search for an argument in context.
 @flags: enum FFPARS_CTX_FIND.
+For a context with many arguments created by ffpars_setctx() the key names are hashed on the first search,
+ and the index is cached in ffparser_schem for the other contexts with the same argument list.
 Return NULL if not found. */
 FF_EXTN const ffpars_arg* ffpars_ctx_findarg(ffpars_ctx *ctx, const char *name, size_t len, uint flags);
 
@@ -268,14 +274,18 @@ struct ffparser_schem {
 	const ffpars_arg *curarg;
 	ffstr vals[1];
 	uint list_idx; //for FFPARS_FLIST
+	ffarr argidx; //ffpars_argidx*[]: key indexes of argument lists
 };
 
 /** Initialize parser with a scheme. */
 FF_EXTN void ffpars_scheminit(ffparser_schem *ps, void *p, const ffpars_arg *top);
 
+FF_EXTN void _ffpars_argidx_free(ffarr *cache);
+
 static FFINL void ffpars_schemfree(ffparser_schem *ps) {
 	ffarr_free(&ps->ctxs);
 	ffstr_free(&ps->vals[0]);
+	_ffpars_argidx_free(&ps->argidx);
 }
 
 /** Get context name ('conf' backend).
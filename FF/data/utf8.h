@@ -32,7 +32,9 @@ FF_EXTN size_t ffutf8_len(const char *p, size_t len);
 /** Return the number of bytes needed to encode a character in UTF-8. */
 FF_EXTN uint ffutf8_size(uint uch);
 
-/** Return 1 if it's a valid UTF-8 data. */
+/** Return 1 if it's a valid UTF-8 data.
+The same sequences as by ffutf8_decode1() are accepted (including 5- and 6-byte sequences).
+Data is processed by blocks of 16 (SSE2) or 32 (AVX2, if supported by CPU) bytes. */
 FF_EXTN ffbool ffutf8_valid(const char *data, size_t len);
 
 /** Decode a UTF-8 number.
@@ -2,9 +2,101 @@
 Copyright (c) 2014 Simon Zolin
 */
 
+/*
+Tokenizer (SAX-style):
+<?xml version="1.0"?>         skipped: declarations, processing instructions, comments, <!DOCTYPE>
+<tag attr="value">            FFPARS_OPEN (FFXML_TTAG), FFPARS_KEY (FFXML_TATTR), FFPARS_VAL (FFXML_TATTRVAL)
+	text &amp; <![CDATA[<x>]]> FFPARS_VAL (FFXML_TTEXT): entities are decoded;  CDATA is merged with the text
+	<empty/>                  FFPARS_OPEN, FFPARS_CLOSE
+</tag>                        FFPARS_CLOSE (FFXML_TTAGCLOSE)
+
+Text with whitespace only isn't returned.
+Names aren't checked except that the closing tag must match the opening one.
+Supported entities: &lt; &gt; &amp; &quot; &apos; &#NNN; &#xHHHH;
+A character reference to a UTF-16 surrogate, U+FFFE, U+FFFF or beyond U+10FFFF is FFPARS_EBADVAL.
+There must be only one root element:  another element after it is FFPARS_EBADVAL.
+
+Scheme:
+. an element is an argument of the current context:
+  FFPARS_TOBJ: a new context with the attributes and the child elements;  "#text" argument receives the text
+  other types: the text of the element is the value ("" for an empty element);  attributes are ignored
+. an attribute is an argument of the element's context
+. an element or "#text" met more than once in a context requires FFPARS_FMULTI
+. FFXML_SCHEM_FSKIPUNK: unknown elements (with their children), attributes and text are skipped
+*/
+
 #pragma once
 
-#include <FFOS/types.h>
+#include <FF/data/parse.h>
+
+
+enum FFXML_T {
+	FFXML_TTAG,
+	FFXML_TATTR,
+	FFXML_TATTRVAL,
+	FFXML_TTEXT,
+	FFXML_TTAGCLOSE,
+};
+
+typedef struct ffxml {
+	uint state, nextst;
+	uint type; //enum FFXML_T
+	int ret; //enum FFPARS_E
+	uint line;
+	uint ch;
+	uint quote; // quote character of attribute value;  the number of matched bytes of "CDATA["
+	char esc[12]; // entity: length, data
+
+	ffstr val;
+	ffstr3 buf; // storage for a value which can't point to input data
+	ffarr tags; //char[]: names of the open elements
+	ffarr tagoffs; //uint[]: offsets of the names in 'tags'
+	uint valbuf :1; // 'val' is stored in 'buf'
+	uint text :1; // the text has non-whitespace characters
+	uint rootclosed :1; // the root element is closed
+} ffxml;
+
+/** Initialize parser. */
+FF_EXTN void ffxml_parseinit(ffxml *p);
+
+FF_EXTN void ffxml_parseclose(ffxml *p);
+
+/** Get full error message. */
+FF_EXTN const char* ffxml_errmsg(ffxml *p, int r, char *buf, size_t cap);
+
+/** Parse XML data.
+p->val points to input data if possible,
+ but it's copied to p->buf if the value has entities or CDATA, or is split between input buffers.
+p->val is valid until the next call.
+Return enum FFPARS_E. */
+FF_EXTN int ffxml_parse(ffxml *p, const char *data, size_t *len);
+
+/** Return TRUE if p->val points to the input data passed to the last ffxml_parse() call. */
+#define ffxml_val_borrowed(p)  (!(p)->valbuf)
+
+static FFINL int ffxml_parsestr(ffxml *p, ffstr *data)
+{
+	size_t n = data->len;
+	int r = ffxml_parse(p, data->ptr, &n);
+	ffstr_shift(data, n);
+	return r;
+}
+
+
+enum FFXML_SCHEMFLAG {
+	// enum FFPARS_SCHEMFLAG{}
+	FFXML_SCHEM_FSKIPUNK = 0x10000, // skip unknown elements, attributes and text
+};
+
+/** Initialize parser and scheme.
+Return 0 on success. */
+FF_EXTN int ffxml_scheminit(ffparser_schem *ps, ffxml *p, const ffpars_ctx *ctx);
+
+/** Check that all elements are closed.
+Return 0 on success. */
+FF_EXTN int ffxml_schemfin(ffparser_schem *ps);
+
+FF_EXTN int ffxml_schemrun(ffparser_schem *ps);
 
 
 /** Escape special XML characters: <>&"
@@ -127,7 +127,7 @@ static void insertion_sort(struct sortdata *sd, void *d, size_t n)
 	default:
 		for (size_t i = 0;  i != n;  i++) {
 			ssize_t j;
-			ffmemcpy(T.i1, D.i1, sd->sz);
+			ffmemcpy(T.i1, D.i1 + i * sd->sz, sd->sz);
 			for (j = i - 1;  j >= 0;  j--) {
 				if (sd->cmp(D.i1 + j * sd->sz, T.i1, sd->udata) <= 0)
 					break;
@@ -0,0 +1,949 @@
+/** Compiled regular expressions: lazy DFA.
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/regex.h>
+#include <FF/string.h>
+#include <FF/number.h>
+#include <FF/bitops.h>
+#include <FFOS/mem.h>
+
+
+enum RX_N {
+	RX_N_SET, // consume a byte from 'set', go to 'out'
+	RX_N_SPLIT, // go to 'out' and 'out1'
+	RX_N_EMPTY, // go to 'out'
+	RX_N_BOL, // go to 'out' at the beginning of input
+	RX_N_EOL, // go to 'out' at the end of input
+	RX_N_MATCH, // pattern #out has matched
+};
+
+struct rx_node {
+	uint type; //enum RX_N
+	uint out, out1;
+	uint set[8]; // 256 bits
+};
+
+/* NFA fragment.
+'holes' is a list of the unpatched 'out' fields: ref = node*2 + (0:out, 1:out1).
+The list is stored in the fields themselves: each one contains the next ref + 1;  0: the end of list. */
+struct rx_frag {
+	uint start;
+	uint holes; // ref + 1
+};
+
+struct rx_dstate {
+	uint off, n; // NFA nodes in 'sets'
+	uint hash;
+	uint val; // transition value
+	uint begin :1; // the state is built at the beginning of input
+};
+
+enum {
+	RX_NODES_MAX = 256 * 1024,
+	RX_REPEAT_MAX = 1000,
+	RX_DEPTH_MAX = 64,
+	RX_STATES_DEF = 1000,
+	RX_STATES_MIN = 2,
+
+	// transition value: state index * stride | flags
+	RX_T_ACC = 0x80000000, // the state has matched patterns
+	RX_T_DEAD = 0x40000000, // the state has no NFA nodes
+	RX_T_OFF = 0x3fffffff,
+	RX_T_UNK = 0xffffffff, // not computed yet
+};
+
+#define RX_ESC_CHARS  "\\.|?[-]*+(){}^$"
+
+#define rx_node(rx, i)  ffarr_itemT(&(rx)->nodes, i, struct rx_node)
+
+struct rx_parse {
+	ffregex *rx;
+	const char *p, *end;
+	uint flags;
+	uint depth;
+};
+
+static int rx_alt(struct rx_parse *ps, struct rx_frag *f);
+
+
+void ffregex_init(ffregex *rx)
+{
+	ffmem_tzero(rx);
+	rx->max_states = RX_STATES_DEF;
+	rx->start = RX_T_UNK;
+}
+
+void ffregex_free(ffregex *rx)
+{
+	ffarr_free(&rx->nodes);
+	ffarr_free(&rx->starts);
+	ffmem_safefree0(rx->trans);
+	ffmem_safefree0(rx->acc);
+	ffmem_safefree0(rx->res);
+	ffarr_free(&rx->states);
+	ffarr_free(&rx->sets);
+	ffmem_safefree0(rx->htab);
+	ffmem_safefree0(rx->mark);
+	ffarr_free(&rx->stk);
+	ffarr_free(&rx->tmp);
+}
+
+
+/** Add NFA node.
+Return node index;  -1 on error. */
+static int rx_node_add(ffregex *rx, uint type)
+{
+	if (rx->nodes.len == RX_NODES_MAX)
+		return -1;
+	struct rx_node *n = ffarr_pushgrowT(&rx->nodes, 64 | FFARR_GROWQUARTER, struct rx_node);
+	if (n == NULL)
+		return -1;
+	ffmem_tzero(n);
+	n->type = type;
+	return rx->nodes.len - 1;
+}
+
+static uint* rx_ref(ffregex *rx, uint ref)
+{
+	struct rx_node *n = rx_node(rx, ref / 2);
+	return (ref & 1) ? &n->out1 : &n->out;
+}
+
+/** Set all 'out' fields in the list to 'to'. */
+static void rx_patch(ffregex *rx, uint holes, uint to)
+{
+	while (holes != 0) {
+		uint *p = rx_ref(rx, holes - 1);
+		holes = *p;
+		*p = to;
+	}
+}
+
+/** Join 2 lists. */
+static uint rx_append(ffregex *rx, uint l1, uint l2)
+{
+	if (l1 == 0)
+		return l2;
+	uint *p = rx_ref(rx, l1 - 1);
+	while (*p != 0)
+		p = rx_ref(rx, *p - 1);
+	*p = l2;
+	return l1;
+}
+
+/** Fragment of 1 node with the unpatched 'out'. */
+static int rx_single(ffregex *rx, uint type, struct rx_frag *f)
+{
+	int i;
+	if (0 > (i = rx_node_add(rx, type)))
+		return -1;
+	f->start = i;
+	f->holes = i * 2 + 1;
+	return i;
+}
+
+static void rx_cat(ffregex *rx, struct rx_frag *f, const struct rx_frag *f2)
+{
+	rx_patch(rx, f->holes, f2->start);
+	f->holes = f2->holes;
+}
+
+/** x|y */
+static int rx_or(ffregex *rx, struct rx_frag *f, const struct rx_frag *f2)
+{
+	int i;
+	if (0 > (i = rx_node_add(rx, RX_N_SPLIT)))
+		return -1;
+	rx_node(rx, i)->out = f->start;
+	rx_node(rx, i)->out1 = f2->start;
+	f->start = i;
+	f->holes = rx_append(rx, f->holes, f2->holes);
+	return 0;
+}
+
+/** x? x* x+ */
+static int rx_rep(ffregex *rx, struct rx_frag *f, int op)
+{
+	int i;
+	if (0 > (i = rx_node_add(rx, RX_N_SPLIT)))
+		return -1;
+	rx_node(rx, i)->out = f->start;
+	uint hole = i * 2 + 1 + 1;
+
+	switch (op) {
+	case '?':
+		f->start = i;
+		f->holes = rx_append(rx, f->holes, hole);
+		break;
+
+	case '*':
+		rx_patch(rx, f->holes, i);
+		f->start = i;
+		f->holes = hole;
+		break;
+
+	case '+':
+		rx_patch(rx, f->holes, i);
+		f->holes = hole;
+		break;
+	}
+	return 0;
+}
+
+static void rx_set_add(uint *set, uint c, uint flags)
+{
+	ffbit_setarr(set, c);
+	if ((flags & FFREGEX_ICASE) && ffchar_isletter(c))
+		ffbit_setarr(set, c ^ 0x20);
+}
+
+static int rx_set_single(struct rx_parse *ps, uint c, struct rx_frag *f)
+{
+	int i;
+	if (0 > (i = rx_single(ps->rx, RX_N_SET, f)))
+		return -1;
+	rx_set_add(rx_node(ps->rx, i)->set, c, ps->flags);
+	return 0;
+}
+
+/** Get the next character of a bracket expression.
+Return the character;  -1 on error. */
+static int rx_brkt_char(struct rx_parse *ps)
+{
+	if (ps->p == ps->end)
+		return -1; //no closing bracket
+	int c = (byte)*ps->p++;
+	switch (c) {
+	case '\\':
+		if (ps->p == ps->end
+			|| NULL == ffs_findc(RX_ESC_CHARS, FFSLEN(RX_ESC_CHARS), *ps->p))
+			return -1; //unknown escape sequence
+		return (byte)*ps->p++;
+
+	case '[':
+	case '|':
+	case '.':
+	case '?':
+		return -1; //must be escaped within brackets
+	}
+	return c;
+}
+
+/** [...] */
+static int rx_brkt(struct rx_parse *ps, struct rx_frag *f)
+{
+	uint set[8] = {};
+	uint neg = 0, items = 0;
+	int c, prev = -1;
+
+	if (ps->p != ps->end && *ps->p == '^') {
+		neg = 1;
+		ps->p++;
+	}
+
+	for (;;) {
+		if (ps->p == ps->end)
+			return -1; //no closing bracket
+
+		switch (*ps->p) {
+		case ']':
+			ps->p++;
+			if (items == 0)
+				return -1; //empty
+			goto done;
+
+		case '-':
+			if (prev < 0)
+				return -1; //missing a starting range character, e.g. "[-"
+			c = prev; // "a-z-0" is the same as "a-z" + "z-0"
+			break;
+
+		default:
+			if (0 > (c = rx_brkt_char(ps)))
+				return -1;
+		}
+
+		if (ps->p != ps->end && *ps->p == '-') {
+			// "a-z"
+			ps->p++;
+			if (ps->p != ps->end && (*ps->p == ']' || *ps->p == '-'))
+				return -1; //missing an ending range character, e.g. "[a-]", "[a--"
+			int to;
+			if (0 > (to = rx_brkt_char(ps)))
+				return -1;
+			for (int i = c;  i <= to;  i++) {
+				rx_set_add(set, i, ps->flags);
+			}
+			prev = to;
+		} else {
+			rx_set_add(set, c, ps->flags);
+			prev = c;
+		}
+		items++;
+	}
+
+done:
+	if (neg) {
+		for (uint i = 0;  i != 8;  i++) {
+			set[i] = ~set[i];
+		}
+	}
+	int i;
+	if (0 > (i = rx_single(ps->rx, RX_N_SET, f)))
+		return -1;
+	ffmemcpy(rx_node(ps->rx, i)->set, set, sizeof(set));
+	return 0;
+}
+
+/** Parse an item which may be repeated.
+@assert: set to 1 for ^ and $ */
+static int rx_atom(struct rx_parse *ps, struct rx_frag *f, uint *assert)
+{
+	ffregex *rx = ps->rx;
+	int i, c = (byte)*ps->p++;
+	*assert = 0;
+
+	switch (c) {
+	case '(':
+		if (++ps->depth > RX_DEPTH_MAX)
+			return -1;
+		if (0 != rx_alt(ps, f))
+			return -1;
+		if (ps->p == ps->end || *ps->p != ')')
+			return -1; //unmatched parenthesis
+		ps->p++;
+		ps->depth--;
+		return 0;
+
+	case '.':
+		if (0 > (i = rx_single(rx, RX_N_SET, f)))
+			return -1;
+		ffmem_fill(rx_node(rx, i)->set, 0xff, sizeof(rx_node(rx, i)->set));
+		return 0;
+
+	case '[':
+		return rx_brkt(ps, f);
+
+	case '^':
+	case '$':
+		*assert = 1;
+		if (0 > rx_single(rx, (c == '^') ? RX_N_BOL : RX_N_EOL, f))
+			return -1;
+		return 0;
+
+	case '\\':
+		if (ps->p == ps->end
+			|| NULL == ffs_findc(RX_ESC_CHARS, FFSLEN(RX_ESC_CHARS), *ps->p))
+			return -1; //unknown escape sequence
+		c = (byte)*ps->p++;
+		break;
+
+	case ']':
+	case ')':
+	case '{':
+	case '}':
+	case '?':
+	case '*':
+	case '+':
+		return -1; //unexpected special character
+	}
+
+	return rx_set_single(ps, c, f);
+}
+
+/** Parse "{n}", "{n,}", "{n,m}".
+@max: set to -1 if there's no upper limit */
+static int rx_count(struct rx_parse *ps, uint *min, int *max)
+{
+	uint n;
+	ffstr s;
+	ffstr_set(&s, ps->p, ps->end - ps->p);
+	ffstr_shift(&s, 1);
+
+	if (0 == (n = ffs_toint32(s.ptr, s.len, min, 0)))
+		return -1;
+	ffstr_shift(&s, n);
+	*max = *min;
+
+	if (s.len != 0 && s.ptr[0] == ',') {
+		ffstr_shift(&s, 1);
+		*max = -1;
+		if (s.len != 0 && s.ptr[0] != '}') {
+			uint m;
+			if (0 == (n = ffs_toint32(s.ptr, s.len, &m, 0)))
+				return -1;
+			ffstr_shift(&s, n);
+			*max = m;
+		}
+	}
+
+	if (s.len == 0 || s.ptr[0] != '}')
+		return -1;
+	ffstr_shift(&s, 1);
+
+	if (*min > RX_REPEAT_MAX || *max > RX_REPEAT_MAX
+		|| (*max >= 0 && *min > (uint)*max))
+		return -1;
+	ps->p = s.ptr;
+	return 0;
+}
+
+/** Build one more copy of the item by parsing it again. */
+static int rx_copy(struct rx_parse *ps, const char *item, struct rx_frag *f)
+{
+	const char *p = ps->p;
+	uint a;
+	ps->p = item;
+	int r = rx_atom(ps, f, &a);
+	ps->p = p;
+	return r;
+}
+
+/** x{n,m} = x..x (x (x)?)? */
+static int rx_count_build(struct rx_parse *ps, const char *item, struct rx_frag *f, uint min, int max)
+{
+	ffregex *rx = ps->rx;
+	struct rx_frag r, c, t;
+	uint have = 0, copy0 = 1;
+
+	for (uint i = 0;  i != min;  i++) {
+		if (!copy0 && 0 != rx_copy(ps, item, &c))
+			return -1;
+		if (copy0) {
+			c = *f;
+			copy0 = 0;
+		}
+		if (have)
+			rx_cat(rx, &r, &c);
+		else
+			r = c;
+		have = 1;
+	}
+
+	if (max < 0) {
+		if (!copy0 && 0 != rx_copy(ps, item, &c))
+			return -1;
+		if (copy0)
+			c = *f;
+		if (0 != rx_rep(rx, &c, '*'))
+			return -1;
+		if (have)
+			rx_cat(rx, &r, &c);
+		else
+			r = c;
+		have = 1;
+
+	} else if ((uint)max != min) {
+		uint have_t = 0;
+		for (uint i = max;  i != min;  i--) {
+			if (i - 1 != 0 || !copy0) {
+				if (0 != rx_copy(ps, item, &c))
+					return -1;
+			} else {
+				c = *f;
+			}
+			if (have_t)
+				rx_cat(rx, &c, &t);
+			if (0 != rx_rep(rx, &c, '?'))
+				return -1;
+			t = c;
+			have_t = 1;
+		}
+		if (have)
+			rx_cat(rx, &r, &t);
+		else
+			r = t;
+		have = 1;
+	}
+
+	if (!have && 0 > rx_single(rx, RX_N_EMPTY, &r))
+		return -1;
+	*f = r;
+	return 0;
+}
+
+/** Parse an item with an optional repetition operator. */
+static int rx_repeat(struct rx_parse *ps, struct rx_frag *f)
+{
+	const char *item = ps->p;
+	uint assert, min;
+	int max;
+
+	if (0 != rx_atom(ps, f, &assert))
+		return -1;
+	if (ps->p == ps->end)
+		return 0;
+
+	switch (*ps->p) {
+	case '?':
+	case '*':
+	case '+':
+		if (assert)
+			return -1;
+		if (0 != rx_rep(ps->rx, f, *ps->p++))
+			return -1;
+		break;
+
+	case '{':
+		if (assert)
+			return -1;
+		if (0 != rx_count(ps, &min, &max))
+			return -1;
+		if (0 != rx_count_build(ps, item, f, min, max))
+			return -1;
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (ps->p != ps->end
+		&& NULL != ffs_findc("?*+{", 4, *ps->p))
+		return -1; //several repetition operators, e.g. "a??"
+	return 0;
+}
+
+/** Parse a sequence of items until '|' or ')'. */
+static int rx_concat(struct rx_parse *ps, struct rx_frag *f)
+{
+	struct rx_frag f2;
+	uint have = 0;
+
+	while (ps->p != ps->end && *ps->p != '|' && *ps->p != ')') {
+		if (0 != rx_repeat(ps, &f2))
+			return -1;
+		if (have)
+			rx_cat(ps->rx, f, &f2);
+		else
+			*f = f2;
+		have = 1;
+	}
+
+	if (!have && 0 > rx_single(ps->rx, RX_N_EMPTY, f))
+		return -1;
+	return 0;
+}
+
+static int rx_alt(struct rx_parse *ps, struct rx_frag *f)
+{
+	struct rx_frag f2;
+
+	if (0 != rx_concat(ps, f))
+		return -1;
+
+	while (ps->p != ps->end && *ps->p == '|') {
+		ps->p++;
+		if (0 != rx_concat(ps, &f2))
+			return -1;
+		if (0 != rx_or(ps->rx, f, &f2))
+			return -1;
+	}
+	return 0;
+}
+
+/** '*' -> ".*", '?' -> "." */
+static int rx_wildcard(struct rx_parse *ps, struct rx_frag *f)
+{
+	ffregex *rx = ps->rx;
+	struct rx_frag f2;
+	uint have = 0;
+	int i;
+
+	for (;  ps->p != ps->end;  ps->p++) {
+		switch (*ps->p) {
+		case '*':
+		case '?':
+			if (0 > (i = rx_single(rx, RX_N_SET, &f2)))
+				return -1;
+			ffmem_fill(rx_node(rx, i)->set, 0xff, sizeof(rx_node(rx, i)->set));
+			if (*ps->p == '*' && 0 != rx_rep(rx, &f2, '*'))
+				return -1;
+			break;
+
+		default:
+			if (0 != rx_set_single(ps, (byte)*ps->p, &f2))
+				return -1;
+		}
+
+		if (have)
+			rx_cat(rx, f, &f2);
+		else
+			*f = f2;
+		have = 1;
+	}
+
+	if (!have && 0 > rx_single(rx, RX_N_EMPTY, f))
+		return -1;
+	return 0;
+}
+
+int ffregex_add(ffregex *rx, const char *pattern, size_t len, uint flags)
+{
+	struct rx_parse ps = {};
+	struct rx_frag f, f2;
+	size_t nodes = rx->nodes.len;
+	int r, i;
+
+	ps.rx = rx;
+	ps.p = pattern;
+	ps.end = pattern + len;
+	ps.flags = flags;
+
+	if (flags & FFREGEX_WILDCARD) {
+		flags |= FFREGEX_FULL;
+		r = rx_wildcard(&ps, &f);
+	} else {
+		r = rx_alt(&ps, &f);
+		if (r == 0 && ps.p != ps.end)
+			r = -1; //unmatched parenthesis
+	}
+	if (r != 0)
+		goto err;
+
+	if (flags & FFREGEX_FULL) {
+		// x$
+		if (0 > rx_single(rx, RX_N_EOL, &f2))
+			goto err;
+		rx_cat(rx, &f, &f2);
+
+	} else {
+		// .*x
+		if (0 > (i = rx_single(rx, RX_N_SET, &f2)))
+			goto err;
+		ffmem_fill(rx_node(rx, i)->set, 0xff, sizeof(rx_node(rx, i)->set));
+		if (0 != rx_rep(rx, &f2, '*'))
+			goto err;
+		rx_cat(rx, &f2, &f);
+		f.start = f2.start;
+	}
+
+	if (0 > (i = rx_node_add(rx, RX_N_MATCH)))
+		goto err;
+	rx_node(rx, i)->out = rx->npatterns;
+	rx_patch(rx, f.holes, i);
+
+	uint *start = ffarr_pushgrowT(&rx->starts, 16 | FFARR_GROWQUARTER, uint);
+	if (start == NULL)
+		goto err;
+	*start = f.start;
+	return rx->npatterns++;
+
+err:
+	rx->nodes.len = nodes;
+	return -1;
+}
+
+
+/** Split bytes into classes so that all bytes in a class have the same transitions. */
+static void rx_classes(ffregex *rx)
+{
+	byte cls[256];
+	ushort id[256 * 2];
+	const uint *prev = NULL;
+	uint n = 1;
+
+	ffmem_zero(rx->cls, sizeof(rx->cls));
+
+	struct rx_node *nd;
+	FFARR_WALKT(&rx->nodes, nd, struct rx_node) {
+		if (nd->type != RX_N_SET
+			|| (prev != NULL && !ffmemcmp(prev, nd->set, sizeof(nd->set))))
+			continue;
+		prev = nd->set;
+
+		ffmem_fill(id, 0xff, sizeof(id));
+		n = 0;
+		for (uint b = 0;  b != 256;  b++) {
+			uint k = rx->cls[b] * 2 + ffbit_testarr(nd->set, b);
+			if (id[k] == 0xffff)
+				id[k] = n++;
+			cls[b] = id[k];
+		}
+		ffmemcpy(rx->cls, cls, sizeof(cls));
+	}
+
+	rx->nclasses = n;
+	for (int b = 255;  b >= 0;  b--) {
+		rx->rep[rx->cls[b]] = b;
+	}
+}
+
+int ffregex_compile(ffregex *rx)
+{
+	size_t nodes = rx->nodes.len;
+
+	rx_classes(rx);
+	rx->stride = rx->nclasses + 1;
+	rx->max_states = ffmax(rx->max_states, RX_STATES_MIN);
+	if ((uint64)rx->max_states * rx->stride > RX_T_OFF)
+		return -1;
+	rx->accwords = (rx->npatterns + 31) / 32;
+	rx->hmask = ff_align_power2(rx->max_states * 2) - 1;
+
+	ffmem_safefree0(rx->trans);
+	ffmem_safefree0(rx->acc);
+	ffmem_safefree0(rx->res);
+	ffmem_safefree0(rx->htab);
+	ffmem_safefree0(rx->mark);
+	ffarr_free(&rx->states);
+	ffarr_free(&rx->sets);
+	ffarr_free(&rx->stk);
+	ffarr_free(&rx->tmp);
+
+	// all memory is allocated here so that matching can't fail:
+	//  the cache is cleared when there's no space for a new state
+	if (NULL == (rx->trans = ffmem_alloc((size_t)rx->max_states * rx->stride * sizeof(uint)))
+		|| NULL == (rx->acc = ffmem_alloc((size_t)rx->max_states * ffmax(rx->accwords, 1) * sizeof(uint)))
+		|| NULL == (rx->res = ffmem_alloc(ffmax(rx->accwords, 1) * sizeof(uint)))
+		|| NULL == (rx->htab = ffmem_alloc((rx->hmask + 1) * sizeof(uint)))
+		|| NULL == (rx->mark = ffmem_calloc(ffmax(nodes, 1), sizeof(uint)))
+		|| NULL == ffarr_allocT(&rx->states, rx->max_states, struct rx_dstate)
+		|| NULL == ffarr_allocT(&rx->sets, ffmax(nodes * 4, rx->max_states * 32), uint)
+		|| NULL == ffarr_allocT(&rx->stk, nodes * 2 + 1, uint)
+		|| NULL == ffarr_allocT(&rx->tmp, nodes, uint))
+		return -1;
+
+	ffmem_fill(rx->trans, 0xff, (size_t)rx->max_states * rx->stride * sizeof(uint));
+	ffmem_zero(rx->htab, (rx->hmask + 1) * sizeof(uint));
+	rx->gen = 0;
+	rx->nstates = 0;
+	rx->start = RX_T_UNK;
+	return 0;
+}
+
+/** Clear DFA cache. */
+static void rx_flush(ffregex *rx)
+{
+	ffmem_fill(rx->trans, 0xff, (size_t)rx->nstates * rx->stride * sizeof(uint));
+	ffmem_zero(rx->htab, (rx->hmask + 1) * sizeof(uint));
+	rx->nstates = 0;
+	rx->sets.len = 0;
+	rx->start = RX_T_UNK;
+	rx->flushes++;
+}
+
+/** Add to 'tmp' the NFA nodes reachable from node 'i' without consuming input.
+Only SET, EOL, MATCH nodes are added: they determine the transitions of a DFA state. */
+static void rx_closure(ffregex *rx, uint i, uint bol, uint eol)
+{
+	uint *stk = (uint*)rx->stk.ptr, *tmp = (uint*)rx->tmp.ptr;
+	size_t n = 0;
+	stk[n++] = i;
+
+	while (n != 0) {
+		i = stk[--n];
+		if (rx->mark[i] == rx->gen)
+			continue;
+		rx->mark[i] = rx->gen;
+		const struct rx_node *nd = rx_node(rx, i);
+
+		switch (nd->type) {
+		case RX_N_SET:
+			if (!eol)
+				tmp[rx->tmp.len++] = i;
+			break;
+
+		case RX_N_MATCH:
+			tmp[rx->tmp.len++] = i;
+			break;
+
+		case RX_N_EOL:
+			if (eol)
+				stk[n++] = nd->out;
+			else
+				tmp[rx->tmp.len++] = i;
+			break;
+
+		case RX_N_BOL:
+			if (bol)
+				stk[n++] = nd->out;
+			break;
+
+		case RX_N_EMPTY:
+			stk[n++] = nd->out;
+			break;
+
+		case RX_N_SPLIT:
+			stk[n++] = nd->out1;
+			stk[n++] = nd->out;
+			break;
+		}
+	}
+}
+
+static void rx_closure_begin(ffregex *rx)
+{
+	rx->tmp.len = 0;
+	if (++rx->gen == 0) {
+		ffmem_zero(rx->mark, rx->nodes.len * sizeof(uint));
+		rx->gen = 1;
+	}
+}
+
+static int rx_cmp_uint(const void *a, const void *b, void *udata)
+{
+	uint i = *(uint*)a, j = *(uint*)b;
+	return (i < j) ? -1 : (i > j);
+}
+
+/** Find or create the DFA state for the NFA nodes in 'tmp'.
+Return transition value. */
+static uint rx_state(ffregex *rx, uint begin)
+{
+	uint *set = (uint*)rx->tmp.ptr;
+	uint n = rx->tmp.len;
+	uint i, h = 2166136261U + begin;
+	struct rx_dstate *st, *states = (void*)rx->states.ptr;
+
+	ffsort(set, n, sizeof(uint), &rx_cmp_uint, NULL);
+	for (i = 0;  i != n;  i++) {
+		h = (h ^ set[i]) * 16777619U;
+	}
+
+	for (i = h & rx->hmask;  rx->htab[i] != 0;  i = (i + 1) & rx->hmask) {
+		st = &states[rx->htab[i] - 1];
+		if (st->hash == h && st->n == n && st->begin == begin
+			&& !ffmemcmp((uint*)rx->sets.ptr + st->off, set, n * sizeof(uint)))
+			return st->val;
+	}
+
+	if (rx->nstates == rx->max_states
+		|| ffarr_unused(&rx->sets) < n) {
+		rx_flush(rx);
+		for (i = h & rx->hmask;  rx->htab[i] != 0;  i = (i + 1) & rx->hmask) {
+		}
+	}
+
+	uint idx = rx->nstates++;
+	st = &states[idx];
+	st->off = rx->sets.len;
+	st->n = n;
+	st->hash = h;
+	st->begin = begin;
+	ffmemcpy((uint*)rx->sets.ptr + rx->sets.len, set, n * sizeof(uint));
+	rx->sets.len += n;
+	rx->htab[i] = idx + 1;
+
+	st->val = idx * rx->stride;
+	if (n == 0)
+		st->val |= RX_T_DEAD;
+
+	uint *acc = rx->acc + idx * rx->accwords;
+	ffmem_zero(acc, rx->accwords * sizeof(uint));
+	for (i = 0;  i != n;  i++) {
+		const struct rx_node *nd = rx_node(rx, set[i]);
+		if (nd->type == RX_N_MATCH) {
+			ffbit_setarr(acc, nd->out);
+			st->val |= RX_T_ACC;
+		}
+	}
+	return st->val;
+}
+
+static uint rx_start(ffregex *rx)
+{
+	rx_closure_begin(rx);
+	const uint *start;
+	FFARR_WALKT(&rx->starts, start, uint) {
+		rx_closure(rx, *start, 1, 0);
+	}
+	rx->start = rx_state(rx, 1);
+	return rx->start;
+}
+
+/** Compute the transition from state 'val' by class 'k' (k == nclasses: end of input). */
+static uint rx_step(ffregex *rx, uint val, uint k)
+{
+	uint idx = (val & RX_T_OFF) / rx->stride;
+	const struct rx_dstate *st = ffarr_itemT(&rx->states, idx, struct rx_dstate);
+	const uint *set = (uint*)rx->sets.ptr + st->off;
+	uint c = rx->rep[k], eol = (k == rx->nclasses);
+
+	rx_closure_begin(rx);
+	for (uint i = 0;  i != st->n;  i++) {
+		const struct rx_node *nd = rx_node(rx, set[i]);
+		if (eol) {
+			if (nd->type == RX_N_EOL)
+				rx_closure(rx, nd->out, st->begin, 1);
+		} else if (nd->type == RX_N_SET && ffbit_testarr(nd->set, c)) {
+			rx_closure(rx, nd->out, 0, 0);
+		}
+	}
+
+	uint flushes = rx->flushes;
+	uint next = rx_state(rx, 0);
+	if (flushes == rx->flushes)
+		rx->trans[(val & RX_T_OFF) + k] = next;
+	return next;
+}
+
+/** Add the patterns matched by a state.
+Return the number of the new matches. */
+static uint rx_acc(ffregex *rx, uint val, uint *matched)
+{
+	const uint *acc = rx->acc + (val & RX_T_OFF) / rx->stride * rx->accwords;
+	uint n = 0;
+	for (uint i = 0;  i != rx->accwords;  i++) {
+		uint m = acc[i] & ~matched[i];
+		matched[i] |= m;
+		for (;  m != 0;  m &= m - 1) {
+			n++;
+		}
+	}
+	return n;
+}
+
+uint ffregex_matchall(ffregex *rx, const char *s, size_t len, uint *matched)
+{
+	const uint *trans = rx->trans;
+	const byte *cls = rx->cls;
+	uint v, next, n = 0;
+
+	ffmem_zero(matched, rx->accwords * sizeof(uint));
+	if (rx->npatterns == 0)
+		return 0;
+
+	v = rx->start;
+	if (v == RX_T_UNK)
+		v = rx_start(rx);
+	if (v & RX_T_ACC)
+		n += rx_acc(rx, v, matched);
+
+	for (size_t i = 0;  i != len;  i++) {
+		next = trans[(v & RX_T_OFF) + cls[(byte)s[i]]];
+
+		if (next >= RX_T_DEAD) {
+			if (next == RX_T_UNK)
+				next = rx_step(rx, v, cls[(byte)s[i]]);
+
+			if (next & RX_T_ACC) {
+				n += rx_acc(rx, next, matched);
+				if (n == rx->npatterns)
+					return n;
+			}
+
+			if (next & RX_T_DEAD)
+				return n;
+		}
+
+		v = next;
+	}
+
+	next = trans[(v & RX_T_OFF) + rx->nclasses];
+	if (next == RX_T_UNK)
+		next = rx_step(rx, v, rx->nclasses);
+	if (next & RX_T_ACC)
+		n += rx_acc(rx, next, matched);
+	return n;
+}
+
+int ffregex_match(ffregex *rx, const char *s, size_t len)
+{
+	if (0 == ffregex_matchall(rx, s, len, rx->res))
+		return -1;
+	for (uint i = 0;  ;  i++) {
+		if (rx->res[i] != 0)
+			return i * 32 + ffbit_ffs32(rx->res[i]) - 1;
+	}
+}
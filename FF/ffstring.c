@@ -8,6 +8,15 @@ Copyright (c) 2013 Simon Zolin
 #include <FFOS/error.h>
 #include <math.h>
 
+#ifdef FF_AMD64
+#include <emmintrin.h> //SSE2
+#ifdef __GNUC__
+#include <immintrin.h> //AVX2
+#endif
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 
 #ifdef FFMEM_DBG
 ffatomic ffmemcpy_total;
@@ -26,21 +35,73 @@ void ffmem_xor(byte *dst, const byte *src, size_t len, const byte *key, size_t n
 	}
 }
 
-void ffmem_xor4(void *dst, const void *src, size_t len, uint key)
+/* Rotate 4-byte key by 'n' bytes so that it applies to data following the 'n'-th byte. */
+static FFINL uint xor4_key_shift(uint key, size_t n)
+{
+	byte k[8];
+	uint r;
+	ffmemcpy(k, &key, 4);
+	ffmemcpy(k + 4, &key, 4);
+	ffmemcpy(&r, k + (n & 3), 4);
+	return r;
+}
+
+#if defined FF_AMD64 && defined __GNUC__
+#define XOR4_AVX2
+__attribute__((target("avx2")))
+static size_t xor4_avx2(byte *dst, const byte *src, size_t len, uint key)
 {
-	byte *key1 = (byte*)&key, *dst1 = dst;
-	const byte *src1 = src;
-	uint *dst4 = dst;
-	const uint *src4 = src;
 	size_t i;
+	__m256i k = _mm256_set1_epi32(key);
+	for (i = 0;  i + 64 <= len;  i += 64) {
+		__m256i a = _mm256_loadu_si256((void*)(src + i));
+		__m256i b = _mm256_loadu_si256((void*)(src + i + 32));
+		_mm256_storeu_si256((void*)(dst + i), _mm256_xor_si256(a, k));
+		_mm256_storeu_si256((void*)(dst + i + 32), _mm256_xor_si256(b, k));
+	}
+	return i;
+}
+#endif
 
-	for (i = 0;  i != len / 4;  i++) {
-		dst4[i] = src4[i] ^ key;
+uint ffmem_xor4(void *dst, const void *src, size_t len, uint key)
+{
+	byte *d = dst;
+	const byte *s = src;
+	size_t i = 0;
+
+#ifdef XOR4_AVX2
+	if (len >= 256 && __builtin_cpu_supports("avx2"))
+		i = xor4_avx2(d, s, len, key);
+#endif
+
+#if defined FF_AMD64
+	__m128i k = _mm_set1_epi32(key);
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i v = _mm_loadu_si128((void*)(s + i));
+		_mm_storeu_si128((void*)(d + i), _mm_xor_si128(v, k));
 	}
 
-	for (i = i * 4;  i != len;  i++) {
-		dst1[i] = src1[i] ^ key1[i % 4];
+#elif defined __ARM_NEON
+	uint8x16_t k = vreinterpretq_u8_u32(vdupq_n_u32(key));
+	for (;  i + 16 <= len;  i += 16) {
+		vst1q_u8(d + i, veorq_u8(vld1q_u8(s + i), k));
 	}
+#endif
+
+	// 'i' is a multiple of 4 here, so the key bytes are still in phase
+	for (;  i + 4 <= len;  i += 4) {
+		uint v;
+		ffmemcpy(&v, s + i, 4);
+		v ^= key;
+		ffmemcpy(d + i, &v, 4);
+	}
+
+	const byte *kb = (byte*)&key;
+	for (;  i != len;  i++) {
+		d[i] = s[i] ^ kb[i % 4];
+	}
+
+	return xor4_key_shift(key, len);
 }
 
 int ffs_icmp(const char *s1, const char *s2, size_t len)
@@ -913,22 +974,40 @@ fail:
 	return 0;
 }
 
+static const char dec_pairs[200] =
+	"00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859" "60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
+
+/* Write 2 digits at once, from the end. */
 static FFINL char* _ffs_fromint_dec(char *ps, uint64 i, uint flags)
 {
-	if (i <= 0xffffffff) {
-		uint i4 = (uint)i;
-		do {
-			*(--ps) = (byte)(i4 % 10 + '0');
-			i4 /= 10;
-		} while (i4 != 0);
+	uint r;
 
-	} else {
-		do {
-			*(--ps) = (byte)(i % 10 + '0');
-			i /= 10;
-		} while (i != 0);
+	while (i > 0xffffffff) {
+		r = (uint)(i % 100);
+		i /= 100;
+		ps -= 2;
+		ps[0] = dec_pairs[r * 2];
+		ps[1] = dec_pairs[r * 2 + 1];
+	}
+
+	uint i4 = (uint)i;
+	while (i4 >= 100) {
+		r = i4 % 100;
+		i4 /= 100;
+		ps -= 2;
+		ps[0] = dec_pairs[r * 2];
+		ps[1] = dec_pairs[r * 2 + 1];
 	}
 
+	if (i4 >= 10) {
+		ps -= 2;
+		ps[0] = dec_pairs[i4 * 2];
+		ps[1] = dec_pairs[i4 * 2 + 1];
+	} else
+		*(--ps) = (byte)(i4 + '0');
+
 	return ps;
 }
 
@@ -1157,6 +1236,8 @@ proc:
 	return i;
 }
 
+static uint flt_short(double d, char *dst, size_t cap);
+
 uint ffs_fromfloat(double d, char *dst, size_t cap, uint flags)
 {
 	const char *end = dst + cap;
@@ -1164,11 +1245,14 @@ uint ffs_fromfloat(double d, char *dst, size_t cap, uint flags)
 	uint64 num, frac = 0;
 	uint width = ((flags & _FFINT_WIDTH_MASK) >> 24), wfrac = ((flags & _FFS_FLT_FRAC_WIDTH_MASK) >> 16), n, scale;
 	ffbool minus = 0;
-	flags &= FFINT_ZEROWIDTH;
 
 	if (cap == 0)
 		return 0;
 
+	if (flags & FFS_FLTSHORT)
+		return flt_short(d, dst, cap);
+	flags &= FFINT_ZEROWIDTH;
+
 	if (d < 0) {
 		d = -d;
 		minus = 1;
@@ -1206,6 +1290,285 @@ uint ffs_fromfloat(double d, char *dst, size_t cap, uint flags)
 	return buf - dst;
 }
 
+
+/* Shortest text of a double value: Grisu2 algorithm (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers").
+The value and its rounding boundaries are multiplied by a cached power of 10 so that
+ the integer part of the upper boundary has a few decimal digits;
+ the digits are generated until the number is within the boundaries,
+ then the last digit is moved as close to the value as possible.
+The result is always converted back to the same value
+ and for the vast majority of values it's the shortest possible one. */
+
+struct diyfp {
+	uint64 f;
+	int e;
+};
+
+/* Normalized 10^k, k = -348 + 8*i */
+static const uint64 flt_pow10_f[] = {
+	0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+	0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+	0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+	0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+	0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+	0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+	0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+	0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+	0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+	0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+	0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+	0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+	0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+	0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+	0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+	0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+	0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+	0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+	0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+	0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+	0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+	0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+static const short flt_pow10_e[] = {
+	-1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+	-901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+	-582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+	-263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+	56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+	375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+	694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+	1013, 1039, 1066
+};
+
+static const uint flt_pow10_32[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+/* Multiply, get the upper 64 bits rounded. */
+static struct diyfp diyfp_mul(struct diyfp a, struct diyfp b)
+{
+	const uint64 m32 = 0xffffffff;
+	uint64 ac = (a.f >> 32) * (b.f >> 32)
+		, bc = (a.f & m32) * (b.f >> 32)
+		, ad = (a.f >> 32) * (b.f & m32)
+		, bd = (a.f & m32) * (b.f & m32);
+	uint64 tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1U << 31);
+	struct diyfp r = { ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), a.e + b.e + 64 };
+	return r;
+}
+
+static struct diyfp diyfp_norm(struct diyfp v)
+{
+	while (!(v.f & 0x8000000000000000ULL)) {
+		v.f <<= 1;
+		v.e--;
+	}
+	return v;
+}
+
+static void grisu_round(char *buf, uint len, uint64 delta, uint64 rest, uint64 ten_kappa, uint64 wp_w)
+{
+	while (rest < wp_w && delta - rest >= ten_kappa
+		&& (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+		buf[len - 1]--;
+		rest += ten_kappa;
+	}
+}
+
+/* Generate digits of 'w' which lie within [mp - delta, mp].
+Return the number of digits;  'k' is increased by the decimal exponent. */
+static uint grisu_digits(struct diyfp w, struct diyfp mp, uint64 delta, char *buf, int *k)
+{
+	const struct diyfp one = { 1ULL << -mp.e, mp.e };
+	uint64 wp_w = mp.f - w.f;
+	uint p1 = (uint)(mp.f >> -one.e);
+	uint64 p2 = mp.f & (one.f - 1);
+	uint len = 0, d;
+	int kappa = 10;
+
+	while (kappa > 1 && p1 < flt_pow10_32[kappa - 1])
+		kappa--;
+
+	while (kappa > 0) {
+		d = p1 / flt_pow10_32[kappa - 1];
+		p1 %= flt_pow10_32[kappa - 1];
+		if (d != 0 || len != 0)
+			buf[len++] = (char)('0' + d);
+		kappa--;
+		uint64 rest = ((uint64)p1 << -one.e) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			grisu_round(buf, len, delta, rest, (uint64)flt_pow10_32[kappa] << -one.e, wp_w);
+			return len;
+		}
+	}
+
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		d = (uint)(p2 >> -one.e);
+		if (d != 0 || len != 0)
+			buf[len++] = (char)('0' + d);
+		p2 &= one.f - 1;
+		kappa--;
+		if (p2 < delta) {
+			*k += kappa;
+			uint i = -kappa;
+			grisu_round(buf, len, delta, p2, one.f, wp_w * ((i < 9) ? flt_pow10_32[i] : 0));
+			return len;
+		}
+	}
+}
+
+/* Get decimal digits of a positive value:  d = buf[0..N) * 10^k.
+Return N. */
+static uint grisu2(double d, char *buf, int *k)
+{
+	union {
+		double d;
+		uint64 i;
+	} u;
+	u.d = d;
+	int be = (int)((u.i >> 52) & 0x7ff);
+	uint64 sig = u.i & 0x000fffffffffffffULL;
+	struct diyfp v, mp, mm;
+	if (be != 0) {
+		v.f = sig | 0x0010000000000000ULL;
+		v.e = be - 1075;
+	} else {
+		v.f = sig;
+		v.e = -1074;
+	}
+
+	// boundaries: the half-way points between the value and its neighbours
+	mp.f = (v.f << 1) + 1;
+	mp.e = v.e - 1;
+	while (!(mp.f & 0x0020000000000000ULL)) {
+		mp.f <<= 1;
+		mp.e--;
+	}
+	mp.f <<= 64 - 52 - 2;
+	mp.e -= 64 - 52 - 2;
+	if (v.f == 0x0010000000000000ULL) {
+		// the lower neighbour is closer
+		mm.f = (v.f << 2) - 1;
+		mm.e = v.e - 2;
+	} else {
+		mm.f = (v.f << 1) - 1;
+		mm.e = v.e - 1;
+	}
+	mm.f <<= mm.e - mp.e;
+	mm.e = mp.e;
+
+	// get c = 10^-k so that the exponent of mp*c is within [-60, -32]
+	double dk = (-61 - mp.e) * 0.30102999566398114 + 347;
+	int ik = (int)dk;
+	if (dk - ik > 0.0)
+		ik++;
+	uint i = (uint)(ik >> 3) + 1;
+	*k = -(-348 + (int)i * 8);
+	struct diyfp c = { flt_pow10_f[i], flt_pow10_e[i] };
+
+	struct diyfp w = diyfp_mul(diyfp_norm(v), c);
+	mp = diyfp_mul(mp, c);
+	mm = diyfp_mul(mm, c);
+	mm.f++;
+	mp.f--;
+	return grisu_digits(w, mp, mp.f - mm.f, buf, k);
+}
+
+static uint flt_exp(char *buf, int e)
+{
+	char *p = buf;
+	if (e < 0) {
+		*p++ = '-';
+		e = -e;
+	}
+	if (e >= 100) {
+		*p++ = (char)('0' + e / 100);
+		e %= 100;
+		*p++ = dec_pairs[e * 2];
+		*p++ = dec_pairs[e * 2 + 1];
+	} else if (e >= 10) {
+		*p++ = dec_pairs[e * 2];
+		*p++ = dec_pairs[e * 2 + 1];
+	} else
+		*p++ = (char)('0' + e);
+	return p - buf;
+}
+
+/* Format the number buf[0..len) * 10^k.
+Return the number of bytes written. */
+static uint flt_format(char *buf, uint len, int k)
+{
+	int kk = (int)len + k; // 10^(kk-1) <= value < 10^kk
+	uint i;
+
+	if (k >= 0 && kk <= 21) {
+		// 1234e7 -> 12340000000.0
+		for (i = len;  i != (uint)kk;  i++)
+			buf[i] = '0';
+		buf[kk] = '.';
+		buf[kk + 1] = '0';
+		return kk + 2;
+
+	} else if (kk > 0 && kk <= 21) {
+		// 1234e-2 -> 12.34
+		memmove(&buf[kk + 1], &buf[kk], len - kk);
+		buf[kk] = '.';
+		return len + 1;
+
+	} else if (kk > -6 && kk <= 0) {
+		// 1234e-6 -> 0.001234
+		uint off = 2 - kk;
+		memmove(&buf[off], &buf[0], len);
+		buf[0] = '0';
+		buf[1] = '.';
+		for (i = 2;  i != off;  i++)
+			buf[i] = '0';
+		return len + off;
+
+	} else if (len == 1) {
+		// 1e30
+		buf[1] = 'e';
+		return 2 + flt_exp(&buf[2], kk - 1);
+	}
+
+	// 1234e30 -> 1.234e33
+	memmove(&buf[2], &buf[1], len - 1);
+	buf[1] = '.';
+	buf[len + 1] = 'e';
+	return len + 2 + flt_exp(&buf[len + 2], kk - 1);
+}
+
+static uint flt_short(double d, char *dst, size_t cap)
+{
+	char buf[32], *p = buf;
+	int k;
+
+	if (isnan(d)) {
+		p = ffmem_copycz(p, "nan");
+		goto done;
+	}
+
+	if (signbit(d)) {
+		*p++ = '-';
+		d = -d;
+	}
+
+	if (isinf(d))
+		p = ffmem_copycz(p, "inf");
+	else if (d == 0)
+		p = ffmem_copycz(p, "0.0");
+	else {
+		uint n = grisu2(d, p, &k);
+		p += flt_format(p, n, k);
+	}
+
+done:
+	cap = ffmin(cap, (size_t)(p - buf));
+	ffmemcpy(dst, buf, cap);
+	return cap;
+}
+
 uint ffs_tobool(const char *s, size_t len, ffbool *dst, uint flags)
 {
 	if (len >= 4 && !ffs_icmp(s, "true", 4)) {
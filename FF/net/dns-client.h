@@ -38,14 +38,17 @@ struct ffdnsclient {
 	uint max_tries;
 	uint retry_timeout; //in msec
 	uint buf_size;
+	uint batch_size; //max. number of datagrams sent or received by a single system call.  Default: 1
 	uint enable_ipv6 :1;
 	uint edns :1;
 	uint debug_log :1;
+	uint tcp :1; //send all queries over TCP
 
 	fflist servs; //ffdnscl_serv[]
 	ffdnscl_serv *curserv;
 
 	ffrbtree queries; //active queries by hostname.  dns_query[]
+	void **txids; //active queries by transaction ID.  dns_query*[64k]
 };
 
 struct ffdnscl_serv {
@@ -57,10 +60,19 @@ struct ffdnscl_serv {
 	ffaddr addr;
 	char saddr_s[FF_MAXIP4];
 	ffstr saddr;
-	char *ansbuf;
+	char *ansbuf; //char[buf_size * batch_size]
+	struct dns_batch *batch; //queued requests and message headers for batched I/O
 	unsigned connected :1;
 
 	uint nqueries;
+
+	// TCP connection, reused for all queries to this server
+	ffaio_task tcp_aio;
+	ffarr tcp_out; //pending outgoing messages: {len[2] data[len]}...
+	size_t tcp_out_off; //number of bytes of tcp_out already sent
+	ffarr tcp_in; //incoming messages
+	unsigned tcp_state :2; //enum TCP_STATE
+	unsigned tcp_sending :1;
 };
 
 enum FFDNSCL_LOG {
@@ -74,6 +86,8 @@ enum FFDNSCL_LOG {
 FF_EXTN ffdnsclient* ffdnscl_new(ffdnscl_conf *conf);
 FF_EXTN void ffdnscl_free(ffdnsclient *r);
 
+/** Add DNS server.
+addr: "IPV4[:PORT]" */
 FF_EXTN int ffdnscl_serv_add(ffdnsclient *r, const ffstr *addr);
 
 FF_EXTN ffdnscl_res* ffdnscl_res_by_ai(const ffaddrinfo *ai);
@@ -84,6 +98,8 @@ FF_EXTN void ffdnscl_res_free(ffdnscl_res *dr);
 
 enum FFDNSCL_F {
 	FFDNSCL_CANCEL = 1,
+	FFDNSCL_BATCH = 2, //queue the query and send it later with ffdnscl_flush()
+	FFDNSCL_TCP = 4, //send the query over TCP.  Note: TCP is used automatically if UDP response is truncated.
 };
 
 /**
@@ -91,4 +107,8 @@ flags: enum FFDNSCL_F
 Return 0 on success. */
 FF_EXTN int ffdnscl_resolve(ffdnsclient *r, const char *name, size_t namelen, ffdnscl_onresolve ondone, void *udata, uint flags);
 
+/** Send all queries queued with FFDNSCL_BATCH flag.
+On Linux multiple datagrams are sent by a single system call. */
+FF_EXTN void ffdnscl_flush(ffdnsclient *r);
+
 FF_EXTN void ffdnscl_unref(ffdnsclient *r, const ffaddrinfo *ai);
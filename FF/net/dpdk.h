@@ -15,6 +15,7 @@ Copyright (c) 2018 Simon Zolin
 #include <rte_kni.h>
 #include <rte_vhost.h>
 #include <rte_bus_pci.h>
+#include <rte_bus_vdev.h>
 
 
 typedef void (*ffdpdk_logger_t)(uint level, const char *fmt, ...);
@@ -154,14 +155,34 @@ FF_EXTN int ffdpdk_port_cnt(void);
 /** Return 1 if a bonding device. */
 #define ffdpdk_port_isbond(p)  ((p)->info.pci_dev == NULL && !strcmp((p)->info.driver_name, "net_bonding"))
 
+/** Return 1 if a software device (net_null, net_ring, net_pcap, etc.). */
+#define ffdpdk_port_isvirt(p)  ((p)->info.pci_dev == NULL && !ffdpdk_port_isbond(p))
+
 /** Get device name. */
-#define ffdpdk_port_name(p)  (ffdpdk_port_isbond(p) ? "bonding" : ffdpdk_port_pciname(p))
+#define ffdpdk_port_name(p) \
+	(ffdpdk_port_isbond(p) ? "bonding" \
+	: ffdpdk_port_isvirt(p) ? (p)->info.driver_name \
+	: ffdpdk_port_pciname(p))
 
 #define ffdpdk_port_rx_lim_queues(p)  ((p)->info.max_rx_queues)
 #define ffdpdk_port_tx_lim_queues(p)  ((p)->info.max_tx_queues)
 #define ffdpdk_port_rx_lim_desc(p)  ((p)->info.rx_desc_lim.nb_max)
 #define ffdpdk_port_tx_lim_desc(p)  ((p)->info.tx_desc_lim.nb_max)
 
+/** Create a software device.
+Allows running the same RX/TX code without a NIC.
+'name': driver name with a unique suffix, e.g. "net_null0", "net_ring0", "net_pcap0"
+'args': driver arguments, e.g.:
+ net_null: "size=64,copy=0"
+ net_ring: "nodeaction=r0:0:CREATE" (packets sent to TX queue N are received from RX queue N)
+ net_pcap: "rx_pcap=in.pcap,tx_pcap=out.pcap"
+Return port ID;  -1 on error. */
+FF_EXTN int ffdpdk_vdev_add(const char *name, const char *args);
+
+/** Destroy a software device.
+The port must be closed. */
+FF_EXTN void ffdpdk_vdev_rm(const char *name);
+
 /** Initialize device.
 'id': 0 .. ffdpdk_port_cnt() */
 FF_EXTN int ffdpdk_port_init(ffdpdk_port *p, uint id);
@@ -226,6 +247,88 @@ Must be called at least every 100ms. */
 FF_EXTN void ffdpdk_port_lacp_process(ffdpdk_queue *q);
 
 
+
+/* Worker */
+
+typedef struct ffdpdk_worker ffdpdk_worker;
+
+/** Process a burst of packets received from RX queue.
+Handler passes each packet to either ffdpdk_worker_tx() or ffdpdk_worker_drop(). */
+typedef void (*ffdpdk_handler_t)(ffdpdk_worker *w, ffdpdk_mbuf **pkts, uint n);
+
+enum { FFDPDK_BURST_MAX = 64 };
+
+struct ffdpdk_worker {
+	ffdpdk_queue *rxq;
+	ffdpdk_queue *txq;
+	ffdpdk_handler_t handler; // NULL: forward all packets to 'txq'
+	void *udata;
+	uint burst; // packets per RX burst: 1..FFDPDK_BURST_MAX
+	ffdpdk_clock flush_clk; // TX queue is flushed when the timer expires
+
+	volatile uint stop;
+	uint lcore;
+
+	// written by the worker's CPU only:
+	uint64 polls; // RX burst calls
+	uint64 bursts; // non-empty RX bursts
+	uint64 flushes; // TX flushes by timer
+	uint64 tsc_busy; // CPU cycles spent on non-empty bursts
+	uint64 tsc; // CPU cycles spent in the loop
+};
+
+/** Prepare worker object.
+Default parameters: 32 packets per burst, TX flush every 100us. */
+FF_EXTN void ffdpdk_worker_init(ffdpdk_worker *w, ffdpdk_queue *rxq, ffdpdk_queue *txq, ffdpdk_handler_t handler, void *udata);
+
+/** Run-to-completion loop: RX burst -> handler -> TX.
+Runs until ffdpdk_worker::stop is set.  The bufferred packets are sent before return.
+'w': ffdpdk_worker*
+The signature is compatible with rte_eal_remote_launch(). */
+FF_EXTN int ffdpdk_worker_run(void *w);
+
+/** Start each worker on its own slave CPU.
+Return -1 if there are less slave CPUs than workers. */
+FF_EXTN int ffdpdk_workers_start(ffdpdk_worker *w, uint n);
+
+/** Signal workers to stop and wait until they finish. */
+FF_EXTN void ffdpdk_workers_stop(ffdpdk_worker *w, uint n);
+
+/** Send packet via worker's TX queue. */
+#define ffdpdk_worker_tx(w, pkt)  ffdpdk_port_write((w)->txq, pkt)
+
+/** Free packet and account it as dropped. */
+#define ffdpdk_worker_drop(w, pkt)  ffdpdk_port_pktdrop((w)->rxq, pkt)
+
+typedef struct ffdpdk_wstat {
+	uint64 recvd;
+	uint64 sent;
+	uint64 dropped; // by handler or because TX ring was full
+	uint64 polls;
+	uint64 bursts;
+	uint64 burst_pkts; // bursts * burst size: the capacity of non-empty bursts
+	uint64 flushes;
+	uint64 tsc_busy;
+	uint64 tsc;
+	uint workers; // number of workers added to this object
+} ffdpdk_wstat;
+
+/** Add worker's counters to 'st'.
+May be called from another CPU while the worker is running. */
+FF_EXTN void ffdpdk_worker_stat(const ffdpdk_worker *w, ffdpdk_wstat *st);
+
+typedef struct ffdpdk_wrate {
+	uint64 rx_pps;
+	uint64 tx_pps;
+	uint64 drop_pps;
+	uint fill; // average fill of non-empty RX bursts, %
+	uint busy; // CPU time spent on packet processing, %
+} ffdpdk_wrate;
+
+/** Get rates from 2 snapshots of the same counters. */
+FF_EXTN void ffdpdk_wstat_rate(const ffdpdk_wstat *cur, const ffdpdk_wstat *prev, ffdpdk_wrate *r);
+
+
 /** Get pointer to Ethernet header from mbuf. */
 #define ffdpdk_pkt_ptr(m, T)  rte_pktmbuf_mtod_offset(m, T, 0)
 
@@ -32,7 +32,9 @@ typedef struct dns_query {
 	ushort txid4;
 	ushort txid6;
 	unsigned need4 :1
-		, need6 :1;
+		, need6 :1
+		, tcp :1 //send over TCP
+		, tc4 :1, tc6 :1; //the question has been sent over TCP after a truncated response
 	byte nres; //number of elements in res[2]
 	ushort ques_len4;
 	ushort ques_len6;
@@ -49,6 +51,29 @@ typedef struct dns_a6 {
 	struct sockaddr_in6 addr;
 } dns_a6;
 
+/** Batched datagram I/O. */
+struct dns_batch {
+	uint nsend; //number of queued datagrams
+	ffiovec *siov; //ffiovec[batch_size]: queued datagrams
+	char *sbuf; //char[batch_size * FFDNS_MAXMSG]: copies of the queued datagrams
+	ushort *stxid; //ushort[batch_size]: transaction IDs of the queued datagrams
+#ifdef FF_LINUX
+	struct mmsghdr *smsg; //[batch_size]
+	struct mmsghdr *rmsg; //[batch_size]
+	ffiovec *riov; //[batch_size]: buffers for incoming datagrams
+#endif
+};
+
+enum {
+	TXID_MAX = 0xffff,
+};
+
+enum TCP_STATE {
+	TCP_NONE,
+	TCP_CONNECTING,
+	TCP_CONNECTED,
+};
+
 struct ffdnscl_res {
 	void *cached_id;
 	uint usage; //reference count.  0 if stored in cache.
@@ -90,21 +115,34 @@ do { \
 static int serv_init(ffdnscl_serv *serv);
 static ffdnscl_serv * serv_next(ffdnsclient *r);
 static void serv_fin(ffdnscl_serv *serv);
+static struct dns_batch* serv_batch_new(ffdnscl_serv *serv);
+static void serv_batch_free(struct dns_batch *b);
+static int serv_flush(ffdnscl_serv *serv);
+static void serv_reset(ffdnscl_serv *serv);
+
+// TCP
+static int tcp_enqueue(ffdnscl_serv *serv, const char *data, size_t len);
+static int tcp_connect(ffdnscl_serv *serv);
+static void tcp_onconnect(void *udata);
+static void tcp_write(void *udata);
+static void tcp_read(void *udata);
+static void tcp_close(ffdnscl_serv *serv);
 
 // QUERY
 #define query_sib(pnod)  FF_GETPTR(dns_query, rbtnod, pnod)
 static int query_addusr(dns_query *q, ffdnscl_onresolve ondone, void *udata);
 static int query_rmuser(ffdnsclient *r, const ffstr *host, ffdnscl_onresolve ondone, void *udata);
 static size_t query_prep(ffdnsclient *r, char *buf, size_t cap, uint txid, const ffstr *nm, int type);
-static void query_send(dns_query *q, int resend);
-static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend);
+static int query_txid(ffdnsclient *r, uint exclude);
+static void query_send(dns_query *q, int resend, uint flags);
+static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend, uint flags);
 static void query_onexpire(void *param);
 static void query_fin(dns_query *q, int status);
 static void query_free(void *param);
 
 // ANSWER
 static void ans_read(void *udata);
-static void ans_proc(ffdnscl_serv *serv, const ffstr *resp);
+static void ans_proc(ffdnscl_serv *serv, const ffstr *resp, uint tcp);
 static dns_query * ans_find_query(ffdnscl_serv *serv, ffdns_hdr_host *h, const ffstr *resp);
 static uint ans_nrecs(dns_query *q, ffdns_hdr_host *h, const ffstr *resp, const char *pbuf, int is4);
 static ffdnscl_res* ans_proc_resp(dns_query *q, ffdns_hdr_host *h, const ffstr *resp, int is4);
@@ -138,9 +176,17 @@ ffdnsclient* ffdnscl_new(ffdnscl_conf *conf)
 	if (r->time == NULL)
 		r->time = &time_dummy;
 
+	if (r->batch_size == 0)
+		r->batch_size = 1;
+
 	fflist_init(&r->servs);
 	r->curserv = NULL;
 	ffrbt_init(&r->queries);
+
+	if (NULL == (r->txids = ffmem_calloc(TXID_MAX + 1, sizeof(void*)))) {
+		ffmem_free(r);
+		return NULL;
+	}
 	return r;
 }
 
@@ -152,7 +198,7 @@ int ffdnscl_resolve(ffdnsclient *r, const char *name, size_t namelen, ffdnscl_on
 	ffrbt_node *found_query, *parent;
 	dns_query *q = NULL;
 	ffstr host;
-	ushort txid4, txid6 = 0;
+	int txid4, txid6 = 0;
 
 	ffstr_set(&host, name, namelen);
 
@@ -179,7 +225,10 @@ int ffdnscl_resolve(ffdnsclient *r, const char *name, size_t namelen, ffdnscl_on
 	}
 
 	// prepare DNS queries: A and AAAA
-	txid4 = ffrnd_get() & 0xffff;
+	if (-1 == (txid4 = query_txid(r, (uint)-1))) {
+		errlog_x(r, "%S: no free transaction IDs", &host);
+		goto fail;
+	}
 	ibuf4 = query_prep(r, buf4, FFCNT(buf4), txid4, &host, FFDNS_A);
 	if (ibuf4 == 0) {
 		errlog_x(r, "invalid hostname: %S", &host);
@@ -187,7 +236,10 @@ int ffdnscl_resolve(ffdnsclient *r, const char *name, size_t namelen, ffdnscl_on
 	}
 
 	if (r->enable_ipv6) {
-		txid6 = ffrnd_get() & 0xffff;
+		if (-1 == (txid6 = query_txid(r, txid4))) {
+			errlog_x(r, "%S: no free transaction IDs", &host);
+			goto fail;
+		}
 		ibuf6 = query_prep(r, buf6, FFCNT(buf6), txid6, &host, FFDNS_AAAA);
 	}
 
@@ -197,6 +249,8 @@ int ffdnscl_resolve(ffdnsclient *r, const char *name, size_t namelen, ffdnscl_on
 		goto nomem;
 	ffmem_zero(q, sizeof(dns_query));
 	q->r = r;
+	q->tmr.handler = &query_onexpire;
+	q->tmr.param = q;
 
 	if (0 != query_addusr(q, ondone, udata))
 		goto nomem;
@@ -208,20 +262,23 @@ int ffdnscl_resolve(ffdnsclient *r, const char *name, size_t namelen, ffdnscl_on
 	ffmemcpy(q->question, buf4, ibuf4);
 	q->ques_len4 = (ushort)ibuf4;
 	q->txid4 = txid4;
+	r->txids[txid4] = q;
 
 	if (r->enable_ipv6) {
 		q->need6 = 1;
 		ffmemcpy(q->question + ibuf4, buf6, ibuf6);
 		q->ques_len6 = (ushort)ibuf6;
 		q->txid6 = txid6;
+		r->txids[txid6] = q;
 	}
 
 	q->rbtnod.key = namecrc;
 	ffrbt_insert(&r->queries, &q->rbtnod, parent);
 	q->tries_left = r->max_tries;
 	q->firstsend = r->time();
+	q->tcp = ((flags & FFDNSCL_TCP) || r->tcp);
 
-	query_send(q, 0);
+	query_send(q, 0, flags);
 	return 0;
 
 nomem:
@@ -235,6 +292,15 @@ fail:
 	return 0;
 }
 
+void ffdnscl_flush(ffdnsclient *r)
+{
+	ffdnscl_serv *serv;
+	FFLIST_WALK(&r->servs, serv, sib) {
+		if (serv->batch->nsend != 0)
+			serv_flush(serv);
+	}
+}
+
 void ffdnscl_unref(ffdnsclient *r, const ffaddrinfo *ai)
 {
 	dns_a *paddrs = FF_GETPTR(dns_a, ainfo, ai);
@@ -252,6 +318,7 @@ void ffdnscl_free(ffdnsclient *r)
 
 	ffrbt_freeall(&r->queries, &query_free, FFOFF(dns_query, rbtnod));
 	FFLIST_ENUMSAFE(&r->servs, serv_fin, ffdnscl_serv, sib);
+	ffmem_free(r->txids);
 	ffmem_free(r);
 }
 
@@ -259,6 +326,10 @@ static void query_free(void *param)
 {
 	dns_query *q = param;
 	q->r->timer(&q->tmr, 0);
+	if (q->r->txids[q->txid4] == q)
+		q->r->txids[q->txid4] = NULL;
+	if (q->r->txids[q->txid6] == q)
+		q->r->txids[q->txid6] = NULL;
 	ffstr_free(&q->name);
 	ffarr_free(&q->users);
 	ffmem_free(q);
@@ -275,7 +346,7 @@ static void query_onexpire(void *param)
 		return;
 	}
 
-	query_send(q, 1);
+	query_send(q, 1, 0);
 }
 
 /** One more user wants to send the same query. */
@@ -326,7 +397,20 @@ static int query_rmuser(ffdnsclient *r, const ffstr *host, ffdnscl_onresolve ond
 	return 1;
 }
 
-static void query_send(dns_query *q, int resend)
+/** Get a random transaction ID not used by any active query.
+Return -1 if all IDs are in use. */
+static int query_txid(ffdnsclient *r, uint exclude)
+{
+	uint id = ffrnd_get() & TXID_MAX;
+	for (uint i = 0;  i != TXID_MAX + 1;  i++) {
+		if (r->txids[id] == NULL && id != exclude)
+			return id;
+		id = (id + 1) & TXID_MAX;
+	}
+	return -1;
+}
+
+static void query_send(dns_query *q, int resend, uint flags)
 {
 	ffdnscl_serv *serv;
 
@@ -340,18 +424,46 @@ static void query_send(dns_query *q, int resend)
 
 		q->tries_left--;
 		serv = serv_next(q->r);
-		if (0 == query_send1(q, serv, resend))
+		if (0 == query_send1(q, serv, resend, flags))
 			return;
 	}
 }
 
-/** Send query to server. */
-static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend)
+/** Add datagram to the server's send queue.
+The data is copied because the query may be freed before the queue is sent. */
+static int query_enqueue(ffdnscl_serv *serv, const char *data, size_t len, uint txid)
+{
+	struct dns_batch *b = serv->batch;
+	if (b->nsend == serv->r->batch_size
+		&& 0 != serv_flush(serv))
+		return 1;
+	char *buf = b->sbuf + b->nsend * FFDNS_MAXMSG;
+	ffmemcpy(buf, data, len);
+	b->stxid[b->nsend] = txid;
+	ffiov_set(&b->siov[b->nsend++], buf, len);
+	return 0;
+}
+
+/** Send query to server.
+flags: enum FFDNSCL_F:
+ FFDNSCL_BATCH: don't send the queued datagrams until the queue is full or ffdnscl_flush() is called */
+static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend, uint flags)
 {
-	ssize_t rc;
 	int er;
 	ffdnsclient *r = q->r;
 
+	if (q->tcp) {
+		if ((q->need6 && 0 != tcp_enqueue(serv, q->question + q->ques_len4, q->ques_len6))
+			|| (q->need4 && 0 != tcp_enqueue(serv, q->question, q->ques_len4)))
+			return 1;
+
+		serv->nqueries += q->need4 + q->need6;
+		dbglog_q(q, LOG_DBGNET, "%ssent query #%u/#%u via TCP (%u).  [%L]"
+			, (resend ? "re" : ""), (int)q->txid4, (int)q->txid6, serv->nqueries, (size_t)r->queries.len);
+		r->timer(&q->tmr, r->retry_timeout);
+		return 0;
+	}
+
 	if (!serv->connected) {
 		if (0 != serv_init(serv))
 			return 1;
@@ -365,11 +477,8 @@ static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend)
 	}
 
 	if (q->need6) {
-		rc = ffskt_send(serv->sk, q->question + q->ques_len4, q->ques_len6, 0);
-		if (rc != q->ques_len6) {
-			er = FFERR_WRITE;
-			goto fail;
-		}
+		if (0 != query_enqueue(serv, q->question + q->ques_len4, q->ques_len6, q->txid6))
+			return 1;
 
 		serv->nqueries++;
 
@@ -378,11 +487,8 @@ static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend)
 	}
 
 	if (q->need4) {
-		rc = ffskt_send(serv->sk, q->question, q->ques_len4, 0);
-		if (rc != q->ques_len4) {
-			er = FFERR_WRITE;
-			goto fail;
-		}
+		if (0 != query_enqueue(serv, q->question, q->ques_len4, q->txid4))
+			return 1;
 
 		serv->nqueries++;
 
@@ -390,19 +496,14 @@ static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend)
 			, (resend ? "re" : ""), "A", (int)q->txid4, serv->nqueries, (size_t)r->queries.len);
 	}
 
-	q->tmr.handler = &query_onexpire;
-	q->tmr.param = q;
-	r->timer(&q->tmr, r->retry_timeout);
+	// the retry timer is started by serv_flush()
+	if (!(flags & FFDNSCL_BATCH)
+		&& 0 != serv_flush(serv))
+		return 1;
 	return 0;
 
 fail:
 	syserrlog_srv(serv, "%e", er);
-	if (er == FFERR_WRITE) {
-		ffskt_close(serv->sk);
-		serv->sk = FF_BADSKT;
-		ffaio_fin(&serv->aiotask);
-		serv->connected = 0;
-	}
 	return 1;
 }
 
@@ -440,6 +541,27 @@ static void ans_read(void *udata)
 	ffstr resp;
 
 	for (;;) {
+
+#ifdef FF_LINUX
+		if (serv->r->batch_size != 1) {
+			struct dns_batch *b = serv->batch;
+			int n = recvmmsg(serv->sk, b->rmsg, serv->r->batch_size, MSG_DONTWAIT, NULL);
+			if (n > 0) {
+				dbglog_srv(serv, LOG_DBGNET, "received %u responses", n);
+				for (int i = 0;  i != n;  i++) {
+					ffstr_set(&resp, b->riov[i].iov_base, b->rmsg[i].msg_len);
+					ans_proc(serv, &resp, 0);
+				}
+				continue;
+
+			} else if (n < 0 && !fferr_again(fferr_last())) {
+				syserrlog_srv(serv, "%e", FFERR_READ);
+				return;
+			}
+			// no more data: wait for a signal from kernel
+		}
+#endif
+
 		r = ffaio_recv(&serv->aiotask, &ans_read, serv->ansbuf, serv->r->buf_size);
 		if (r == FFAIO_ASYNC)
 			return;
@@ -451,12 +573,13 @@ static void ans_read(void *udata)
 		dbglog_srv(serv, LOG_DBGNET, "received response (%L bytes)", r);
 
 		ffstr_set(&resp, serv->ansbuf, r);
-		ans_proc(serv, &resp);
+		ans_proc(serv, &resp, 0);
 	}
 }
 
-/** Process response and notify users waiting for it. */
-static void ans_proc(ffdnscl_serv *serv, const ffstr *resp)
+/** Process response and notify users waiting for it.
+tcp: response is received over TCP */
+static void ans_proc(ffdnscl_serv *serv, const ffstr *resp, uint tcp)
 {
 	ffdns_hdr_host h;
 	dns_query *q;
@@ -468,11 +591,9 @@ static void ans_proc(ffdnscl_serv *serv, const ffstr *resp)
 		return;
 
 	if (q->need4 && h.id == q->txid4) {
-		q->need4 = 0;
 		is4 = 1;
 
 	} else if (q->need6 && h.id == q->txid6) {
-		q->need6 = 0;
 		is4 = 0;
 
 	} else {
@@ -480,6 +601,30 @@ static void ans_proc(ffdnscl_serv *serv, const ffstr *resp)
 		return;
 	}
 
+	if (!tcp && ((ffdns_hdr*)resp->ptr)->tc) {
+		// the answer doesn't fit into UDP datagram: send the same question over TCP
+		if ((is4) ? q->tc4 : q->tc6) {
+			dbglog_q(q, LOG_DBGNET, "#%u: duplicate truncated response", h.id);
+			return;
+		}
+		dbglog_q(q, LOG_DBGNET, "#%u: response is truncated, retrying via TCP", h.id);
+		q->tcp = 1;
+		if (is4) {
+			q->tc4 = 1;
+			tcp_enqueue(serv, q->question, q->ques_len4);
+		} else {
+			q->tc6 = 1;
+			tcp_enqueue(serv, q->question + q->ques_len4, q->ques_len6);
+		}
+		r->timer(&q->tmr, r->retry_timeout);
+		return;
+	}
+
+	if (is4)
+		q->need4 = 0;
+	else
+		q->need6 = 0;
+
 	if (h.rcode != FFDNS_NOERROR) {
 		errlog_q(q, "#%u: DNS response: (%u) %s"
 			, h.id, h.rcode, ffdns_errstr(h.rcode));
@@ -525,9 +670,7 @@ static dns_query * ans_find_query(ffdnscl_serv *serv, ffdns_hdr_host *h, const f
 	ffdns_hdr *hdr;
 	char qname[FFDNS_MAXNAME];
 	const char *errmsg = NULL;
-	uint namecrc;
 	ffstr name;
-	ffrbt_node *found_query;
 	uint resp_id = 0;
 
 	if (resp->len < sizeof(ffdns_hdr)) {
@@ -559,10 +702,11 @@ static dns_query * ans_find_query(ffdnscl_serv *serv, ffdns_hdr_host *h, const f
 	name.len--;
 	name.ptr = qname;
 
-	serv->r->log(FFDNSCL_LOG_DBG /*LOG_DBGNET*/, &name
-		, "DNS response #%u.  Status: %u.  AA: %u, RA: %u.  Q: %u, A: %u, N: %u, R: %u."
-		, h->id, hdr->rcode, hdr->aa, hdr->ra
-		, h->qdcount, h->ancount, h->nscount, h->arcount);
+	if (serv->r->debug_log)
+		serv->r->log(FFDNSCL_LOG_DBG /*LOG_DBGNET*/, &name
+			, "DNS response #%u.  Status: %u.  AA: %u, RA: %u.  Q: %u, A: %u, N: %u, R: %u."
+			, h->id, hdr->rcode, hdr->aa, hdr->ra
+			, h->qdcount, h->ancount, h->nscount, h->arcount);
 
 	if (pbuf + sizeof(ffdns_ques) > end) {
 		errmsg = "too small response";
@@ -580,15 +724,12 @@ static dns_query * ans_find_query(ffdnscl_serv *serv, ffdns_hdr_host *h, const f
 		}
 	}
 
-	namecrc = ffcrc32_get(qname, name.len);
-
-	found_query = ffrbt_find(&serv->r->queries, namecrc, NULL);
-	if (found_query == NULL) {
+	q = serv->r->txids[h->id];
+	if (q == NULL) {
 		errmsg = "unexpected DNS response";
 		goto fail;
 	}
 
-	q = query_sib(found_query);
 	if (!ffstr_eq2(&q->name, &name)) {
 		errmsg = "unexpected DNS response";
 		goto fail;
@@ -845,33 +986,93 @@ static void query_fin(dns_query *q, int status)
 
 int ffdnscl_serv_add(ffdnsclient *r, const ffstr *saddr)
 {
+	ffstr ip, port;
+	ushort nport = FFDNS_PORT;
 	ffdnscl_serv *serv = ffmem_new(ffdnscl_serv);
 	if (serv == NULL)
 		return -1;
-	fflist_ins(&r->servs, &serv->sib);
-
+	serv->sk = FF_BADSKT;
 	serv->r = r;
-	serv->ansbuf = ffmem_alloc(r->buf_size);
-	if (serv->ansbuf == NULL)
+
+	if (0 != ffip_split(saddr->ptr, saddr->len, &ip, &port))
+		goto err;
+	if (port.len != 0 && !ffstr_toint(&port, &nport, FFS_INT16))
 		goto err;
-	r->curserv = FF_GETPTR(ffdnscl_serv, sib, r->servs.first);
 
 	ffip4 a4;
-	if (0 != ffip4_parse(&a4, saddr->ptr, saddr->len))
+	if (0 != ffip4_parse(&a4, ip.ptr, ip.len))
 		goto err;
 	ffaddr_init(&serv->addr);
 	ffip4_set(&serv->addr, (void*)&a4);
-	ffip_setport(&serv->addr, FFDNS_PORT);
+	ffip_setport(&serv->addr, nport);
+
+	serv->ansbuf = ffmem_alloc(r->buf_size * r->batch_size);
+	if (serv->ansbuf == NULL)
+		goto err;
+	if (NULL == (serv->batch = serv_batch_new(serv)))
+		goto err;
 
 	char *s = ffs_copy(serv->saddr_s, serv->saddr_s + FFCNT(serv->saddr_s), saddr->ptr, saddr->len);
 	ffstr_set(&serv->saddr, serv->saddr_s, s - serv->saddr_s);
+
+	fflist_ins(&r->servs, &serv->sib);
+	r->curserv = FF_GETPTR(ffdnscl_serv, sib, r->servs.first);
 	return 0;
 
 err:
-	ffmem_free(serv);
+	serv_fin(serv);
 	return -1;
 }
 
+/** Allocate the send queue and prepare message headers for sendmmsg()/recvmmsg(). */
+static struct dns_batch* serv_batch_new(ffdnscl_serv *serv)
+{
+	uint n = serv->r->batch_size;
+	struct dns_batch *b = ffmem_new(struct dns_batch);
+	if (b == NULL)
+		return NULL;
+
+	if (NULL == (b->siov = ffmem_tcalloc(ffiovec, n))
+		|| NULL == (b->sbuf = ffmem_alloc(n * FFDNS_MAXMSG))
+		|| NULL == (b->stxid = ffmem_tcalloc(ushort, n)))
+		goto err;
+
+#ifdef FF_LINUX
+	if (NULL == (b->smsg = ffmem_tcalloc(struct mmsghdr, n))
+		|| NULL == (b->rmsg = ffmem_tcalloc(struct mmsghdr, n))
+		|| NULL == (b->riov = ffmem_tcalloc(ffiovec, n)))
+		goto err;
+
+	for (uint i = 0;  i != n;  i++) {
+		b->smsg[i].msg_hdr.msg_iov = &b->siov[i];
+		b->smsg[i].msg_hdr.msg_iovlen = 1;
+
+		ffiov_set(&b->riov[i], serv->ansbuf + i * serv->r->buf_size, serv->r->buf_size);
+		b->rmsg[i].msg_hdr.msg_iov = &b->riov[i];
+		b->rmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+
+	return b;
+
+err:
+	serv_batch_free(b);
+	return NULL;
+}
+
+static void serv_batch_free(struct dns_batch *b)
+{
+	ffmem_safefree(b->siov);
+	ffmem_safefree(b->sbuf);
+	ffmem_safefree(b->stxid);
+#ifdef FF_LINUX
+	ffmem_safefree(b->smsg);
+	ffmem_safefree(b->rmsg);
+	ffmem_safefree(b->riov);
+#endif
+	ffmem_free(b);
+}
+
 /** Prepare socket to connect to a DNS server. */
 static int serv_init(ffdnscl_serv *serv)
 {
@@ -917,11 +1118,234 @@ fail:
 
 static void serv_fin(ffdnscl_serv *serv)
 {
+	if (serv->tcp_state != TCP_NONE)
+		tcp_close(serv);
+	ffarr_free(&serv->tcp_out);
+	ffarr_free(&serv->tcp_in);
 	FF_SAFECLOSE(serv->sk, FF_BADSKT, ffskt_close);
 	FF_SAFECLOSE(serv->ansbuf, NULL, ffmem_free);
+	FF_SAFECLOSE(serv->batch, NULL, serv_batch_free);
 	ffmem_free(serv);
 }
 
+/** Close connection after I/O error. */
+static void serv_reset(ffdnscl_serv *serv)
+{
+	ffskt_close(serv->sk);
+	serv->sk = FF_BADSKT;
+	ffaio_fin(&serv->aiotask);
+	serv->connected = 0;
+}
+
+/** Start the retry timers of the queries whose datagrams have been sent or lost.
+The queries which have been freed are skipped. */
+static void serv_batch_timers(ffdnscl_serv *serv)
+{
+	struct dns_batch *b = serv->batch;
+	ffdnsclient *r = serv->r;
+	for (uint i = 0;  i != b->nsend;  i++) {
+		dns_query *q = r->txids[b->stxid[i]];
+		if (q != NULL)
+			r->timer(&q->tmr, r->retry_timeout);
+	}
+}
+
+/** Send all queued datagrams.
+Queries whose datagrams are lost due to an error will be resent by timer.
+Return 0 on success. */
+static int serv_flush(ffdnscl_serv *serv)
+{
+	struct dns_batch *b = serv->batch;
+	uint i = 0;
+
+	while (i != b->nsend) {
+#ifdef FF_LINUX
+		int n = sendmmsg(serv->sk, &b->smsg[i], b->nsend - i, 0);
+		if (n <= 0)
+			goto fail;
+		i += n;
+#else
+		ssize_t n = ffskt_send(serv->sk, b->siov[i].iov_base, b->siov[i].iov_len, 0);
+		if (n != (ssize_t)b->siov[i].iov_len)
+			goto fail;
+		i++;
+#endif
+	}
+
+	dbglog_srv(serv, LOG_DBGNET, "sent %u datagrams", b->nsend);
+	serv_batch_timers(serv);
+	b->nsend = 0;
+	return 0;
+
+fail:
+	syserrlog_srv(serv, "%e", FFERR_WRITE);
+	serv_batch_timers(serv);
+	b->nsend = 0;
+	serv_reset(serv);
+	return 1;
+}
+
+
+/** Add message to the TCP output buffer and start sending it.
+Connect to server if necessary.
+Return 0 on success. */
+static int tcp_enqueue(ffdnscl_serv *serv, const char *data, size_t len)
+{
+	char *p;
+	if (NULL == ffarr_grow(&serv->tcp_out, 2 + len, FFARR_GROWQUARTER)) {
+		syserrlog_srv(serv, "%e", FFERR_BUFALOC);
+		return 1;
+	}
+	p = ffarr_end(&serv->tcp_out);
+	ffint_hton16(p, len);
+	ffmemcpy(p + 2, data, len);
+	serv->tcp_out.len += 2 + len;
+
+	if (serv->tcp_state == TCP_NONE)
+		return tcp_connect(serv);
+	if (serv->tcp_state == TCP_CONNECTED && !serv->tcp_sending)
+		tcp_write(serv);
+	return 0;
+}
+
+/** Begin connecting to a DNS server via TCP. */
+static int tcp_connect(ffdnscl_serv *serv)
+{
+	int er;
+	ffskt sk;
+
+	if (FF_BADSKT == (sk = ffskt_create(ffaddr_family(&serv->addr), SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP))) {
+		syserrlog_srv(serv, "%e", FFERR_SKTCREAT);
+		return 1;
+	}
+
+	if (0 != ffskt_setopt(sk, IPPROTO_TCP, TCP_NODELAY, 1))
+		syserrlog_srv(serv, "%s", "setsockopt(TCP_NODELAY)");
+
+	ffaio_init(&serv->tcp_aio);
+	serv->tcp_aio.udata = serv;
+	serv->tcp_aio.sk = sk;
+	serv->tcp_state = TCP_CONNECTING;
+	if (0 != ffaio_attach(&serv->tcp_aio, serv->r->kq, FFKQU_READ | FFKQU_WRITE)) {
+		er = FFERR_KQUATT;
+		goto fail;
+	}
+
+	if (NULL == ffarr_realloc(&serv->tcp_in, 2 + 0xffff)) {
+		er = FFERR_BUFALOC;
+		goto fail;
+	}
+
+	dbglog_srv(serv, LOG_DBGNET, "TCP: connecting...", 0);
+	tcp_onconnect(serv);
+	return 0;
+
+fail:
+	syserrlog_srv(serv, "%e", er);
+	tcp_close(serv);
+	return 1;
+}
+
+static void tcp_onconnect(void *udata)
+{
+	ffdnscl_serv *serv = udata;
+	int r = ffaio_connect(&serv->tcp_aio, &tcp_onconnect, &serv->addr.a, serv->addr.len);
+	if (r == FFAIO_ASYNC)
+		return;
+	else if (r == FFAIO_ERROR) {
+		syserrlog_srv(serv, "%e", FFERR_SKTCONN);
+		tcp_close(serv);
+		return;
+	}
+
+	dbglog_srv(serv, LOG_DBGNET, "TCP: connected", 0);
+	serv->tcp_state = TCP_CONNECTED;
+	tcp_read(serv);
+	if (serv->tcp_state == TCP_CONNECTED)
+		tcp_write(serv);
+}
+
+/** Send pending messages. */
+static void tcp_write(void *udata)
+{
+	ffdnscl_serv *serv = udata;
+	ssize_t r;
+
+	serv->tcp_sending = 0;
+	while (serv->tcp_out_off != serv->tcp_out.len) {
+		r = ffaio_send(&serv->tcp_aio, &tcp_write, serv->tcp_out.ptr + serv->tcp_out_off, serv->tcp_out.len - serv->tcp_out_off);
+		if (r == FFAIO_ASYNC) {
+			serv->tcp_sending = 1;
+			return;
+		} else if (r == FFAIO_ERROR) {
+			syserrlog_srv(serv, "%e", FFERR_WRITE);
+			tcp_close(serv);
+			return;
+		}
+		serv->tcp_out_off += r;
+	}
+
+	dbglog_srv(serv, LOG_DBGNET, "TCP: sent %L bytes", serv->tcp_out.len);
+	serv->tcp_out.len = 0;
+	serv->tcp_out_off = 0;
+}
+
+/** Receive and process responses from DNS server.
+Responses may arrive in any order:  they are matched with queries by transaction ID. */
+static void tcp_read(void *udata)
+{
+	ffdnscl_serv *serv = udata;
+	ssize_t r;
+	ffstr d, resp;
+
+	for (;;) {
+		r = ffaio_recv(&serv->tcp_aio, &tcp_read, ffarr_end(&serv->tcp_in), ffarr_unused(&serv->tcp_in));
+		if (r == FFAIO_ASYNC)
+			return;
+		else if (r == FFAIO_ERROR) {
+			syserrlog_srv(serv, "%e", FFERR_READ);
+			tcp_close(serv);
+			return;
+		} else if (r == 0) {
+			dbglog_srv(serv, LOG_DBGNET, "TCP: server has closed connection", 0);
+			tcp_close(serv);
+			return;
+		}
+
+		serv->tcp_in.len += r;
+		dbglog_srv(serv, LOG_DBGNET, "TCP: received %L bytes", r);
+
+		ffstr_set2(&d, &serv->tcp_in);
+		while (d.len >= 2) {
+			uint n = ffint_ntoh16(d.ptr);
+			if (d.len < 2 + n)
+				break;
+			ffstr_set(&resp, d.ptr + 2, n);
+			ffstr_shift(&d, 2 + n);
+			ans_proc(serv, &resp, 1);
+			if (serv->tcp_state != TCP_CONNECTED)
+				return; // connection was closed by a user callback
+		}
+
+		// move the incomplete response to the beginning of buffer
+		memmove(serv->tcp_in.ptr, d.ptr, d.len);
+		serv->tcp_in.len = d.len;
+	}
+}
+
+/** Close TCP connection.
+Queries waiting for a response will be resent by timer. */
+static void tcp_close(ffdnscl_serv *serv)
+{
+	FF_SAFECLOSE(serv->tcp_aio.sk, FF_BADSKT, ffskt_close);
+	ffaio_fin(&serv->tcp_aio);
+	serv->tcp_state = TCP_NONE;
+	serv->tcp_sending = 0;
+	serv->tcp_out.len = 0;
+	serv->tcp_out_off = 0;
+	serv->tcp_in.len = 0;
+}
+
 /** Round-robin balancer. */
 static ffdnscl_serv * serv_next(ffdnsclient *r)
 {
@@ -178,14 +178,45 @@ get_eth_conf(struct rte_eth_conf *eth_conf, uint32_t num_devices)
 	return 0;
 }
 
+int ffdpdk_vdev_add(const char *name, const char *args)
+{
+	int r;
+	uint16_t id;
+
+	if (0 != (r = rte_vdev_init(name, args))) {
+		errlog(gdpdk, "rte_vdev_init(%s, %s): (%d) %s", name, args, -r, strerror(-r));
+		return -1;
+	}
+
+	if (0 != rte_eth_dev_get_port_by_name(name, &id)) {
+		errlog(gdpdk, "rte_eth_dev_get_port_by_name(%s)", name);
+		rte_vdev_uninit(name);
+		return -1;
+	}
+
+	dbglog(gdpdk, "rte_vdev_init(%s): port%u", name, id);
+	return id;
+}
+
+void ffdpdk_vdev_rm(const char *name)
+{
+	if (0 != rte_vdev_uninit(name)) {
+		errlog(gdpdk, "rte_vdev_uninit(%s)", name);
+		return;
+	}
+	dbglog(gdpdk, "rte_vdev_uninit(%s) ok", name);
+}
+
 int ffdpdk_port_init(ffdpdk_port *p, uint id)
 {
 	rte_eth_dev_info_get(id, &p->info);
 
-	// p->conf.rx_adv_conf.rss_conf.rss_hf = ETH_RSS_PROTO_MASK;
-	p->conf.rxmode.hw_ip_checksum = 1;
+	if (!ffdpdk_port_isvirt(p)) {
+		// p->conf.rx_adv_conf.rss_conf.rss_hf = ETH_RSS_PROTO_MASK;
+		p->conf.rxmode.hw_ip_checksum = 1;
 
-	get_eth_conf(&p->conf, p->info.max_vmdq_pools);
+		get_eth_conf(&p->conf, p->info.max_vmdq_pools);
+	}
 	p->info.default_txconf.txq_flags &= ~ETH_TXQ_FLAGS_NOVLANOFFL;
 	p->info.default_rxconf.rx_drop_en = 1;
 
@@ -399,6 +430,138 @@ int ffdpdk_ports_online(ffdpdk_port *ports, uint nports)
 }
 
 
+void ffdpdk_worker_init(ffdpdk_worker *w, ffdpdk_queue *rxq, ffdpdk_queue *txq, ffdpdk_handler_t handler, void *udata)
+{
+	ffmem_tzero(w);
+	w->rxq = rxq;
+	w->txq = txq;
+	w->handler = handler;
+	w->udata = udata;
+	w->burst = 32;
+	ffdpdk_clk_init(&w->flush_clk, ffdpdk_clk_from_us(100), 0);
+}
+
+static void worker_fwd(ffdpdk_worker *w, ffdpdk_mbuf **pkts, uint n)
+{
+	for (uint i = 0;  i != n;  i++) {
+		ffdpdk_worker_tx(w, pkts[i]);
+	}
+}
+
+int ffdpdk_worker_run(void *param)
+{
+	ffdpdk_worker *w = param;
+	ffdpdk_mbuf *pkts[FFDPDK_BURST_MAX];
+	ffdpdk_handler_t handler = (w->handler != NULL) ? w->handler : &worker_fwd;
+	uint burst = ffmin(w->burst, FFDPDK_BURST_MAX);
+	uint64 start, t;
+
+	w->lcore = ffdpdk_core();
+	dbglog(gdpdk, "lcore%u: worker started: port%u que#%u", w->lcore, w->rxq->p->id, w->rxq->que);
+	start = ffcpu_rdtsc();
+
+	while (!w->stop) {
+		t = ffcpu_rdtsc();
+		uint n = ffdpdk_port_read(w->rxq, pkts, burst);
+		w->polls++;
+		if (n != 0) {
+			w->bursts++;
+			handler(w, pkts, n);
+			w->tsc_busy += ffcpu_rdtsc() - t;
+		}
+
+		if (ffdpdk_clk_expired(&w->flush_clk)) {
+			if (w->txq != NULL && w->txq->txlen != 0) {
+				ffdpdk_port_flush(w->txq);
+				w->flushes++;
+			}
+			w->tsc = ffcpu_rdtsc() - start;
+		}
+	}
+
+	if (w->txq != NULL)
+		ffdpdk_port_flush(w->txq);
+	w->tsc = ffcpu_rdtsc() - start;
+	dbglog(gdpdk, "lcore%u: worker stopped", w->lcore);
+	return 0;
+}
+
+int ffdpdk_workers_start(ffdpdk_worker *w, uint n)
+{
+	uint i = 0;
+	int lc;
+
+	RTE_LCORE_FOREACH_SLAVE(lc) {
+		if (i == n)
+			break;
+		w[i].stop = 0;
+		w[i].lcore = lc;
+		if (0 != rte_eal_remote_launch(&ffdpdk_worker_run, &w[i], lc)) {
+			errlog(gdpdk, "rte_eal_remote_launch(): lcore%u", lc);
+			goto err;
+		}
+		i++;
+	}
+
+	if (i != n) {
+		errlog(gdpdk, "not enough CPU cores for %u workers", n);
+		goto err;
+	}
+	return 0;
+
+err:
+	ffdpdk_workers_stop(w, i);
+	return -1;
+}
+
+void ffdpdk_workers_stop(ffdpdk_worker *w, uint n)
+{
+	for (uint i = 0;  i != n;  i++) {
+		w[i].stop = 1;
+	}
+	for (uint i = 0;  i != n;  i++) {
+		rte_eal_wait_lcore(w[i].lcore);
+	}
+}
+
+void ffdpdk_worker_stat(const ffdpdk_worker *w, ffdpdk_wstat *st)
+{
+	st->recvd += w->rxq->stat.recvd;
+	st->dropped += w->rxq->stat.dropped;
+	if (w->txq != NULL) {
+		st->sent += w->txq->stat.sent;
+		if (w->txq != w->rxq)
+			st->dropped += w->txq->stat.dropped;
+	}
+	st->polls += w->polls;
+	st->bursts += w->bursts;
+	st->burst_pkts += w->bursts * ffmin(w->burst, FFDPDK_BURST_MAX);
+	st->flushes += w->flushes;
+	st->tsc_busy += w->tsc_busy;
+	st->tsc += w->tsc;
+	st->workers++;
+}
+
+void ffdpdk_wstat_rate(const ffdpdk_wstat *cur, const ffdpdk_wstat *prev, ffdpdk_wrate *r)
+{
+	ffmem_tzero(r);
+	uint64 tsc = cur->tsc - prev->tsc;
+	if (tsc == 0)
+		return;
+
+	// counters of several workers are summed up, but they run in parallel
+	double sec = (double)tsc / ffmax(cur->workers, 1) / rte_get_tsc_hz();
+	r->rx_pps = (cur->recvd - prev->recvd) / sec;
+	r->tx_pps = (cur->sent - prev->sent) / sec;
+	r->drop_pps = (cur->dropped - prev->dropped) / sec;
+
+	uint64 cap = cur->burst_pkts - prev->burst_pkts;
+	if (cap != 0)
+		r->fill = (cur->recvd - prev->recvd) * 100 / cap;
+	r->busy = (cur->tsc_busy - prev->tsc_busy) * 100 / tsc;
+}
+
+
 static int kni_change_mtu(uint16_t port_id, unsigned new_mtu)
 {
 	errlog(gdpdk, "KNI@port%u: MTU change isn't supported", port_id);
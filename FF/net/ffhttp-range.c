@@ -0,0 +1,217 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/net/http-range.h>
+#include <FF/number.h>
+#include <FFOS/random.h>
+
+
+/** Parse 1 range: "first-[last]" or "-suffix".
+Return 0 on success;  1 if the range isn't satisfiable;  -1 on syntax error. */
+static int range_parse1(const ffstr *s, uint64 size, uint64 *off, uint64 *len)
+{
+	uint64 first, last;
+	ffstr a, b;
+	const char *dash = ffs_find(s->ptr, s->len, '-');
+	if (dash == s->ptr + s->len)
+		return -1;
+	ffstr_set(&a, s->ptr, dash - s->ptr);
+	ffstr_set(&b, dash + 1, s->ptr + s->len - (dash + 1));
+
+	if (a.len == 0) {
+		// "-suffix"
+		if (!ffstr_toint(&b, &last, FFS_INT64))
+			return -1;
+		if (last == 0 || size == 0)
+			return 1;
+		last = ffmin64(last, size);
+		*off = size - last;
+		*len = last;
+		return 0;
+	}
+
+	if (!ffstr_toint(&a, &first, FFS_INT64))
+		return -1;
+	if (b.len == 0)
+		last = (uint64)-1; // "first-"
+	else if (!ffstr_toint(&b, &last, FFS_INT64))
+		return -1;
+	if (last < first)
+		return -1;
+
+	if (first >= size)
+		return 1;
+	last = ffmin64(last, size - 1);
+	*off = first;
+	*len = last - first + 1;
+	return 0;
+}
+
+static int part_cmp(const void *a, const void *b, void *udata)
+{
+	const ffhttp_range_part *p1 = a, *p2 = b;
+	return (p1->off > p2->off) - (p1->off < p2->off);
+}
+
+int ffhttp_ranges_parse(ffhttp_ranges *r, const char *d, size_t len, uint64 size)
+{
+	ffstr s, val;
+	uint n = 0;
+	ffhttp_range_part *p;
+
+	r->parts.len = 0;
+	r->cur = 0;
+	r->size = size;
+
+	ffstr_set(&s, d, len);
+	if (!ffs_imatchz(s.ptr, s.len, "bytes="))
+		return FFHTTP_RANGE_IGNORE;
+	ffstr_shift(&s, FFSLEN("bytes="));
+
+	while (s.len != 0) {
+		ffstr_nextval3(&s, &val, ',' | FFS_NV_TABS);
+		if (val.len == 0)
+			continue; // empty list element
+		if (++n > r->max_ranges)
+			return FFHTTP_RANGE_IGNORE;
+
+		uint64 off, sz;
+		int e = range_parse1(&val, size, &off, &sz);
+		if (e < 0)
+			return FFHTTP_RANGE_IGNORE;
+		else if (e > 0)
+			continue;
+
+		if (NULL == (p = ffarr_pushgrowT(&r->parts, 4, ffhttp_range_part)))
+			return FFHTTP_RANGE_IGNORE;
+		p->off = off;
+		p->len = sz;
+	}
+	if (n == 0)
+		return FFHTTP_RANGE_IGNORE;
+	if (r->parts.len == 0)
+		return FFHTTP_RANGE_UNSATISFIABLE;
+
+	// sort and merge overlapping and close ranges
+	ffhttp_range_part *parts = (void*)r->parts.ptr;
+	if (r->parts.len != 1)
+		ffsort(parts, r->parts.len, sizeof(ffhttp_range_part), &part_cmp, NULL);
+	size_t k = 0;
+	for (size_t i = 1;  i != r->parts.len;  i++) {
+		uint64 end = parts[k].off + parts[k].len;
+		if (parts[i].off <= end + r->coalesce_gap) {
+			parts[k].len = ffmax(end, parts[i].off + parts[i].len) - parts[k].off;
+			continue;
+		}
+		parts[++k] = parts[i];
+	}
+	r->parts.len = k + 1;
+	return FFHTTP_RANGE_OK;
+}
+
+int ffhttp_ranges_resp(ffhttp_ranges *r, ffhttp_cook *c, const ffstr *cont_type)
+{
+	char buf[128];
+	uint n;
+	ffhttp_range_part *p;
+
+	if (r->parts.len == 0) {
+		ffhttp_setstatus(c, FFHTTP_416_REQUESTED_RANGE_NOT_SATISFIABLE);
+		n = ffs_fmt(buf, buf + sizeof(buf), "bytes */%U", r->size);
+		ffhttp_addihdr(c, FFHTTP_CONTENT_RANGE, buf, n);
+		c->cont_len = 0;
+		r->body_len = 0;
+		return c->err;
+	}
+
+	ffhttp_setstatus(c, FFHTTP_206_PARTIAL);
+
+	if (r->parts.len == 1) {
+		p = (void*)r->parts.ptr;
+		n = ffs_fmt(buf, buf + sizeof(buf), "bytes %U-%U/%U"
+			, p->off, p->off + p->len - 1, r->size);
+		ffhttp_addihdr(c, FFHTTP_CONTENT_RANGE, buf, n);
+		if (cont_type != NULL)
+			c->cont_type = *cont_type;
+		c->cont_len = p->len;
+		r->body_len = p->len;
+		return c->err;
+	}
+
+	uint64 rnd = ((uint64)ffrnd_get() << 32) | ffrnd_get();
+	ffs_fromint(rnd, r->boundary, sizeof(r->boundary), FFINT_HEXLOW | FFINT_ZEROWIDTH | FFINT_WIDTH(16));
+
+	r->hdrs.len = 0;
+	r->body_len = 0;
+	FFARR_WALKT(&r->parts, p, ffhttp_range_part) {
+		p->hdr_off = r->hdrs.len;
+		if (0 == ffstr_catfmt(&r->hdrs, "%*s--%*s" FFCRLF
+			, (size_t)((p != (void*)r->parts.ptr) ? 2 : 0), FFCRLF
+			, sizeof(r->boundary), r->boundary))
+			return -1;
+		if (cont_type != NULL
+			&& 0 == ffstr_catfmt(&r->hdrs, "Content-Type: %S" FFCRLF, cont_type))
+			return -1;
+		if (0 == ffstr_catfmt(&r->hdrs, "Content-Range: bytes %U-%U/%U" FFCRLF FFCRLF
+			, p->off, p->off + p->len - 1, r->size))
+			return -1;
+		p->hdr_len = r->hdrs.len - p->hdr_off;
+		r->body_len += p->hdr_len + p->len;
+	}
+	r->end_off = r->hdrs.len;
+	if (0 == ffstr_catfmt(&r->hdrs, FFCRLF "--%*s--" FFCRLF, sizeof(r->boundary), r->boundary))
+		return -1;
+	r->end_len = r->hdrs.len - r->end_off;
+	r->body_len += r->end_len;
+
+	r->ctype.len = 0;
+	if (0 == ffstr_catfmt(&r->ctype, "multipart/byteranges; boundary=%*s", sizeof(r->boundary), r->boundary))
+		return -1;
+	ffstr_set2(&c->cont_type, &r->ctype);
+	c->cont_len = r->body_len;
+	return c->err;
+}
+
+int ffhttp_ranges_next(ffhttp_ranges *r, const ffsf *file, ffsf *part)
+{
+	if (r->cur == r->parts.len)
+		return 0;
+	const ffhttp_range_part *p = ffarr_itemT(&r->parts, r->cur++, ffhttp_range_part);
+
+	ffsf_init(part);
+	fffile_mapset(&part->fm, file->fm.blocksize, file->fm.fd, file->fm.foff + p->off, p->len);
+
+	if (r->parts.len == 1)
+		return 1;
+
+	ffiov_set(&r->iov[0], r->hdrs.ptr + p->hdr_off, p->hdr_len);
+	part->ht.headers = &r->iov[0];
+	part->ht.hdr_cnt = 1;
+	if (r->cur == r->parts.len) {
+		ffiov_set(&r->iov[1], r->hdrs.ptr + r->end_off, r->end_len);
+		part->ht.trailers = &r->iov[1];
+		part->ht.trl_cnt = 1;
+	}
+	return 1;
+}
+
+uint ffhttp_ranges_iov(ffhttp_ranges *r, const char *data, ffiovec *iov)
+{
+	const ffhttp_range_part *p;
+	uint n = 0;
+
+	if (r->parts.len == 1) {
+		p = (void*)r->parts.ptr;
+		ffiov_set(&iov[n++], data + p->off, p->len);
+		return n;
+	}
+
+	FFARR_WALKT(&r->parts, p, ffhttp_range_part) {
+		ffiov_set(&iov[n++], r->hdrs.ptr + p->hdr_off, p->hdr_len);
+		ffiov_set(&iov[n++], data + p->off, p->len);
+	}
+	if (r->parts.len != 0)
+		ffiov_set(&iov[n++], r->hdrs.ptr + r->end_off, r->end_len);
+	return n;
+}
@@ -0,0 +1,883 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/net/http-server.h>
+#include <FF/list.h>
+#include <FFOS/error.h>
+
+
+struct ffhttpsv {
+	struct ffhttpsv_conf conf;
+	ffaio_acceptor acc;
+	ffskt lsk;
+	fflist conns; //ffhttpsv_conn[]
+	fflist1 recycled_conns;
+	fflist1 free_bufs;
+	uint nfree_bufs;
+	uint nused_bufs;
+	uint listening :1
+		, accept_paused :1
+		;
+	struct ffhttpsv_stat stat;
+};
+
+struct filter {
+	const struct ffhttp_filter *iface;
+	void *p;
+};
+
+struct ffhttpsv_conn {
+	ffhttpsv *sv;
+	uint state;
+	fflist_item sib;
+	fflist1_item recycled;
+	ffskt sk;
+	ffaio_task aio;
+	ffaddr peer;
+	fftmrq_entry tmr;
+
+	char *buf; // request headers and pipelined data
+	size_t len; // filled bytes in 'buf'
+	size_t off; // offset of the unprocessed data in 'buf'
+	ffhttp_request req;
+	struct filter f;
+	ffarr body; // request body
+
+	ffhttp_cook resp; // status and headers set by user
+	ffhttp_cook out; // the final response headers
+	char chunk_hdr[FFINT_MAXCHARS + 2];
+	ffiovec iov[8];
+	ffiovec *iov_cur;
+	uint iov_n;
+	ffsf *sf; // data to send from file:  NULL or 'sf_out'
+	ffsf sf_out; // the user's object with response headers and chunk framing in 'ht'
+	ffsf *sf_user; // the user's object:  the file mapping state is copied back to it
+
+	uint nreqs;
+	void *udata;
+	uint resp_started :1
+		, resp_more :1 // more body data will follow
+		, resp_chunked :1
+		, resp_nobody :1
+		, conn_close :1
+		, user :1 // FFHTTPSV_REQUEST has been delivered
+		, in_handler :1
+		;
+};
+
+
+#define dbglog(...) \
+do { \
+	if (c->sv->conf.debug_log) \
+		c->sv->conf.log(c->sv->conf.udata, FFHTTPSV_LOG_DEBUG, __VA_ARGS__); \
+} while (0)
+#define warnlog(...)  c->sv->conf.log(c->sv->conf.udata, FFHTTPSV_LOG_WARN, __VA_ARGS__)
+#define syswarnlog(...)  c->sv->conf.log(c->sv->conf.udata, FFHTTPSV_LOG_WARN | FFHTTPSV_LOG_SYS, __VA_ARGS__)
+#define syserrlog(...)  c->sv->conf.log(c->sv->conf.udata, FFHTTPSV_LOG_ERR | FFHTTPSV_LOG_SYS, __VA_ARGS__)
+
+enum {
+	R_ASYNC = 1,
+	R_DATA,
+	R_DONE,
+	R_ERR,
+};
+
+enum {
+	I_RECV, I_PARSE, I_RECVBODY, I_BODY, I_USER, I_USER_WAIT, I_SEND, I_SENT, I_FIN,
+	I_ERR_RESP, I_CLOSE,
+};
+
+static void conn_process(ffhttpsv_conn *c);
+static void conn_close(ffhttpsv_conn *c);
+static void sv_accept(void *udata);
+
+static const struct ffhttp_filter*const req_filters[] = {
+	&ffhttp_chunked_filter, &ffhttp_contlen_filter
+};
+
+
+static void log_empty(void *udata, uint level, const char *fmt, ...)
+{
+}
+
+void ffhttpsv_conf_init(struct ffhttpsv_conf *conf)
+{
+	ffmem_tzero(conf);
+	conf->kq = FF_BADFD;
+	conf->log = &log_empty;
+	conf->max_conns = 10000;
+	conf->buffer_size = 4 * 1024;
+	conf->max_free_buffers = 1000;
+	conf->max_body = 1 * 1024 * 1024;
+	conf->max_keepalive = 1000;
+	conf->read_timeout = 65 * 1000;
+	conf->write_timeout = 65 * 1000;
+	conf->keepalive_timeout = 65 * 1000;
+}
+
+ffhttpsv* ffhttpsv_create(const struct ffhttpsv_conf *conf)
+{
+	ffhttpsv *sv;
+	if (NULL == (sv = ffmem_new(ffhttpsv)))
+		return NULL;
+	sv->conf = *conf;
+	if (sv->conf.log == NULL)
+		sv->conf.log = &log_empty;
+	sv->lsk = FF_BADSKT;
+	fflist_init(&sv->conns);
+	return sv;
+}
+
+void ffhttpsv_free(ffhttpsv *sv)
+{
+	if (sv == NULL)
+		return;
+
+	if (sv->listening) {
+		ffaio_acceptfin(&sv->acc);
+		sv->listening = 0;
+	}
+
+	ffhttpsv_conn *c;
+	fflist_item *next;
+	FFLIST_WALKSAFE(&sv->conns, c, sib, next) {
+		conn_close(c);
+	}
+
+	while (NULL != (c = (void*)fflist1_pop(&sv->recycled_conns))) {
+		c = FF_GETPTR(ffhttpsv_conn, recycled, c);
+		ffhttp_cookdestroy(&c->resp);
+		ffhttp_cookdestroy(&c->out);
+		ffmem_free(c);
+	}
+
+	void *b;
+	while (NULL != (b = fflist1_pop(&sv->free_bufs))) {
+		ffmem_free(b);
+	}
+
+	ffmem_free(sv);
+}
+
+void ffhttpsv_stat(ffhttpsv *sv, struct ffhttpsv_stat *st)
+{
+	*st = sv->stat;
+	st->conns_active = sv->conns.len;
+	st->bufs_used = sv->nused_bufs;
+	st->bufs_free = sv->nfree_bufs;
+}
+
+
+/** Get buffer from pool. */
+static char* buf_get(ffhttpsv *sv)
+{
+	char *b;
+	if (NULL != (b = (void*)fflist1_pop(&sv->free_bufs)))
+		sv->nfree_bufs--;
+	else if (NULL == (b = ffmem_alloc(sv->conf.buffer_size)))
+		return NULL;
+	sv->nused_bufs++;
+	return b;
+}
+
+/** Return buffer to pool. */
+static void buf_put(ffhttpsv *sv, char *b)
+{
+	sv->nused_bufs--;
+	if (sv->nfree_bufs == sv->conf.max_free_buffers) {
+		ffmem_free(b);
+		return;
+	}
+	fflist1_push(&sv->free_bufs, (fflist1_item*)b);
+	sv->nfree_bufs++;
+}
+
+
+int ffhttpsv_listen(ffhttpsv *sv, ffskt lsk, int family)
+{
+	if (0 != ffaio_acceptinit(&sv->acc, sv->conf.kq, lsk, sv, family, SOCK_STREAM))
+		return -1;
+	sv->lsk = lsk;
+	sv->listening = 1;
+	sv_accept(sv);
+	return 0;
+}
+
+/** Accept connections until there are no more pending, or until the limit is reached. */
+static void sv_accept(void *udata)
+{
+	ffhttpsv *sv = udata;
+	ffaddr local, peer;
+	ffskt sk;
+
+	for (;;) {
+		if (sv->conns.len >= sv->conf.max_conns) {
+			if (!sv->accept_paused) {
+				sv->accept_paused = 1;
+				sv->stat.accept_paused++;
+			}
+			return;
+		}
+
+		if (FF_BADSKT == (sk = ffaio_accept(&sv->acc, &local, &peer, SOCK_NONBLOCK, &sv_accept))) {
+			if (fferr_again(fferr_last()))
+				return;
+			sv->conf.log(sv->conf.udata, FFHTTPSV_LOG_ERR | FFHTTPSV_LOG_SYS, "%s", ffskt_accept_S);
+			// e.g. too many open files: retry when a connection is closed
+			sv->accept_paused = 1;
+			return;
+		}
+
+		ffhttpsv_conn_add(sv, sk, &peer);
+	}
+}
+
+int ffhttpsv_conn_add(ffhttpsv *sv, ffskt sk, const ffaddr *peer)
+{
+	ffhttpsv_conn *c;
+	if (NULL != (c = (void*)fflist1_pop(&sv->recycled_conns)))
+		c = FF_GETPTR(ffhttpsv_conn, recycled, c);
+	else if (NULL == (c = ffmem_new(ffhttpsv_conn))) {
+		ffskt_close(sk);
+		return -1;
+	}
+
+	c->sv = sv;
+	c->sk = sk;
+	c->peer = *peer;
+	c->tmr.param = c;
+	ffhttp_req_init(&c->req);
+	ffhttp_cookinit(&c->resp, c->resp.buf.ptr, c->resp.buf.cap);
+	fflist_ins(&sv->conns, &c->sib);
+	sv->stat.conns++;
+
+	ffaio_init(&c->aio);
+	c->aio.sk = sk;
+	c->aio.udata = c;
+	if (0 != ffaio_attach(&c->aio, sv->conf.kq, FFKQU_READ | FFKQU_WRITE)) {
+		syserrlog("%s", ffkqu_attach_S);
+		conn_close(c);
+		return -1;
+	}
+
+	if (sv->conf.debug_log) {
+		char saddr[FF_MAXIP6];
+		size_t n = ffaddr_tostr(peer, saddr, sizeof(saddr), FFADDR_USEPORT);
+		dbglog("%p: new connection from %*s [%u]", c, n, saddr, sv->conns.len);
+	}
+
+	c->state = I_RECV;
+	conn_process(c);
+	return 0;
+}
+
+static void conn_close(ffhttpsv_conn *c)
+{
+	ffhttpsv *sv = c->sv;
+	dbglog("%p: closing connection", c);
+
+	if (fftmrq_active(sv->conf.tmrq, &c->tmr))
+		fftmrq_rm(sv->conf.tmrq, &c->tmr);
+
+	if (c->user)
+		sv->conf.handler(c, FFHTTPSV_CLOSE);
+
+	FF_SAFECLOSE(c->f.p, NULL, c->f.iface->close);
+	ffhttp_req_free(&c->req);
+	ffarr_free(&c->body);
+	if (c->buf != NULL)
+		buf_put(sv, c->buf);
+
+	if (c->sk != FF_BADSKT) {
+		ffskt_fin(c->sk);
+		ffskt_close(c->sk);
+	}
+	ffaio_fin(&c->aio);
+	fflist_rm(&sv->conns, &c->sib);
+
+	// header buffers are kept for the next connection
+	ffarr rbuf = c->resp.buf, obuf = c->out.buf;
+	uint inst = c->aio.instance;
+	ffmem_tzero(c);
+	c->aio.instance = inst;
+	c->resp.buf.ptr = rbuf.ptr;
+	c->resp.buf.cap = rbuf.cap;
+	c->out.buf.ptr = obuf.ptr;
+	c->out.buf.cap = obuf.cap;
+	fflist1_push(&sv->recycled_conns, &c->recycled);
+
+	if (sv->accept_paused && sv->listening) {
+		sv->accept_paused = 0;
+		sv_accept(sv);
+	}
+}
+
+
+static void conn_ontmr(void *param)
+{
+	ffhttpsv_conn *c = param;
+	dbglog("%p: timeout", c);
+	c->sv->stat.timeouts++;
+	conn_close(c);
+}
+
+/** Set timer.  The previous timer is removed. */
+static void conn_timer(ffhttpsv_conn *c, uint value_ms)
+{
+	fftimer_queue *tq = c->sv->conf.tmrq;
+	if (fftmrq_active(tq, &c->tmr))
+		fftmrq_rm(tq, &c->tmr);
+	if (value_ms == 0)
+		return;
+	c->tmr.handler = &conn_ontmr;
+	fftmrq_add(tq, &c->tmr, -(int)value_ms);
+}
+
+static void conn_aio(void *udata)
+{
+	ffhttpsv_conn *c = udata;
+	conn_timer(c, 0);
+	conn_process(c);
+}
+
+/** Receive more data into buffer. */
+static int conn_recv(ffhttpsv_conn *c)
+{
+	ssize_t r;
+
+	if (c->buf == NULL
+		&& NULL == (c->buf = buf_get(c->sv))) {
+		syserrlog("%s", ffmem_alloc_S);
+		return R_ERR;
+	}
+
+	if (c->len == c->sv->conf.buffer_size) {
+		warnlog("%p: buffer is full", c);
+		return R_ERR;
+	}
+
+	r = ffaio_recv(&c->aio, &conn_aio, c->buf + c->len, c->sv->conf.buffer_size - c->len);
+	if (r == FFAIO_ASYNC) {
+		uint tmr = c->sv->conf.read_timeout;
+		if (c->len == 0) {
+			// idle connection doesn't need a buffer while waiting
+			buf_put(c->sv, c->buf);
+			c->buf = NULL;
+			if (c->nreqs != 0)
+				tmr = c->sv->conf.keepalive_timeout;
+		}
+		conn_timer(c, tmr);
+		return R_ASYNC;
+	}
+
+	if (r == 0) {
+		if (c->len != 0)
+			warnlog("%p: client has closed connection", c);
+		return R_DONE;
+	} else if (r < 0) {
+		syswarnlog("%s", ffskt_recv_S);
+		return R_ERR;
+	}
+
+	dbglog("%p: recv: +%L [%L]", c, r, c->len + r);
+	c->len += r;
+	return R_DATA;
+}
+
+/** Parse request headers.
+Return 0: done;  R_ASYNC: need more data;  R_ERR: error (error response is prepared). */
+static int req_parse(ffhttpsv_conn *c)
+{
+	int r = ffhttp_req(&c->req, c->buf, c->len);
+	switch (r) {
+	case FFHTTP_DONE:
+		break;
+
+	case FFHTTP_MORE:
+		if (c->len != c->sv->conf.buffer_size)
+			return R_ASYNC;
+		r = FFHTTP_ETOOLARGE;
+		//fallthrough
+
+	default:
+		warnlog("%p: parse HTTP request: %s", c, ffhttp_errstr(r));
+		ffhttp_setstatus(&c->resp, (r == FFHTTP_ETOOLARGE) ? FFHTTP_413_REQUEST_ENTITY_TOO_LARGE : FFHTTP_400_BAD_REQUEST);
+		return R_ERR;
+	}
+
+	if (c->sv->conf.debug_log) {
+		ffstr line = ffhttp_firstline(&c->req.h);
+		dbglog("%p: request: %S", c, &line);
+	}
+	c->off = c->req.h.len;
+	if (c->nreqs != 0)
+		c->sv->stat.keepalive_reqs++;
+
+	if (c->req.h.has_body) {
+		const struct ffhttp_filter *const *f;
+		FFARRS_FOREACH(req_filters, f) {
+			void *d = (*f)->open(&c->req.h);
+			if (d == NULL)
+				continue;
+			else if (d == (void*)-1) {
+				ffhttp_setstatus(&c->resp, FFHTTP_500_INTERNAL_SERVER_ERROR);
+				return R_ERR;
+			}
+			c->f.iface = *f;
+			c->f.p = d;
+			break;
+		}
+		if (c->f.p == NULL) {
+			ffhttp_setstatus(&c->resp, FFHTTP_400_BAD_REQUEST);
+			return R_ERR;
+		}
+		if (c->req.h.cont_len > (int64)c->sv->conf.max_body) {
+			ffhttp_setstatus(&c->resp, FFHTTP_413_REQUEST_ENTITY_TOO_LARGE);
+			return R_ERR;
+		}
+	}
+	return 0;
+}
+
+static int body_add(ffhttpsv_conn *c, const void *d, size_t n)
+{
+	if (c->body.len + n > c->sv->conf.max_body) {
+		ffhttp_setstatus(&c->resp, FFHTTP_413_REQUEST_ENTITY_TOO_LARGE);
+		return R_ERR;
+	}
+	if (NULL == ffarr_append(&c->body, d, n)) {
+		ffhttp_setstatus(&c->resp, FFHTTP_500_INTERNAL_SERVER_ERROR);
+		return R_ERR;
+	}
+	return 0;
+}
+
+/** Get chunked request body: all chunks in buffer are processed at once. */
+static int req_body_chunked(ffhttpsv_conn *c)
+{
+	ffhttp_chunked *ch = c->f.p; // ffhttp_chunked_filter object
+	ffiovec iov[16];
+
+	for (;;) {
+		size_t n = c->len - c->off;
+		uint niov = FFCNT(iov);
+		int r = ffhttp_chunkparse_v(ch, c->buf + c->off, &n, iov, &niov);
+		c->off += n;
+
+		if (ffhttp_iserr(r)) {
+			warnlog("%p: request body: %s", c, ffhttp_errstr(r));
+			ffhttp_setstatus(&c->resp, FFHTTP_400_BAD_REQUEST);
+			return R_ERR;
+		}
+
+		for (uint i = 0;  i != niov;  i++) {
+			if (0 != body_add(c, iov[i].iov_base, iov[i].iov_len))
+				return R_ERR;
+		}
+
+		if (r == FFHTTP_DONE)
+			return 0;
+		if (r == FFHTTP_MORE)
+			break;
+	}
+
+	c->len = c->off = c->req.h.len;
+	return R_ASYNC;
+}
+
+/** Get request body from buffer.
+Return 0: done;  R_ASYNC: need more data;  R_ERR: error. */
+static int req_body(ffhttpsv_conn *c)
+{
+	if (c->f.iface == &ffhttp_chunked_filter)
+		return req_body_chunked(c);
+
+	ffstr in, out;
+	ffstr_set(&in, c->buf + c->off, c->len - c->off);
+
+	for (;;) {
+		int r = c->f.iface->process(c->f.p, &in, &out);
+		if (ffhttp_iserr(r)) {
+			warnlog("%p: request body: %s", c, ffhttp_errstr(r));
+			ffhttp_setstatus(&c->resp, FFHTTP_400_BAD_REQUEST);
+			return R_ERR;
+		}
+
+		if (out.len != 0 && 0 != body_add(c, out.ptr, out.len))
+			return R_ERR;
+
+		if (r == FFHTTP_DONE) {
+			c->off = in.ptr - c->buf;
+			return 0;
+		}
+		if (in.len == 0)
+			break;
+	}
+
+	// all body data in buffer is consumed: receive more data after the headers
+	c->len = c->off = c->req.h.len;
+	return R_ASYNC;
+}
+
+/** Prepare the next request on this connection. */
+static void req_fin(ffhttpsv_conn *c)
+{
+	FF_SAFECLOSE(c->f.p, NULL, c->f.iface->close);
+	ffhttp_req_free(&c->req);
+	ffhttp_req_init(&c->req);
+	c->body.len = 0;
+	ffhttp_cookreset(&c->resp);
+	c->resp.buf.len = 0;
+	c->out.buf.len = 0;
+	c->sf = NULL;
+	c->resp_started = c->resp_more = c->resp_chunked = c->resp_nobody = 0;
+	c->nreqs++;
+
+	// move pipelined data to the beginning of buffer
+	size_t n = c->len - c->off;
+	if (n != 0)
+		memmove(c->buf, c->buf + c->off, n);
+	c->len = n;
+	c->off = 0;
+	if (n == 0) {
+		buf_put(c->sv, c->buf);
+		c->buf = NULL;
+	}
+}
+
+/** Send data from iovec array or from file. */
+static int conn_send(ffhttpsv_conn *c)
+{
+	int64 r;
+
+	for (;;) {
+		if (c->sf != NULL) {
+			r = ffsf_sendasync(c->sf, &c->aio, &conn_aio);
+			c->sf_user->fm = c->sf->fm;
+		} else
+			r = ffaio_sendv(&c->aio, &conn_aio, c->iov_cur, c->iov_n);
+
+		if (r == FFAIO_ASYNC) {
+			conn_timer(c, c->sv->conf.write_timeout);
+			return R_ASYNC;
+		} else if (r < 0) {
+			syswarnlog("%s", ffskt_send_S);
+			return R_ERR;
+		}
+
+		dbglog("%p: send: +%D", c, r);
+		if (c->sf != NULL) {
+			r = ffsf_shift(c->sf, r);
+			c->sf_user->fm = c->sf->fm;
+			if (r == 0)
+				return 0;
+		} else {
+			uint64 by = r;
+			size_t n = ffiov_shiftv(c->iov_cur, c->iov_n, &by);
+			c->iov_cur += n;
+			c->iov_n -= n;
+			if (c->iov_n == 0)
+				return 0;
+		}
+	}
+}
+
+/** Prepare response headers. */
+static int resp_hdrs(ffhttpsv_conn *c, uint64 body_len, uint flags)
+{
+	const ffhttp_request *req = &c->req;
+	ffhttp_cook *o = &c->out;
+
+	// copy status and special fields set by user
+	ffarr b = o->buf;
+	*o = c->resp;
+	o->buf = b;
+	o->buf.len = 0;
+
+	if (c->resp.code == 0)
+		ffhttp_setstatus(o, FFHTTP_200_OK);
+
+	if (req->h.conn_close
+		|| c->nreqs + 1 == c->sv->conf.max_keepalive)
+		o->conn_close = 1;
+	o->http10_keepalive = (!req->h.http11 && !o->conn_close);
+	c->resp_nobody = (req->method == FFHTTP_HEAD || ffhttp_resp_nobody(o->code));
+
+	if (o->cont_len == -1 && !ffhttp_resp_nobody(o->code)) {
+		if (!(flags & FFHTTPSV_MORE))
+			o->cont_len = body_len;
+		else if (req->h.http11 && o->trans_enc.len == 0) {
+			ffstr_setz(&o->trans_enc, "chunked");
+			c->resp_chunked = 1;
+		} else
+			o->conn_close = 1; // the end of body is signalled by closing the connection
+	}
+	c->conn_close = o->conn_close;
+
+	ffhttp_addstatus(o);
+	ffarr_append(&o->buf, c->resp.buf.ptr, c->resp.buf.len);
+	ffhttp_cookflush(o);
+	if (0 != ffhttp_cookfin(o))
+		return -1;
+	return 0;
+}
+
+/** Prepare iovec array for: [headers] [chunk header] [data] [chunk trailer] */
+static int resp_prep(ffhttpsv_conn *c, const ffstr *data, uint64 data_len, uint flags)
+{
+	uint n = 0;
+
+	if (!c->resp_started) {
+		c->resp_started = 1;
+		if (0 != resp_hdrs(c, data_len, flags))
+			return -1;
+		dbglog("%p: response: %*s", c, c->out.buf.len, c->out.buf.ptr);
+		ffiov_set(&c->iov[n++], c->out.buf.ptr, c->out.buf.len);
+	}
+
+	if (c->resp_nobody)
+		data_len = 0;
+
+	// a response without body (e.g. to HEAD) has no chunk framing:  only the headers are sent
+	uint chunked = c->resp_chunked && !c->resp_nobody;
+
+	if (chunked && data_len != 0) {
+		uint r = ffhttp_chunkbegin(c->chunk_hdr, sizeof(c->chunk_hdr), data_len);
+		ffiov_set(&c->iov[n++], c->chunk_hdr, r);
+	}
+
+	if (data != NULL && data_len != 0)
+		ffiov_set(&c->iov[n++], data->ptr, data->len);
+
+	if (chunked) {
+		const char *s;
+		uint r;
+		if (flags & FFHTTPSV_MORE)
+			r = (data_len != 0) ? ffhttp_chunkfin(&s, FFHTTP_CHUNKFIN) : 0;
+		else
+			r = ffhttp_chunkfin(&s, (data_len != 0) ? FFHTTP_CHUNKLAST : FFHTTP_CHUNKZERO);
+		if (r != 0)
+			ffiov_set(&c->iov[n++], (void*)s, r);
+	}
+
+	c->iov_cur = c->iov;
+	c->iov_n = n;
+	c->resp_more = !!(flags & FFHTTPSV_MORE);
+	return 0;
+}
+
+/** Continue processing after the user has sent data.
+If called from within the user handler, conn_process() will continue after the handler returns. */
+static void conn_resume(ffhttpsv_conn *c, uint state)
+{
+	c->state = state;
+	if (!c->in_handler)
+		conn_process(c);
+}
+
+void ffhttpsv_send(ffhttpsv_conn *c, const ffstr *data, uint flags)
+{
+	FF_ASSERT(c->state == I_USER_WAIT);
+	c->sf = NULL;
+	if (0 != resp_prep(c, data, (data != NULL) ? data->len : 0, flags)) {
+		conn_resume(c, I_CLOSE);
+		return;
+	}
+	conn_resume(c, I_SEND);
+}
+
+void ffhttpsv_sendfile(ffhttpsv_conn *c, ffsf *sf, uint flags)
+{
+	FF_ASSERT(c->state == I_USER_WAIT);
+	c->sf = NULL;
+	if (0 != resp_prep(c, NULL, ffsf_len(sf), flags))
+		goto err;
+
+	if (c->resp_nobody) {
+		conn_resume(c, I_SEND);
+		return;
+	}
+
+	// the user's 'ht' isn't modified: the merged list is in 'c->iov'
+	c->sf_out = *sf;
+	c->sf_user = sf;
+	uint i = c->iov_n;
+
+	if ((sf->ht.hdr_cnt | sf->ht.trl_cnt) != 0) {
+		// [response headers] [user headers] (file) [user trailers]
+		if (c->resp_chunked) {
+			warnlog("%p: sendfile: headers and trailers can't be sent in chunked response", c);
+			goto err;
+		}
+		if (i + sf->ht.hdr_cnt > FFCNT(c->iov)) {
+			warnlog("%p: sendfile: too many headers: %u", c, (int)sf->ht.hdr_cnt);
+			goto err;
+		}
+		ffmemcpy(&c->iov[i], sf->ht.headers, sf->ht.hdr_cnt * sizeof(ffiovec));
+		c->sf_out.ht.hdr_cnt += i;
+
+	} else {
+		// [headers] [chunk header] (file) [chunk trailer]
+		if (c->resp_chunked && sf->fm.fsize != 0)
+			c->sf_out.ht.trailers = &c->iov[--i];
+		c->sf_out.ht.trl_cnt = c->iov_n - i;
+		c->sf_out.ht.hdr_cnt = i;
+	}
+
+	c->sf_out.ht.headers = c->iov;
+	c->sf = &c->sf_out;
+	conn_resume(c, I_SEND);
+	return;
+
+err:
+	conn_resume(c, I_CLOSE);
+}
+
+/** Send a short response generated by the server. */
+static void resp_err(ffhttpsv_conn *c)
+{
+	c->sv->stat.errors++;
+	c->resp.conn_close = 1;
+	c->resp.cont_len = 0;
+	c->resp.buf.len = 0;
+	resp_prep(c, NULL, 0, 0);
+}
+
+
+static void conn_process(ffhttpsv_conn *c)
+{
+	int r;
+
+	for (;;) {
+	switch (c->state) {
+
+	case I_RECV:
+	case I_RECVBODY:
+		r = conn_recv(c);
+		if (r == R_ASYNC)
+			return;
+		else if (r != R_DATA) {
+			c->sv->stat.errors += (r == R_ERR);
+			c->state = I_CLOSE;
+			continue;
+		}
+		c->state = (c->state == I_RECVBODY) ? I_BODY : I_PARSE;
+		continue;
+
+	case I_PARSE:
+		r = req_parse(c);
+		if (r == R_ASYNC) {
+			// parse again when more data is received
+			ffhttp_req_free(&c->req);
+			ffhttp_req_init(&c->req);
+			c->state = I_RECV;
+			continue;
+		} else if (r == R_ERR) {
+			c->state = I_ERR_RESP;
+			continue;
+		}
+		c->state = (c->req.h.has_body) ? I_BODY : I_USER;
+		continue;
+
+	case I_BODY:
+		r = req_body(c);
+		if (r == R_ASYNC) {
+			c->state = I_RECVBODY;
+			continue;
+		} else if (r == R_ERR) {
+			c->state = I_ERR_RESP;
+			continue;
+		}
+		c->state = I_USER;
+		//fallthrough
+
+	case I_USER:
+		c->state = I_USER_WAIT;
+		c->user = 1;
+		c->in_handler = 1;
+		c->sv->conf.handler(c, FFHTTPSV_REQUEST);
+		c->in_handler = 0;
+		continue;
+
+	case I_USER_WAIT:
+		return;
+
+	case I_SEND:
+		r = conn_send(c);
+		if (r == R_ASYNC)
+			return;
+		else if (r == R_ERR) {
+			c->sv->stat.errors++;
+			c->state = I_CLOSE;
+			continue;
+		}
+		c->state = I_SENT;
+		//fallthrough
+
+	case I_SENT:
+		if (c->resp_more) {
+			c->state = I_USER_WAIT;
+			c->in_handler = 1;
+			c->sv->conf.handler(c, FFHTTPSV_SENT);
+			c->in_handler = 0;
+			continue;
+		}
+		c->state = I_FIN;
+		//fallthrough
+
+	case I_FIN:
+		c->sv->stat.reqs++;
+		if (c->conn_close) {
+			c->state = I_CLOSE;
+			continue;
+		}
+		req_fin(c);
+		c->state = (c->len != 0) ? I_PARSE : I_RECV; // parse the pipelined data first
+		continue;
+
+	case I_ERR_RESP:
+		resp_err(c);
+		c->sf = NULL;
+		c->state = I_SEND;
+		continue;
+
+	case I_CLOSE:
+		conn_close(c);
+		return;
+	}
+	}
+}
+
+
+const ffhttp_request* ffhttpsv_req(ffhttpsv_conn *c)
+{
+	return &c->req;
+}
+
+ffstr ffhttpsv_reqbody(ffhttpsv_conn *c)
+{
+	ffstr s;
+	ffstr_set2(&s, &c->body);
+	return s;
+}
+
+ffhttp_cook* ffhttpsv_resp(ffhttpsv_conn *c)
+{
+	return &c->resp;
+}
+
+void ffhttpsv_setudata(ffhttpsv_conn *c, void *udata)
+{
+	c->udata = udata;
+}
+
+void* ffhttpsv_udata(ffhttpsv_conn *c)
+{
+	return c->udata;
+}
+
+void* ffhttpsv_conn_srvdata(ffhttpsv_conn *c)
+{
+	return c->sv->conf.udata;
+}
@@ -1291,20 +1291,21 @@ static FFINL int chnk_size(ffhttp_chunked *c, int ch)
 hi CRLF
 0  CRLF
    CRLF */
+enum CHNK_STATE {
+	iStart = 0, iSize
+	, iExt
+	, iBeforeDataLF
+	, iData, iAfterData, iAfterDataLF
+	, iTrlStart, iTrlLF
+	, iTrlHdr, iTrlHdrLF
+};
+
 int ffhttp_chunkparse(ffhttp_chunked *c, const char *body, size_t *len, ffstr *dst)
 {
 	size_t i;
 	int r = FFHTTP_EEOL;
 	int t;
 	int st = c->state;
-	enum {
-		iStart = 0, iSize
-		, iExt
-		, iBeforeDataLF
-		, iData, iAfterData, iAfterDataLF
-		, iTrlStart, iTrlLF
-		, iTrlHdr, iTrlHdrLF
-	};
 
 	for (i = 0;  i < *len;  i++) {
 		int ch = body[i];
@@ -1450,6 +1451,127 @@ end:
 	return r;
 }
 
+/** Parse chunk size line "HEX [;EXT] [CR] LF" at once.
+Return the line length;  0 if the line isn't complete or isn't valid:
+ the caller falls back to the state machine. */
+static FFINL size_t chnk_sizeline(const char *d, size_t len, uint64 *size)
+{
+	uint64 sz = 0;
+	size_t i;
+	int h;
+	size_t n = ffmin(len, 16);
+	for (i = 0;  i != n && -1 != (h = ffchar_tohex(d[i]));  i++) {
+		sz = sz * 16 + h;
+	}
+
+	if (i == 0 || i == 16 || i == len)
+		return 0;
+
+	if (d[i] == ';' || d[i] == ' ' || d[i] == '\t') {
+		// skip chunk extension: find LF with memchr() which is vectorized
+		const char *lf = ffs_findc(d + i, len - i, LF);
+		if (lf == NULL)
+			return 0;
+		const char *cr = ffs_findc(d + i, lf - (d + i), CR);
+		if (cr != NULL && cr != lf - 1)
+			return 0; // CR not followed by LF
+		*size = sz;
+		return lf + 1 - d;
+	}
+
+	if (d[i] == CR)
+		i++;
+	if (i == len || d[i] != LF)
+		return 0;
+
+	*size = sz;
+	return i + 1;
+}
+
+/*
+Fast path handles complete chunk size lines, data and CRLF after data,
+ everything else (partial lines, trailers, errors) is processed by ffhttp_chunkparse().
+Parser state is kept in local variables: stores to 'iov' may alias 'c'. */
+int ffhttp_chunkparse_v(ffhttp_chunked *c, const char *body, size_t *len, ffiovec *iov, uint *n_iov)
+{
+	const char *d = body, *end = body + *len;
+	uint n = 0, cap = *n_iov;
+	uint st = c->state;
+	uint64 cursiz = c->cursiz;
+	int r = FFHTTP_MORE;
+
+	if (c->last && d != end && n != cap)
+		goto slow; // the slow path writes to 'iov' without checking the capacity
+
+	while (d != end && n != cap) {
+
+		if (st == iStart) {
+			size_t k = chnk_sizeline(d, end - d, &cursiz);
+			if (k == 0)
+				goto slow;
+			d += k;
+			if (cursiz == 0) {
+				c->last = 1;
+				st = iTrlStart;
+				goto slow; // the trailer is processed by the state machine
+			}
+			st = iData;
+		}
+
+		if (st == iData) {
+			if (cursiz != 0) {
+				size_t sz = (size_t)ffmin64(cursiz, (uint64)(end - d));
+				ffiov_set(&iov[n++], d, sz);
+				cursiz -= sz;
+				d += sz;
+				if (cursiz != 0)
+					break; // all input is processed
+			}
+			st = iAfterData;
+		}
+
+		if (st == iAfterData) {
+			if (end - d >= 2 && d[0] == CR && d[1] == LF) {
+				d += 2;
+				st = iStart;
+				continue;
+			} else if (d != end && d[0] == LF) {
+				d++;
+				st = iStart;
+				continue;
+			} else if (d == end) {
+				break;
+			}
+		}
+
+slow:
+		if (n != 0)
+			break; // return data now, the rest is processed by the state machine on the next call
+
+		c->state = st;
+		c->cursiz = cursiz;
+		size_t sz = end - d;
+		ffstr s;
+		r = ffhttp_chunkparse(c, d, &sz, &s);
+		st = c->state;
+		cursiz = c->cursiz;
+		d += sz;
+		if (r == FFHTTP_OK) {
+			ffiov_set(&iov[n++], s.ptr, s.len);
+			continue;
+		}
+		break; // FFHTTP_MORE, FFHTTP_DONE or error
+	}
+
+	c->state = st;
+	c->cursiz = cursiz;
+	*len = d - body;
+	*n_iov = n;
+	if (n != 0)
+		return FFHTTP_OK;
+	return r;
+}
+
 static const char chnkLast[] = FFCRLF "0" FFCRLF FFCRLF;
 static const char *const sChnkEnd[] = {
 	FFCRLF
@@ -1468,6 +1590,31 @@ int ffhttp_chunkfin(const char **pbuf, int flags)
 	return nChnkEnd[flags];
 }
 
+uint ffhttp_chunkv(char *hdr, const ffiovec *data, uint n, ffiovec *out, int flags)
+{
+	uint64 total = 0;
+	uint k = 1;
+	for (uint i = 0;  i != n;  i++) {
+		if (data[i].iov_len == 0)
+			continue;
+		out[k++] = data[i];
+		total += data[i].iov_len;
+	}
+
+	if (total == 0) {
+		if (flags == FFHTTP_CHUNKFIN)
+			return 0;
+		ffiov_set(&out[0], sChnkEnd[FFHTTP_CHUNKZERO], nChnkEnd[FFHTTP_CHUNKZERO]);
+		return 1;
+	}
+
+	ffiov_set(&out[0], hdr, ffhttp_chunkbegin(hdr, FFHTTP_CHUNKHDR_MAX, total));
+	if (flags == FFHTTP_CHUNKZERO)
+		flags = FFHTTP_CHUNKLAST;
+	ffiov_set(&out[k++], sChnkEnd[flags], nChnkEnd[flags]);
+	return k;
+}
+
 
 static void* http_chunked_open(ffhttp_headers *h)
 {
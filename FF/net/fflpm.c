@@ -0,0 +1,338 @@
+/**
+Copyright (c) 2018 Simon Zolin
+*/
+
+#include <FF/net/lpm.h>
+#include <FF/net/proto.h>
+#include <FF/number.h>
+#include <FFOS/thread.h>
+
+
+/*
+Table entry (uint):
+ bit 31: 1: bits 0..30 is the index of a group of 256 entries for the next 8 bits of address
+         0: bits 0..30 is the value + 1;  0: no match
+*/
+#define ENT_GRP  0x80000000
+
+enum {
+	TOP4_BITS = 24,
+	TOP6_BITS = 16,
+	GRP_SIZE = 256,
+};
+
+struct lpm_tbl {
+	uint *top; // 2^top_bits entries
+	uint *grp; // groups of GRP_SIZE entries
+	uint ngrp;
+	uint grpcap;
+};
+
+struct fflpm {
+	struct lpm_tbl t4, t6;
+};
+
+struct fflpm_pfx {
+	byte ip[16];
+	byte bits;
+	byte ip6;
+	uint val;
+};
+
+
+void fflpm_build_free(fflpm_build *b)
+{
+	ffarr_free(&b->pfx);
+}
+
+static int build_add(fflpm_build *b, const void *ip, uint iplen, uint bits, uint val)
+{
+	struct fflpm_pfx *p;
+	if (bits > iplen * 8 || val > FFLPM_MAXVAL)
+		return -1;
+	if (NULL == (p = ffarr_pushgrowT(&b->pfx, 256 | FFARR_GROWQUARTER, struct fflpm_pfx)))
+		return -1;
+	ffmem_tzero(p);
+	ffmemcpy(p->ip, ip, iplen);
+	p->bits = bits;
+	p->ip6 = (iplen == 16);
+	p->val = val;
+	return 0;
+}
+
+int fflpm_build_add4(fflpm_build *b, const void *ip, uint bits, uint val)
+{
+	return build_add(b, ip, 4, bits, val);
+}
+
+int fflpm_build_add6(fflpm_build *b, const void *ip, uint bits, uint val)
+{
+	return build_add(b, ip, 16, bits, val);
+}
+
+/* "ADDR[/BITS] [VALUE]" */
+static int build_addline(fflpm_build *b, ffstr *line, uint defval)
+{
+	ffstr pfx, addr, sbits, sval;
+	uint bits, val = defval;
+	byte ip[16];
+
+	ffstr_nextval3(line, &pfx, ' ' | FFS_NV_WORDS | FFS_NV_TABS);
+	ffstr_nextval3(line, &sval, ' ' | FFS_NV_WORDS | FFS_NV_TABS);
+	if (line->len != 0)
+		return -1;
+	if (sval.len != 0 && !ffstr_toint(&sval, &val, FFS_INT32))
+		return -1;
+
+	ffs_split2by(pfx.ptr, pfx.len, '/', &addr, &sbits);
+	uint ip6 = (NULL != ffs_findc(addr.ptr, addr.len, ':'));
+	bits = (ip6) ? 128 : 32;
+	if (sbits.len != 0 && !ffstr_toint(&sbits, &bits, FFS_INT32))
+		return -1;
+
+	if (ip6) {
+		if (0 != ffip6_parse(ip, addr.ptr, addr.len))
+			return -1;
+		return fflpm_build_add6(b, ip, bits, val);
+	}
+
+	if (0 != ffip4_parse((void*)ip, addr.ptr, addr.len))
+		return -1;
+	return fflpm_build_add4(b, ip, bits, val);
+}
+
+int fflpm_build_addtext(fflpm_build *b, const char *data, size_t len, uint defval)
+{
+	ffstr d, line;
+	uint nline = 0, n = 0;
+	ffstr_set(&d, data, len);
+
+	while (d.len != 0) {
+		ffstr_nextval3(&d, &line, '\n' | FFS_NV_CR);
+		nline++;
+		if (line.len == 0 || line.ptr[0] == '#')
+			continue;
+		if (0 != build_addline(b, &line, defval))
+			return -(int)nline;
+		n++;
+	}
+	return n;
+}
+
+
+static void tbl_free(struct lpm_tbl *t)
+{
+	ffmem_safefree(t->top);
+	ffmem_safefree(t->grp);
+}
+
+/** Allocate a group filled with 'ent'.
+Return group index;  -1 on error. */
+static int tbl_newgroup(struct lpm_tbl *t, uint ent)
+{
+	if (t->ngrp == t->grpcap) {
+		uint cap = ffmax(t->grpcap * 2, 64);
+		if (cap > ENT_GRP / GRP_SIZE)
+			return -1;
+		uint *g;
+		if (NULL == (g = ffmem_realloc(t->grp, (size_t)cap * GRP_SIZE * sizeof(uint))))
+			return -1;
+		t->grp = g;
+		t->grpcap = cap;
+	}
+
+	uint *g = &t->grp[(size_t)t->ngrp * GRP_SIZE];
+	for (uint i = 0;  i != GRP_SIZE;  i++) {
+		g[i] = ent;
+	}
+	return t->ngrp++;
+}
+
+/** Release unused capacity of groups array. */
+static void tbl_trim(struct lpm_tbl *t)
+{
+	uint *g;
+	if (t->ngrp == t->grpcap)
+		return;
+	if (t->ngrp == 0) {
+		ffmem_safefree0(t->grp);
+		t->grpcap = 0;
+		return;
+	}
+	if (NULL == (g = ffmem_realloc(t->grp, (size_t)t->ngrp * GRP_SIZE * sizeof(uint))))
+		return;
+	t->grp = g;
+	t->grpcap = t->ngrp;
+}
+
+static void ent_fill(uint *e, uint n, uint val)
+{
+	for (uint i = 0;  i != n;  i++) {
+		e[i] = val;
+	}
+}
+
+/** Insert prefix.
+Prefixes must be inserted in ascending order of their length:
+ then a prefix simply overwrites the entries of all shorter prefixes it covers. */
+static int tbl_insert(struct lpm_tbl *t, uint top_bits, const byte *ip, uint bits, uint val)
+{
+	uint ent = val + 1;
+	uint itop = 0;
+	for (uint i = 0;  i != top_bits / 8;  i++) {
+		itop = (itop << 8) | ip[i];
+	}
+
+	if (bits <= top_bits) {
+		uint n = 1U << (top_bits - bits);
+		ent_fill(&t->top[itop & ~(n - 1)], n, ent);
+		return 0;
+	}
+
+	uint *e = &t->top[itop];
+	uint depth = top_bits;
+	for (uint i = top_bits / 8;  ;  i++) {
+
+		if (!(*e & ENT_GRP)) {
+			size_t off = (e >= t->grp && e < t->grp + (size_t)t->ngrp * GRP_SIZE) ? e - t->grp : (size_t)-1;
+			int g = tbl_newgroup(t, *e);
+			if (g < 0)
+				return -1;
+			if (off != (size_t)-1)
+				e = &t->grp[off]; // groups array has been reallocated
+			*e = ENT_GRP | g;
+		}
+
+		uint *grp = &t->grp[(size_t)(*e & ~ENT_GRP) * GRP_SIZE];
+		if (bits <= depth + 8) {
+			uint n = 1U << (depth + 8 - bits);
+			ent_fill(&grp[ip[i] & ~(n - 1)], n, ent);
+			return 0;
+		}
+		e = &grp[ip[i]];
+		depth += 8;
+	}
+}
+
+fflpm* fflpm_create(fflpm_build *b)
+{
+	fflpm *t;
+	struct fflpm_pfx *p = (void*)b->pfx.ptr;
+	size_t n = b->pfx.len, *sorted = NULL;
+	uint count[128 + 2] = {};
+
+	if (NULL == (t = ffmem_new(fflpm)))
+		return NULL;
+
+	if (NULL == (t->t4.top = ffmem_callocT((size_t)1 << TOP4_BITS, uint))
+		|| NULL == (t->t6.top = ffmem_callocT((size_t)1 << TOP6_BITS, uint)))
+		goto err;
+
+	// stable counting sort by prefix length
+	if (NULL == (sorted = ffmem_allocT(n, size_t)))
+		goto err;
+	for (size_t i = 0;  i != n;  i++) {
+		count[p[i].bits + 1]++;
+	}
+	for (uint i = 1;  i != FFCNT(count);  i++) {
+		count[i] += count[i - 1];
+	}
+	for (size_t i = 0;  i != n;  i++) {
+		sorted[count[p[i].bits]++] = i;
+	}
+
+	for (size_t i = 0;  i != n;  i++) {
+		const struct fflpm_pfx *pf = &p[sorted[i]];
+		int r;
+		if (pf->ip6)
+			r = tbl_insert(&t->t6, TOP6_BITS, pf->ip, pf->bits, pf->val);
+		else
+			r = tbl_insert(&t->t4, TOP4_BITS, pf->ip, pf->bits, pf->val);
+		if (r != 0)
+			goto err;
+	}
+
+	tbl_trim(&t->t4);
+	tbl_trim(&t->t6);
+	ffmem_free(sorted);
+	return t;
+
+err:
+	ffmem_safefree(sorted);
+	fflpm_free(t);
+	return NULL;
+}
+
+void fflpm_free(fflpm *t)
+{
+	if (t == NULL)
+		return;
+	tbl_free(&t->t4);
+	tbl_free(&t->t6);
+	ffmem_free(t);
+}
+
+size_t fflpm_memsize(const fflpm *t)
+{
+	return sizeof(fflpm)
+		+ (((size_t)1 << TOP4_BITS) + (size_t)t->t4.grpcap * GRP_SIZE
+			+ ((size_t)1 << TOP6_BITS) + (size_t)t->t6.grpcap * GRP_SIZE) * sizeof(uint);
+}
+
+int fflpm_find4(const fflpm *t, const void *ip)
+{
+	uint a = ffint_ntoh32(ip);
+	uint e = t->t4.top[a >> 8];
+	if (e & ENT_GRP)
+		e = t->t4.grp[(size_t)(e & ~ENT_GRP) * GRP_SIZE + (a & 0xff)];
+	return (int)e - 1;
+}
+
+int fflpm_find6(const fflpm *t, const void *ip)
+{
+	const byte *a = ip;
+	uint e = t->t6.top[(a[0] << 8) | a[1]];
+	for (uint i = TOP6_BITS / 8;  e & ENT_GRP;  i++) {
+		e = t->t6.grp[(size_t)(e & ~ENT_GRP) * GRP_SIZE + a[i]];
+	}
+	return (int)e - 1;
+}
+
+void fflpm_find4_burst(const fflpm *t, const uint *ip, int *vals, uint n)
+{
+	const uint *top = t->t4.top, *grp = t->t4.grp;
+	uint i;
+
+	// issue all random reads of the large table before using their results
+	for (i = 0;  i != n;  i++) {
+		__builtin_prefetch(&top[ffint_ntoh32(&ip[i]) >> 8]);
+	}
+
+	for (i = 0;  i != n;  i++) {
+		uint a = ffint_ntoh32(&ip[i]);
+		uint e = top[a >> 8];
+		if (e & ENT_GRP)
+			e = grp[(size_t)(e & ~ENT_GRP) * GRP_SIZE + (a & 0xff)];
+		vals[i] = (int)e - 1;
+	}
+}
+
+
+fflpm* fflpm_ptr_replace(fflpm_ptr *p, fflpm *t, ffatomic *readers, uint nreaders)
+{
+	ffatom_fence_rel();
+	fflpm *old = (void*)ffatom_swap(&p->tbl, (size_t)t);
+	size_t gen = ffatom_addret(&p->gen, 1);
+
+	for (uint i = 0;  i != nreaders;  i++) {
+		for (;;) {
+			size_t seen = ffatom_get(&readers[i]);
+			if (seen == FFLPM_OFFLINE || seen >= gen)
+				break;
+			ffthd_sleep(1);
+		}
+	}
+
+	ffatom_fence_acq();
+	return old;
+}
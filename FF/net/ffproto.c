@@ -6,6 +6,15 @@ Copyright (c) 2017 Simon Zolin
 #include <FF/string.h>
 #include <FFOS/cpu.h>
 
+#ifdef FF_AMD64
+#include <emmintrin.h> //SSE2
+#ifdef __GNUC__
+#include <immintrin.h> //AVX2
+#endif
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 
 uint ffeth_tostr(char *buf, size_t cap, const ffeth *eth)
 {
@@ -332,30 +341,328 @@ int ffip6hdr_tostr(ffip6hdr *ip6, char *buf, size_t cap)
 }
 
 
-/** Compute Internet checksum with data length which is a multiple of 4. */
-static FFINL uint in_chksum_4(const void *buf, uint len4)
+/* Internet checksum:
+32-bit words are added to 64-bit accumulators so that no carries are lost,
+ then the sum is folded down to 16 bits.
+One's complement sum doesn't depend on byte order, so the words are loaded as is. */
+
+/** Fold 64-bit sum into 32 bits. */
+static FFINL uint in_sum_fold64(uint64 sum)
 {
-	uint sum = 0;
-	const uint *n = buf;
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	return (uint)sum;
+}
 
-	for (;  len4 != 0;  len4--) {
-		sum = ffint_addcarry32(sum, *n++);
+#if defined FF_AMD64 && defined __GNUC__
+#define INSUM_AVX2
+__attribute__((target("avx2")))
+static uint64 in_sum_avx2(const byte *d, size_t len, size_t *off)
+{
+	size_t i;
+	__m256i z = _mm256_setzero_si256(), acc0 = z, acc1 = z;
+	for (i = 0;  i + 64 <= len;  i += 64) {
+		__m256i a = _mm256_loadu_si256((void*)(d + i));
+		__m256i b = _mm256_loadu_si256((void*)(d + i + 32));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, z));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, z));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, z));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, z));
 	}
-	return sum;
+	*off = i;
+
+	uint64 r[4];
+	_mm256_storeu_si256((void*)r, _mm256_add_epi64(acc0, acc1));
+	return (uint64)in_sum_fold64(r[0] + r[1]) + in_sum_fold64(r[2] + r[3]);
 }
+#endif
 
-/** Add hi-word to low-word with Carry flag: (HI(sum) + LO(sum)) + CF. */
-static FFINL uint in_chksum_reduce(uint sum)
+uint ffip_sum(const void *data, size_t len, uint sum)
 {
-	sum = (sum >> 16) + (sum & 0xffff);
-	sum = (sum >> 16) + (sum & 0xffff);
-	return sum;
+	const byte *d = data;
+	uint64 s = sum;
+	size_t i = 0;
+
+#ifdef INSUM_AVX2
+	if (len >= 256 && __builtin_cpu_supports("avx2"))
+		s += in_sum_avx2(d, len, &i);
+#endif
+
+#if defined FF_AMD64
+	if (i + 16 <= len) {
+		__m128i z = _mm_setzero_si128(), acc = z;
+		for (;  i + 16 <= len;  i += 16) {
+			__m128i v = _mm_loadu_si128((void*)(d + i));
+			acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, z));
+			acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, z));
+		}
+		uint64 r[2];
+		_mm_storeu_si128((void*)r, acc);
+		s += (uint64)in_sum_fold64(r[0]) + in_sum_fold64(r[1]);
+	}
+
+#elif defined __ARM_NEON
+	if (i + 16 <= len) {
+		uint64x2_t acc = vdupq_n_u64(0);
+		for (;  i + 16 <= len;  i += 16) {
+			acc = vpadalq_u32(acc, vreinterpretq_u32_u8(vld1q_u8(d + i)));
+		}
+		s += (uint64)in_sum_fold64(vgetq_lane_u64(acc, 0)) + in_sum_fold64(vgetq_lane_u64(acc, 1));
+	}
+#endif
+
+	for (;  i + 4 <= len;  i += 4) {
+		uint v;
+		ffmemcpy(&v, d + i, 4);
+		s += v;
+	}
+
+	if (i + 2 <= len) {
+		ushort v;
+		ffmemcpy(&v, d + i, 2);
+		s += v;
+		i += 2;
+	}
+
+	if (i != len) {
+		// the last byte is padded with zero
+		byte b[2] = { d[i], 0 };
+		ushort v;
+		ffmemcpy(&v, b, 2);
+		s += v;
+	}
+
+	return in_sum_fold64(s);
 }
 
 uint ffip4_chksum(const void *hdr, uint ihl)
 {
-	uint sum = in_chksum_4(hdr, ihl);
-	return ~in_chksum_reduce(sum) & 0xffff;
+	return ffip_chksum(hdr, ihl * 4);
+}
+
+uint ffip4_pseudo_sum(const ffip4 *src, const ffip4 *dst, uint proto, uint len)
+{
+	uint64 s = (uint)ffint_unaligned32(src)
+		+ (uint)ffint_unaligned32(dst)
+		+ ffhton16(proto)
+		+ ffhton16(len);
+	return in_sum_fold64(s);
+}
+
+uint ffip4_l4_chksum(const ffip4hdr *ip, const void *l4, uint len)
+{
+	uint sum = ffip4_pseudo_sum(&ip->saddr, &ip->daddr, ip->proto, len);
+	return ffip_sum_fold(ffip_sum(l4, len, sum));
+}
+
+uint ffip6_pseudo_sum(const ffip6 *src, const ffip6 *dst, uint nexthdr, uint len)
+{
+	uint sum = ffip_sum(src, sizeof(ffip6), 0);
+	sum = ffip_sum(dst, sizeof(ffip6), sum);
+	return in_sum_fold64((uint64)sum + ffhton32(len) + ffhton32(nexthdr));
+}
+
+uint ffip6_l4_chksum(const ffip6hdr *ip, uint nexthdr, const void *l4, uint len)
+{
+	uint sum = ffip6_pseudo_sum(&ip->saddr, &ip->daddr, nexthdr, len);
+	return ffip_sum_fold(ffip_sum(l4, len, sum));
+}
+
+uint ffip_chksum_update(uint crc, const void *old, const void *new_data, size_t len)
+{
+	// ~HC + ~m + m' = ~HC + ~sum(m) + sum(m')
+	uint m = ffip_sum(old, len, 0);
+	m = (m >> 16) + (m & 0xffff);
+	m += (m >> 16);
+	uint64 s = (~crc & 0xffff) + (~m & 0xffff);
+	uint sum = ffip_sum(new_data, len, in_sum_fold64(s));
+	return ffip_sum_fold(sum);
+}
+
+
+/* Parse L4 header */
+static void pkt_l4(ffpkt_burst *b, uint k, const byte *p, uint off, uint end, uint proto)
+{
+	b->l4_proto[k] = proto;
+
+	uint hl;
+	switch (proto) {
+	case FFIP_TCP: {
+		const fftcphdr *t = (void*)(p + off);
+		if (off + sizeof(fftcphdr) > end
+			|| (hl = fftcp_hdrlen(t)) < sizeof(fftcphdr)
+			|| off + hl > end)
+			goto bad;
+		b->flags[k] |= FFPKT_TCP;
+		b->sport[k] = ffint_ntoh16(t->sport);
+		b->dport[k] = ffint_ntoh16(t->dport);
+		b->tcp_flags[k] = t->flags;
+		break;
+	}
+
+	case FFIP_UDP: {
+		const ffudphdr *u = (void*)(p + off);
+		hl = sizeof(ffudphdr);
+		if (off + hl > end)
+			goto bad;
+		b->flags[k] |= FFPKT_UDP;
+		b->sport[k] = ffint_ntoh16(u->sport);
+		b->dport[k] = ffint_ntoh16(u->dport);
+		break;
+	}
+
+	case FFIP_ICMP:
+	case FFIP6_ICMP:
+		hl = 4;
+		if (off + hl > end)
+			goto bad;
+		b->flags[k] |= FFPKT_ICMP;
+		break;
+
+	default:
+		return;
+	}
+
+	b->l4_off[k] = off;
+	b->data_off[k] = off + hl;
+	b->data_len[k] = end - (off + hl);
+	return;
+
+bad:
+	b->flags[k] |= FFPKT_EBAD;
+}
+
+static void pkt_ip4(ffpkt_burst *b, uint k, const byte *p, uint off, uint len, uint flags)
+{
+	const ffip4hdr *ip = (void*)(p + off);
+	uint hl, total;
+	if (off + sizeof(ffip4hdr) > len
+		|| ip->version != 4
+		|| (hl = ffip4_hdrlen(ip)) < sizeof(ffip4hdr)
+		|| (total = ffint_ntoh16(ip->total_len)) < hl
+		|| off + total > len) {
+		b->flags[k] |= FFPKT_EBAD;
+		return;
+	}
+
+	b->flags[k] |= FFPKT_IP4;
+	b->ip4_src[k] = ffint_unaligned32(&ip->saddr);
+	b->ip4_dst[k] = ffint_unaligned32(&ip->daddr);
+	if ((flags & FFPKT_VERIFY_CHKSUM) && 0 != ffip4_chksum(ip, ip->ihl))
+		b->flags[k] |= FFPKT_ECHKSUM;
+
+	if (ffip4_frag_off(ip) != 0) {
+		// L4 header is only in the first fragment
+		b->flags[k] |= FFPKT_FRAG;
+		b->l4_proto[k] = ip->proto;
+		return;
+	}
+
+	pkt_l4(b, k, p, off + hl, off + total, ip->proto);
+	if (ffip4_frag_more(ip))
+		b->flags[k] |= FFPKT_FRAG;
+}
+
+static void pkt_ip6(ffpkt_burst *b, uint k, const byte *p, uint off, uint len)
+{
+	const ffip6hdr *ip = (void*)(p + off);
+	uint end;
+	if (off + sizeof(ffip6hdr) > len
+		|| ffip6_ver(ip) != 6
+		|| (end = off + sizeof(ffip6hdr) + ffip6_datalen(ip)) > len) {
+		b->flags[k] |= FFPKT_EBAD;
+		return;
+	}
+	b->flags[k] |= FFPKT_IP6;
+
+	uint next = ip->nexthdr, frag = 0;
+	off += sizeof(ffip6hdr);
+	for (;;) {
+		switch (next) {
+		case FFIP6_HOPOPTS:
+		case FFIP6_ROUTING:
+		case FFIP6_DSTOPTS:
+			if (off + 8 > end)
+				goto bad;
+			next = p[off];
+			off += (p[off + 1] + 1) * 8;
+			continue;
+
+		case FFIP6_FRAG:
+			if (off + 8 > end)
+				goto bad;
+			if ((ffint_ntoh16(p + off + 2) & 0xfff8) != 0) {
+				// not the first fragment
+				b->flags[k] |= FFPKT_FRAG;
+				b->l4_proto[k] = p[off];
+				return;
+			}
+			frag = ffint_ntoh16(p + off + 2) & 1;
+			next = p[off];
+			off += 8;
+			continue;
+		}
+		break;
+	}
+
+	if (off > end)
+		goto bad;
+	pkt_l4(b, k, p, off, end, next);
+	if (frag)
+		b->flags[k] |= FFPKT_FRAG;
+	return;
+
+bad:
+	b->flags[k] |= FFPKT_EBAD;
+}
+
+uint ffpkt_parse_burst(ffpkt_burst *b, const void *const *pkts, const uint *lens, uint n, uint flags)
+{
+	n = ffmin(n, FFPKT_BURST_MAX);
+	b->n = n;
+
+	// clear all the arrays at once: they're laid out one after another
+	ffmem_zero(b->flags, (byte*)(b + 1) - (byte*)b->flags);
+
+	for (uint k = 0;  k != n;  k++) {
+		if (k + 4 < n)
+			__builtin_prefetch(pkts[k + 4]);
+
+		const byte *p = pkts[k];
+		uint len = lens[k];
+		uint off = sizeof(ffeth_hdr);
+		if (len < off) {
+			b->flags[k] = FFPKT_EBAD;
+			continue;
+		}
+
+		uint type = ffint_ntoh16(((ffeth_hdr*)p)->type);
+		while (type == FFETH_VLAN) {
+			if (off + sizeof(ffvlanhdr) > len)
+				break;
+			const ffvlanhdr *v = (void*)(p + off);
+			if (b->vlan[k] == 0)
+				b->vlan[k] = ffvlan_id(v);
+			type = ffint_ntoh16(v->eth_type);
+			off += sizeof(ffvlanhdr);
+		}
+		b->eth_type[k] = type;
+
+		switch (type) {
+		case FFETH_IP4:
+			b->l3_off[k] = off;
+			pkt_ip4(b, k, p, off, len, flags);
+			break;
+		case FFETH_IP6:
+			b->l3_off[k] = off;
+			pkt_ip6(b, k, p, off, len);
+			break;
+		case FFETH_VLAN:
+			b->flags[k] = FFPKT_EBAD;
+			break;
+		}
+	}
+	return n;
 }
 
 
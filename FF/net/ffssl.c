@@ -3,7 +3,13 @@ Copyright (c) 2015 Simon Zolin
 */
 
 #include <FF/net/ssl.h>
+#include <FF/crc.h>
 #include <FFOS/error.h>
+#include <FFOS/atomic.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
 
 
 enum {
@@ -15,7 +21,8 @@ enum {
 struct ssl_s {
 	int conn_idx
 		, verify_cb_idx
-		, bio_con_idx;
+		, bio_con_idx
+		, sesscache_idx;
 	BIO_METHOD *bio_meth;
 };
 static struct ssl_s *_ffssl;
@@ -60,6 +67,8 @@ int ffssl_init(void)
 		return FFSSL_ENEWIDX;
 	if (-1 == (_ffssl->bio_con_idx = BIO_get_ex_new_index(0, NULL, NULL, NULL, NULL)))
 		return FFSSL_ENEWIDX;
+	if (-1 == (_ffssl->sesscache_idx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL)))
+		return FFSSL_ENEWIDX;
 
 	BIO_METHOD *bm;
 	if (NULL == (bm = BIO_meth_new(BIO_TYPE_MEM, "aio")))
@@ -241,6 +250,11 @@ int ffssl_ctx_conf(SSL_CTX *ctx, const struct ffssl_ctx_conf *o)
 
 	_ffssl_ctx_protoallow(ctx, o->allowed_protocols);
 
+#ifdef SSL_OP_ENABLE_KTLS
+	if (o->ktls)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
 	return 0;
 }
 
@@ -307,6 +321,406 @@ int ffssl_ctx_cache(SSL_CTX *ctx, int size)
 }
 
 
+/*
+Memory layout:
+ffssl_sesscache
+uint buckets[nbuckets] // index of the first slot in chain
+sesscache_slot slots[nslots]
+
+Slot indexes are 1-based so that the same region may be mapped at different addresses.
+*/
+
+#define SESSCACHE_MAGIC  0x53534346
+enum {
+	SESSCACHE_KEYS = 3,
+	SESSCACHE_DEFSESSSIZE = 2048,
+};
+
+struct sesscache_key {
+	byte name[16];
+	byte aes[32];
+	byte hmac[32];
+	uint64 created;
+};
+
+struct ffssl_sesscache {
+	uint magic;
+	fflock lk;
+	uint nbuckets; //power of 2
+	uint nslots;
+	uint slot_size;
+	uint slots_off;
+	uint max_sess_size;
+	uint lru_first, lru_last; //most and least recently used
+	uint free;
+	uint key_lifetime;
+	uint ikey; //current ticket key
+	struct sesscache_key keys[SESSCACHE_KEYS];
+	struct ffssl_sesscache_stat stat;
+};
+
+struct sesscache_slot {
+	uint next; //next slot in chain or in free list
+	uint lru_prev, lru_next;
+	uint hash;
+	uint64 expire;
+	uint idlen;
+	byte id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	uint len;
+	byte data[0];
+};
+
+#define sc_buckets(sc)  ((uint*)((sc) + 1))
+
+static FFINL struct sesscache_slot* sc_slot(ffssl_sesscache *sc, uint i)
+{
+	return (void*)((char*)sc + sc->slots_off + (size_t)(i - 1) * sc->slot_size);
+}
+
+size_t ffssl_sesscache_size(const struct ffssl_sesscache_conf *conf)
+{
+	size_t nbuckets = ff_align_power2(ffmax(conf->max_sessions, 1));
+	size_t sess = (conf->max_sess_size != 0) ? conf->max_sess_size : SESSCACHE_DEFSESSSIZE;
+	return ff_align_ceil2(sizeof(ffssl_sesscache) + nbuckets * sizeof(uint), 8)
+		+ (size_t)ffmax(conf->max_sessions, 1) * ff_align_ceil2(sizeof(struct sesscache_slot) + sess, 8);
+}
+
+/* Generate a new ticket key.  Cache is locked. */
+static void sc_key_new(ffssl_sesscache *sc, uint64 now)
+{
+	uint i = (sc->keys[sc->ikey].created == 0) ? sc->ikey : (sc->ikey + 1) % SESSCACHE_KEYS;
+	struct sesscache_key *k = &sc->keys[i];
+	if (1 != RAND_bytes((byte*)k, FFOFF(struct sesscache_key, created)))
+		return;
+	k->created = now;
+	sc->ikey = i;
+	sc->stat.ticket_keys++;
+}
+
+ffssl_sesscache* ffssl_sesscache_init(void *mem, size_t size, const struct ffssl_sesscache_conf *conf)
+{
+	ffssl_sesscache *sc = mem;
+	if (size < ffssl_sesscache_size(conf))
+		return NULL;
+
+	ffmem_zero(sc, sizeof(ffssl_sesscache));
+	fflk_init(&sc->lk);
+	sc->nslots = ffmax(conf->max_sessions, 1);
+	sc->nbuckets = ff_align_power2(sc->nslots);
+	sc->max_sess_size = (conf->max_sess_size != 0) ? conf->max_sess_size : SESSCACHE_DEFSESSSIZE;
+	sc->slot_size = ff_align_ceil2(sizeof(struct sesscache_slot) + sc->max_sess_size, 8);
+	sc->slots_off = ff_align_ceil2(sizeof(ffssl_sesscache) + sc->nbuckets * sizeof(uint), 8);
+	ffmem_zero(sc_buckets(sc), sc->nbuckets * sizeof(uint));
+
+	for (uint i = 1;  i <= sc->nslots;  i++) {
+		sc_slot(sc, i)->next = (i != sc->nslots) ? i + 1 : 0;
+	}
+	sc->free = 1;
+
+	sc->key_lifetime = conf->ticket_key_lifetime;
+	if (sc->key_lifetime != 0)
+		sc_key_new(sc, time(NULL));
+
+	sc->magic = SESSCACHE_MAGIC;
+	return sc;
+}
+
+static void sc_lru_unlink(ffssl_sesscache *sc, uint i)
+{
+	struct sesscache_slot *s = sc_slot(sc, i);
+	if (s->lru_prev != 0)
+		sc_slot(sc, s->lru_prev)->lru_next = s->lru_next;
+	else
+		sc->lru_first = s->lru_next;
+	if (s->lru_next != 0)
+		sc_slot(sc, s->lru_next)->lru_prev = s->lru_prev;
+	else
+		sc->lru_last = s->lru_prev;
+}
+
+static void sc_lru_push(ffssl_sesscache *sc, uint i)
+{
+	struct sesscache_slot *s = sc_slot(sc, i);
+	s->lru_prev = 0;
+	s->lru_next = sc->lru_first;
+	if (sc->lru_first != 0)
+		sc_slot(sc, sc->lru_first)->lru_prev = i;
+	else
+		sc->lru_last = i;
+	sc->lru_first = i;
+}
+
+/* Find slot and the link pointing to it */
+static uint sc_find(ffssl_sesscache *sc, uint hash, const void *id, size_t idlen, uint **plink)
+{
+	uint *link = &sc_buckets(sc)[hash & (sc->nbuckets - 1)];
+	for (uint i = *link;  i != 0;  i = *link) {
+		struct sesscache_slot *s = sc_slot(sc, i);
+		if (s->hash == hash && s->idlen == idlen && !ffmemcmp(s->id, id, idlen)) {
+			*plink = link;
+			return i;
+		}
+		link = &s->next;
+	}
+	return 0;
+}
+
+/* Remove session and put its slot to free list */
+static void sc_rm(ffssl_sesscache *sc, uint i, uint *link)
+{
+	struct sesscache_slot *s = sc_slot(sc, i);
+	if (link == NULL)
+		sc_find(sc, s->hash, s->id, s->idlen, &link);
+	*link = s->next;
+	sc_lru_unlink(sc, i);
+	s->next = sc->free;
+	sc->free = i;
+	sc->stat.sessions--;
+}
+
+int ffssl_sesscache_store(ffssl_sesscache *sc, const void *id, size_t idlen, const void *data, size_t len, uint64 expire)
+{
+	uint i, *link, hash;
+	struct sesscache_slot *s;
+
+	if (idlen > SSL_MAX_SSL_SESSION_ID_LENGTH || len > sc->max_sess_size)
+		return -1;
+	hash = ffcrc32_get(id, idlen);
+
+	fflk_lock(&sc->lk);
+
+	if (0 != (i = sc_find(sc, hash, id, idlen, &link))) {
+		sc_lru_unlink(sc, i);
+
+	} else {
+		if (sc->free == 0) {
+			sc_rm(sc, sc->lru_last, NULL);
+			sc->stat.evictions++;
+		}
+
+		i = sc->free;
+		s = sc_slot(sc, i);
+		sc->free = s->next;
+		s->hash = hash;
+		s->idlen = idlen;
+		ffmemcpy(s->id, id, idlen);
+		link = &sc_buckets(sc)[hash & (sc->nbuckets - 1)];
+		s->next = *link;
+		*link = i;
+		sc->stat.sessions++;
+	}
+
+	s = sc_slot(sc, i);
+	s->expire = expire;
+	s->len = len;
+	ffmemcpy(s->data, data, len);
+	sc_lru_push(sc, i);
+	sc->stat.stores++;
+
+	fflk_unlock(&sc->lk);
+	return 0;
+}
+
+ssize_t ffssl_sesscache_fetch(ffssl_sesscache *sc, const void *id, size_t idlen, void *buf, size_t cap, uint64 now)
+{
+	uint i, *link;
+	ssize_t r = 0;
+	uint hash = ffcrc32_get(id, idlen);
+
+	fflk_lock(&sc->lk);
+
+	if (0 == (i = sc_find(sc, hash, id, idlen, &link))) {
+		sc->stat.misses++;
+		goto end;
+	}
+
+	struct sesscache_slot *s = sc_slot(sc, i);
+	if (s->expire <= now) {
+		sc_rm(sc, i, link);
+		sc->stat.expired++;
+		sc->stat.misses++;
+		goto end;
+	}
+
+	if (s->len > cap) {
+		r = -1;
+		goto end;
+	}
+	ffmemcpy(buf, s->data, s->len);
+	r = s->len;
+	sc_lru_unlink(sc, i);
+	sc_lru_push(sc, i);
+	sc->stat.hits++;
+
+end:
+	fflk_unlock(&sc->lk);
+	return r;
+}
+
+void ffssl_sesscache_del(ffssl_sesscache *sc, const void *id, size_t idlen)
+{
+	uint i, *link;
+	uint hash = ffcrc32_get(id, idlen);
+	fflk_lock(&sc->lk);
+	if (0 != (i = sc_find(sc, hash, id, idlen, &link)))
+		sc_rm(sc, i, link);
+	fflk_unlock(&sc->lk);
+}
+
+void ffssl_sesscache_stat(ffssl_sesscache *sc, struct ffssl_sesscache_stat *st)
+{
+	fflk_lock(&sc->lk);
+	*st = sc->stat;
+	fflk_unlock(&sc->lk);
+}
+
+static int ssl_sess_new(SSL *ssl, SSL_SESSION *sess)
+{
+	ffssl_sesscache *sc = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), _ffssl->sesscache_idx);
+	uint idlen;
+	const byte *id = SSL_SESSION_get_id(sess, &idlen);
+	int n = i2d_SSL_SESSION(sess, NULL);
+	if (n <= 0 || (uint)n > sc->max_sess_size)
+		return 0;
+
+	byte *buf, *p;
+	if (NULL == (buf = ffmem_alloc(n)))
+		return 0;
+	p = buf;
+	i2d_SSL_SESSION(sess, &p);
+	ffssl_sesscache_store(sc, id, idlen, buf, n
+		, (uint64)SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess));
+	ffmem_free(buf);
+	return 0; //session isn't referenced by us
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static SSL_SESSION* ssl_sess_get(SSL *ssl, const byte *id, int idlen, int *copy)
+#else
+static SSL_SESSION* ssl_sess_get(SSL *ssl, byte *id, int idlen, int *copy)
+#endif
+{
+	ffssl_sesscache *sc = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), _ffssl->sesscache_idx);
+	SSL_SESSION *sess = NULL;
+	byte *buf;
+	ssize_t n;
+
+	*copy = 0;
+	if (NULL == (buf = ffmem_alloc(sc->max_sess_size)))
+		return NULL;
+	n = ffssl_sesscache_fetch(sc, id, idlen, buf, sc->max_sess_size, time(NULL));
+	if (n > 0) {
+		const byte *p = buf;
+		sess = d2i_SSL_SESSION(NULL, &p, n);
+	}
+	ffmem_free(buf);
+	return sess;
+}
+
+static void ssl_sess_remove(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+	ffssl_sesscache *sc = SSL_CTX_get_ex_data(ctx, _ffssl->sesscache_idx);
+	uint idlen;
+	const byte *id = SSL_SESSION_get_id(sess, &idlen);
+	ffssl_sesscache_del(sc, id, idlen);
+}
+
+/* Get ticket key: the current one for encryption (rotate if it's too old) or by name for decryption.
+Return 1: current key;  2: older key (ticket must be renewed);  0: not found. */
+static int sc_ticket_key(ffssl_sesscache *sc, byte *name, struct sesscache_key *key, int enc)
+{
+	int r = 0;
+	uint64 now = time(NULL);
+
+	fflk_lock(&sc->lk);
+
+	if (enc) {
+		if (now >= sc->keys[sc->ikey].created + sc->key_lifetime)
+			sc_key_new(sc, now);
+		*key = sc->keys[sc->ikey];
+		ffmemcpy(name, key->name, sizeof(key->name));
+		r = 1;
+		goto end;
+	}
+
+	for (uint i = 0;  i != SESSCACHE_KEYS;  i++) {
+		const struct sesscache_key *k = &sc->keys[i];
+		if (k->created != 0
+			&& now < k->created + SESSCACHE_KEYS * sc->key_lifetime
+			&& !ffmemcmp(k->name, name, sizeof(k->name))) {
+			*key = *k;
+			r = (i == sc->ikey && now < k->created + sc->key_lifetime) ? 1 : 2;
+			break;
+		}
+	}
+
+end:
+	fflk_unlock(&sc->lk);
+	return r;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ssl_ticket_key_cb(SSL *ssl, byte *name, byte *iv, EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx, int enc)
+#else
+static int ssl_ticket_key_cb(SSL *ssl, byte *name, byte *iv, EVP_CIPHER_CTX *cctx, HMAC_CTX *hctx, int enc)
+#endif
+{
+	ffssl_sesscache *sc = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), _ffssl->sesscache_idx);
+	struct sesscache_key k;
+	int r;
+
+	if (enc && 1 != RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())))
+		return -1;
+	if (0 == (r = sc_ticket_key(sc, name, &k, enc)))
+		return 0;
+
+	if (1 != EVP_CipherInit_ex(cctx, EVP_aes_256_cbc(), NULL, k.aes, iv, enc))
+		r = -1;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, k.hmac, sizeof(k.hmac)),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0),
+		OSSL_PARAM_construct_end(),
+	};
+	if (r > 0 && 1 != EVP_MAC_CTX_set_params(hctx, params))
+		r = -1;
+#else
+	if (r > 0 && 1 != HMAC_Init_ex(hctx, k.hmac, sizeof(k.hmac), EVP_sha256(), NULL))
+		r = -1;
+#endif
+
+	ffmem_zero(&k, sizeof(k));
+	return r;
+}
+
+int ffssl_ctx_sesscache(SSL_CTX *ctx, ffssl_sesscache *sc)
+{
+	if (0 == SSL_CTX_set_ex_data(ctx, _ffssl->sesscache_idx, sc))
+		return FFSSL_ESETDATA;
+
+	int sessid_ctx = 0;
+	SSL_CTX_set_session_id_context(ctx, (void*)&sessid_ctx, sizeof(int));
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+	SSL_CTX_sess_set_new_cb(ctx, &ssl_sess_new);
+	SSL_CTX_sess_set_get_cb(ctx, &ssl_sess_get);
+	SSL_CTX_sess_set_remove_cb(ctx, &ssl_sess_remove);
+
+	if (sc->key_lifetime == 0) {
+		// per-process ticket keys would prevent resumption on other workers
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		return 0;
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &ssl_ticket_key_cb);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(ctx, &ssl_ticket_key_cb);
+#endif
+	return 0;
+}
+
+
 int ffssl_create(SSL **con, SSL_CTX *ctx, uint flags, ffssl_opt *opt)
 {
 	SSL *c;
@@ -334,7 +748,19 @@ int ffssl_create(SSL **con, SSL_CTX *ctx, uint flags, ffssl_opt *opt)
 		}
 	}
 
-	if (flags & FFSSL_IOBUF) {
+	if (flags & FFSSL_SOCKET) {
+		if (flags & FFSSL_IOBUF) {
+			e = FFSSL_ESYS;
+			fferr_set(EINVAL);
+			goto fail;
+		}
+		if (NULL == (bio = BIO_new_socket(opt->sk, BIO_NOCLOSE))) {
+			e = FFSSL_EBIONEW;
+			goto fail;
+		}
+		SSL_set_bio(c, bio, bio);
+
+	} else if (flags & FFSSL_IOBUF) {
 		struct ssl_iobuf *iobuf;
 		if (NULL == (iobuf = ffmem_alloc(sizeof(struct ssl_iobuf)))) {
 			e = FFSSL_ESYS;
@@ -381,6 +807,19 @@ size_t ffssl_get(SSL *c, uint flags)
 	case FFSSL_CERT_VERIFY_RESULT:
 		r = SSL_get_verify_result(c);
 		break;
+#ifdef BIO_get_ktls_send
+	case FFSSL_KTLS_SEND:
+		r = !!BIO_get_ktls_send(SSL_get_wbio(c));
+		break;
+	case FFSSL_KTLS_RECV:
+		r = !!BIO_get_ktls_recv(SSL_get_rbio(c));
+		break;
+#else
+	case FFSSL_KTLS_SEND:
+	case FFSSL_KTLS_RECV:
+		r = 0; // kTLS isn't supported by OpenSSL < 3.0
+		break;
+#endif
 	}
 	return r;
 }
@@ -436,6 +875,33 @@ int ffssl_write(SSL *c, const void *buf, size_t size)
 	return -r;
 }
 
+int64 ffssl_sendfile(SSL *c, ffsf *sf, int flags)
+{
+#ifdef BIO_get_ktls_send
+	int64 r;
+
+	if (BIO_get_ktls_send(SSL_get_wbio(c))) {
+		// TLS records are created by kernel: SSL object isn't involved
+		r = ffsf_send(sf, (ffskt)SSL_get_fd(c), flags);
+		if (r >= 0)
+			return r;
+		if (fferr_again(fferr_last()))
+			return -FFSSL_WANTWRITE;
+		return -(FFSSL_EWRITE | (SSL_ERROR_SYSCALL << 8));
+	}
+#endif
+
+	ffstr d;
+	if (-1 == ffsf_nextchunk(sf, &d))
+		return -(FFSSL_EWRITE | (SSL_ERROR_SYSCALL << 8));
+	if (d.len == 0)
+		return 0;
+
+	// file mapping may be moved after a write is retried
+	SSL_set_mode(c, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	return ffssl_write(c, d.ptr, d.len);
+}
+
 int ffssl_shut(SSL *c)
 {
 	int r = SSL_shutdown(c); //send 'close-notify' alert
@@ -33,6 +33,7 @@ rec
 
 #include <FF/net/tls.h>
 #include <FF/number.h>
+#include <FF/crc.h>
 
 
 static int tls_rec_read(fftls *t, ffstr *data, uint *version, ffstr *body);
@@ -255,6 +256,9 @@ static int tls_srvhello_read(fftls *t, ffstr *data)
 
 enum ext_type {
 	EXT_SERVER_NAME = 0,
+	EXT_SUPP_GROUPS = 10,
+	EXT_EC_FORMATS = 11,
+	EXT_SIG_ALGS = 13,
 	EXT_ALPN = 16,
 	EXT_SUPP_VERS = 43,
 };
@@ -548,6 +552,436 @@ int fftls_read(fftls *t)
 }
 
 
+/* GREASE values (RFC 8701):  0x0a0a, 0x1a1a, ... 0xfafa */
+#define tls_grease(val)  (((val) & 0x0f0f) == 0x0a0a && ((val) >> 8) == ((val) & 0xff))
+
+/* Get the whole Client Hello message from TLS records.
+Return 1 on success;  0 if more data is needed;  <0 on error (-enum FFTLS_E). */
+static int hello_gather(fftls_hello *h, const ffstr *data, ffstr *msg, char *buf, size_t cap)
+{
+	ffstr d = *data, body;
+	size_t n = 0, total;
+	uint ver;
+	int r;
+
+	for (;;) {
+		r = tls_rec_read(NULL, &d, &ver, &body);
+		if (r <= 0)
+			return r;
+		if (r != RT_HANDSHAKE)
+			return -FFTLS_ENOTSUPP;
+
+		if (n == 0) {
+			if (body.len == 0 || (byte)body.ptr[0] != HS_CLIENT_HELLO)
+				return -FFTLS_ENOTSUPP;
+			h->version = ver;
+
+			if (body.len >= sizeof(struct hshake)
+				&& sizeof(struct hshake) + ffint_ntoh24(body.ptr + 1) <= body.len) {
+				// the whole message is within the first record
+				ffstr_set(msg, body.ptr, sizeof(struct hshake) + ffint_ntoh24(body.ptr + 1));
+				break;
+			}
+		}
+
+		if (buf == NULL || body.len > cap - n)
+			return -FFTLS_ENOTSUPP;
+		ffmemcpy(buf + n, body.ptr, body.len);
+		n += body.len;
+
+		if (n >= sizeof(struct hshake)) {
+			total = sizeof(struct hshake) + ffint_ntoh24(buf + 1);
+			if (total > cap)
+				return -FFTLS_ENOTSUPP;
+			if (n >= total) {
+				ffstr_set(msg, buf, total);
+				break;
+			}
+		}
+	}
+
+	h->size = d.ptr - data->ptr;
+	return 1;
+}
+
+/* Get data of the highest non-GREASE version from 'supported-versions' extension. */
+static uint hello_suppvers(ffstr d, uint version)
+{
+	int n;
+	if ((n = datalen8(&d)) < 0)
+		return version;
+	for (int i = 0;  i + 2 <= n;  i += 2) {
+		uint ver = ffint_ntoh16(d.ptr + i);
+		if (!tls_grease(ver) && ver > version)
+			version = ver;
+	}
+	return version;
+}
+
+/** Set extension data without length prefix.
+Return 0 on success. */
+static int hello_extlist(ffstr d, ffstr *dst, uint len_size)
+{
+	int n = (len_size == 1) ? datalen8(&d) : datalen16(&d);
+	if (n < 0)
+		return -1;
+	ffstr_set(dst, d.ptr, n);
+	return 0;
+}
+
+int fftls_peek_hello(fftls_hello *h, const void *data, size_t len, void *buf, size_t cap)
+{
+	ffstr d, msg, exts, ed;
+	fftls t = {};
+	int r;
+
+	ffmem_tzero(h);
+	ffstr_set(&d, data, len);
+	r = hello_gather(h, &d, &msg, buf, cap);
+	if (r == 0)
+		return FFTLS_RMORE;
+	else if (r < 0)
+		goto err;
+
+	ffstr_shift(&msg, sizeof(struct hshake));
+	t.version = h->version;
+	t.hshake_type = HS_CLIENT_HELLO;
+	if ((r = tls_clihello_read(&t, &msg)) <= 0)
+		goto err;
+	h->version = h->max_version = t.version;
+	h->session_id = t.session_id;
+	h->ciphers = t.ciphers;
+
+	if (msg.len == 0)
+		return FFTLS_RCLIENT_HELLO; //no extensions
+	if (tlsexts_data(&t, &msg, &exts) <= 0) {
+		r = 0;
+		goto err;
+	}
+	h->exts = exts;
+
+	while (exts.len != 0) {
+		const struct ext *e = (void*)exts.ptr;
+		if (sizeof(struct ext) > exts.len
+			|| sizeof(struct ext) + ffint_ntoh16(e->len) > exts.len) {
+			r = 0;
+			goto err;
+		}
+		ffstr_set(&ed, e->data, ffint_ntoh16(e->len));
+		ffstr_shift(&exts, sizeof(struct ext) + ed.len);
+
+		r = 0;
+		switch (ffint_ntoh16(e->type)) {
+		case EXT_SERVER_NAME:
+			r = tlsext_servname_read(&t, &ed, &h->hostname);
+			break;
+		case EXT_ALPN:
+			r = tlsext_clihel_alpn_read(&t, &ed, &h->alpn_protos);
+			break;
+		case EXT_SUPP_VERS:
+			h->max_version = hello_suppvers(ed, h->max_version);
+			r = 1;
+			break;
+		case EXT_SUPP_GROUPS:
+			r = (0 == hello_extlist(ed, &h->groups, 2));
+			break;
+		case EXT_EC_FORMATS:
+			r = (0 == hello_extlist(ed, &h->ec_formats, 1));
+			break;
+		case EXT_SIG_ALGS:
+			r = (0 == hello_extlist(ed, &h->sig_algs, 2));
+			break;
+		default:
+			r = 1;
+		}
+		if (r <= 0)
+			goto err;
+	}
+
+	return FFTLS_RCLIENT_HELLO;
+
+err:
+	h->err = (r == 0) ? FFTLS_EDATA : -r;
+	return FFTLS_RERR;
+}
+
+
+/* Add values from ushort[] list in decimal form, skipping GREASE.
+Return NULL if there's not enough space. */
+static char* fp_list16_dec(char *p, const char *end, const ffstr *list)
+{
+	uint first = 1;
+	for (size_t i = 0;  i + 2 <= list->len;  i += 2) {
+		uint v = ffint_ntoh16(list->ptr + i);
+		if (tls_grease(v))
+			continue;
+		if (end - p < FFSLEN("-65535"))
+			return NULL;
+		if (!first)
+			*p++ = '-';
+		first = 0;
+		p += ffs_fromint(v, p, end - p, 0);
+	}
+	return p;
+}
+
+size_t fftls_ja3(const fftls_hello *h, char *buf, size_t cap)
+{
+	char *p = buf, *end = buf + cap;
+	ffstr exts = h->exts;
+	uint first = 1;
+
+	if (cap < FFSLEN("65535,"))
+		return 0;
+	p += ffs_fromint(h->version, p, end - p, 0);
+	*p++ = ',';
+
+	if (NULL == (p = fp_list16_dec(p, end, &h->ciphers)))
+		return 0;
+	if (p == end)
+		return 0;
+	*p++ = ',';
+
+	while (exts.len >= sizeof(struct ext)) {
+		const struct ext *e = (void*)exts.ptr;
+		ffstr_shift(&exts, ffmin(sizeof(struct ext) + ffint_ntoh16(e->len), exts.len));
+		uint v = ffint_ntoh16(e->type);
+		if (tls_grease(v))
+			continue;
+		if (end - p < FFSLEN("-65535"))
+			return 0;
+		if (!first)
+			*p++ = '-';
+		first = 0;
+		p += ffs_fromint(v, p, end - p, 0);
+	}
+	if (p == end)
+		return 0;
+	*p++ = ',';
+
+	if (NULL == (p = fp_list16_dec(p, end, &h->groups)))
+		return 0;
+	if (p == end)
+		return 0;
+	*p++ = ',';
+
+	for (size_t i = 0;  i != h->ec_formats.len;  i++) {
+		if (end - p < FFSLEN("-255"))
+			return 0;
+		if (i != 0)
+			*p++ = '-';
+		p += ffs_fromint((byte)h->ec_formats.ptr[i], p, end - p, 0);
+	}
+
+	return p - buf;
+}
+
+/* Add 4-digit hex values separated by ','.
+Return NULL if there's not enough space. */
+static char* fp_hex_list(char *p, const char *end, const uint *vals, size_t n)
+{
+	for (size_t i = 0;  i != n;  i++) {
+		if (end - p < FFSLEN(",ffff"))
+			return NULL;
+		if (i != 0)
+			*p++ = ',';
+		p += ffs_fromint(vals[i], p, end - p, FFINT_HEXLOW | FFINT_ZEROWIDTH | FFINT_WIDTH(4));
+	}
+	return p;
+}
+
+/* Get non-GREASE values from ushort[] list. */
+static size_t fp_list16(const ffstr *list, uint *vals, size_t cap)
+{
+	size_t n = 0;
+	for (size_t i = 0;  i + 2 <= list->len && n != cap;  i += 2) {
+		uint v = ffint_ntoh16(list->ptr + i);
+		if (!tls_grease(v))
+			vals[n++] = v;
+	}
+	return n;
+}
+
+static const char ja4_vers[][3] = { "s3", "10", "11", "12", "13" };
+
+size_t fftls_ja4r(const fftls_hello *h, char *buf, size_t cap)
+{
+	char *p = buf, *end = buf + cap;
+	uint vals[128];
+	size_t nciph, next = 0, next_all = 0;
+	ffstr exts = h->exts;
+
+	if (cap < FFSLEN("t13d1516h2_"))
+		return 0;
+
+	*p++ = 't';
+	if (h->max_version >= 0x0300 && h->max_version <= 0x0304)
+		p = ffmem_copy(p, ja4_vers[h->max_version - 0x0300], 2);
+	else
+		p = ffmem_copy(p, "00", 2);
+	*p++ = (h->hostname.len != 0) ? 'd' : 'i';
+
+	nciph = fp_list16(&h->ciphers, vals, FFCNT(vals));
+
+	// extensions excluding SNI and ALPN go to 'vals' after ciphers
+	uint *ext_vals = vals + nciph;
+	while (exts.len >= sizeof(struct ext)) {
+		const struct ext *e = (void*)exts.ptr;
+		ffstr_shift(&exts, ffmin(sizeof(struct ext) + ffint_ntoh16(e->len), exts.len));
+		uint v = ffint_ntoh16(e->type);
+		if (tls_grease(v))
+			continue;
+		next_all++;
+		if (v != EXT_SERVER_NAME && v != EXT_ALPN && nciph + next != FFCNT(vals))
+			ext_vals[next++] = v;
+	}
+
+	p += ffs_fromint(ffmin(nciph, 99), p, end - p, FFINT_ZEROWIDTH | FFINT_WIDTH(2));
+	p += ffs_fromint(ffmin(next_all, 99), p, end - p, FFINT_ZEROWIDTH | FFINT_WIDTH(2));
+
+	// first and last characters of the first ALPN protocol
+	ffstr alpn = h->alpn_protos, proto;
+	if (0 != fftls_alpn_next(&alpn, &proto) && proto.len != 0) {
+		byte c1 = proto.ptr[0], c2 = proto.ptr[proto.len - 1];
+		if ((ffchar_isletter(c1) || ffchar_isdigit(c1)) && (ffchar_isletter(c2) || ffchar_isdigit(c2))) {
+			*p++ = c1;
+			*p++ = c2;
+		} else {
+			*p++ = ffhex[c1 >> 4];
+			*p++ = ffhex[c2 & 0x0f];
+		}
+	} else {
+		p = ffmem_copy(p, "00", 2);
+	}
+	*p++ = '_';
+
+	ffint_sort(vals, nciph, 0);
+	if (NULL == (p = fp_hex_list(p, end, vals, nciph)))
+		return 0;
+	if (p == end)
+		return 0;
+	*p++ = '_';
+
+	ffint_sort(ext_vals, next, 0);
+	if (NULL == (p = fp_hex_list(p, end, ext_vals, next)))
+		return 0;
+	if (p == end)
+		return 0;
+	*p++ = '_';
+
+	size_t nsig = fp_list16(&h->sig_algs, vals, FFCNT(vals));
+	if (NULL == (p = fp_hex_list(p, end, vals, nsig)))
+		return 0;
+
+	return p - buf;
+}
+
+
+struct sniroute_ent {
+	ffstr name;
+	void *val;
+};
+
+static int sniroute_cmpkey(void *val, const void *key, void *param)
+{
+	const struct sniroute_ent *e = val;
+	const ffstr *k = key;
+	return !(e->name.len == k->len && 0 == ffs_icmp(e->name.ptr, k->ptr, k->len));
+}
+
+int fftls_sniroute_init(fftls_sniroute *sr, const ffstr *names, void *const *vals, size_t n)
+{
+	size_t total = 0, nwild = 0;
+	int r = -1;
+	ffmem_tzero(sr);
+
+	for (size_t i = 0;  i != n;  i++) {
+		total += names[i].len;
+		if (ffstr_matchcz(&names[i], "*."))
+			nwild++;
+	}
+
+	if (NULL == (sr->ents = ffmem_tcalloc(struct sniroute_ent, ffmax(n, 1))) // calloc(0) may return NULL
+		|| NULL == (sr->names = ffmem_alloc(total + 1))
+		|| 0 != ffhst_init(&sr->exact, n - nwild)
+		|| 0 != ffhst_init(&sr->wild, nwild))
+		goto err;
+	sr->exact.cmpkey = &sniroute_cmpkey;
+	sr->wild.cmpkey = &sniroute_cmpkey;
+
+	struct sniroute_ent *ents = sr->ents;
+	char *p = sr->names;
+	for (size_t i = 0;  i != n;  i++) {
+		ffstr s = names[i];
+		ffhstab *ht = &sr->exact;
+		if (ffstr_matchcz(&s, "*.")) {
+			ffstr_shift(&s, 2);
+			ht = &sr->wild;
+		}
+		if (s.len != 0 && ffarr_back(&s) == '.')
+			s.len--;
+		if (s.len == 0 || NULL != ffs_findc(s.ptr, s.len, '*')) {
+			r = i + 1;
+			goto err;
+		}
+
+		ffmemcpy(p, s.ptr, s.len);
+		ffstr_set(&ents[i].name, p, s.len);
+		p += s.len;
+		ents[i].val = vals[i];
+
+		uint hash = ffcrc32_iget(s.ptr, s.len);
+		if (NULL != ffhst_find(ht, hash, &ents[i].name, NULL)) {
+			r = i + 1;
+			goto err;
+		}
+		if (0 > ffhst_ins(ht, hash, &ents[i]))
+			goto err;
+	}
+
+	return 0;
+
+err:
+	fftls_sniroute_free(sr);
+	return r;
+}
+
+void fftls_sniroute_free(fftls_sniroute *sr)
+{
+	ffhst_free(&sr->exact);
+	ffhst_free(&sr->wild);
+	ffmem_safefree0(sr->ents);
+	ffmem_safefree0(sr->names);
+}
+
+void* fftls_sniroute_find(const fftls_sniroute *sr, const char *host, size_t len)
+{
+	const struct sniroute_ent *e;
+	ffstr s;
+	ffstr_set(&s, host, len);
+	if (s.len != 0 && ffarr_back(&s) == '.')
+		s.len--;
+
+	if (NULL != (e = ffhst_find(&sr->exact, ffcrc32_iget(s.ptr, s.len), &s, NULL)))
+		return e->val;
+
+	if (sr->wild.len == 0)
+		return sr->dflt;
+
+	// "a.b.domain": search "b.domain", then "domain"
+	for (;;) {
+		const char *dot = ffs_findc(s.ptr, s.len, '.');
+		if (dot == NULL)
+			break;
+		ffstr_shift(&s, dot + 1 - s.ptr);
+		if (NULL != (e = ffhst_find(&sr->wild, ffcrc32_iget(s.ptr, s.len), &s, NULL)))
+			return e->val;
+	}
+
+	return sr->dflt;
+}
+
+
 static const char tls_vers[][8] = {
 	"TLSv1", "TLSv1.1", "TLSv1.2", "TLSv1.3"
 };
@@ -7,6 +7,283 @@ Copyright (c) 2013 Simon Zolin
 #include <FF/path.h>
 #include <FF/number.h>
 
+#ifdef FF_AMD64
+#include <emmintrin.h> //SSE2
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+
+/* Character classification of 16-byte blocks.
+Each function returns a bit mask: bit N is set if byte N belongs to the class.
+Bytes >=0x80 are negative in signed comparisons, so they never match an ASCII range. */
+#if defined FF_AMD64
+#define URL_SIMD
+typedef __m128i url_v;
+#define v_load(p)  _mm_loadu_si128((void*)(p))
+#define v_eq(v, c)  _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define v_lt(v, c)  _mm_cmplt_epi8(v, _mm_set1_epi8(c))
+#define v_gt(v, c)  _mm_cmpgt_epi8(v, _mm_set1_epi8(c))
+#define v_or(a, b)  _mm_or_si128(a, b)
+#define v_and(a, b)  _mm_and_si128(a, b)
+#define v_lower(v)  _mm_or_si128(v, _mm_set1_epi8(0x20))
+#define v_mask(v)  (uint)_mm_movemask_epi8(v)
+
+#elif defined __ARM_NEON
+#define URL_SIMD
+typedef int8x16_t url_v;
+#define v_load(p)  vld1q_s8((void*)(p))
+#define v_eq(v, c)  vreinterpretq_s8_u8(vceqq_s8(v, vdupq_n_s8(c)))
+#define v_lt(v, c)  vreinterpretq_s8_u8(vcltq_s8(v, vdupq_n_s8(c)))
+#define v_gt(v, c)  vreinterpretq_s8_u8(vcgtq_s8(v, vdupq_n_s8(c)))
+#define v_or(a, b)  vorrq_s8(a, b)
+#define v_and(a, b)  vandq_s8(a, b)
+#define v_lower(v)  vorrq_s8(v, vdupq_n_s8(0x20))
+
+static inline uint v_mask(url_v v)
+{
+	static const uint8_t bits[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t m = vandq_u8(vreinterpretq_u8_s8(v), vld1q_u8(bits));
+	uint8x8_t p = vpadd_u8(vget_low_u8(m), vget_high_u8(m));
+	p = vpadd_u8(p, p);
+	p = vpadd_u8(p, p);
+	return vget_lane_u16(vreinterpret_u16_u8(p), 0);
+}
+#endif
+
+#ifdef URL_SIMD
+/* a-zA-Z0-9_-. */
+static inline uint v_hostchars(url_v v)
+{
+	url_v lw = v_lower(v);
+	url_v m = v_and(v_gt(lw, 'a' - 1), v_lt(lw, 'z' + 1));
+	m = v_or(m, v_and(v_gt(v, '0' - 1), v_lt(v, '9' + 1)));
+	m = v_or(m, v_or(v_eq(v, '_'), v_or(v_eq(v, '-'), v_eq(v, '.'))));
+	return v_mask(m);
+}
+
+/* ffchar_isansiwhite() or '#' */
+static inline uint v_stopchars(url_v v)
+{
+	url_v m = v_or(v_lt(v, ' ' + 1), v_or(v_eq(v, 0x7f), v_eq(v, '#')));
+	return v_mask(m);
+}
+#endif
+
+#define url_hostchar(c)  (ffchar_isname(c) || (c) == '-' || (c) == '.')
+#define url_stopchar(c)  (ffchar_isansiwhite(c) || (c) == '#')
+
+/** Get the number of leading host characters. */
+static size_t url_hostspan(const char *s, size_t len)
+{
+	size_t i = 0;
+#ifdef URL_SIMD
+	for (;  i + 16 <= len;  i += 16) {
+		uint m = ~v_hostchars(v_load(s + i)) & 0xffff;
+		if (m != 0)
+			return i + ffbit_ffs32(m) - 1;
+	}
+#endif
+	while (i != len && url_hostchar(s[i])) {
+		i++;
+	}
+	return i;
+}
+
+/** Get the number of leading characters allowed in query string. */
+static size_t url_qsspan(const char *s, size_t len)
+{
+	size_t i = 0;
+#ifdef URL_SIMD
+	for (;  i + 16 <= len;  i += 16) {
+		uint m = v_stopchars(v_load(s + i));
+		if (m != 0)
+			return i + ffbit_ffs32(m) - 1;
+	}
+#endif
+	while (i != len && !url_stopchar(s[i])) {
+		i++;
+	}
+	return i;
+}
+
+/** Classify up to 16 bytes of path.
+'evt': '%', '?' or a stop character
+'slash': '/'
+'dotslash': '/' or '.' */
+static void url_pathmask(const char *s, size_t n, uint *evt, uint *slash, uint *dotslash)
+{
+#ifdef URL_SIMD
+	if (n >= 16) {
+		url_v v = v_load(s);
+		url_v sl = v_eq(v, '/');
+		*evt = v_stopchars(v) | v_mask(v_or(v_eq(v, '%'), v_eq(v, '?')));
+		*slash = v_mask(sl);
+		*dotslash = v_mask(v_or(sl, v_eq(v, '.')));
+		return;
+	}
+#endif
+	uint e = 0, sl = 0, ds = 0;
+	n = ffmin(n, 16);
+	for (uint i = 0;  i != n;  i++) {
+		int ch = s[i];
+		if (ch == '%' || ch == '?' || url_stopchar(ch))
+			e |= 1 << i;
+		else if (ch == '/')
+			sl |= 1 << i;
+		if (ch == '/' || ch == '.')
+			ds |= 1 << i;
+	}
+	*evt = e;
+	*slash = sl;
+	*dotslash = ds;
+}
+
+enum URL_I {
+	iHostStart = 0, iHost, iIp6, iAfterHost, iPort
+	, iPathStart, iPath, iQuoted1, iQuoted2, iQs
+	, iPortOrScheme, iSchemeSlash2
+};
+
+/* Parse the whole URL in one pass over 16-byte blocks.
+Handles the common input: "[scheme://]host[:port][/path[?query]]" or "/path[?query]",
+ optionally followed by a stop character (e.g. " HTTP/1.1").
+The result is the same as the state machine would produce.
+Return enum FFURL_E;  -1: the input must be parsed by the state machine. */
+static int url_parse_fast(ffurl *url, const char *s, size_t len)
+{
+	ffurl u;
+	size_t i = 0, n;
+	int er, idx;
+	uint evt, slash, dotslash;
+
+	if (len == 0 || len > 0xffff)
+		return -1;
+	ffmem_tzero(&u);
+
+	if (s[0] != '/') {
+		n = url_hostspan(s, len);
+		if (n + FFSLEN("://") <= len && s[n] == ':' && s[n + 1] == '/' && s[n + 2] == '/') {
+			if (n == 0 || n > 0xff || ffchar_isdigit(s[0]))
+				return -1;
+			i = n + FFSLEN("://");
+			u.offhost = i;
+			n = url_hostspan(s + i, len - i);
+		}
+		if (n == 0 || n > 0xff)
+			return -1; // IPv6 address, bad or too large host
+		u.hostlen = n;
+
+		if (ffchar_isdigit(s[i])) {
+			u.ipv4 = 1;
+			for (size_t k = i;  k != i + n;  k++) {
+				if (!(ffchar_isdigit(s[k]) || s[k] == '.')) {
+					u.ipv4 = 0;
+					break;
+				}
+			}
+		}
+		i += n;
+
+		if (i == len) {
+			idx = iHost;
+			er = FFURL_EOK;
+			goto done;
+		}
+
+		if (s[i] == ':') {
+			i++;
+			if (u.offhost == 0 && i != len && s[i] == '/')
+				return -1; // "scheme:/"
+
+			uint port = 0;
+			size_t off = i;
+			for (;  i != len && ffchar_isdigit(s[i]);  i++) {
+				port = port * 10 + (s[i] - '0');
+				if (port > 0xffff)
+					return -1;
+			}
+			u.port = port;
+			u.portlen = i - off;
+
+			if (i == len) {
+				if (u.portlen == 0)
+					return -1;
+				idx = iPort;
+				er = FFURL_EOK;
+				goto done;
+			}
+		}
+
+		if (s[i] != '/')
+			return -1;
+	}
+
+	u.offpath = i;
+	idx = iPath;
+	for (;;) {
+		n = len - i;
+		url_pathmask(s + i, n, &evt, &slash, &dotslash);
+		if (n > 16)
+			n = 16;
+		uint lim = (evt != 0) ? ffbit_ffs32(evt) - 1 : n;
+
+		if (!u.complex) {
+			// "//", "/.": the previous character is '/'
+			uint prev = (i != 0 && s[i - 1] == '/');
+			if (((slash << 1) | prev) & dotslash & ((1U << lim) - 1))
+				u.complex = 1;
+		}
+		i += lim;
+		u.pathlen += lim;
+		u.decoded_pathlen += lim;
+
+		if (evt == 0) {
+			if (i == len) {
+				er = FFURL_EOK;
+				goto done;
+			}
+			continue;
+		}
+
+		switch (s[i]) {
+		case '%':
+			if (i + 2 >= len || !ffchar_ishex(s[i + 1]) || !ffchar_ishex(s[i + 2]))
+				return -1;
+			u.complex = 1;
+			i += FFSLEN("%XX");
+			u.pathlen += FFSLEN("%XX");
+			u.decoded_pathlen++;
+			if (i == len) {
+				er = FFURL_EOK;
+				goto done;
+			}
+			continue;
+
+		case '?':
+			i++;
+			idx = iQs;
+			n = url_qsspan(s + i, len - i);
+			u.querystr = (n != 0);
+			i += n;
+			er = (i == len) ? FFURL_EOK : FFURL_ESTOP;
+			goto done;
+
+		default:
+			er = FFURL_ESTOP;
+			goto done;
+		}
+	}
+
+done:
+	u.idx = idx;
+	u.len = i;
+	if (!(idx == iPath || idx == iQs))
+		u.offpath = u.len;
+	*url = u;
+	return er;
+}
+
 
 /*
 host:
@@ -20,17 +297,19 @@ valid input:
 */
 int ffurl_parse(ffurl *url, const char *s, size_t len)
 {
-	enum {
-		iHostStart = 0, iHost, iIp6, iAfterHost, iPort
-		, iPathStart, iPath, iQuoted1, iQuoted2, iQs
-		, iPortOrScheme, iSchemeSlash2
-	};
+	static const ffurl url_zero;
 	int er = 0;
 	int idx = url->idx;
 	size_t i;
 	ffbool again = 0;
 	ffbool consistent;
 
+	if (url->len == 0 && !ffmemcmp(url, &url_zero, sizeof(ffurl))) {
+		if (0 <= (er = url_parse_fast(url, s, len)))
+			return er;
+		er = 0;
+	}
+
 	for (i = url->len;  i < len;  i++) {
 		int ch = s[i];
 
@@ -347,6 +626,28 @@ int ffurl_joinstr(ffstr *dst, const ffstr *scheme, const ffstr *host, uint port,
 	return dst->len;
 }
 
+/** Get the number of leading characters which are copied as is by ffuri_decode(). */
+static size_t uri_plainspan(const char *s, size_t len, uint flags)
+{
+	size_t i = 0;
+#ifdef URL_SIMD
+	for (;  i + 16 <= len;  i += 16) {
+		url_v v = v_load(s + i);
+		uint m = v_mask(v_eq(v, '%'));
+		if (flags & FFURI_DEC_HTTPREQ)
+			m |= v_stopchars(v);
+		if (m != 0)
+			return i + ffbit_ffs32(m) - 1;
+	}
+#endif
+	for (;  i != len;  i++) {
+		if (s[i] == '%'
+			|| ((flags & FFURI_DEC_HTTPREQ) && url_stopchar(s[i])))
+			break;
+	}
+	return i;
+}
+
 size_t ffuri_decode(char *dst, size_t dstcap, const char *d, size_t len, uint flags)
 {
 	enum { iUri, iQuoted1, iQuoted2 };
@@ -357,6 +658,19 @@ size_t ffuri_decode(char *dst, size_t dstcap, const char *d, size_t len, uint fl
 	size_t i;
 
 	for (i = 0;  i != len && idst < dstcap;  ++i) {
+
+		if (idx == iUri) {
+			// copy everything up to the next '%' at once
+			size_t n = uri_plainspan(d + i, ffmin(len - i, dstcap - idst), flags);
+			if (n != 0) {
+				memmove(dst + idst, d + i, n);
+				idst += n;
+				i += n;
+				if (i == len || idst == dstcap)
+					break;
+			}
+		}
+
 		int ch = d[i];
 
 		switch (idx) {
@@ -523,7 +837,28 @@ static int val_add(ffarr *buf, const char *s, size_t len)
 	return 0;
 }
 
-static int _ffurlqs_process_str(ffurlqs *p, const char **pd)
+/** Get the number of leading characters which don't need decoding in query string. */
+static size_t urlqs_plainspan(const char *s, size_t len)
+{
+	size_t i = 0;
+#ifdef URL_SIMD
+	for (;  i + 16 <= len;  i += 16) {
+		url_v v = v_load(s + i);
+		url_v m = v_or(v_or(v_eq(v, '&'), v_eq(v, '=')), v_or(v_eq(v, '+'), v_eq(v, '%')));
+		uint mask = v_mask(m);
+		if (mask != 0)
+			return i + ffbit_ffs32(mask) - 1;
+	}
+#endif
+	for (;  i != len;  i++) {
+		int ch = s[i];
+		if (ch == '&' || ch == '=' || ch == '+' || ch == '%')
+			break;
+	}
+	return i;
+}
+
+static int _ffurlqs_process_str(ffurlqs *p, const char **pd, const char *end)
 {
 	const char *d = *pd;
 	char c;
@@ -540,7 +875,11 @@ static int _ffurlqs_process_str(ffurlqs *p, const char **pd)
 		return val_store(&p->buf, &c, 1);
 	}
 
-	return val_add(&p->buf, d, 1);
+	// the current character is never special in the current state
+	size_t n = 1 + urlqs_plainspan(d + 1, end - (d + 1));
+	*pd += n - 1;
+	p->ch += n - 1;
+	return val_add(&p->buf, d, n);
 }
 
 int ffurlqs_parse(ffurlqs *p, const char *d, size_t *len)
@@ -573,7 +912,7 @@ int ffurlqs_parse(ffurlqs *p, const char *d, size_t *len)
 				break;
 			}
 
-			r = _ffurlqs_process_str(p, &d);
+			r = _ffurlqs_process_str(p, &d, end);
 			break;
 
 		case qs_val_start:
@@ -588,7 +927,7 @@ int ffurlqs_parse(ffurlqs *p, const char *d, size_t *len)
 				break;
 			}
 
-			r = _ffurlqs_process_str(p, &d);
+			r = _ffurlqs_process_str(p, &d, end);
 			break;
 		}
 
@@ -7,11 +7,13 @@ Copyright (c) 2018 Simon Zolin
 #include <FF/number.h>
 #include <sha1/sha1.h>
 #include <base64/base64.h>
+#include <zlib/zlib-ff.h>
 
 
 enum B1 {
 	WS_F_FIN = 0x80,
 	WS_F_RES = 0x70, //must be 0
+	WS_F_RSV1 = 0x40, //compressed message (permessage-deflate)
 	WS_F_OPCODE = 0x0f, //enum FFWEBSKT_OP
 };
 enum B2 {
@@ -39,6 +41,13 @@ enum {
 
 #define KEY_GUID  "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 
+/* Appended by Z_SYNC_FLUSH;  not transferred with permessage-deflate */
+#define DEFL_TAIL  "\x00\x00\xff\xff"
+
+enum {
+	DEFL_ZOUT = 16 * 1024, //size of buffer for decompressed data
+};
+
 /* base64(SHA-1(request."Sec-WebSocket-Key" KEY_GUID)) */
 void ffwebskt_accept(ffwebskt *w, const ffstr *clientkey)
 {
@@ -61,6 +70,107 @@ int ffwebskt_accept_ver(ffwebskt *w, const ffstr *ver)
 	return -1;
 }
 
+/* Parse permessage-deflate offer:
+ "permessage-deflate; server_no_context_takeover; client_max_window_bits=15"
+Return enum FFWEBSKT_DEFL;  -1 if the offer can't be accepted. */
+static int defl_offer(ffstr offer)
+{
+	ffstr name, param, val;
+	uint f = 0, seen = 0, bit, n;
+
+	ffstr_nextval3(&offer, &name, ';');
+	if (!ffstr_ieqcz(&name, "permessage-deflate"))
+		return -1;
+
+	while (offer.len != 0) {
+		ffstr_nextval3(&offer, &param, ';');
+		ffs_split2by(param.ptr, param.len, '=', &name, &val);
+		if (val.len >= 2 && val.ptr[0] == '"' && ffarr_back(&val) == '"') {
+			val.ptr++;
+			val.len -= 2;
+		}
+
+		if (ffstr_ieqcz(&name, "server_no_context_takeover")) {
+			bit = 1;
+			f |= FFWEBSKT_DEFL_SERV_NOCTX;
+
+		} else if (ffstr_ieqcz(&name, "client_no_context_takeover")) {
+			bit = 2;
+			f |= FFWEBSKT_DEFL_CLI_NOCTX;
+
+		} else if (ffstr_ieqcz(&name, "server_max_window_bits")) {
+			bit = 4;
+			// our compressor always uses 32k window
+			if (!ffstr_toint(&val, &n, FFS_INT32) || n != 15)
+				return -1;
+
+		} else if (ffstr_ieqcz(&name, "client_max_window_bits")) {
+			bit = 8;
+			// our decompressor accepts any window size
+			if (val.len != 0
+				&& !(ffstr_toint(&val, &n, FFS_INT32) && n >= 8 && n <= 15))
+				return -1;
+
+		} else
+			return -1; //unknown parameter
+
+		if (seen & bit)
+			return -1; //duplicate parameter
+		seen |= bit;
+
+		if ((bit & 3) && val.len != 0)
+			return -1;
+	}
+
+	return f;
+}
+
+int ffwebskt_accept_ext(ffwebskt *w, const ffstr *ext, uint flags)
+{
+	ffstr s = *ext, offer;
+	int f = -1;
+
+	while (s.len != 0) {
+		ffstr_nextval3(&s, &offer, ',');
+		if (-1 != (f = defl_offer(offer)))
+			break;
+	}
+	if (f == -1)
+		return 1;
+
+	f |= flags;
+	if (0 != ffwebskt_inflate_init(w))
+		return -1;
+	w->defl_flags = f;
+
+	char *p = w->buf, *end = w->buf + sizeof(w->buf);
+	p = ffs_copycz(p, end, "permessage-deflate");
+	if (f & FFWEBSKT_DEFL_SERV_NOCTX)
+		p = ffs_copycz(p, end, "; server_no_context_takeover");
+	if (f & FFWEBSKT_DEFL_CLI_NOCTX)
+		p = ffs_copycz(p, end, "; client_no_context_takeover");
+	w->out.ptr = w->buf,  w->out.len = p - w->buf;
+	return 0;
+}
+
+int ffwebskt_inflate_init(ffwebskt *w)
+{
+	z_conf conf = {0};
+	if (w->lz == NULL
+		&& 0 != z_inflate_init(&w->lz, &conf))
+		return -1;
+	if (NULL == ffarr_realloc(&w->zout, DEFL_ZOUT))
+		return -1;
+	w->deflate = 1;
+	return 0;
+}
+
+void ffwebskt_close(ffwebskt *w)
+{
+	FF_SAFECLOSE(w->lz, NULL, z_inflate_free);
+	ffarr_free(&w->zout);
+}
+
 #define GATHER(w, st, n) \
 	(w)->state = R_GATHER,  (w)->nxstate = st,  (w)->gathlen = n
 
@@ -71,6 +181,8 @@ int ffwebskt_accept_ver(ffwebskt *w, const ffstr *ver)
   . Determine data length
   . Return FFWEBSKT_RMSG
 . Decrypt body if necessary
+. Decompress body if necessary
+  . Pass the flush marker to decompressor after the last frame of a message
 . Return message body (FFWEBSKT_RDATA, FFWEBSKT_RDATA_FIN)
 */
 int ffwebskt_parse(ffwebskt *w)
@@ -79,7 +191,7 @@ int ffwebskt_parse(ffwebskt *w)
 	enum {
 		R_INIT, R_GATHER,
 		R_HDR, R_HLEN2, R_HLEN8, R_HOK,
-		R_BODY,
+		R_BODY, R_INFLATE,
 	};
 
 	for (;;) {
@@ -102,8 +214,14 @@ int ffwebskt_parse(ffwebskt *w)
 	case R_HDR:
 		w->op = w->buf[0] & WS_F_OPCODE;
 
-		if ((w->buf[0] & WS_F_RES) != 0)
+		n = w->buf[0] & WS_F_RES;
+		if (n == WS_F_RSV1 && w->deflate
+			&& (w->op == FFWEBSKT_OP_TEXT || w->op == FFWEBSKT_OP_BIN))
+			w->compressed = 1;
+		else if (n != 0)
 			return FFWEBSKT_RERR;
+		else if (w->op != FFWEBSKT_OP_CONT)
+			w->compressed = 0;
 
 		if (!w->cont && w->op == FFWEBSKT_OP_CONT)
 			return FFWEBSKT_RERR; //unexpected "continuation" frame
@@ -166,6 +284,13 @@ int ffwebskt_parse(ffwebskt *w)
 
 	case R_BODY: {
 		if (w->datalen == 0) {
+			if (w->compressed && !w->cont && !w->ztail) {
+				ffstr_set(&w->zin, DEFL_TAIL, 4);
+				w->ztail = 1;
+				w->state = R_INFLATE;
+				continue;
+			}
+			w->ztail = 0;
 			w->nbuf = 0;
 			GATHER(w, R_HDR, 2);
 			return FFWEBSKT_RDATA_FIN;
@@ -175,15 +300,50 @@ int ffwebskt_parse(ffwebskt *w)
 			return FFWEBSKT_RMORE;
 
 		size_t nn = ffmin64(w->datalen, w->in.len);
-		if (w->mask_off != 0) {
+		if (w->mask_off != 0 && w->inplace) {
+			w->mask = ffmem_xor4(w->in.ptr, w->in.ptr, nn, w->mask);
+			ffstr_set(&w->out, w->in.ptr, nn);
+		} else if (w->mask_off != 0) {
 			nn = ffmin64(nn, sizeof(w->buf));
-			ffmem_xor4(w->buf, w->in.ptr, nn, w->mask);
+			w->mask = ffmem_xor4(w->buf, w->in.ptr, nn, w->mask);
 			ffstr_set(&w->out, w->buf, nn);
 		} else {
 			ffstr_set(&w->out, w->in.ptr, nn);
 		}
 		ffarr_shift(&w->in, nn);
 		w->datalen -= nn;
+		if (w->compressed) {
+			w->zin = w->out;
+			w->state = R_INFLATE;
+			continue;
+		}
+		return FFWEBSKT_RDATA;
+	}
+
+	case R_INFLATE: {
+		size_t rd = w->zin.len;
+		int r = z_inflate(w->lz, w->zin.ptr, &rd, w->zout.ptr, w->zout.cap, 0);
+
+		if (r == Z_DONE) {
+			// the last deflate block:  the next message starts a new stream
+			z_inflate_reset(w->lz);
+			w->zin.len = 0;
+			w->state = R_BODY;
+			continue;
+
+		} else if (r < 0)
+			return FFWEBSKT_RERR;
+
+		ffstr_shift(&w->zin, rd);
+		if (r == 0) {
+			if (w->zin.len != 0 && rd == 0)
+				return FFWEBSKT_RERR;
+			if (w->zin.len == 0)
+				w->state = R_BODY;
+			continue;
+		}
+
+		ffstr_set(&w->out, w->zout.ptr, r);
 		return FFWEBSKT_RDATA;
 	}
 
@@ -193,36 +353,105 @@ int ffwebskt_parse(ffwebskt *w)
 }
 
 
-int ffwebskt_newmsg(ffwebskt_cook *w, uint mask_key, uint op)
+int ffwebskt_wdeflate_init(ffwebskt_cook *w, uint level, uint noctx)
 {
-	FF_ASSERT(0 == (op & ~WS_F_OPCODE));
+	z_conf conf = {0};
+	conf.level = level;
+	if (0 != z_deflate_init(&w->lz, &conf))
+		return -1;
+	w->noctx = !!noctx;
+	return 0;
+}
+
+void ffwebskt_wclose(ffwebskt_cook *w)
+{
+	FF_SAFECLOSE(w->lz, NULL, z_deflate_free);
+	ffarr_free(&w->zbuf);
+}
+
+/* Compress the whole message into 'zbuf' and set it as input data. */
+static int ws_deflate(ffwebskt_cook *w)
+{
+	w->zbuf.len = 0;
+
+	for (;;) {
+		if (ffarr_unused(&w->zbuf) < 64
+			&& NULL == ffarr_grow(&w->zbuf, ffmax(w->in.len / 2, 4096), FFARR_GROWQUARTER))
+			return -1;
+
+		size_t rd = w->in.len, cap = ffarr_unused(&w->zbuf);
+		int r = z_deflate(w->lz, w->in.ptr, &rd, ffarr_end(&w->zbuf), cap, Z_SYNC_FLUSH);
+		if (r < 0)
+			return -1;
+		ffstr_shift(&w->in, rd);
+		w->zbuf.len += r;
+
+		// the flush is complete when there's free space left in output buffer
+		if (w->in.len == 0 && (size_t)r != cap)
+			break;
+	}
+
+	if (w->zbuf.len >= 4
+		&& !ffmemcmp(ffarr_end(&w->zbuf) - 4, DEFL_TAIL, 4))
+		w->zbuf.len -= 4;
+
+	if (w->noctx)
+		z_deflate_reset(w->lz);
 
+	ffstr_set(&w->in, w->zbuf.ptr, w->zbuf.len);
+	return 0;
+}
+
+/* Write message header.
+@flags_op: enum B1
+Return header size;  0 if data is too large. */
+static uint ws_hdr(char *buf, uint64 len, uint flags_op, uint mask_key)
+{
 	char *p;
-	w->buf[0] = 0;
-	w->buf[0] |= WS_F_FIN;
-	w->buf[0] |= op;
-	w->buf[1] = 0;
-
-	if (w->in.len < WS_MAXMSG1) {
-		w->buf[1] |= w->in.len;
-		p = w->buf + 2;
-	} else if (w->in.len <= WS_MAXMSG2) {
-		ffint_hton16(w->buf + 2, w->in.len);
-		p = w->buf + 2 + 2;
-	} else if ((uint64)w->in.len <= WS_MAXMSG) {
-		ffint_hton64(w->buf + 2, w->in.len);
-		p = w->buf + 2 + 8;
+	buf[0] = flags_op;
+	buf[1] = 0;
+
+	if (len < WS_MAXMSG1) {
+		buf[1] |= len;
+		p = buf + 2;
+	} else if (len <= WS_MAXMSG2) {
+		buf[1] |= 126;
+		ffint_hton16(buf + 2, len);
+		p = buf + 2 + 2;
+	} else if (len <= WS_MAXMSG) {
+		buf[1] |= 127;
+		ffint_hton64(buf + 2, len);
+		p = buf + 2 + 8;
 	} else
-		return FFWEBSKT_RERR;
+		return 0;
 
 	if (mask_key != 0) {
-		w->buf[1] |= WS_F_MASK;
+		buf[1] |= WS_F_MASK;
 		ffmemcpy(p, &mask_key, 4);
 		p += 4;
 	}
 
+	return p - buf;
+}
+
+int ffwebskt_newmsg(ffwebskt_cook *w, uint mask_key, uint op)
+{
+	FF_ASSERT(0 == (op & ~WS_F_OPCODE));
+
+	uint f = WS_F_FIN | op;
+
+	if (w->lz != NULL && (op == FFWEBSKT_OP_TEXT || op == FFWEBSKT_OP_BIN)) {
+		if (0 != ws_deflate(w))
+			return FFWEBSKT_RERR;
+		f |= WS_F_RSV1;
+	}
+
+	uint n = ws_hdr(w->buf, w->in.len, f, mask_key);
+	if (n == 0)
+		return FFWEBSKT_RERR;
+
 	w->mask = mask_key;
-	w->out.ptr = w->buf,  w->out.len = p - w->buf;
+	w->out.ptr = w->buf,  w->out.len = n;
 	return FFWEBSKT_RDATA;
 }
 
@@ -231,9 +460,15 @@ int ffwebskt_writenext(ffwebskt_cook *w)
 	if (w->in.len == 0)
 		return FFWEBSKT_RDATA_FIN;
 
-	if (w->mask != 0) {
+	if (w->mask != 0 && w->inplace) {
+		w->mask = ffmem_xor4(w->in.ptr, w->in.ptr, w->in.len, w->mask);
+		w->out = w->in;
+		w->in.len = 0;
+		return FFWEBSKT_RDATA;
+
+	} else if (w->mask != 0) {
 		size_t n = ffmin64(w->in.len, sizeof(w->buf));
-		ffmem_xor4(w->buf, w->in.ptr, n, w->mask);
+		w->mask = ffmem_xor4(w->buf, w->in.ptr, n, w->mask);
 		w->out.ptr = w->buf,  w->out.len = n;
 		ffarr_shift(&w->in, n);
 		return FFWEBSKT_RDATA;
@@ -243,3 +478,72 @@ int ffwebskt_writenext(ffwebskt_cook *w)
 	w->in.len = 0;
 	return FFWEBSKT_RDATA;
 }
+
+
+static ffwebskt_bcast* bcast_alloc(const void *data, size_t len, uint f, uint flags)
+{
+	ffwebskt_bcast *b;
+	size_t n = sizeof(ffwebskt_bcast) + ((flags & FFWEBSKT_BC_COPY) ? len : 0);
+	if (NULL == (b = ffmem_alloc(n)))
+		return NULL;
+	ffmem_tzero(b);
+
+	uint hdrlen = ws_hdr(b->hdr, len, f, 0);
+	if (hdrlen == 0) {
+		ffmem_free(b);
+		return NULL;
+	}
+	ffiov_set(&b->iov[0], b->hdr, hdrlen);
+
+	if (flags & FFWEBSKT_BC_COPY) {
+		ffmemcpy(b + 1, data, len);
+		data = b + 1;
+	}
+	ffiov_set(&b->iov[1], data, len);
+	b->size = hdrlen + len;
+	ffatom_set(&b->ref, 1);
+	return b;
+}
+
+ffwebskt_bcast* ffwebskt_bcast_new(const void *data, size_t len, uint op, uint flags)
+{
+	FF_ASSERT(0 == (op & ~WS_F_OPCODE));
+	return bcast_alloc(data, len, WS_F_FIN | op, flags);
+}
+
+ffwebskt_bcast* ffwebskt_bcast_deflate(ffwebskt_cook *w, const void *data, size_t len, uint op)
+{
+	FF_ASSERT(op == FFWEBSKT_OP_TEXT || op == FFWEBSKT_OP_BIN);
+	FF_ASSERT(w->lz != NULL && w->noctx);
+	ffstr_set(&w->in, data, len);
+	if (0 != ws_deflate(w))
+		return NULL;
+	ffwebskt_bcast *b = bcast_alloc(w->in.ptr, w->in.len, WS_F_FIN | WS_F_RSV1 | op, FFWEBSKT_BC_COPY);
+	w->in.len = 0;
+	return b;
+}
+
+void ffwebskt_bcast_unref(ffwebskt_bcast *b)
+{
+	if (0 != ffatom_decret(&b->ref))
+		return;
+	if (b->onfree != NULL)
+		b->onfree(b->udata);
+	ffmem_free(b);
+}
+
+uint ffwebskt_bcast_iov(const ffwebskt_bcast *b, uint64 off, ffiovec *iov)
+{
+	uint n = 0;
+	for (uint i = 0;  i != 2;  i++) {
+		size_t len = b->iov[i].iov_len;
+		if (off >= len) {
+			off -= len;
+			continue;
+		}
+		ffiov_set(&iov[n], (char*)b->iov[i].iov_base + off, len - off);
+		n++;
+		off = 0;
+	}
+	return n;
+}
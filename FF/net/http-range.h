@@ -0,0 +1,110 @@
+/** HTTP range requests.
+Copyright (c) 2019 Simon Zolin
+*/
+
+/*
+Range: bytes=0-99,200-299,-100
+ . ranges are resolved against the content size, sorted and coalesced (overlapping and close ranges)
+ . unsatisfiable ranges are skipped;  if none is left: 416 Requested Range Not Satisfiable
+
+1 range:
+	206 Partial Content
+	Content-Range: bytes 0-99/1000
+	Content-Length: 100
+
+	(data)
+
+N ranges:
+	206 Partial Content
+	Content-Type: multipart/byteranges; boundary=B
+	Content-Length: ...
+
+	--B CRLF
+	Content-Type: text/plain CRLF
+	Content-Range: bytes 0-99/1000 CRLF
+	CRLF
+	(data)
+	CRLF --B CRLF
+	...
+	(data)
+	CRLF --B-- CRLF
+
+Each part is sent by ffsf: file region with the part header in sf_hdtr.headers
+ and the closing boundary in sf_hdtr.trailers of the last part.
+*/
+
+#pragma once
+
+#include <FF/net/http.h>
+#include <FF/sys/sendfile.h>
+
+
+typedef struct ffhttp_range_part {
+	uint64 off;
+	uint64 len;
+	size_t hdr_off; // part header in ffhttp_ranges.hdrs
+	uint hdr_len;
+} ffhttp_range_part;
+
+typedef struct ffhttp_ranges {
+	ffarr parts; //ffhttp_range_part[]
+	uint64 size; // content size
+	uint64 body_len; // response body size
+	ffarr hdrs; // part headers, the closing boundary
+	size_t end_off;
+	uint end_len;
+	ffarr ctype; // Content-Type value
+	char boundary[16];
+	uint cur; // the next part to send
+	ffiovec iov[2]; // part header, closing boundary
+
+	uint max_ranges; // the maximum number of ranges in request
+	uint coalesce_gap; // merge ranges separated by less than this number of bytes
+} ffhttp_ranges;
+
+static FFINL void ffhttp_ranges_init(ffhttp_ranges *r)
+{
+	ffmem_tzero(r);
+	r->max_ranges = 100;
+	r->coalesce_gap = 80; // about the size of a part header
+}
+
+static FFINL void ffhttp_ranges_free(ffhttp_ranges *r)
+{
+	ffarr_free(&r->parts);
+	ffarr_free(&r->hdrs);
+	ffarr_free(&r->ctype);
+}
+
+enum FFHTTP_RANGE_E {
+	FFHTTP_RANGE_OK,
+	FFHTTP_RANGE_IGNORE, // invalid syntax or too many ranges: the header must be ignored, send the whole content
+	FFHTTP_RANGE_UNSATISFIABLE, // no range is within the content: 416
+};
+
+/** Parse Range header value "bytes=RANGE[,RANGE]...".
+'size': content size
+Return enum FFHTTP_RANGE_E. */
+FF_EXTN int ffhttp_ranges_parse(ffhttp_ranges *r, const char *d, size_t len, uint64 size);
+
+/** Get the number of parts after coalescing. */
+#define ffhttp_ranges_n(r)  ((r)->parts.len)
+
+/** Set response status and headers:
+ 206 with Content-Range (1 part) or Content-Type: multipart/byteranges (N parts), Content-Length;
+ 416 with "Content-Range: bytes * /SIZE" if no ranges are satisfiable.
+Prepare the part headers.
+'cont_type': Content-Type of the content;  the object must be valid until the response headers are written
+Return 0 on success. */
+FF_EXTN int ffhttp_ranges_resp(ffhttp_ranges *r, ffhttp_cook *c, const ffstr *cont_type);
+
+/** Get the next part to send.
+'file': file data;  'file->fm.foff' is the offset of the content in file
+'part': [out] file region and the part framing;  the user calls ffsf_close() after the part is sent
+Return 0 if there are no more parts. */
+FF_EXTN int ffhttp_ranges_next(ffhttp_ranges *r, const ffsf *file, ffsf *part);
+
+/** Get the response body for the data in memory.
+'iov': [out] 2 * ffhttp_ranges_n() + 1 elements
+Return the number of elements. */
+FF_EXTN uint ffhttp_ranges_iov(ffhttp_ranges *r, const char *data, ffiovec *iov);
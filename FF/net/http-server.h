@@ -0,0 +1,149 @@
+/** HTTP/1.1 server.
+This interface handles connections from HTTP clients: the user only processes requests.
+Copyright (c) 2019 Simon Zolin
+*/
+
+/*
+accept -> recv request headers -> [recv request body] -> user handler -> ffhttpsv_send() -> ... -> keep-alive
+                ^                                                                                      |
+                +--------------------------------------------------------------------------------------+
+
+Buffers for request headers are taken from a pool:
+ a connection waiting for the next keep-alive request holds no buffer.
+Back-pressure:
+ . a response body is sent by user in parts: the next part is requested (FFHTTPSV_SENT) after the previous one is sent
+ . the server stops accepting connections while 'max_conns' are active
+*/
+
+#pragma once
+
+#include <FF/net/http.h>
+#include <FF/sys/timer-queue.h>
+#include <FF/sys/sendfile.h>
+#include <FFOS/asyncio.h>
+
+
+typedef struct ffhttpsv ffhttpsv;
+typedef struct ffhttpsv_conn ffhttpsv_conn;
+
+enum FFHTTPSV_LOG {
+	FFHTTPSV_LOG_ERR = 1,
+	FFHTTPSV_LOG_WARN,
+	FFHTTPSV_LOG_INFO,
+	FFHTTPSV_LOG_DEBUG,
+
+	FFHTTPSV_LOG_SYS = 0x10,
+};
+
+/** Logger function. */
+typedef void (*ffhttpsv_log)(void *udata, uint level, const char *fmt, ...);
+
+enum FFHTTPSV_EV {
+	/** A complete request is received.
+	The user sends response with ffhttpsv_send() - now or later. */
+	FFHTTPSV_REQUEST,
+
+	/** The previous part of response body is sent and the user must send the next part. */
+	FFHTTPSV_SENT,
+
+	/** The connection is being closed.  The user must release the connection-specific data.
+	Called only if FFHTTPSV_REQUEST has been delivered for this connection. */
+	FFHTTPSV_CLOSE,
+};
+
+/** User's handler receives events for a connection.
+event: enum FFHTTPSV_EV */
+typedef void (*ffhttpsv_handler)(ffhttpsv_conn *c, uint event);
+
+/** HTTP server configuration. */
+struct ffhttpsv_conf {
+	fffd kq; /** Kernel queue used for asynchronous events.  Required. */
+	fftimer_queue *tmrq; /** Timer queue for connection timeouts.  Required.  The user starts it. */
+	ffhttpsv_handler handler; /** Required. */
+	ffhttpsv_log log;
+	void *udata; /** Opaque data for log() */
+
+	uint max_conns; /** Maximum number of active connections */
+	uint buffer_size; /** Buffer for request headers and pipelined requests */
+	uint max_free_buffers; /** Maximum number of unused buffers kept for reuse */
+	uint max_body; /** Maximum size of request body */
+	uint max_keepalive; /** Maximum number of requests per connection */
+	uint read_timeout; /** msec */
+	uint write_timeout; /** msec */
+	uint keepalive_timeout; /** msec */
+	uint debug_log :1; /** Log messages with FFHTTPSV_LOG_DEBUG. */
+};
+
+/** Set default configuration. */
+FF_EXTN void ffhttpsv_conf_init(struct ffhttpsv_conf *conf);
+
+/** Create server object.
+Return NULL on error. */
+FF_EXTN ffhttpsv* ffhttpsv_create(const struct ffhttpsv_conf *conf);
+
+/** Close all connections and free the server object. */
+FF_EXTN void ffhttpsv_free(ffhttpsv *sv);
+
+/** Start accepting connections.
+lsk: non-blocking listening socket
+family: AF_INET or AF_INET6
+Return 0 on success. */
+FF_EXTN int ffhttpsv_listen(ffhttpsv *sv, ffskt lsk, int family);
+
+/** Process a connection accepted by user.
+sk: non-blocking socket;  it's closed by the server
+Return 0 on success. */
+FF_EXTN int ffhttpsv_conn_add(ffhttpsv *sv, ffskt sk, const ffaddr *peer);
+
+struct ffhttpsv_stat {
+	uint64 conns; /** Accepted connections */
+	uint64 reqs; /** Processed requests */
+	uint64 keepalive_reqs; /** Requests received on a reused connection */
+	uint64 timeouts;
+	uint64 errors; /** Bad requests and I/O errors */
+	uint64 accept_paused; /** How many times 'max_conns' limit has been reached */
+	uint conns_active;
+	uint bufs_used;
+	uint bufs_free;
+};
+
+FF_EXTN void ffhttpsv_stat(ffhttpsv *sv, struct ffhttpsv_stat *st);
+
+
+/** Get parsed request. */
+FF_EXTN const ffhttp_request* ffhttpsv_req(ffhttpsv_conn *c);
+
+/** Get request body. */
+FF_EXTN ffstr ffhttpsv_reqbody(ffhttpsv_conn *c);
+
+/** Get response object, the status is "200 OK" by default.
+The user may set status and the special fields, and add headers with ffhttp_addhdr().
+Must be called before the first ffhttpsv_send(). */
+FF_EXTN ffhttp_cook* ffhttpsv_resp(ffhttpsv_conn *c);
+
+enum FFHTTPSV_SEND {
+	/** More body data will follow.
+	If Content-Length is unknown, "Transfer-Encoding: chunked" is used for HTTP/1.1 clients. */
+	FFHTTPSV_MORE = 1,
+};
+
+/** Send response headers (on the first call) and body data.
+data: must be valid until the next FFHTTPSV_SENT or FFHTTPSV_CLOSE event
+ NULL: no data
+flags: enum FFHTTPSV_SEND */
+FF_EXTN void ffhttpsv_send(ffhttpsv_conn *c, const ffstr *data, uint flags);
+
+/** Send response body from file.
+sf: must be valid until the next event
+ 'sf->ht' may contain data (e.g. from ffhttp_ranges_next()) only if the response isn't chunked:
+  Content-Length is set or FFHTTPSV_MORE isn't used;
+  otherwise, or if there are more than 7 header iovecs, the connection is closed.
+ 'sf->ht' isn't modified;  the file mapping state 'sf->fm' is updated as data is sent. */
+FF_EXTN void ffhttpsv_sendfile(ffhttpsv_conn *c, ffsf *sf, uint flags);
+
+/** Set/get user data for the connection. */
+FF_EXTN void ffhttpsv_setudata(ffhttpsv_conn *c, void *udata);
+FF_EXTN void* ffhttpsv_udata(ffhttpsv_conn *c);
+
+/** Get the server object user data (ffhttpsv_conf.udata). */
+FF_EXTN void* ffhttpsv_conn_srvdata(ffhttpsv_conn *c);
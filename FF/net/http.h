@@ -623,6 +623,17 @@ static FFINL void ffhttp_chunkinit(ffhttp_chunked *c) {
 Return enum FFHTTP_E.
 If there is data, return FFHTTP_OK and set 'dst'.  'len' is set to the number of processed bytes. */
 FF_EXTN int ffhttp_chunkparse(ffhttp_chunked *c, const char *body, size_t *len, ffstr *dst);
+
+/** Parse chunked-encoded data and get content as several slices at once.
+This is faster than ffhttp_chunkparse() for data with many small chunks.
+'iov': output data slices
+'n_iov': [in] the capacity of 'iov';  [out] the number of slices
+Return FFHTTP_OK if there is data;  FFHTTP_MORE if there's no data and all input is processed;
+ FFHTTP_DONE;  enum FFHTTP_E on error.
+'len' is set to the number of processed bytes.
+If there's data, an error or the end of body is returned on the next call. */
+FF_EXTN int ffhttp_chunkparse_v(ffhttp_chunked *c, const char *body, size_t *len, ffiovec *iov, uint *n_iov);
+
 static FFINL int ffhttp_chunkparse_str(ffhttp_chunked *c, ffstr *body, ffstr *dst)
 {
 	size_t n = body->len;
@@ -652,6 +663,16 @@ enum FFHTTP_CHUNKED {
 'pbuf' is set to point to the static string, and the number of valid bytes is returned. */
 FF_EXTN int ffhttp_chunkfin(const char **pbuf, int flags);
 
+enum { FFHTTP_CHUNKHDR_MAX = 16 + 2 };
+
+/** Frame several data buffers as one chunk.
+'hdr': buffer for chunk header, FFHTTP_CHUNKHDR_MAX bytes
+'out': n + 2 elements: chunk header, non-empty data buffers, the end of chunk
+'flags': enum FFHTTP_CHUNKED: FFHTTP_CHUNKFIN or FFHTTP_CHUNKLAST (the last chunk follows)
+If there's no data, only the last chunk is written (or nothing with FFHTTP_CHUNKFIN).
+Return the number of elements in 'out'. */
+FF_EXTN uint ffhttp_chunkv(char *hdr, const ffiovec *data, uint n, ffiovec *out, int flags);
+
 
 /** Interface for HTTP content filtering. */
 struct ffhttp_filter {
@@ -0,0 +1,113 @@
+/** IP prefix table: longest prefix match for IPv4 and IPv6 addresses.
+Copyright (c) 2018 Simon Zolin
+*/
+
+/*
+IPv4 table is DIR-24-8: the first 24 bits of address index a flat table;
+ an entry either holds the value or points to a group of 256 entries for the last 8 bits.
+IPv6 table is DIR-16-8-...-8: a 16-bit table followed by a chain of 8-bit groups.
+A lookup costs 1-2 memory reads for IPv4 and 1 + (prefix length - 16) / 8 reads for IPv6.
+
+The table is immutable: it's built at once from a list of prefixes.
+To change it, build a new table and replace the pointer with fflpm_ptr_replace().
+*/
+
+#pragma once
+
+#include <FF/array.h>
+
+
+typedef struct fflpm fflpm;
+
+/** Prefix list for a new table. */
+typedef struct fflpm_build {
+	ffarr pfx; //struct fflpm_pfx[]
+} fflpm_build;
+
+enum { FFLPM_MAXVAL = 0x7ffffffe };
+
+static FFINL void fflpm_build_init(fflpm_build *b)
+{
+	ffmem_tzero(b);
+}
+
+FF_EXTN void fflpm_build_free(fflpm_build *b);
+
+/** Add IPv4 prefix.
+'ip': address in network byte order;  host bits are ignored
+'bits': 0..32
+'val': 0..FFLPM_MAXVAL
+If the same prefix is added more than once, the last value is used.
+Return 0 on success. */
+FF_EXTN int fflpm_build_add4(fflpm_build *b, const void *ip, uint bits, uint val);
+
+/** Add IPv6 prefix.
+'bits': 0..128 */
+FF_EXTN int fflpm_build_add6(fflpm_build *b, const void *ip, uint bits, uint val);
+
+/** Add prefixes from text.
+Each line: "ADDR[/BITS] [VALUE]", e.g. "10.0.0.0/8 1" or "2001:db8::/32".
+ADDR is IPv4 or IPv6 address.  BITS is 32 or 128 by default.  VALUE is 'defval' by default.
+Empty lines and lines starting with '#' are skipped.
+Return the number of prefixes added;  <0 on error: -N is the line number. */
+FF_EXTN int fflpm_build_addtext(fflpm_build *b, const char *data, size_t len, uint defval);
+
+/** Create a lookup table from the added prefixes.
+The list may be freed afterwards.
+Return NULL on error. */
+FF_EXTN fflpm* fflpm_create(fflpm_build *b);
+
+FF_EXTN void fflpm_free(fflpm *t);
+
+/** Get the amount of memory used by the table. */
+FF_EXTN size_t fflpm_memsize(const fflpm *t);
+
+/** Find the longest prefix matching IPv4 address.
+'ip': network byte order
+Return the prefix value;  -1 if not found. */
+FF_EXTN int fflpm_find4(const fflpm *t, const void *ip);
+
+/** Find the longest prefix matching IPv6 address. */
+FF_EXTN int fflpm_find6(const fflpm *t, const void *ip);
+
+/** Find the values for a burst of IPv4 addresses.
+'ip': addresses as read from packet headers, e.g. ffpkt_burst.ip4_dst[]
+'vals': output values;  -1 if not found */
+FF_EXTN void fflpm_find4_burst(const fflpm *t, const uint *ip, int *vals, uint n);
+
+
+/** The current table shared by reader threads.
+Readers never lock:
+	const fflpm *t = fflpm_ptr_get(p);
+	... lookups ...
+	fflpm_ptr_quiesce(p, &my_counter);  //no references to 't' after this point
+Writer replaces the table with fflpm_ptr_replace() and frees the old one when it returns. */
+typedef struct fflpm_ptr {
+	ffatomic tbl; //fflpm*
+	ffatomic gen; //incremented on each replacement
+} fflpm_ptr;
+
+/** Reader's counter value while it's not using the table at all (e.g. sleeping).
+The reader calls fflpm_ptr_quiesce() before using the table again. */
+#define FFLPM_OFFLINE  ((size_t)-1)
+
+static FFINL const fflpm* fflpm_ptr_get(fflpm_ptr *p)
+{
+	const fflpm *t = (void*)ffatom_get(&p->tbl);
+	ffatom_fence_acq();
+	return t;
+}
+
+/** Reader's quiescent state: it doesn't hold pointers to any table.
+Must be called periodically, e.g. after each processed burst.
+'seen': reader's own counter */
+static FFINL void fflpm_ptr_quiesce(fflpm_ptr *p, ffatomic *seen)
+{
+	// full barrier: the table pointer must not be read before the counter is stored
+	ffatom_swap(seen, ffatom_get(&p->gen));
+}
+
+/** Publish a new table and wait until each reader has passed its quiescent state.
+'readers': counters of all readers
+Return the old table which is not used by anyone now. */
+FF_EXTN fflpm* fflpm_ptr_replace(fflpm_ptr *p, fflpm *t, ffatomic *readers, uint nreaders);
@@ -134,6 +134,7 @@ typedef struct ffip4hdr {
 } ffip4hdr;
 
 enum FFIP4_PROTO {
+	FFIP_ICMP = 1,
 	FFIP_TCP = 6,
 	FFIP_UDP = 17,
 };
@@ -156,6 +157,60 @@ To validate checksum in a complete header, just compare the result with 0. */
 FF_EXTN uint ffip4_chksum(const void *hdr, uint ihl);
 
 
+/* Internet checksum (RFC 1071).
+Checksum values are in the byte order of the packet data:
+ store them as is (ffint_set_unaligned16()), don't convert with ffint_hton16(). */
+
+/** Add data to the partial sum.
+Data of odd length may be passed only as the last chunk.
+@sum: previous partial sum or 0
+Return partial sum. */
+FF_EXTN uint ffip_sum(const void *data, size_t len, uint sum);
+
+/** Get checksum from the partial sum. */
+static FFINL uint ffip_sum_fold(uint sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return ~sum & 0xffff;
+}
+
+/** Compute checksum of data of any length. */
+static FFINL uint ffip_chksum(const void *data, size_t len)
+{
+	return ffip_sum_fold(ffip_sum(data, len, 0));
+}
+
+/** Partial sum of TCP/UDP pseudo-header.
+@len: length of TCP/UDP header and data */
+FF_EXTN uint ffip4_pseudo_sum(const ffip4 *src, const ffip4 *dst, uint proto, uint len);
+
+/** Compute TCP/UDP checksum for IPv4 packet.
+@l4: TCP/UDP header (with checksum field set to 0) and data
+Note: UDP checksum 0 must be sent as 0xffff. */
+FF_EXTN uint ffip4_l4_chksum(const ffip4hdr *ip, const void *l4, uint len);
+
+/** Update checksum after a 16-bit field has been changed from 'old' to 'new' (RFC 1624).
+Values are read from packet data as is (ffint_unaligned16()). */
+static FFINL uint ffip_chksum_update16(uint crc, uint old, uint new_val)
+{
+	uint sum = (~crc & 0xffff) + (~old & 0xffff) + (new_val & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	return ~sum & 0xffff;
+}
+
+/** Update checksum after a 32-bit field (e.g. IPv4 address) has been changed. */
+static FFINL uint ffip_chksum_update32(uint crc, uint old, uint new_val)
+{
+	crc = ffip_chksum_update16(crc, old & 0xffff, new_val & 0xffff);
+	return ffip_chksum_update16(crc, old >> 16, new_val >> 16);
+}
+
+/** Update checksum after data of even length (e.g. IPv6 address) has been changed. */
+FF_EXTN uint ffip_chksum_update(uint crc, const void *old, const void *new_data, size_t len);
+
+
 typedef struct { char a[16]; } ffip6;
 
 enum { FFIP6_STRLEN = FFSLEN("abcd:") * 8 - 1 };
@@ -210,6 +265,21 @@ typedef struct ffip6hdr {
 
 FF_EXTN int ffip6hdr_tostr(ffip6hdr *h, char *buf, size_t cap);
 
+FF_EXTN uint ffip6_pseudo_sum(const ffip6 *src, const ffip6 *dst, uint nexthdr, uint len);
+
+/** Compute TCP/UDP checksum for IPv6 packet.
+@nexthdr: TCP or UDP (IPv6 header may be followed by extension headers) */
+FF_EXTN uint ffip6_l4_chksum(const ffip6hdr *ip, uint nexthdr, const void *l4, uint len);
+
+enum FFIP6_EXT {
+	FFIP6_HOPOPTS = 0,
+	FFIP6_ROUTING = 43,
+	FFIP6_FRAG = 44,
+	FFIP6_ICMP = 58,
+	FFIP6_NONE = 59,
+	FFIP6_DSTOPTS = 60,
+};
+
 
 enum FFARP_HW {
 	FFARP_ETH = 1,
@@ -285,3 +355,44 @@ typedef struct ffudphdr {
 	byte length[2];
 	byte crc[2];
 } ffudphdr;
+
+
+enum { FFPKT_BURST_MAX = 64 };
+
+enum FFPKT_F {
+	FFPKT_IP4 = 1,
+	FFPKT_IP6 = 2,
+	FFPKT_TCP = 4,
+	FFPKT_UDP = 8,
+	FFPKT_ICMP = 0x10,
+	FFPKT_FRAG = 0x20, //IP fragment;  L4 header is parsed only in the first fragment
+	FFPKT_EBAD = 0x40, //truncated or invalid header
+	FFPKT_ECHKSUM = 0x80, //bad IPv4 header checksum (FFPKT_VERIFY_CHKSUM)
+};
+
+/** Decoded L2-L4 headers of a burst of packets, as structure of arrays.
+Offsets are from the beginning of a packet;  0 if the header is absent. */
+typedef struct ffpkt_burst {
+	uint n;
+	uint flags[FFPKT_BURST_MAX]; //enum FFPKT_F
+	ushort eth_type[FFPKT_BURST_MAX]; //enum FFETH_T after VLAN tags
+	ushort vlan[FFPKT_BURST_MAX]; //the outer VLAN ID or 0
+	ushort l3_off[FFPKT_BURST_MAX];
+	ushort l4_off[FFPKT_BURST_MAX];
+	ushort data_off[FFPKT_BURST_MAX]; //L4 payload
+	ushort data_len[FFPKT_BURST_MAX];
+	byte l4_proto[FFPKT_BURST_MAX]; //enum FFIP4_PROTO, FFIP6_ICMP
+	byte tcp_flags[FFPKT_BURST_MAX]; //enum FFTCP_F
+	ushort sport[FFPKT_BURST_MAX], dport[FFPKT_BURST_MAX]; //host byte order
+	uint ip4_src[FFPKT_BURST_MAX], ip4_dst[FFPKT_BURST_MAX]; //network byte order
+} ffpkt_burst;
+
+enum FFPKT_PARSE {
+	FFPKT_VERIFY_CHKSUM = 1, //verify IPv4 header checksum
+};
+
+/** Parse Ethernet, VLAN, IPv4/IPv6 and TCP/UDP/ICMP headers of packets.
+@pkts, lens: packets and their lengths
+@flags: enum FFPKT_PARSE
+Return the number of packets parsed:  min(n, FFPKT_BURST_MAX). */
+FF_EXTN uint ffpkt_parse_burst(ffpkt_burst *b, const void *const *pkts, const uint *lens, uint n, uint flags);
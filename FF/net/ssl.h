@@ -5,6 +5,7 @@ Copyright (c) 2015 Simon Zolin
 #pragma once
 
 #include <FF/array.h>
+#include <FF/sys/sendfile.h>
 
 #ifdef FF_WIN
 #define OPENSSL_SYS_WIN32
@@ -85,6 +86,12 @@ struct ffssl_ctx_conf {
 	ffssl_tls_srvname_cb tls_srvname_func;
 
 	uint allowed_protocols; //enum FFSSL_PROTO
+
+	/** Enable kernel TLS offload (TX and RX) after handshake.
+	Takes effect only for connections created with FFSSL_SOCKET,
+	 and only if both the negotiated cipher and the kernel support it.
+	Use ffssl_get(FFSSL_KTLS_SEND) to check whether it's active. */
+	uint ktls :1;
 };
 
 /** Configurate SSL context. */
@@ -104,6 +111,53 @@ static FFINL void ffssl_ctx_sess_del(SSL_CTX *ctx, SSL *c)
 }
 
 
+/** Server session cache and session ticket keys in memory shared by worker processes.
+A session established by one worker can be resumed by any other worker.
+Sessions are evicted by TTL or in LRU order when the cache is full.
+Ticket keys are rotated after 'ticket_key_lifetime' seconds,
+ and the 2 previous keys are still accepted (a client receives a new ticket then). */
+typedef struct ffssl_sesscache ffssl_sesscache;
+
+struct ffssl_sesscache_conf {
+	uint max_sessions;
+	uint max_sess_size; //max. size of a serialized session.  Default: 2048
+	uint ticket_key_lifetime; //seconds.  0: disable session tickets
+};
+
+struct ffssl_sesscache_stat {
+	uint64 hits, misses;
+	uint64 stores;
+	uint64 evictions; //removed by LRU
+	uint64 expired; //removed by TTL
+	uint64 ticket_keys; //ticket keys generated
+	uint sessions; //sessions currently stored
+};
+
+/** Get the size of memory region needed for the cache. */
+FF_EXTN size_t ffssl_sesscache_size(const struct ffssl_sesscache_conf *conf);
+
+/** Initialize cache.
+@mem: memory region shared by processes, e.g. mmap(MAP_SHARED) before fork()
+Return NULL if the region is too small. */
+FF_EXTN ffssl_sesscache* ffssl_sesscache_init(void *mem, size_t size, const struct ffssl_sesscache_conf *conf);
+
+/** Use shared cache for server sessions (and ticket keys) of this context. */
+FF_EXTN int ffssl_ctx_sesscache(SSL_CTX *ctx, ffssl_sesscache *sc);
+
+/** Store session data.
+@expire: UNIX time */
+FF_EXTN int ffssl_sesscache_store(ffssl_sesscache *sc, const void *id, size_t idlen, const void *data, size_t len, uint64 expire);
+
+/** Get session data.
+@now: UNIX time
+Return data length;  0 if not found;  -1 if buffer is too small. */
+FF_EXTN ssize_t ffssl_sesscache_fetch(ffssl_sesscache *sc, const void *id, size_t idlen, void *buf, size_t cap, uint64 now);
+
+FF_EXTN void ffssl_sesscache_del(ffssl_sesscache *sc, const void *id, size_t idlen);
+
+FF_EXTN void ffssl_sesscache_stat(ffssl_sesscache *sc, struct ffssl_sesscache_stat *st);
+
+
 enum FFSSL_CREATE {
 	/** Connection type: client (default) or server. */
 	FFSSL_CONNECT = 0,
@@ -114,11 +168,16 @@ enum FFSSL_CREATE {
 	 use ffssl_iobuf() to get SSL buffer for the data that needs to be read/sent.
 	After I/O is performed, ffssl_input() must be called to set the number of bytes transferred. */
 	FFSSL_IOBUF = 2,
+
+	/** Attach socket ffssl_opt.sk to the connection.
+	Required for kernel TLS offload.  Can't be used with FFSSL_IOBUF. */
+	FFSSL_SOCKET = 4,
 };
 
 typedef struct ffssl_opt {
 	void *udata; //opaque data for callback functions
 	const char *tls_hostname; //set hostname for SNI
+	ffskt sk; //FFSSL_SOCKET
 } ffssl_opt;
 
 /** Create a connection.
@@ -136,6 +195,8 @@ enum FFSSL_FOPT {
 	FFSSL_SESS_REUSED,
 	FFSSL_NUM_RENEGOTIATIONS,
 	FFSSL_CERT_VERIFY_RESULT, //X509_V_OK or other X509_V_*
+	FFSSL_KTLS_SEND, //1 if the kernel encrypts the outgoing data
+	FFSSL_KTLS_RECV, //1 if the kernel decrypts the incoming data
 };
 
 /**
@@ -163,6 +224,14 @@ FF_EXTN int ffssl_read(SSL *c, void *buf, size_t size);
 Return the number of bytes sent or enum FFSSL_EIO (negative value). */
 FF_EXTN int ffssl_write(SSL *c, const void *buf, size_t size);
 
+/** Send headers, file data and trailers.
+With kernel TLS the data is passed to sendfile() on the connection's socket, so the file isn't copied to userspace.
+ The caller may also use ffsf_sendasync() on this socket directly.
+Otherwise the next chunk of data is encrypted by ffssl_write().
+Use ffsf_shift() to move forward by the returned number of bytes.
+Return the number of bytes sent or enum FFSSL_EIO (negative value). */
+FF_EXTN int64 ffssl_sendfile(SSL *c, ffsf *sf, int flags);
+
 /**
 Return 0 on success;  enum FFSSL_EIO for more I/O;  enum FFSSL_E on error. */
 FF_EXTN int ffssl_shut(SSL *c);
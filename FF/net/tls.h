@@ -5,6 +5,7 @@ Copyright (c) 2018 Simon Zolin
 #pragma once
 
 #include <FF/array.h>
+#include <FF/hashtab.h>
 
 
 enum FFTLS_E {
@@ -72,3 +73,72 @@ FF_EXTN int fftls_alpn_next(ffstr *buf, ffstr *proto);
 /** Write a TLS alert record.
 Return the number of bytes written;  -1 if not enough space. */
 FF_EXTN int fftls_alert(void *buffer, size_t cap, const void *data, size_t len);
+
+
+/** Client Hello data parsed by fftls_peek_hello().
+All fields point to the input data, or to the reassembly buffer. */
+typedef struct fftls_hello {
+	int err; //enum FFTLS_E
+	uint version; //version from Client Hello
+	uint max_version; //the highest version from 'supported-versions' extension, or 'version'
+	uint size; //number of input bytes occupied by the records with Client Hello
+
+	ffstr session_id;
+	ffstr ciphers; //ushort[], network byte order
+	ffstr exts; //raw extensions list (struct ext[])
+	ffstr hostname; //server name
+	ffstr alpn_protos; //struct alpn_proto[]
+	ffstr groups; //supported groups (ushort[])
+	ffstr ec_formats; //EC point formats (byte[])
+	ffstr sig_algs; //signature algorithms (ushort[])
+} fftls_hello;
+
+/** Parse Client Hello from the beginning of a TCP stream without consuming the data.
+Suitable to be called again each time more data arrives (e.g. into socket receive buffer via MSG_PEEK).
+No memory is allocated.
+@buf: (optional) buffer to reassemble a handshake message split into several records.
+ Without it only a single-record Client Hello is supported.
+Return FFTLS_RCLIENT_HELLO on success;
+ FFTLS_RMORE if more data is needed;
+ FFTLS_RERR on error ('h->err' is set). */
+FF_EXTN int fftls_peek_hello(fftls_hello *h, const void *data, size_t len, void *buf, size_t cap);
+
+/** Get JA3 fingerprint string for Client Hello:
+ "VERSION,CIPHERS,EXTENSIONS,GROUPS,EC_FORMATS" - decimal values separated by '-', GREASE values are skipped.
+JA3 hash is MD5 of this string.
+Return string length;  0 if the buffer is too small. */
+FF_EXTN size_t fftls_ja3(const fftls_hello *h, char *buf, size_t cap);
+
+/** Get JA4 fingerprint for Client Hello in raw form (JA4_r):
+ "t13d1516h2_CIPHERS_EXTENSIONS_SIGALGS"
+ CIPHERS, EXTENSIONS: sorted hex values without GREASE;  EXTENSIONS don't include SNI and ALPN.
+JA4 is the same string with the last 3 parts replaced by truncated SHA-256 hashes.
+Return string length;  0 if the buffer is too small. */
+FF_EXTN size_t fftls_ja4r(const fftls_hello *h, char *buf, size_t cap);
+
+
+/** SNI routing table.
+Built once from a list of "host" and "*.domain" names.  Lookups don't allocate memory. */
+typedef struct fftls_sniroute {
+	ffhstab exact; //"host"
+	ffhstab wild; //"domain" for "*.domain"
+	void *ents; //struct sniroute_ent[]
+	char *names;
+	void *dflt; //value returned when nothing matches
+} fftls_sniroute;
+
+/** Build SNI routing table.
+@names: "host" or "*.domain";  "*.domain" matches any subdomain of "domain" at any level.
+ Names are case-insensitive.
+@vals: values to return for each name (not NULL)
+Return 0 on success;
+ -1 on error;
+ >0: 1-based index of a duplicate or invalid name. */
+FF_EXTN int fftls_sniroute_init(fftls_sniroute *sr, const ffstr *names, void *const *vals, size_t n);
+
+FF_EXTN void fftls_sniroute_free(fftls_sniroute *sr);
+
+/** Find route for a server name.
+Exact name has priority, then the longest matching "*.domain".
+Return value for the matched name;  'sr->dflt' if nothing matches. */
+FF_EXTN void* fftls_sniroute_find(const fftls_sniroute *sr, const char *host, size_t len);
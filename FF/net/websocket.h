@@ -12,6 +12,7 @@ Handshake request:
  Origin: http://url
  Sec-WebSocket-Protocol: (proto1), (proto2)
  Sec-WebSocket-Version: 13
+ Sec-WebSocket-Extensions: permessage-deflate[; PARAM[=VAL]]... [, ...]
 
 Handshake response:
  HTTP/1.1 101 Switching Protocols
@@ -19,6 +20,7 @@ Handshake response:
  Connection: Upgrade
  Sec-WebSocket-Accept: (base64-data)
  Sec-WebSocket-Protocol: (proto1) | (proto2)
+ Sec-WebSocket-Extensions: permessage-deflate[; server_no_context_takeover][; client_no_context_takeover]
 
 Handshake response in case client's version isn't supported:
  HTTP/1.1 426 Upgrade Required
@@ -26,11 +28,19 @@ Handshake response in case client's version isn't supported:
 
 (msg(TEXT | BIN) [msg(CONT)... msg(CONT+FIN)])...
 msg(CLOSE)
+
+permessage-deflate (RFC 7692):
+ Message body is raw deflate data flushed with Z_SYNC_FLUSH without the trailing 00 00 ff ff.
+ RSV1 bit is set in the first frame of a compressed message.
 */
 
 #pragma once
 
 #include <FF/array.h>
+#include <FFOS/atomic.h>
+#include <FFOS/socket.h>
+
+struct z_ctx; // zlib-ff.h
 
 
 enum FFWEBSKT_R {
@@ -50,6 +60,12 @@ enum FFWEBSKT_OP {
 	FFWEBSKT_OP_PONG,
 };
 
+/** permessage-deflate parameters. */
+enum FFWEBSKT_DEFL {
+	FFWEBSKT_DEFL_SERV_NOCTX = 1, //server_no_context_takeover
+	FFWEBSKT_DEFL_CLI_NOCTX = 2, //client_no_context_takeover
+};
+
 typedef struct ffwebskt {
 	uint state;
 	uint nxstate;
@@ -61,10 +77,19 @@ typedef struct ffwebskt {
 	uint op; //enum FFWEBSKT_OP
 	uint cont :1;
 	uint server :1;
+	uint inplace :1; //unmask data right in the input buffer, which must be writable
+	uint deflate :1; //permessage-deflate is negotiated
+	uint compressed :1; //the current message is compressed
+	uint ztail :1; //the flush marker is passed to decompressor
+	uint defl_flags; //enum FFWEBSKT_DEFL:  negotiated parameters
 
 	ffstr in;
 	ffstr out;
 
+	struct z_ctx *lz;
+	ffstr zin; //compressed data not yet passed to decompressor
+	ffarr zout; //decompressed data
+
 	char buf[4096]; //holds value for "Sec-WebSocket-Accept", or a message header, or decoded data
 	uint nbuf;
 } ffwebskt;
@@ -73,6 +98,7 @@ typedef struct ffwebskt {
 #define FFWEBSKT_HDR_ACCEPT  "Sec-WebSocket-Accept"
 #define FFWEBSKT_HDR_VER  "Sec-WebSocket-Version"
 #define FFWEBSKT_HDR_PROTO  "Sec-WebSocket-Protocol"
+#define FFWEBSKT_HDR_EXT  "Sec-WebSocket-Extensions"
 
 /** Get server security key.
 @clientkey: value of HTTP header Sec-WebSocket-Key
@@ -83,6 +109,22 @@ FF_EXTN void ffwebskt_accept(struct ffwebskt *w, const ffstr *clientkey);
 Return 0 on success. */
 FF_EXTN int ffwebskt_accept_ver(struct ffwebskt *w, const ffstr *ver);
 
+/** Negotiate permessage-deflate extension and prepare the decompressor.
+@ext: value of HTTP header Sec-WebSocket-Extensions
+@flags: enum FFWEBSKT_DEFL:  parameters to require from client in addition to the ones it offers
+Call ffwebskt_body() to get the value for Sec-WebSocket-Extensions response header.
+The negotiated parameters are in 'w->defl_flags'.
+Return 0 if the extension is accepted;
+ 1 if client hasn't offered acceptable parameters;
+ -1 on error. */
+FF_EXTN int ffwebskt_accept_ext(struct ffwebskt *w, const ffstr *ext, uint flags);
+
+/** Prepare the decompressor after permessage-deflate is negotiated by other means (e.g. on client side).
+Return 0 on success. */
+FF_EXTN int ffwebskt_inflate_init(struct ffwebskt *w);
+
+FF_EXTN void ffwebskt_close(struct ffwebskt *w);
+
 /** Set input data. */
 #define ffwebskt_input(w, d, n)  ffstr_set(&(w)->in, d, n)
 
@@ -97,6 +139,7 @@ FF_EXTN int ffwebskt_accept_ver(struct ffwebskt *w, const ffstr *ver);
 
 /** Parse data.
 Call ffwebskt_input() to set input data.
+Body of a compressed message is returned decompressed.
 Return enum FFWEBSKT_R. */
 FF_EXTN int ffwebskt_parse(struct ffwebskt *w);
 
@@ -105,12 +148,29 @@ typedef struct ffwebskt_cook {
 	ffstr in;
 	ffstr out;
 	uint mask;
+	uint inplace :1; //mask data right in the input buffer, which must be writable
+	uint noctx :1; //don't use previous messages for compression (no context takeover)
+	struct z_ctx *lz;
+	ffarr zbuf; //compressed message
 	char buf[4096];
 } ffwebskt_cook;
 
+/** Compress TEXT and BIN messages with permessage-deflate.
+@level: compression level (0:default)
+@noctx: don't use context takeover, i.e. compress each message independently
+ Server sets it if FFWEBSKT_DEFL_SERV_NOCTX is negotiated, client - if FFWEBSKT_DEFL_CLI_NOCTX.
+Broadcasting:  a message compressed with no context takeover may be sent as is to any client
+ that negotiated permessage-deflate, as long as the writer for each such client also works with no context takeover.
+ Compress once with a separate writer, then send the same header and body to all clients.
+Return 0 on success. */
+FF_EXTN int ffwebskt_wdeflate_init(ffwebskt_cook *w, uint level, uint noctx);
+
+FF_EXTN void ffwebskt_wclose(ffwebskt_cook *w);
+
 /** Get message header.
 Call ffwebskt_input() to set input data.
  Data must be valid until ffwebskt_writenext() returns FFWEBSKT_RDATA_FIN.
+ If compression is enabled, the whole message is compressed here.
 @op: enum FFWEBSKT_OP
 Return enum FFWEBSKT_R. */
 FF_EXTN int ffwebskt_newmsg(ffwebskt_cook *w, uint mask_key, uint op);
@@ -118,3 +178,46 @@ FF_EXTN int ffwebskt_newmsg(ffwebskt_cook *w, uint mask_key, uint op);
 /** Get message body.
 Return enum FFWEBSKT_R. */
 FF_EXTN int ffwebskt_writenext(ffwebskt_cook *w);
+
+
+/** A message shared between many connections (server->client).
+Frame header is built once, payload is either referenced or copied once.
+Each connection sends the same iovecs, then releases its reference. */
+typedef struct ffwebskt_bcast {
+	ffatomic ref;
+	ffiovec iov[2]; //header, payload
+	uint64 size; //total bytes to send
+	void (*onfree)(void *udata); //called when the last reference is released
+	void *udata;
+	char hdr[2+8];
+	// char data[] with FFWEBSKT_BC_COPY
+} ffwebskt_bcast;
+
+enum FFWEBSKT_BC {
+	FFWEBSKT_BC_COPY = 1, //copy payload;  otherwise it must be valid until onfree() is called
+};
+
+/** Create a shared message with 1 reference.
+@op: enum FFWEBSKT_OP
+@flags: enum FFWEBSKT_BC
+Return NULL on error. */
+FF_EXTN ffwebskt_bcast* ffwebskt_bcast_new(const void *data, size_t len, uint op, uint flags);
+
+/** Compress data with permessage-deflate and create a shared message from it.
+Writer must be initialized by ffwebskt_wdeflate_init() with 'noctx' set.
+@op: FFWEBSKT_OP_TEXT or FFWEBSKT_OP_BIN */
+FF_EXTN ffwebskt_bcast* ffwebskt_bcast_deflate(ffwebskt_cook *w, const void *data, size_t len, uint op);
+
+static FFINL ffwebskt_bcast* ffwebskt_bcast_ref(ffwebskt_bcast *b)
+{
+	ffatom_inc(&b->ref);
+	return b;
+}
+
+/** Release a reference.  The object is freed after the last one. */
+FF_EXTN void ffwebskt_bcast_unref(ffwebskt_bcast *b);
+
+/** Get data to send after 'off' bytes are already sent.
+@iov: ffiovec[2]
+Return the number of iovecs;  0 if all data is sent. */
+FF_EXTN uint ffwebskt_bcast_iov(const ffwebskt_bcast *b, uint64 off, ffiovec *iov);
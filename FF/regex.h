@@ -0,0 +1,98 @@
+/** Compiled regular expressions: lazy DFA, multi-pattern matching.
+Copyright (c) 2019 Simon Zolin
+*/
+
+/*
+REGEX:     MEANING:
+.          any byte
+[az]       either 'a' or 'z'
+[a-z]      any byte from 'a' to 'z'
+[^a-z]     any byte except 'a'..'z'
+\.         a special character is escaped:  \ . | ? [ - ] * + ( ) { } ^ $
+a|bc       either "a" or "bc"
+(ab)       group
+x?         optional
+x*         0 or more
+x+         1 or more
+x{n}       n times
+x{n,}      n or more times
+x{n,m}     from n to m times
+^          beginning of input
+$          end of input
+
+Patterns are compiled into one NFA (Thompson's construction),
+ whose byte alphabet is reduced into classes of bytes that are never distinguished by any pattern.
+The DFA is built lazily during matching:
+ a DFA state is a set of NFA nodes;  its transition is computed when it's needed for the first time.
+The DFA states are cached;  when the cache is full, it's cleared and the states are built again.
+Input data is processed in 1 pass and in linear time for all patterns at once.
+*/
+
+#pragma once
+
+#include <FF/array.h>
+
+
+enum FFREGEX_F {
+	FFREGEX_ICASE = 1, // case-insensitive match of latin letters
+	FFREGEX_FULL = 2, // the whole input must match, as ffs_regex() does;  otherwise: any part of input
+	FFREGEX_WILDCARD = 4, // the pattern is a wildcard ('*', '?'), as ffs_wildcard() accepts;  implies FFREGEX_FULL
+};
+
+typedef struct ffregex {
+	uint max_states; /** Max. number of DFA states in cache (default: 1000).  Set before ffregex_compile(). */
+	uint flushes; /** The number of times the cache has been cleared */
+	uint npatterns;
+
+	ffarr nodes; //struct rx_node[]: NFA of all patterns
+	ffarr starts; //uint[]: start node of each pattern
+
+	// DFA:
+	byte cls[256]; // byte -> class
+	byte rep[256]; // class -> byte
+	uint nclasses;
+	uint stride; // transitions of a state: classes + end of input
+	uint start; // transition to the start state
+	uint nstates;
+	uint accwords;
+	uint *trans; //uint[max_states * stride]
+	uint *acc; //uint[max_states * accwords]: bit array of the patterns matched by a state
+	uint *res; //uint[accwords]
+	ffarr states; //struct rx_dstate[max_states]
+	ffarr sets; //uint[]: NFA nodes of the states
+	uint *htab; // slot -> state index + 1
+	uint hmask;
+	uint *mark; //uint[nodes]
+	uint gen;
+	ffarr stk; //uint[]
+	ffarr tmp; //uint[]
+} ffregex;
+
+FF_EXTN void ffregex_init(ffregex *rx);
+
+FF_EXTN void ffregex_free(ffregex *rx);
+
+/** Add pattern.
+@flags: enum FFREGEX_F.
+Return pattern index;  <0 if pattern is invalid. */
+FF_EXTN int ffregex_add(ffregex *rx, const char *pattern, size_t len, uint flags);
+
+#define ffregex_addz(rx, sz, flags) \
+	ffregex_add(rx, sz, ffsz_len(sz), flags)
+
+/** Prepare for matching after all patterns are added.
+Return 0 on success. */
+FF_EXTN int ffregex_compile(ffregex *rx);
+
+/** Find all matching patterns.
+The object must not be used by several threads at once.
+@matched: bit array of 'npatterns' bits (see ffbit_testarr())
+Return the number of matched patterns. */
+FF_EXTN uint ffregex_matchall(ffregex *rx, const char *s, size_t len, uint *matched);
+
+/** Match input against all patterns.
+Return the smallest index of a matching pattern;  -1 if none match. */
+FF_EXTN int ffregex_match(ffregex *rx, const char *s, size_t len);
+
+#define ffregex_matchstr(rx, str) \
+	ffregex_match(rx, (str)->ptr, (str)->len)
@@ -193,8 +193,11 @@ FF_EXTN void * ffmemchr(const void *d, int b, size_t len);
 /** Apply XOR on a data with a key of arbitrary length. */
 FF_EXTN void ffmem_xor(byte *dst, const byte *src, size_t len, const byte *key, size_t nkey);
 
-/** Apply XOR on a data with 4-byte key. */
-FF_EXTN void ffmem_xor4(void *dst, const void *src, size_t len, uint key);
+/** Apply XOR on a data with 4-byte key (WebSocket masking).
+Buffers may be unaligned;  'dst' may be equal to 'src'.
+Uses SSE2 (AVX2 if supported by CPU) or NEON.
+Return the key to continue with the data following 'src + len'. */
+FF_EXTN uint ffmem_xor4(void *dst, const void *src, size_t len, uint key);
 
 /** Search byte in a buffer.
 Return END if not found. */
@@ -561,6 +564,7 @@ FF_EXTN uint ffs_toint(const char *src, size_t len, void *dst, int flags);
 	ffs_toint(src, len, dst, FFS_INT64 | (flags))
 
 enum { FFINT_MAXCHARS = FFSLEN("18446744073709551615") };
+enum { FFS_FLTMAXCHARS = FFSLEN("-0.0000012345678901234567") }; // ffs_fromfloat(FFS_FLTSHORT)
 
 enum FFINT_TOSTR {
 	FFINT_SIGNED = 1
@@ -570,6 +574,7 @@ enum FFINT_TOSTR {
 	, FFINT_ZEROWIDTH = 8
 	, FFINT_SEP1000 = 0x10 // use thousands separator, e.g. "1,000"
 	, FFINT_NEG = 0x40 // value is always negative
+	, FFS_FLTSHORT = 0x80 // ffs_fromfloat(): the shortest text which is converted back to the same value
 
 	, _FFINT_WIDTH_MASK = 0xff000000
 	, _FFS_FLT_FRAC_WIDTH_MASK = 0x00ff0000
@@ -601,6 +606,7 @@ FF_EXTN uint ffs_tofloat(const char *s, size_t len, double *dst, int flags);
 
 /** Convert float to string.
 @flags: enum FFINT_TOSTR
+ FFS_FLTSHORT: 0.1 -> "0.1", 100 -> "100.0", 1.5e-7 -> "1.5e-7";  width flags are ignored
 Return bytes written. */
 FF_EXTN uint ffs_fromfloat(double d, char *dst, size_t cap, uint flags);
 
@@ -743,6 +749,7 @@ c?         optional character
 [az]       either 'a' or 'z'
 [a-z]      any character from 'a' to 'z'
 a|bc       either "a" or "bc"
+The pattern is interpreted on each call;  ffregex (FF/regex.h) compiles patterns once and matches many of them at once.
 Return 0 if match;  >0 if non-match;  <0 if regexp is invalid. */
 FF_EXTN int ffs_regex(const char *regexp, size_t regexp_len, const char *s, size_t len, uint flags);
 
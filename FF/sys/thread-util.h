@@ -0,0 +1,29 @@
+/** Helpers for the code that splits work between threads.
+Copyright (c) 2019 Simon Zolin
+*/
+
+#pragma once
+
+#include <FFOS/thread.h>
+#include <FFOS/atomic.h>
+#include <FFOS/process.h>
+
+
+/** Wait for a change of a shared variable: spin for a while, then sleep.
+@spins: the number of calls since the last change;  the caller resets it to 0 */
+static FFINL void ffthd_spinwait(uint *spins)
+{
+	if (++*spins < 1000)
+		ffcpu_pause();
+	else
+		ffthd_sleep(1);
+}
+
+/** Get the number of online CPUs;  1 if it's unknown. */
+static FFINL uint ffsys_ncpu(void)
+{
+	ffsysconf sc;
+	ffsc_init(&sc);
+	int n = ffsc_get(&sc, _SC_NPROCESSORS_ONLN);
+	return (n > 0) ? n : 1;
+}
@@ -118,8 +118,40 @@ static void test_sort_dec(void (*func)(ffarr *a))
 	ffarr_free(&a);
 }
 
+struct sort12 {
+	uint key;
+	uint val; // key * 3:  the whole element is moved
+	uint pad;
+};
+static int cmp12(const void *a, const void *b, void *udata)
+{
+	const struct sort12 *e1 = a, *e2 = b;
+	return ffint_cmp(e1->key, e2->key);
+}
+
+/** Sort elements of a size without a special case:  insertion sort (n * 12 <= cache line) and merge sort. */
+static void test_sort_size12(void)
+{
+	FFTEST_FUNC;
+	struct sort12 e[100];
+	static const uint counts[] = { 2, 3, 5, FFCNT(e) };
+	for (uint k = 0;  k != FFCNT(counts);  k++) {
+		uint n = counts[k];
+		for (uint i = 0;  i != n;  i++) {
+			e[i].key = (n < 10) ? n - 1 - i : (i * 7 + 3) % n; // a permutation of 0..n-1
+			e[i].val = e[i].key * 3;
+			e[i].pad = 0;
+		}
+		ffsort(e, n, sizeof(struct sort12), &cmp12, NULL);
+		for (uint i = 0;  i != n;  i++) {
+			x(e[i].key == i && e[i].val == i * 3);
+		}
+	}
+}
+
 int test_sort(void)
 {
+	test_sort_size12();
 	test_sort_inc(&dosort);
 	test_sort_dec(&dosort);
 	test_sort_rnd(&dosort);
@@ -6,6 +6,8 @@ Copyright (c) 2013 Simon Zolin
 #include <FFOS/file.h>
 #include <FF/data/conf.h>
 #include <FF/data/psarg.h>
+#include <FF/crc.h>
+#include <FF/time.h>
 #include "schem.h"
 #include "all.h"
 
@@ -392,12 +394,235 @@ void test_conf_write(void)
 	ffconf_wdestroy(&cw);
 }
 
+/** Values point to input data unless they have escape sequences or are split between input buffers. */
+static void test_conf_borrowed(void)
+{
+	static const char data[] = "key \"value\" \"v\\tal\"\nk2 bare\n";
+	ffconf conf;
+	ffstr d;
+
+	ffconf_parseinit(&conf);
+	ffstr_setcz(&d, data);
+	x(FFPARS_KEY == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "key") && ffconf_val_borrowed(&conf) && conf.val.ptr == data);
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "value") && ffconf_val_borrowed(&conf) && conf.val.ptr == data + 5);
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "v\tal") && !ffconf_val_borrowed(&conf));
+	x(FFPARS_KEY == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "k2") && ffconf_val_borrowed(&conf));
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "bare") && ffconf_val_borrowed(&conf));
+	ffconf_parseclose(&conf);
+
+	// the value is split between 2 buffers
+	ffconf_parseinit(&conf);
+	ffstr_set(&d, data, FFSLEN("key \"val"));
+	x(FFPARS_KEY == ffconf_parsestr(&conf, &d));
+	x(FFPARS_MORE == ffconf_parsestr(&conf, &d));
+	x(d.len == 0);
+	ffstr_set(&d, data + FFSLEN("key \"val"), FFSLEN(data) - FFSLEN("key \"val"));
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "value") && !ffconf_val_borrowed(&conf));
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(FFPARS_KEY == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "k2") && ffconf_val_borrowed(&conf));
+	ffconf_parseclose(&conf);
+}
+
+
+// BINARY CACHE
+
+struct cache_obj {
+	int64 workers;
+	ffstr name;
+	uint routes, paths;
+	uint64 sum;
+};
+
+static int cache_path(ffparser_schem *ps, void *obj, const ffstr *val)
+{
+	struct cache_obj *o = obj;
+	o->paths++;
+	o->sum += ffcrc32_get(val->ptr, val->len) + val->len;
+	return 0;
+}
+static int cache_weight(ffparser_schem *ps, void *obj, const int64 *val)
+{
+	struct cache_obj *o = obj;
+	o->sum += *val;
+	return 0;
+}
+static const ffpars_arg cache_route_args[] = {
+	{ "path", FFPARS_TSTR | FFPARS_FLIST, FFPARS_DST(&cache_path) },
+	{ "weight", FFPARS_TINT | FFPARS_F64BIT, FFPARS_DST(&cache_weight) },
+};
+static int cache_route(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	struct cache_obj *o = obj;
+	o->routes++;
+	ffpars_setargs(ctx, obj, cache_route_args, FFCNT(cache_route_args));
+	return 0;
+}
+static const ffpars_arg cache_args[] = {
+	{ "workers", FFPARS_TINT | FFPARS_F64BIT, FFPARS_DSTOFF(struct cache_obj, workers) },
+	{ "name", FFPARS_TSTR | FFPARS_FCOPY, FFPARS_DSTOFF(struct cache_obj, name) },
+	{ "route", FFPARS_TOBJ | FFPARS_FMULTI, FFPARS_DST(&cache_route) },
+};
+// "weight" isn't supported
+static const ffpars_arg cache_route_args_old[] = {
+	{ "path", FFPARS_TSTR | FFPARS_FLIST, FFPARS_DST(&cache_path) },
+};
+static int cache_route_old(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	ffpars_setargs(ctx, obj, cache_route_args_old, FFCNT(cache_route_args_old));
+	return 0;
+}
+static const ffpars_arg cache_args_old[] = {
+	{ "workers", FFPARS_TINT | FFPARS_F64BIT, FFPARS_DSTOFF(struct cache_obj, workers) },
+	{ "name", FFPARS_TSTR | FFPARS_FCOPY, FFPARS_DSTOFF(struct cache_obj, name) },
+	{ "route", FFPARS_TOBJ | FFPARS_FMULTI, FFPARS_DST(&cache_route_old) },
+};
+
+static void cache_gen(ffarr *d, uint n)
+{
+	ffstr_catfmt(d, "# routes\nworkers 4\nname \"main\\tserver\"\n");
+	for (uint i = 0;  i != n;  i++) {
+		ffstr_catfmt(d, "route {\n\tpath \"/api/v%u/items\" \"/static/%u\" \"/x y/%u\"\n\tweight %u\n}\n"
+			, i % 3, i, i, i * 7);
+	}
+}
+
+static int cache_load(struct ffconf_loadfile *lf, struct cache_obj *o, const char *cache_fn
+	, const ffpars_arg *args, uint nargs)
+{
+	ffmem_tzero(lf);
+	ffmem_tzero(o);
+	lf->fn = TESTDIR "/conf-cache.conf";
+	lf->cache_fn = cache_fn;
+	lf->obj = o;
+	lf->args = args;
+	lf->nargs = nargs;
+	lf->bufsize = 1000; // values are split between input buffers
+	int r = ffconf_loadfile(lf);
+	if (r == 0)
+		x(ffstr_eqcz(&o->name, "main\tserver"));
+	ffstr_free(&o->name);
+	ffstr_null(&o->name);
+	return r;
+}
+
+#define CACHE_FN  TESTDIR "/conf-cache.bin"
+
+static void test_conf_cache(void)
+{
+	FFTEST_FUNC;
+	struct ffconf_loadfile lf;
+	struct cache_obj o, o2;
+	ffarr d = {};
+	char errstr[256];
+
+	cache_gen(&d, 1000);
+	x(0 == fffile_writeall(TESTDIR "/conf-cache.conf", d.ptr, d.len, 0));
+	fffile_rm(CACHE_FN);
+
+	x(0 == cache_load(&lf, &o, NULL, cache_args, FFCNT(cache_args)));
+	x(o.workers == 4 && o.routes == 1000 && o.paths == 3000);
+
+	// the text is parsed and the cache is created
+	x(0 == cache_load(&lf, &o2, CACHE_FN, cache_args, FFCNT(cache_args)));
+	x(!lf.cache_used);
+	x(!ffmemcmp(&o, &o2, sizeof(o)));
+
+	// the data is loaded from the cache
+	x(0 == cache_load(&lf, &o2, CACHE_FN, cache_args, FFCNT(cache_args)));
+	x(lf.cache_used);
+	x(!ffmemcmp(&o, &o2, sizeof(o)));
+
+	// the same error as when parsing the text
+	x(FFPARS_EUKNKEY == cache_load(&lf, &o2, NULL, cache_args_old, FFCNT(cache_args_old)));
+	ffsz_copy(errstr, sizeof(errstr), lf.errstr, -1);
+	x(FFPARS_EUKNKEY == cache_load(&lf, &o2, CACHE_FN, cache_args_old, FFCNT(cache_args_old)));
+	x(lf.cache_used);
+	x(!ffsz_cmp(errstr, lf.errstr));
+
+	// the source file is changed
+	ffstr_catfmt(&d, "route {\n\tpath \"/new\"\n}\n");
+	x(0 == fffile_writeall(TESTDIR "/conf-cache.conf", d.ptr, d.len, 0));
+	x(0 == cache_load(&lf, &o2, CACHE_FN, cache_args, FFCNT(cache_args)));
+	x(!lf.cache_used && o2.routes == 1001);
+	x(0 == cache_load(&lf, &o2, CACHE_FN, cache_args, FFCNT(cache_args)));
+	x(lf.cache_used && o2.routes == 1001);
+
+	x(0 == cache_load(&lf, &o, NULL, cache_args, FFCNT(cache_args)));
+	x(!fffile_exists(CACHE_FN ".tmp"));
+
+	// the cache file is truncated
+	ffarr c = {};
+	x(0 == fffile_readall(&c, CACHE_FN, -1));
+	x(0 == fffile_writeall(CACHE_FN, c.ptr, c.len / 2, 0));
+	x(0 == cache_load(&lf, &o2, CACHE_FN, cache_args, FFCNT(cache_args)));
+	x(!lf.cache_used && !ffmemcmp(&o, &o2, sizeof(o)));
+
+	// the cache file is corrupted:  the text is parsed, the handlers are called once for each token
+	for (uint i = 0;  i != 3;  i++) {
+		static const uint offs[] = { 50, 100, 1000 };
+		c.ptr[offs[i]] ^= 0xff;
+		x(0 == fffile_writeall(CACHE_FN, c.ptr, c.len, 0));
+		c.ptr[offs[i]] ^= 0xff;
+		x(0 == cache_load(&lf, &o2, CACHE_FN, cache_args, FFCNT(cache_args)));
+		x(!lf.cache_used && !ffmemcmp(&o, &o2, sizeof(o)));
+	}
+	x(0 == cache_load(&lf, &o2, CACHE_FN, cache_args, FFCNT(cache_args)));
+	x(lf.cache_used && !ffmemcmp(&o, &o2, sizeof(o)));
+
+	ffarr_free(&c);
+	ffarr_free(&d);
+	fffile_rm(CACHE_FN);
+	fffile_rm(TESTDIR "/conf-cache.conf");
+}
+
+/** Load a large config file: parse the text, parse and create the cache, load from the cache. */
+int test_conf_cache_speed(void)
+{
+	FFTEST_FUNC;
+	enum { N = 200000 };
+	static const char *const names[] = { "text", "text+cache write", "cache" };
+	struct ffconf_loadfile lf;
+	struct cache_obj o, o2;
+	ffarr d = {};
+	fftime start, stop;
+
+	cache_gen(&d, N);
+	x(0 == fffile_writeall(TESTDIR "/conf-cache.conf", d.ptr, d.len, 0));
+	fffile_rm(CACHE_FN);
+	x(0 == cache_load(&lf, &o, NULL, cache_args, FFCNT(cache_args)));
+
+	for (uint i = 0;  i != 3;  i++) {
+		fftime_now(&start);
+		x(0 == cache_load(&lf, &o2, (i == 0) ? NULL : CACHE_FN, cache_args, FFCNT(cache_args)));
+		fftime_now(&stop);
+		fftime_diff(&start, &stop);
+		x(lf.cache_used == (i == 2));
+		x(!ffmemcmp(&o, &o2, sizeof(o)));
+		fffile_fmt(ffstdout, NULL, "%s: %U bytes in %Ums\n"
+			, names[i], (uint64)d.len, (uint64)fftime_ms(&stop));
+	}
+
+	ffarr_free(&d);
+	fffile_rm(CACHE_FN);
+	fffile_rm(TESTDIR "/conf-cache.conf");
+	return 0;
+}
+
 int test_conf()
 {
 	FFTEST_FUNC;
 
 	test_conf_parse(TESTDATADIR "/schem.conf");
 	test_conf_schem(TESTDATADIR "/schem.conf");
+	test_conf_borrowed();
+	test_conf_cache();
 	return 0;
 }
 
@@ -0,0 +1,314 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/data/csv.h>
+#include <FF/time.h>
+#include <FFOS/file.h>
+#include <FFOS/atomic.h>
+#include <FFOS/test.h>
+#include <test/all.h>
+
+#define x FFTEST_BOOL
+
+
+/** Print the records to a string (single thread). */
+static int csv_print(void *udata, const struct ffcsv_rec *r)
+{
+	ffarr *out = udata;
+	if (r->err != 0) {
+		ffstr_catfmt(out, "E%d@%U", r->err, r->off);
+		return 0;
+	}
+	ffstr_catfmt(out, "%s%U:", (r->header) ? "H" : "", r->off);
+	for (uint i = 0;  i != r->nfields;  i++) {
+		ffstr_catfmt(out, "[%S]", &r->fields[i]);
+	}
+	ffstr_catfmt(out, "\n");
+	return 0;
+}
+
+/** Parse data and compare the records with the expected text. */
+static int csv_check(struct ffcsv_conf *conf, const char *data, const char *exp, int exp_r)
+{
+	ffarr out = {};
+	conf->handler = &csv_print;
+	conf->udata = &out;
+	conf->threads = 1;
+	int r = ffcsv_run(conf, data, ffsz_len(data), NULL);
+	int ok = (r == exp_r && ffstr_eqz(&out, exp));
+	if (!ok)
+		fffile_fmt(ffstdout, NULL, "%s: %d %S\n", data, r, &out);
+	ffarr_free(&out);
+	return ok;
+}
+
+static void test_csv_fields(void)
+{
+	struct ffcsv_conf conf;
+	ffcsv_conf_init(&conf);
+
+	x(csv_check(&conf, "", "", 0));
+	x(csv_check(&conf, "a,b,c\n1,,3", "0:[a][b][c]\n6:[1][][3]\n", 0));
+	x(csv_check(&conf, "a,b\r\n\r\n\n,\r\n", "0:[a][b]\n8:[][]\n", 0));
+	x(csv_check(&conf, "\"a,b\",\"c\nd\",\"\"\"q\"\"\",\"\"\n", "0:[a,b][c\nd][\"q\"][]\n", 0));
+	x(csv_check(&conf, "\"x\"\"\",\"y\"\"\"\"z\"\r\n\"\"", "0:[x\"][y\"\"z]\n16:[]\n", 0));
+
+	// a quoted field crosses the bounds of 64-byte blocks
+	ffarr d = {}, exp = {};
+	for (uint i = 0;  i != 200;  i++) {
+		ffstr_catfmt(&exp, "%L:[%u][%*c\"%*c]\n", d.len, i, (size_t)i, (int)',', (size_t)(i % 70), (int)'\n');
+		ffstr_catfmt(&d, "%u,\"%*c\"\"%*c\"\n", i, (size_t)i, (int)',', (size_t)(i % 70), (int)'\n');
+	}
+	ffarr_append(&d, "", 1);
+	ffarr_append(&exp, "", 1);
+	x(csv_check(&conf, d.ptr, exp.ptr, 0));
+	ffarr_free(&d);
+	ffarr_free(&exp);
+
+	// errors
+	x(csv_check(&conf, "a,b\nc,d\"e\n", "0:[a][b]\nE3@4", FFPARS_EBADCHAR));
+	x(csv_check(&conf, "a\n\"b\"c,d\n", "0:[a]\nE3@2", FFPARS_EBADCHAR));
+	x(csv_check(&conf, "a\n\"b\" \n", "0:[a]\nE3@2", FFPARS_EBADCHAR));
+	x(csv_check(&conf, "a\n\"b\n", "0:[a]\nE6@2", FFPARS_EBADVAL));
+
+	// TSV without quoting
+	conf.delim = '\t';
+	conf.quote = 0;
+	x(csv_check(&conf, "a\"\tb\n\"c\t", "0:[a\"][b]\n5:[\"c][]\n", 0));
+
+	// header
+	ffcsv_conf_init(&conf);
+	conf.header = 1;
+	x(csv_check(&conf, "\"n\nm\",v\n1,2\n", "H0:[n\nm][v]\n8:[1][2]\n", 0));
+}
+
+
+struct csv_test {
+	ffatomic recs, sum, bad, hdr;
+	ffcsv_cols cols;
+	uint threads;
+};
+
+struct csv_obj {
+	int64 id;
+	ffstr name;
+	int64 val;
+};
+
+static const ffpars_arg csv_obj_args[] = {
+	{ "id", FFPARS_TINT | FFPARS_F64BIT | FFPARS_FREQUIRED, FFPARS_DSTOFF(struct csv_obj, id) },
+	{ "name", FFPARS_TSTR, FFPARS_DSTOFF(struct csv_obj, name) },
+	{ "value", FFPARS_TINT | FFPARS_F64BIT | FFPARS_FSIGN, FFPARS_DSTOFF(struct csv_obj, val) },
+};
+
+/** Generate records with the fields: id, quoted name with delimiters, line breaks and quotes, value. */
+static void csv_gen(ffarr *d, uint n, uint64 *sum)
+{
+	*sum = 0;
+	ffstr_catfmt(d, "Value,ID,Extra,Name\r\n");
+	for (uint i = 0;  i != n;  i++) {
+		if (i % 101 == 7)
+			ffstr_catfmt(d, "\r\n");
+		ffstr_catfmt(d, "%u,%u,x,\"name %u, \"\"%u\"\"%s\"\r\n"
+			, i * 3, i, i, i % 10, (i % 5) ? "" : "\nline2");
+		char buf[FFINT_MAXCHARS];
+		*sum += i + i * 3 + FFSLEN("name , \"\"") + ffs_fromint(i, buf, sizeof(buf), 0) + 1 + ((i % 5) ? 0 : FFSLEN("\nline2"));
+	}
+}
+
+/** Called from several threads at once. */
+static int csv_handler(void *udata, const struct ffcsv_rec *r)
+{
+	struct csv_test *t = udata;
+	if (r->header) {
+		ffatom_inc(&t->hdr);
+		if (0 != ffcsv_cols_init(&t->cols, csv_obj_args, FFCNT(csv_obj_args), r->fields, r->nfields
+			, FFCSV_COLS_SKIPUNK | FFCSV_COLS_KEYICASE))
+			return 1;
+		return 0;
+	}
+
+	struct csv_obj o = {};
+	if (r->err != 0 || r->worker >= t->threads
+		|| 0 != ffcsv_cols_bind(&t->cols, r, &o)) {
+		ffatom_inc(&t->bad);
+		return 0;
+	}
+	ffatom_inc(&t->recs);
+	ffatom_add(&t->sum, o.id + o.val + o.name.len);
+	return 0;
+}
+
+static void csv_test_reset(struct csv_test *t)
+{
+	ffatom_set(&t->recs, 0);
+	ffatom_set(&t->sum, 0);
+	ffatom_set(&t->bad, 0);
+	ffatom_set(&t->hdr, 0);
+	ffcsv_cols_free(&t->cols);
+}
+
+static void test_csv_cols(void)
+{
+	ffcsv_cols c;
+	struct csv_obj o = {};
+	struct ffcsv_rec r = {};
+	ffstr hdr[3], f[3];
+
+	ffstr_setz(&hdr[0], "name");
+	ffstr_setz(&hdr[1], "unknown");
+	ffstr_setz(&hdr[2], "id");
+	x(FFPARS_EUKNKEY == ffcsv_cols_init(&c, csv_obj_args, FFCNT(csv_obj_args), hdr, 3, 0));
+	x(FFPARS_ENOREQ == ffcsv_cols_init(&c, csv_obj_args, FFCNT(csv_obj_args), hdr, 2, FFCSV_COLS_SKIPUNK));
+	ffstr_setz(&hdr[1], "name");
+	x(FFPARS_EDUPKEY == ffcsv_cols_init(&c, csv_obj_args, FFCNT(csv_obj_args), hdr, 3, 0));
+
+	ffstr_setz(&hdr[1], "value");
+	x(0 == ffcsv_cols_init(&c, csv_obj_args, FFCNT(csv_obj_args), hdr, 3, 0));
+	ffstr_setz(&f[0], "nm");
+	ffstr_setz(&f[1], "-5");
+	ffstr_setz(&f[2], "42");
+	r.fields = f;
+	r.nfields = 3;
+	x(0 == ffcsv_cols_bind(&c, &r, &o));
+	x(o.id == 42 && o.val == -5 && ffstr_eqz(&o.name, "nm"));
+	ffstr_setz(&f[2], "4x");
+	x(FFPARS_EBADINT == ffcsv_cols_bind(&c, &r, &o));
+	ffcsv_cols_free(&c);
+
+	// bind in order
+	x(0 == ffcsv_cols_init(&c, csv_obj_args, FFCNT(csv_obj_args), NULL, 2, 0));
+	ffstr_setz(&f[0], "7");
+	r.nfields = 2;
+	x(0 == ffcsv_cols_bind(&c, &r, &o));
+	x(o.id == 7 && ffstr_eqz(&o.name, "-5"));
+	ffcsv_cols_free(&c);
+}
+
+#define CSV_FN  TESTDIR "/csv.tmp"
+
+int test_csv(void)
+{
+	FFTEST_FUNC;
+	enum { N = 20000 };
+	ffarr d = {};
+	struct ffcsv_conf conf;
+	struct ffcsv_stat st;
+	struct csv_test t = {};
+	uint64 sum;
+
+	test_csv_fields();
+	test_csv_cols();
+
+	csv_gen(&d, N, &sum);
+	ffcsv_conf_init(&conf);
+	conf.handler = &csv_handler;
+	conf.udata = &t;
+	conf.header = 1;
+
+	// records and quoted line breaks cross the bounds of chunks
+	static const uint chunks[] = { 1, 100, 1000, 64 * 1024 };
+	static const uint threads[] = { 1, 2, 4 };
+	for (uint i = 0;  i != FFCNT(chunks);  i++) {
+		for (uint k = 0;  k != FFCNT(threads);  k++) {
+			conf.chunk_size = chunks[i];
+			conf.threads = threads[k];
+			t.threads = threads[k];
+			csv_test_reset(&t);
+			ffmem_tzero(&st);
+			x(0 == ffcsv_run(&conf, d.ptr, d.len, &st));
+			x(st.records == N + 1);
+			x(ffatom_get(&t.hdr) == 1);
+			x(ffatom_get(&t.recs) == N);
+			x(ffatom_get(&t.bad) == 0);
+			x(ffatom_get(&t.sum) == sum);
+		}
+	}
+
+	// the handler stops processing
+	csv_test_reset(&t);
+	conf.chunk_size = 1000;
+	conf.threads = 2;
+	x(1 == ffcsv_run(&conf, FFSTR("id,id\n1\n"), NULL));
+
+	// file mapping: records cross the bounds of 64k blocks
+	fffd f;
+	fffilemap fm;
+	x(0 == fffile_writeall(CSV_FN, d.ptr, d.len, 0));
+	x(FF_BADFD != (f = fffile_open(CSV_FN, O_RDONLY)));
+	csv_test_reset(&t);
+	ffmem_tzero(&st);
+	conf.threads = 4;
+	t.threads = 4;
+	fffile_mapinit(&fm);
+	fffile_mapset(&fm, 64 * 1024, f, 0, d.len);
+	x(0 == ffcsv_runmap(&conf, &fm, &st));
+	fffile_mapclose(&fm);
+	x(st.records == N + 1);
+	x(ffatom_get(&t.hdr) == 1);
+	x(ffatom_get(&t.sum) == sum);
+	fffile_close(f);
+	fffile_rm(CSV_FN);
+
+	ffcsv_cols_free(&t.cols);
+	ffarr_free(&d);
+	return 0;
+}
+
+
+static int csv_speed_handler(void *udata, const struct ffcsv_rec *r)
+{
+	if (r->nfields != 8)
+		ffatom_inc((ffatomic*)udata);
+	return 0;
+}
+
+/** Parse CSV and TSV data with 1..16 threads. */
+int test_csv_speed(void)
+{
+	FFTEST_FUNC;
+	enum { N = 2000000 };
+	ffarr d = {};
+	struct ffcsv_conf conf;
+	ffatomic bad = {};
+	fftime start, stop;
+
+	for (uint tsv = 0;  tsv != 2;  tsv++) {
+		d.len = 0;
+		for (uint i = 0;  i != N;  i++) {
+			if (tsv)
+				ffstr_catfmt(&d, "%u\t2019-06-01T12:%02u:%02u\tuser%u@example.com\t%u.%02u\tUSD\tcompleted\t%u\tweb\n"
+					, i, (i / 60) % 60, i % 60, i % 1000, i % 10000, i % 100, i * 7 % 100000);
+			else
+				ffstr_catfmt(&d, "%u,2019-06-01T12:%02u:%02u,\"Smith, John %u\",%u.%02u,USD,\"said \"\"ok\"\"\",%u,web\n"
+					, i, (i / 60) % 60, i % 60, i % 1000, i % 10000, i % 100, i * 7 % 100000);
+		}
+
+		ffcsv_conf_init(&conf);
+		conf.handler = &csv_speed_handler;
+		conf.udata = &bad;
+		if (tsv) {
+			conf.delim = '\t';
+			conf.quote = 0;
+		}
+
+		for (uint threads = 1;  threads <= 16;  threads *= 2) {
+			struct ffcsv_stat st = {};
+			conf.threads = threads;
+			fftime_now(&start);
+			x(0 == ffcsv_run(&conf, d.ptr, d.len, &st));
+			fftime_now(&stop);
+			fftime_diff(&start, &stop);
+			uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+			x(st.records == N);
+			fffile_fmt(ffstdout, NULL, "%s, %u threads: %U bytes in %Uus: %U MB/sec\n"
+				, (tsv) ? "TSV" : "CSV", threads
+				, (uint64)d.len, us, (uint64)d.len / ffmax(us, 1));
+		}
+	}
+	x(ffatom_get(&bad) == 0);
+
+	ffarr_free(&d);
+	return 0;
+}
@@ -4,7 +4,9 @@ Copyright (c) 2019 Simon Zolin
 
 #include <FF/net/dns-client.h>
 #include <FF/net/dns.h>
+#include <FF/time.h>
 #include <FFOS/random.h>
+#include <FFOS/thread.h>
 #include <FFOS/test.h>
 
 #define x FFTEST_BOOL
@@ -20,6 +22,7 @@ static void dnslog(uint level, const ffstr *trxn, const char *fmt, ...);
 static void dnstimer(fftmrq_entry *tmr, uint value_ms);
 static fftime dnstime(void);
 static void tmr_exit(void *param);
+static void load_onresolve(void *udata, int status, const ffaddrinfo *ai[2]);
 
 void test_dns_client(void)
 {
@@ -130,3 +133,333 @@ static void tmr_exit(void *param)
 {
 	gflags |= 2;
 }
+
+
+/* Local stand-in DNS server:
+UDP: answers each A query with 127.0.0.1;  sets TC flag for "bigN.*" names.
+TCP: answers each A query with BIG_NRECS records;  sends responses for each pair of queries in reverse order. */
+
+enum {
+	STUB_PORT = 64053,
+	LOAD_QUERIES = 100000,
+	LOAD_WINDOW = 256, //max. number of queries in flight
+	BIG_NRECS = 200,
+};
+
+/** Convert query in 'buf' into a response.
+nrecs: number of A records to add;  -1: set TC flag
+Return response length;  0 if the query is invalid. */
+static uint stub_response(char *buf, uint n, uint cap, int nrecs)
+{
+	// skip question name
+	uint i = sizeof(ffdns_hdr);
+	while (i < n && buf[i] != '\0')
+		i += (byte)buf[i] + 1;
+	i += 1 + sizeof(ffdns_ques);
+	if (i > n)
+		return 0;
+
+	ffdns_hdr *h = (void*)buf;
+	h->qr = 1;
+	h->ra = 1;
+	ffmem_zero(h->ancount, 6);
+	ffdns_ques_host qh;
+	ffdns_questohost(&qh, buf + i - sizeof(ffdns_ques));
+	if (nrecs == -1) {
+		h->tc = 1;
+		return i;
+	}
+	if (qh.type != FFDNS_A)
+		return i;
+
+	ffint_hton16(h->ancount, nrecs);
+	char *p = buf + i;
+	for (int k = 0;  k != nrecs;  k++) {
+		if (p + 2 + sizeof(ffdns_ans) + 4 > buf + cap)
+			return 0;
+		*p++ = '\xc0'; // pointer to the name in question
+		*p++ = sizeof(ffdns_hdr);
+		ffdns_ans *ans = (void*)p;
+		ffint_hton16(ans->type, FFDNS_A);
+		ffint_hton16(ans->clas, FFDNS_IN);
+		ffint_hton32(ans->ttl, 60);
+		ffint_hton16(ans->len, 4);
+		p += sizeof(ffdns_ans);
+		*p++ = 127;
+		*p++ = 0;
+		*p++ = k >> 8;
+		*p++ = k + 1;
+	}
+	return p - buf;
+}
+
+static int FFTHDCALL stub_dns_server(void *param)
+{
+	ffskt sk = (ffskt)(size_t)param;
+	char buf[FFDNS_MAXMSG];
+	struct sockaddr_in peer;
+
+	for (;;) {
+		socklen_t peerlen = sizeof(peer);
+		ssize_t n = recvfrom(sk, buf, sizeof(buf), 0, (void*)&peer, &peerlen);
+		if (n < (ssize_t)sizeof(ffdns_hdr))
+			break; // quit signal
+
+		int big = !ffmemcmp(buf + sizeof(ffdns_hdr), "\4big", 4);
+		n = stub_response(buf, n, sizeof(buf), (big) ? -1 : 1);
+		if (n != 0)
+			sendto(sk, buf, n, 0, (void*)&peer, peerlen);
+	}
+	return 0;
+}
+
+static uint tcp_nconns;
+
+static int FFTHDCALL stub_dns_server_tcp(void *param)
+{
+	ffskt lsn = (ffskt)(size_t)param;
+	ffskt sk;
+	ffarr in = {}, out[2] = {};
+	uint nout = 0;
+
+	if (FF_BADSKT == (sk = ffskt_accept(lsn, NULL, NULL, 0)))
+		return 1;
+	tcp_nconns++;
+	ffarr_alloc(&in, 64 * 1024);
+	ffarr_alloc(&out[0], 64 * 1024);
+	ffarr_alloc(&out[1], 64 * 1024);
+
+	for (;;) {
+		ssize_t r = ffskt_recv(sk, ffarr_end(&in), ffarr_unused(&in), 0);
+		if (r <= 0)
+			break;
+		in.len += r;
+
+		while (in.len >= 2) {
+			uint n = ffint_ntoh16(in.ptr);
+			if (in.len < 2 + n)
+				break;
+
+			ffarr *a = &out[nout++];
+			ffmemcpy(a->ptr + 2, in.ptr + 2, n);
+			_ffarr_rmleft(&in, 2 + n, sizeof(char));
+			n = stub_response(a->ptr + 2, n, a->cap - 2, BIG_NRECS);
+			ffint_hton16(a->ptr, n);
+			a->len = 2 + n;
+
+			if (nout == 2) {
+				ffskt_send(sk, out[1].ptr, out[1].len, 0);
+				ffskt_send(sk, out[0].ptr, out[0].len, 0);
+				nout = 0;
+			}
+		}
+	}
+
+	ffskt_close(sk);
+	ffarr_free(&in);
+	ffarr_free(&out[0]);
+	ffarr_free(&out[1]);
+	return 0;
+}
+
+static uint big_done;
+
+static void big_onresolve(void *udata, int status, const ffaddrinfo *ai[2])
+{
+	uint n = 0;
+	x(status == FFDNS_NOERROR);
+	for (const ffaddrinfo *it = ai[0];  it != NULL;  it = it->ai_next) {
+		n++;
+	}
+	x(n == BIG_NRECS);
+	big_done++;
+
+	for (uint i = 0;  i != 2;  i++) {
+		if (ai[i] != NULL)
+			ffdnscl_unref(ctx, ai[i]);
+	}
+}
+
+static void dns_loop(fffd kq, uint *counter, uint until)
+{
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 1000);
+	ffkqu_entry ents[64];
+	while (*counter != until && !(gflags & 2)) {
+		int n = ffkqu_wait(kq, ents, FFCNT(ents), &tm);
+		for (int i = 0;  i < n;  i++) {
+			ffkev_call(&ents[i]);
+		}
+		ffdnscl_flush(ctx);
+	}
+}
+
+/** Large responses:  UDP response is truncated, so the client repeats the queries via TCP.
+TCP connection is reused and the responses are received out of order. */
+void test_dns_client_tcp(void)
+{
+	FFTEST_FUNC;
+
+	ffaddr a;
+	ffaddr_init(&a);
+	x(0 == ffaddr_set(&a, FFSTR("127.0.0.1"), NULL, 0));
+	ffip_setport(&a, STUB_PORT);
+	ffskt usk = ffskt_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	x(usk != FF_BADSKT);
+	x(0 == ffskt_bind(usk, &a.a, a.len));
+	ffskt lsn = ffskt_create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	x(lsn != FF_BADSKT);
+	x(0 == ffskt_bind(lsn, &a.a, a.len));
+	x(0 == ffskt_listen(lsn, SOMAXCONN));
+	ffthd uth = ffthd_create(&stub_dns_server, (void*)(size_t)usk, 0);
+	ffthd tth = ffthd_create(&stub_dns_server_tcp, (void*)(size_t)lsn, 0);
+
+	fffd kq = ffkqu_create();
+	fftmrq_init(&tq);
+	fftmrq_start(&tq, kq, 100);
+	gflags = 0;
+	gtmr.handler = &tmr_exit;
+	fftmrq_add(&tq, &gtmr, -10000);
+
+	ffdnscl_conf conf = {};
+	conf.kq = kq;
+	conf.oncomplete = &oncomplete;
+	conf.log = &dnslog;
+	conf.time = &dnstime;
+	conf.timer = &dnstimer;
+	conf.max_tries = 3;
+	conf.retry_timeout = 3000;
+	conf.buf_size = FFDNS_MAXMSG;
+
+	ctx = ffdnscl_new(&conf);
+	x(ctx != NULL);
+	ffstr s;
+	ffstr_setz(&s, "127.0.0.1:64053");
+	x(0 == ffdnscl_serv_add(ctx, &s));
+
+	big_done = 0;
+	// UDP -> truncated -> TCP
+	x(0 == ffdnscl_resolve(ctx, FFSTR("big1.test"), &big_onresolve, NULL, 0));
+	x(0 == ffdnscl_resolve(ctx, FFSTR("big2.test"), &big_onresolve, NULL, 0));
+	dns_loop(kq, &big_done, 2);
+	x(big_done == 2);
+
+	// TCP
+	x(0 == ffdnscl_resolve(ctx, FFSTR("big3.test"), &big_onresolve, NULL, FFDNSCL_TCP));
+	x(0 == ffdnscl_resolve(ctx, FFSTR("big4.test"), &big_onresolve, NULL, FFDNSCL_TCP));
+	dns_loop(kq, &big_done, 4);
+	x(big_done == 4);
+
+	ffdnscl_free(ctx);
+	ffthd_join(tth, -1, NULL);
+	x(tcp_nconns == 1);
+
+	ffskt c = ffskt_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	ffskt_connect(c, &a.a, a.len);
+	ffskt_send(c, "", 1, 0);
+	ffskt_close(c);
+	ffthd_join(uth, -1, NULL);
+	ffskt_close(usk);
+	ffskt_close(lsn);
+
+	fftmrq_destroy(&tq, kq);
+	ffkqu_close(kq);
+}
+
+static uint load_sent, load_done, load_failed;
+
+static void load_resolve_next(void)
+{
+	char name[64];
+	uint n = ffs_fmt(name, name + sizeof(name), "host%u.test", load_sent++);
+	x(0 == ffdnscl_resolve(ctx, name, n, &load_onresolve, NULL, FFDNSCL_BATCH));
+}
+
+static void load_onresolve(void *udata, int status, const ffaddrinfo *ai[2])
+{
+	load_done++;
+	if (status != FFDNS_NOERROR || ai[0] == NULL) {
+		load_failed++;
+	} else {
+		const struct sockaddr_in *a = (void*)ai[0]->ai_addr;
+		x(!ffmemcmp(&a->sin_addr, "\x7f\x00\x00\x01", 4));
+	}
+
+	for (uint i = 0;  i != 2;  i++) {
+		if (ai[i] != NULL)
+			ffdnscl_unref(ctx, ai[i]);
+	}
+
+	if (load_sent != LOAD_QUERIES)
+		load_resolve_next();
+}
+
+/** Resolve many names through a local server and measure queries per second. */
+void test_dns_client_load(void)
+{
+	FFTEST_FUNC;
+
+	ffaddr a;
+	ffaddr_init(&a);
+	x(0 == ffaddr_set(&a, FFSTR("127.0.0.1"), NULL, 0));
+	ffip_setport(&a, STUB_PORT);
+	ffskt srv = ffskt_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	x(srv != FF_BADSKT);
+	x(0 == ffskt_bind(srv, &a.a, a.len));
+	ffthd th = ffthd_create(&stub_dns_server, (void*)(size_t)srv, 0);
+	x(th != FFTHD_INV);
+
+	fffd kq = ffkqu_create();
+	fftmrq_init(&tq);
+	fftmrq_start(&tq, kq, 100);
+	gflags = 0;
+	gtmr.handler = &tmr_exit;
+	fftmrq_add(&tq, &gtmr, -30000);
+
+	ffdnscl_conf conf = {};
+	conf.kq = kq;
+	conf.oncomplete = &oncomplete;
+	conf.log = &dnslog;
+	conf.time = &dnstime;
+	conf.timer = &dnstimer;
+	conf.max_tries = 3;
+	conf.retry_timeout = 1000;
+	conf.buf_size = FFDNS_MAXMSG;
+	conf.batch_size = 64;
+
+	ctx = ffdnscl_new(&conf);
+	x(ctx != NULL);
+	ffstr s;
+	ffstr_setz(&s, "127.0.0.1:64053");
+	x(0 == ffdnscl_serv_add(ctx, &s));
+
+	fftime start, stop;
+	fftime_now(&start);
+
+	load_sent = load_done = load_failed = 0;
+	for (uint i = 0;  i != LOAD_WINDOW;  i++) {
+		load_resolve_next();
+	}
+	ffdnscl_flush(ctx);
+
+	dns_loop(kq, &load_done, LOAD_QUERIES);
+
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	uint64 ms = fftime_sec(&stop) * 1000 + fftime_msec(&stop);
+	fffile_fmt(ffstdout, NULL, "DNS client: %u queries (%u failed) in %Ums: %U q/s\n"
+		, load_done, load_failed, ms, (uint64)load_done * 1000 / ffmax(ms, 1));
+	x(load_done == LOAD_QUERIES);
+
+	// stop the server
+	ffskt c = ffskt_create(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	ffskt_connect(c, &a.a, a.len);
+	ffskt_send(c, "", 1, 0);
+	ffskt_close(c);
+	ffthd_join(th, -1, NULL);
+	ffskt_close(srv);
+
+	ffdnscl_free(ctx);
+	fftmrq_destroy(&tq, kq);
+	ffkqu_close(kq);
+}
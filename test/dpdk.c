@@ -0,0 +1,224 @@
+/** Test DPDK wrapper using software devices: no NIC is required.
+Copyright 2018 Simon Zolin.
+*/
+
+#include <FF/net/dpdk.h>
+#include <FF/net/proto.h>
+#include <FFOS/test.h>
+#include <FFOS/thread.h>
+
+#include <test/all.h>
+
+#define x FFTEST_BOOL
+
+#define PCAP_IN  TESTDATADIR "/packets.pcap"
+#define PCAP_OUT  "fftest-dpdk-out.pcap"
+#define PCAP_PKTS  10
+
+static void logger(uint level, const char *fmt, ...)
+{
+	char buf[1024];
+	va_list va;
+	va_start(va, fmt);
+	ssize_t r = ffs_fmtv2(buf, sizeof(buf), fmt, va);
+	va_end(va);
+	if (r > 0)
+		fffile_write(ffstderr, buf, r);
+}
+
+static int port_open(ffdpdk_port *p, const char *name, const char *args, uint nqueues, ffdpdk_mpool *mp)
+{
+	int id;
+	if (!x(0 <= (id = ffdpdk_vdev_add(name, args))))
+		return -1;
+	x(0 == ffdpdk_port_init(p, id));
+	x(ffdpdk_port_isvirt(p));
+	x(0 == ffdpdk_port_open(p, nqueues, nqueues, mp));
+	x(0 == ffdpdk_port_start(p));
+	return 0;
+}
+
+static void port_close(ffdpdk_port *p, const char *name)
+{
+	ffdpdk_port_close(p);
+	ffdpdk_vdev_rm(name);
+}
+
+static void wstat_print(const char *name, const ffdpdk_wstat *st)
+{
+	ffdpdk_wstat zero = {};
+	ffdpdk_wrate r;
+	ffdpdk_wstat_rate(st, &zero, &r);
+	fffile_fmt(ffstdout, NULL, "%s: rx:%U tx:%U drop:%U  %U/%U/%U pps  burst fill:%u%%  busy:%u%%  timer flushes:%U\n"
+		, name, st->recvd, st->sent, st->dropped
+		, r.rx_pps, r.tx_pps, r.drop_pps, r.fill, r.busy, st->flushes);
+}
+
+
+/* Forward IP packets with valid headers, drop the others. */
+static void pcap_handler(ffdpdk_worker *w, ffdpdk_mbuf **pkts, uint n)
+{
+	const void *data[FFDPDK_BURST_MAX];
+	uint lens[FFDPDK_BURST_MAX];
+	ffpkt_burst b;
+
+	for (uint i = 0;  i != n;  i++) {
+		data[i] = ffdpdk_pkt_ptr(pkts[i], void*);
+		lens[i] = rte_pktmbuf_data_len(pkts[i]);
+	}
+	ffpkt_parse_burst(&b, data, lens, n, FFPKT_VERIFY_CHKSUM);
+
+	for (uint i = 0;  i != n;  i++) {
+		if ((b.flags[i] & (FFPKT_IP4 | FFPKT_IP6))
+			&& !(b.flags[i] & (FFPKT_EBAD | FFPKT_ECHKSUM)))
+			ffdpdk_worker_tx(w, pkts[i]);
+		else
+			ffdpdk_worker_drop(w, pkts[i]);
+	}
+}
+
+/* net_pcap: read packets from file, filter them and write to another file */
+static void test_dpdk_pcap(ffdpdk_mpool *mp)
+{
+	FFTEST_FUNC;
+	ffdpdk_port p = {};
+	ffdpdk_queue rxq = {}, txq = {};
+	ffdpdk_worker w;
+	ffdpdk_wstat st;
+
+	fffile_rm(PCAP_OUT);
+	if (0 != port_open(&p, "net_pcap0", "rx_pcap=" PCAP_IN ",tx_pcap=" PCAP_OUT, 1, mp))
+		return;
+	x(0 == ffdpdk_queue_initrx(&rxq, &p, 0));
+	x(0 == ffdpdk_queue_inittx(&txq, &p, 0, 32));
+
+	ffdpdk_worker_init(&w, &rxq, &txq, &pcap_handler, NULL);
+	x(0 == ffdpdk_workers_start(&w, 1));
+	for (;;) {
+		ffmem_tzero(&st);
+		ffdpdk_worker_stat(&w, &st);
+		if (st.recvd == PCAP_PKTS)
+			break;
+		ffthd_sleep(1);
+	}
+	ffthd_sleep(1); // let the timer flush the TX queue
+	ffdpdk_workers_stop(&w, 1);
+
+	ffmem_tzero(&st);
+	ffdpdk_worker_stat(&w, &st);
+	wstat_print("pcap", &st);
+	x(st.recvd == PCAP_PKTS);
+	// ARP, truncated IPv4, bad IPv4 header checksum
+	x(st.dropped == 3);
+	x(st.sent == PCAP_PKTS - 3);
+	x(st.flushes != 0);
+	x(st.workers == 1);
+
+	ffdpdk_queue_close(&txq);
+	port_close(&p, "net_pcap0");
+	fffile_rm(PCAP_OUT);
+}
+
+
+static void swap_mac(ffdpdk_worker *w, ffdpdk_mbuf **pkts, uint n)
+{
+	for (uint i = 0;  i != n;  i++) {
+		ffeth_hdr *eth = ffdpdk_pkt_ptr(pkts[i], ffeth_hdr*);
+		ffeth a = eth->saddr;
+		eth->saddr = eth->daddr;
+		eth->daddr = a;
+		ffdpdk_worker_tx(w, pkts[i]);
+	}
+}
+
+enum { MAX_WORKERS = 16 };
+
+/* Pipeline: net_null0 -> stage1 -> net_ring0 -> stage2 -> net_null1.
+Each stage is a worker on its own CPU.  With more CPUs the pipeline is replicated using several queues. */
+static void test_dpdk_pipeline(ffdpdk_mpool *mp)
+{
+	FFTEST_FUNC;
+	ffdpdk_port src = {}, ring = {}, dst = {};
+	ffdpdk_queue q[MAX_WORKERS][2];
+	ffdpdk_worker w[MAX_WORKERS];
+	ffdpdk_wstat st[MAX_WORKERS], stages[2];
+	uint npipes = (ffdpdk_cores() - 1) / 2;
+	npipes = ffmin(npipes, MAX_WORKERS / 2);
+	if (npipes == 0) {
+		fffile_fmt(ffstdout, NULL, "%s: skipped: need at least 3 CPUs (-l 0-2)\n", FF_FUNC);
+		return;
+	}
+	uint nw = npipes * 2;
+
+	if (0 != port_open(&src, "net_null0", "size=64,copy=0", npipes, mp)
+		|| 0 != port_open(&ring, "net_ring0", "nodeaction=r0:0:CREATE", npipes, mp)
+		|| 0 != port_open(&dst, "net_null1", "size=64,copy=0", npipes, mp))
+		return;
+
+	ffmem_zero(q, sizeof(q));
+	for (uint i = 0;  i != npipes;  i++) {
+		ffdpdk_worker *w1 = &w[i * 2], *w2 = &w[i * 2 + 1];
+		ffdpdk_queue *q1 = q[i * 2], *q2 = q[i * 2 + 1];
+
+		x(0 == ffdpdk_queue_initrx(&q1[0], &src, i));
+		x(0 == ffdpdk_queue_inittx(&q1[1], &ring, i, 32));
+		ffdpdk_worker_init(w1, &q1[0], &q1[1], &swap_mac, NULL);
+
+		x(0 == ffdpdk_queue_initrx(&q2[0], &ring, i));
+		x(0 == ffdpdk_queue_inittx(&q2[1], &dst, i, 32));
+		ffdpdk_worker_init(w2, &q2[0], &q2[1], NULL, NULL);
+	}
+
+	x(0 == ffdpdk_workers_start(w, nw));
+	ffthd_sleep(1000);
+	ffdpdk_workers_stop(w, nw);
+
+	ffmem_zero(stages, sizeof(stages));
+	for (uint i = 0;  i != nw;  i++) {
+		ffmem_tzero(&st[i]);
+		ffdpdk_worker_stat(&w[i], &st[i]);
+		ffdpdk_worker_stat(&w[i], &stages[i % 2]);
+
+		char name[32];
+		ffs_fmt2(name, sizeof(name), "lcore%u stage%u", w[i].lcore, i % 2 + 1);
+		wstat_print(name, &st[i]);
+		x(st[i].recvd != 0);
+	}
+	wstat_print("stage1", &stages[0]);
+	wstat_print("stage2", &stages[1]);
+
+	// stage2 may stop while some packets are still in the ring
+	x(stages[1].recvd <= stages[0].sent);
+	x(stages[1].recvd == stages[1].sent + stages[1].dropped);
+
+	for (uint i = 0;  i != nw;  i++) {
+		ffdpdk_queue_close(&q[i][1]);
+	}
+	port_close(&src, "net_null0");
+	port_close(&ring, "net_ring0");
+	port_close(&dst, "net_null1");
+}
+
+/*
+Usage: fftest-dpdk [EAL options]
+Default EAL options: --no-pci --no-huge -m 256 -l 0-2 */
+int main(int argc, char **argv)
+{
+	char *args[] = { argv[0], "--no-pci", "--no-huge", "-m", "256", "-l", "0-2", NULL };
+	ffmem_init();
+
+	if (argc == 1) {
+		argc = FFCNT(args) - 1;
+		argv = args;
+	}
+	if (!x(0 == ffdpdk_init(&argc, &argv, 1, &logger)))
+		return 1;
+
+	ffdpdk_mpool *mp;
+	if (!x(NULL != (mp = ffdpdk_mpool_new(8 * 1024))))
+		return 1;
+
+	FFTEST_TIMECALL(test_dpdk_pcap(mp));
+	FFTEST_TIMECALL(test_dpdk_pipeline(mp));
+	return 0;
+}
@@ -0,0 +1,514 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <test/all.h>
+#include <FF/net/http-server.h>
+#include <FF/net/http-range.h>
+#include <FF/net/url.h>
+#include <FF/number.h>
+#include <FF/time.h>
+#include <FFOS/thread.h>
+#include <FFOS/test.h>
+
+#define x FFTEST_BOOL
+
+#define SV_PORT  64081
+
+static fffd kq;
+static fftimer_queue tq;
+static ffhttpsv *sv;
+static uint client_done;
+static ffhttpsv_conn *async_conn;
+static uint nsent;
+
+static void sv_log(void *udata, uint level, const char *fmt, ...)
+{
+	if ((level & 0x0f) > FFHTTPSV_LOG_WARN)
+		return;
+	char buf[1024];
+	va_list va;
+	va_start(va, fmt);
+	ssize_t r = ffs_fmtv2(buf, sizeof(buf), fmt, va);
+	va_end(va);
+	if (r > 0)
+		fffile_fmt(ffstdout, NULL, "httpsv: %*s\n", (size_t)r, buf);
+}
+
+static const ffstr parts[] = { FFSTR_INIT("abc"), FFSTR_INIT("def") };
+
+#define RANGE_FN  TESTDIR "/httpsv-range.tmp"
+static fffd range_fd;
+static ffhttp_ranges range;
+static ffsf range_sf, range_part;
+static uint range_active;
+static const ffstr range_ctype = FFSTR_INIT("text/plain");
+
+/** Send the next part of a range response. */
+static void range_send(ffhttpsv_conn *c)
+{
+	ffsf_close(&range_part);
+	if (!ffhttp_ranges_next(&range, &range_sf, &range_part)) {
+		range_active = 0;
+		ffhttpsv_send(c, NULL, 0);
+		return;
+	}
+	ffhttpsv_sendfile(c, &range_part, FFHTTPSV_MORE);
+}
+
+static void range_req(ffhttpsv_conn *c)
+{
+	ffstr val;
+	ffsf_init(&range_sf);
+	fffile_mapset(&range_sf.fm, 64 * 1024, range_fd, 0, 10);
+
+	if (!ffhttp_findihdr(&ffhttpsv_req(c)->h, FFHTTP_RANGE, &val)
+		|| FFHTTP_RANGE_IGNORE == ffhttp_ranges_parse(&range, val.ptr, val.len, range_sf.fm.fsize)) {
+		ffhttpsv_sendfile(c, &range_sf, 0);
+		return;
+	}
+
+	x(0 == ffhttp_ranges_resp(&range, ffhttpsv_resp(c), &range_ctype));
+	range_active = 1;
+	range_send(c);
+}
+
+static void sv_handler(ffhttpsv_conn *c, uint event)
+{
+	ffstr path, body;
+
+	switch (event) {
+	case FFHTTPSV_REQUEST:
+		path = ffhttp_req_path(ffhttpsv_req(c));
+		if (ffstr_eqz(&path, "/hello")) {
+			ffstr_setz(&body, "hello");
+			ffhttpsv_send(c, &body, 0);
+
+		} else if (ffstr_eqz(&path, "/chunked")) {
+			nsent = 0;
+			ffhttpsv_send(c, &parts[nsent++], FFHTTPSV_MORE);
+
+		} else if (ffstr_eqz(&path, "/echo")) {
+			body = ffhttpsv_reqbody(c);
+			ffhttp_cook *resp = ffhttpsv_resp(c);
+			ffstr_setz(&resp->cont_type, "text/plain");
+			ffhttp_addhdr(resp, FFSTR("X-Test"), FFSTR("1"));
+			ffhttpsv_send(c, &body, 0);
+
+		} else if (ffstr_eqz(&path, "/range")) {
+			range_req(c);
+
+		} else if (ffstr_eqz(&path, "/hdtr-chunked")) {
+			// user headers can't be sent in a chunked response: the connection is closed
+			static ffiovec hdr;
+			static ffsf sf;
+			ffiov_set(&hdr, (void*)"hdr", 3);
+			ffsf_init(&sf);
+			sf.ht.headers = &hdr;
+			sf.ht.hdr_cnt = 1;
+			ffhttpsv_sendfile(c, &sf, FFHTTPSV_MORE);
+			x(sf.ht.headers == &hdr && sf.ht.hdr_cnt == 1);
+
+		} else if (ffstr_eqz(&path, "/async")) {
+			async_conn = c; // respond from the main loop
+
+		} else {
+			ffhttp_setstatus(ffhttpsv_resp(c), FFHTTP_404_NOT_FOUND);
+			ffhttpsv_send(c, NULL, 0);
+		}
+		break;
+
+	case FFHTTPSV_SENT:
+		if (range_active)
+			range_send(c);
+		else if (nsent != FFCNT(parts))
+			ffhttpsv_send(c, &parts[nsent++], FFHTTPSV_MORE);
+		else
+			ffhttpsv_send(c, NULL, 0);
+		break;
+
+	case FFHTTPSV_CLOSE:
+		if (async_conn == c)
+			async_conn = NULL;
+		break;
+	}
+}
+
+static ffskt cl_connect(void)
+{
+	ffaddr a;
+	ffaddr_init(&a);
+	ffaddr_set(&a, FFSTR("127.0.0.1"), NULL, 0);
+	ffip_setport(&a, SV_PORT);
+	ffskt sk = ffskt_create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	x(sk != FF_BADSKT);
+	x(0 == ffskt_connect(sk, &a.a, a.len));
+	ffskt_setopt(sk, IPPROTO_TCP, TCP_NODELAY, 1);
+	return sk;
+}
+
+/** Send request data and check the response.
+closed: read until the server closes connection */
+static void cl_exchange(ffskt sk, const char *req, const char *resp, uint closed)
+{
+	char buf[4096];
+	size_t n = 0, len = ffsz_len(resp);
+	x(ffsz_len(req) == ffskt_send(sk, req, ffsz_len(req), 0));
+
+	while (n < len || closed) {
+		ssize_t r = ffskt_recv(sk, buf + n, sizeof(buf) - n, 0);
+		if (r <= 0)
+			break;
+		n += r;
+	}
+	if (!x(n == len && !ffmemcmp(buf, resp, len)))
+		fffile_fmt(ffstdout, NULL, "expected:\n%s\nreceived:\n%*s\n", resp, n, buf);
+}
+
+/** Request 2 ranges and check the multipart body.
+The boundary is random: it's taken from the server's object after the response is received. */
+static void cl_multirange(ffskt sk)
+{
+	static const char req[] = "GET /range HTTP/1.1\r\nHost: a\r\nRange: bytes=-1,0-1\r\n\r\n";
+	char buf[4096], exp[4096];
+	size_t n = 0;
+	x(FFSLEN(req) == ffskt_send(sk, req, FFSLEN(req), 0));
+
+	for (;;) {
+		ssize_t r = ffskt_recv(sk, buf + n, sizeof(buf) - n, 0);
+		if (r <= 0)
+			break;
+		n += r;
+		if (n >= 4 && ffs_eqcz(buf + n - 4, 4, "--\r\n"))
+			break;
+	}
+
+	ffatom_fence_acq();
+	const char *b = range.boundary;
+	size_t bl = sizeof(range.boundary);
+	size_t body = FFSLEN("--\r\nContent-Type: text/plain\r\nContent-Range: bytes 0-1/10\r\n\r\n01") + bl
+		+ FFSLEN("\r\n--\r\nContent-Type: text/plain\r\nContent-Range: bytes 9-9/10\r\n\r\n9") + bl
+		+ FFSLEN("\r\n----\r\n") + bl;
+	size_t len = ffs_fmt(exp, exp + sizeof(exp)
+		, "HTTP/1.1 206 Partial Content\r\nContent-Type: multipart/byteranges; boundary=%*s\r\nContent-Length: %L\r\n\r\n"
+		"--%*s\r\nContent-Type: text/plain\r\nContent-Range: bytes 0-1/10\r\n\r\n01"
+		"\r\n--%*s\r\nContent-Type: text/plain\r\nContent-Range: bytes 9-9/10\r\n\r\n9"
+		"\r\n--%*s--\r\n"
+		, bl, b, body, bl, b, bl, b, bl, b);
+	if (!x(n == len && !ffmemcmp(buf, exp, len)))
+		fffile_fmt(ffstdout, NULL, "expected:\n%*s\nreceived:\n%*s\n", len, exp, n, buf);
+}
+
+#define RESP_HELLO  "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello"
+#define RESP_RANGE  "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes 2-4/10\r\nContent-Type: text/plain\r\nContent-Length: 3\r\n\r\n234"
+#define RESP_CHUNKED  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" "3\r\nabc\r\n" "3\r\ndef\r\n" "0\r\n\r\n"
+
+static int FFTHDCALL sv_client(void *param)
+{
+	ffskt sk = cl_connect();
+
+	// keep-alive
+	cl_exchange(sk, "GET /hello HTTP/1.1\r\nHost: a\r\n\r\n", RESP_HELLO, 0);
+	cl_exchange(sk, "GET /chunked HTTP/1.1\r\nHost: a\r\n\r\n", RESP_CHUNKED, 0);
+
+	// HEAD with a streaming response: only the headers are sent, the next response follows them
+	cl_exchange(sk, "HEAD /chunked HTTP/1.1\r\nHost: a\r\n\r\n"
+		"GET /hello HTTP/1.1\r\nHost: a\r\n\r\n"
+		, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" RESP_HELLO, 0);
+
+	// pipelined requests, request body
+	cl_exchange(sk, "GET /hello HTTP/1.1\r\nHost: a\r\n\r\n"
+		"POST /echo HTTP/1.1\r\nHost: a\r\nContent-Length: 4\r\n\r\nabcd"
+		"POST /echo HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nab\r\n1\r\nc\r\n0\r\n\r\n"
+		"GET /async HTTP/1.1\r\nHost: a\r\n\r\n"
+		"GET /none HTTP/1.1\r\nHost: a\r\n\r\n"
+		, RESP_HELLO
+		"HTTP/1.1 200 OK\r\nX-Test: 1\r\nContent-Type: text/plain\r\nContent-Length: 4\r\n\r\nabcd"
+		"HTTP/1.1 200 OK\r\nX-Test: 1\r\nContent-Type: text/plain\r\nContent-Length: 3\r\n\r\nabc"
+		"HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nasync"
+		"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"
+		, 0);
+
+	// range requests: 1 part;  no ranges are satisfiable;  multipart/byteranges
+	cl_exchange(sk, "GET /range HTTP/1.1\r\nHost: a\r\nRange: bytes=2-4\r\n\r\n", RESP_RANGE, 0);
+	cl_exchange(sk, "GET /range HTTP/1.1\r\nHost: a\r\nRange: bytes=10-\r\n\r\n"
+		, "HTTP/1.1 416 Requested Range Not Satisfiable\r\nContent-Range: bytes */10\r\nContent-Length: 0\r\n\r\n", 0);
+	cl_multirange(sk);
+
+	// request is split into several packets
+	x(9 == ffskt_send(sk, "GET /hell", 9, 0));
+	ffthd_sleep(50);
+	cl_exchange(sk, "o HTTP/1.1\r\nHost: a\r\n\r\n", RESP_HELLO, 0);
+
+	// HTTP/1.0: the server closes connection
+	cl_exchange(sk, "GET /chunked HTTP/1.0\r\n\r\n"
+		, "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nabcdef", 1);
+	ffskt_close(sk);
+
+	sk = cl_connect();
+	cl_exchange(sk, "GET /hdtr-chunked HTTP/1.1\r\nHost: a\r\n\r\n", "", 1);
+	ffskt_close(sk);
+
+	// bad request
+	sk = cl_connect();
+	cl_exchange(sk, "BAD\r\n\r\n"
+		, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", 1);
+	ffskt_close(sk);
+
+	// headers are larger than server's buffer
+	sk = cl_connect();
+	char big[1024 + 1];
+	memset(big, 'a', sizeof(big) - 1);
+	ffmemcpy(big, "GET / HTTP/1.1\r\nX: ", 19);
+	big[sizeof(big) - 1] = '\0';
+	cl_exchange(sk, big
+		, "HTTP/1.1 413 Request Entity Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", 1);
+	ffskt_close(sk);
+
+	// idle connection is closed by timer
+	sk = cl_connect();
+	cl_exchange(sk, "GET /hello HTTP/1.1\r\nHost: a\r\n\r\n", RESP_HELLO, 0);
+	char c;
+	x(0 == ffskt_recv(sk, &c, 1, 0));
+	ffskt_close(sk);
+
+	ffatom_fence_rel();
+	client_done = 1;
+	return 0;
+}
+
+static ffskt sv_listen(void)
+{
+	ffaddr a;
+	ffaddr_init(&a);
+	ffaddr_set(&a, FFSTR("127.0.0.1"), NULL, 0);
+	ffip_setport(&a, SV_PORT);
+	ffskt lsn = ffskt_create(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	x(lsn != FF_BADSKT);
+	ffskt_setopt(lsn, SOL_SOCKET, SO_REUSEADDR, 1);
+	x(0 == ffskt_bind(lsn, &a.a, a.len));
+	x(0 == ffskt_listen(lsn, SOMAXCONN));
+	x(0 == ffskt_nblock(lsn, 1));
+	return lsn;
+}
+
+static void sv_start(struct ffhttpsv_conf *conf)
+{
+	kq = ffkqu_create();
+	fftmrq_init(&tq);
+	fftmrq_start(&tq, kq, 50);
+	ffhttpsv_conf_init(conf);
+	conf->kq = kq;
+	conf->tmrq = &tq;
+	conf->handler = &sv_handler;
+	conf->log = &sv_log;
+}
+
+static void sv_stop(ffskt lsn)
+{
+	ffhttpsv_free(sv);
+	sv = NULL;
+	ffskt_close(lsn);
+	fftmrq_destroy(&tq, kq);
+	ffkqu_close(kq);
+}
+
+int test_http_server(void)
+{
+	FFTEST_FUNC;
+	struct ffhttpsv_conf conf;
+	struct ffhttpsv_stat st;
+
+	ffhttp_initheaders();
+	x(0 == fffile_writeall(RANGE_FN, "0123456789", 10, 0));
+	x(FF_BADFD != (range_fd = fffile_open(RANGE_FN, O_RDONLY)));
+	ffhttp_ranges_init(&range);
+	range.coalesce_gap = 0; // keep the test ranges separate
+	ffsf_init(&range_part);
+
+	sv_start(&conf);
+	conf.buffer_size = 1024;
+	conf.keepalive_timeout = 200;
+	x(NULL != (sv = ffhttpsv_create(&conf)));
+	ffskt lsn = sv_listen();
+	x(0 == ffhttpsv_listen(sv, lsn, AF_INET));
+
+	client_done = 0;
+	ffthd th = ffthd_create(&sv_client, NULL, 0);
+
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 100);
+	ffkqu_entry ents[64];
+	while (!client_done) {
+		int n = ffkqu_wait(kq, ents, FFCNT(ents), &tm);
+		for (int i = 0;  i < n;  i++) {
+			ffkev_call(&ents[i]);
+		}
+
+		if (async_conn != NULL) {
+			ffhttpsv_conn *c = async_conn;
+			async_conn = NULL;
+			ffstr body;
+			ffstr_setz(&body, "async");
+			ffhttpsv_send(c, &body, 0);
+		}
+	}
+	ffthd_join(th, -1, NULL);
+
+	ffhttpsv_stat(sv, &st);
+	x(st.conns == 5);
+	x(st.reqs == 17);
+	x(st.keepalive_reqs == 13);
+	x(st.errors == 2);
+	x(st.timeouts == 1);
+	x(st.conns_active == 0);
+	x(st.bufs_used == 0);
+	x(st.bufs_free == 1);
+
+	sv_stop(lsn);
+	ffsf_close(&range_part);
+	ffhttp_ranges_free(&range);
+	fffile_close(range_fd);
+	fffile_rm(RANGE_FN);
+	ffhttp_freeheaders();
+	return 0;
+}
+
+
+enum { BENCH_CONNS = 8, BENCH_SEC = 2, BENCH_MAXREQS = 2 * 1024 * 1024 };
+
+struct bench_cl {
+	ffthd th;
+	uint nreqs;
+	uint *lat; // request latency, usec
+	uint err;
+	uint reconnects;
+};
+
+static ffatomic bench_stop;
+
+/* wrk-like client: one keep-alive connection, the next request is sent when the response is received.
+Reconnect when the server closes the connection after 'max_keepalive' requests. */
+static int FFTHDCALL bench_client(void *param)
+{
+	struct bench_cl *b = param;
+	static const char req[] = "GET /hello HTTP/1.1\r\nHost: localhost\r\nUser-Agent: fftest\r\nAccept: */*\r\n\r\n";
+	char buf[1024];
+	ffskt sk = cl_connect();
+
+	while (!ffatom_get(&bench_stop) && b->nreqs != BENCH_MAXREQS) {
+		fftime t1, t2;
+		fftime_now(&t1);
+		if (FFSLEN(req) != ffskt_send(sk, req, FFSLEN(req), 0)) {
+			b->err++;
+			break;
+		}
+		size_t n = 0;
+		while (n < FFSLEN(RESP_HELLO) || !ffs_eqcz(buf + n - FFSLEN("hello"), FFSLEN("hello"), "hello")) {
+			ssize_t r = ffskt_recv(sk, buf + n, sizeof(buf) - n, 0);
+			if (r <= 0) {
+				b->err++;
+				goto end;
+			}
+			n += r;
+		}
+		fftime_now(&t2);
+		fftime_diff(&t1, &t2);
+		b->lat[b->nreqs++] = fftime_sec(&t2) * 1000000 + fftime_usec(&t2);
+
+		if (buf + n != ffs_finds(buf, n, FFSTR("Connection: close"))) {
+			ffskt_close(sk);
+			sk = cl_connect();
+			b->reconnects++;
+		}
+	}
+
+end:
+	ffskt_close(sk);
+	return 0;
+}
+
+static int lat_cmp(const void *a, const void *b, void *udata)
+{
+	uint i1 = *(uint*)a, i2 = *(uint*)b;
+	return (i1 > i2) - (i1 < i2);
+}
+
+/** Load test: BENCH_CONNS client threads send requests over keep-alive connections.
+Print requests/sec and latency percentiles. */
+int test_http_server_speed(void)
+{
+	FFTEST_FUNC;
+	struct ffhttpsv_conf conf;
+	struct ffhttpsv_stat st;
+	struct bench_cl cl[BENCH_CONNS];
+	fftime start, stop;
+
+	ffhttp_initheaders();
+	sv_start(&conf);
+	x(NULL != (sv = ffhttpsv_create(&conf)));
+	ffskt lsn = sv_listen();
+	x(0 == ffhttpsv_listen(sv, lsn, AF_INET));
+
+	ffatom_set(&bench_stop, 0);
+	ffmem_zero(cl, sizeof(cl));
+	for (uint i = 0;  i != BENCH_CONNS;  i++) {
+		cl[i].lat = ffmem_allocT(BENCH_MAXREQS, uint);
+		cl[i].th = ffthd_create(&bench_client, &cl[i], 0);
+	}
+
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 100);
+	ffkqu_entry ents[64];
+	fftime_now(&start);
+	for (;;) {
+		int n = ffkqu_wait(kq, ents, FFCNT(ents), &tm);
+		for (int i = 0;  i < n;  i++) {
+			ffkev_call(&ents[i]);
+		}
+
+		fftime_now(&stop);
+		fftime_diff(&start, &stop);
+		if (fftime_sec(&stop) >= BENCH_SEC && !ffatom_get(&bench_stop)) {
+			ffatom_set(&bench_stop, 1);
+			ffhttpsv_stat(sv, &st);
+		}
+		if (ffatom_get(&bench_stop)) {
+			ffhttpsv_stat(sv, &st);
+			if (st.conns_active == 0)
+				break;
+		}
+	}
+
+	uint64 total = 0;
+	uint reconnects = 0;
+	for (uint i = 0;  i != BENCH_CONNS;  i++) {
+		ffthd_join(cl[i].th, -1, NULL);
+		x(cl[i].err == 0);
+		total += cl[i].nreqs;
+		reconnects += cl[i].reconnects;
+	}
+
+	uint *lat = ffmem_allocT(total, uint);
+	uint64 k = 0;
+	for (uint i = 0;  i != BENCH_CONNS;  i++) {
+		ffmemcpy(lat + k, cl[i].lat, cl[i].nreqs * sizeof(uint));
+		k += cl[i].nreqs;
+		ffmem_free(cl[i].lat);
+	}
+	ffsort(lat, total, sizeof(uint), &lat_cmp, NULL);
+
+	uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "%u connections: %U requests in %Ums: %U req/sec;  latency p50:%uus  p99:%uus  max:%uus\n"
+		, BENCH_CONNS, total, us / 1000, total * 1000000 / ffmax(us, 1)
+		, lat[total / 2], lat[total * 99 / 100], lat[total - 1]);
+	fffile_fmt(ffstdout, NULL, "server: connections:%U  requests:%U  keep-alive:%U  buffers used:%u free:%u\n"
+		, st.conns, st.reqs, st.keepalive_reqs, st.bufs_used, st.bufs_free);
+	x(st.reqs == total);
+	x(st.conns == BENCH_CONNS + reconnects);
+	ffmem_free(lat);
+
+	sv_stop(lsn);
+	ffhttp_freeheaders();
+	return 0;
+}
@@ -3,7 +3,10 @@ Copyright (c) 2013 Simon Zolin
 */
 
 #include <FFOS/test.h>
+#include <FFOS/random.h>
 #include <FF/net/http.h>
+#include <FF/net/http-range.h>
+#include <FF/time.h>
 
 #define x FFTEST_BOOL
 
@@ -449,6 +452,128 @@ static int test_chunked()
 	return 0;
 }
 
+/** Encode data with chunks of size 1..'chunk';  'fuzz': add extensions, LF line endings and trailers. */
+static void chnk_encode(ffarr *dst, const char *d, size_t len, uint chunk, int fuzz)
+{
+	size_t off = 0;
+	while (off != len) {
+		size_t n = (fuzz) ? 1 + ffrnd_get() % chunk : chunk;
+		n = ffmin(len - off, n);
+		ffstr_catfmt(dst, "%xU", (uint64)n);
+		if (fuzz && ffrnd_get() % 8 == 0)
+			ffstr_catfmt(dst, ";ext=%u", n);
+		ffstr_catfmt(dst, (fuzz && ffrnd_get() % 4 == 0) ? "\n" : "\r\n");
+		ffarr_append(dst, d + off, n);
+		ffstr_catfmt(dst, (fuzz && ffrnd_get() % 4 == 0) ? "\n" : "\r\n");
+		off += n;
+	}
+	ffstr_catfmt(dst, "0\r\n");
+	if (fuzz && ffrnd_get() % 2)
+		ffstr_catfmt(dst, "Trailer: val\r\n");
+	ffstr_catfmt(dst, "\r\n");
+}
+
+/** Parse chunked data split into random parts with ffhttp_chunkparse_v(). */
+static int chnk_parse_v(const ffarr *in, ffarr *out, uint split)
+{
+	ffhttp_chunked c;
+	ffiovec iov[8];
+	size_t off = 0;
+	ffhttp_chunkinit(&c);
+	out->len = 0;
+
+	for (;;) {
+		size_t k = 1 + ffrnd_get() % split;
+		k = ffmin(in->len - off, k);
+		size_t n = k;
+		uint niov = 1 + ffrnd_get() % FFCNT(iov);
+		int r = ffhttp_chunkparse_v(&c, in->ptr + off, &n, iov, &niov);
+		for (uint i = 0;  i != niov;  i++) {
+			ffarr_append(out, iov[i].iov_base, iov[i].iov_len);
+		}
+		off += n;
+		if (r == FFHTTP_DONE)
+			return 0;
+		if (r == FFHTTP_MORE)
+			x(n == k);
+		else if (r != FFHTTP_OK)
+			return r;
+		if (off == in->len)
+			return -1;
+	}
+}
+
+static int test_chunked_v()
+{
+	ffarr d = {}, enc = {}, out = {};
+	ffhttp_chunked c;
+	ffiovec iov[4];
+	size_t n;
+	uint niov;
+
+	ffhttp_chunkinit(&c);
+	n = FFSLEN("3\r\nabc\r\n1\nd\n2;ext\r\nef\r\n0\r\n\r\n");
+	niov = FFCNT(iov);
+	x(FFHTTP_OK == ffhttp_chunkparse_v(&c, "3\r\nabc\r\n1\nd\n2;ext\r\nef\r\n0\r\n\r\n", &n, iov, &niov));
+	x(niov == 3 && n == FFSLEN("3\r\nabc\r\n1\nd\n2;ext\r\nef\r\n0\r\n"));
+	x(ffs_eqcz(iov[0].iov_base, iov[0].iov_len, "abc"));
+	x(ffs_eqcz(iov[1].iov_base, iov[1].iov_len, "d"));
+	x(ffs_eqcz(iov[2].iov_base, iov[2].iov_len, "ef"));
+	// no space for output data in the trailer state:  'iov' isn't used
+	ffiov_set(&iov[0], NULL, 0);
+	niov = 0;
+	n = 2;
+	x(FFHTTP_MORE == ffhttp_chunkparse_v(&c, "\r\n", &n, iov, &niov) && niov == 0 && n == 0);
+	x(iov[0].iov_base == NULL);
+	niov = FFCNT(iov);
+	n = 2;
+	x(FFHTTP_DONE == ffhttp_chunkparse_v(&c, "\r\n", &n, iov, &niov) && niov == 0 && n == 2);
+
+	// data is returned before the error
+	ffhttp_chunkinit(&c);
+	n = FFSLEN("1\r\na\r\nx");
+	niov = FFCNT(iov);
+	x(FFHTTP_OK == ffhttp_chunkparse_v(&c, "1\r\na\r\nx", &n, iov, &niov) && niov == 1);
+	n = FFSLEN("x");
+	niov = FFCNT(iov);
+	x(FFHTTP_EHDRVAL == ffhttp_chunkparse_v(&c, "x", &n, iov, &niov) && niov == 0);
+
+	// the same result as ffhttp_chunkparse() for any input split
+	ffarr_alloc(&d, 64 * 1024);
+	for (uint i = 0;  i != d.cap;  i++) {
+		d.ptr[i] = ffrnd_get();
+	}
+	d.len = d.cap;
+	static const uint chunks[] = { 1, 5, 20, 300, 70000 };
+	for (uint i = 0;  i != 200;  i++) {
+		enc.len = 0;
+		size_t len = ffrnd_get() % d.len;
+		chnk_encode(&enc, d.ptr, len, chunks[i % FFCNT(chunks)], 1);
+		x(0 == chnk_parse_v(&enc, &out, (i & 1) ? 7 : 100000));
+		x(out.len == len && !ffmemcmp(out.ptr, d.ptr, len));
+	}
+
+	// encoder
+	char hdr[FFHTTP_CHUNKHDR_MAX];
+	ffiovec data[3], o[5];
+	ffiov_set(&data[0], "abc", 3);
+	ffiov_set(&data[1], "", 0);
+	ffiov_set(&data[2], "0123456789abcdef", 16);
+	x(4 == ffhttp_chunkv(hdr, data, 3, o, FFHTTP_CHUNKFIN));
+	x(ffs_eqcz(o[0].iov_base, o[0].iov_len, "13\r\n"));
+	x(o[2].iov_len == 16 && ffs_eqcz(o[3].iov_base, o[3].iov_len, "\r\n"));
+	x(4 == ffhttp_chunkv(hdr, data, 3, o, FFHTTP_CHUNKLAST));
+	x(ffs_eqcz(o[3].iov_base, o[3].iov_len, "\r\n0\r\n\r\n"));
+	x(0 == ffhttp_chunkv(hdr, data, 0, o, FFHTTP_CHUNKFIN));
+	x(1 == ffhttp_chunkv(hdr, data + 1, 1, o, FFHTTP_CHUNKLAST));
+	x(ffs_eqcz(o[0].iov_base, o[0].iov_len, "0\r\n\r\n"));
+
+	ffarr_free(&d);
+	ffarr_free(&enc);
+	ffarr_free(&out);
+	return 0;
+}
+
 static int test_condnl()
 {
 	ffstr ifnonmatch;
@@ -483,6 +608,115 @@ static int test_range()
 	return 0;
 }
 
+static int test_ranges()
+{
+	ffhttp_ranges r;
+	const ffhttp_range_part *p;
+	ffhttp_ranges_init(&r);
+
+	// sort, coalesce overlapping and close ranges, skip unsatisfiable
+	r.coalesce_gap = 0;
+	x(FFHTTP_RANGE_OK == ffhttp_ranges_parse(&r, FFSTR("bytes=40-,0-9, 5-19,100-,-5,30-31"), 50));
+	x(ffhttp_ranges_n(&r) == 3);
+	p = (void*)r.parts.ptr;
+	x(p[0].off == 0 && p[0].len == 20);
+	x(p[1].off == 30 && p[1].len == 2);
+	x(p[2].off == 40 && p[2].len == 10);
+
+	r.coalesce_gap = 10;
+	x(FFHTTP_RANGE_OK == ffhttp_ranges_parse(&r, FFSTR("bytes=0-9,20-29,45-"), 50));
+	x(ffhttp_ranges_n(&r) == 2);
+	p = (void*)r.parts.ptr;
+	x(p[0].off == 0 && p[0].len == 30);
+	x(p[1].off == 45 && p[1].len == 5);
+
+	x(FFHTTP_RANGE_OK == ffhttp_ranges_parse(&r, FFSTR("bytes=-100"), 50));
+	p = (void*)r.parts.ptr;
+	x(ffhttp_ranges_n(&r) == 1 && p[0].off == 0 && p[0].len == 50);
+
+	x(FFHTTP_RANGE_IGNORE == ffhttp_ranges_parse(&r, FFSTR("bytes=5-2"), 50));
+	x(FFHTTP_RANGE_IGNORE == ffhttp_ranges_parse(&r, FFSTR("bytes=1-2,x"), 50));
+	x(FFHTTP_RANGE_IGNORE == ffhttp_ranges_parse(&r, FFSTR("items=0-1"), 50));
+	x(FFHTTP_RANGE_IGNORE == ffhttp_ranges_parse(&r, FFSTR("bytes="), 50));
+	r.max_ranges = 2;
+	x(FFHTTP_RANGE_IGNORE == ffhttp_ranges_parse(&r, FFSTR("bytes=0-1,3-4,6-7"), 50));
+	r.max_ranges = 100;
+	x(FFHTTP_RANGE_UNSATISFIABLE == ffhttp_ranges_parse(&r, FFSTR("bytes=50-,-0"), 50));
+
+	ffhttp_cook c;
+	ffstr ct;
+	ffstr_setz(&ct, "text/plain");
+
+	// 416
+	ffhttp_cookinit(&c, NULL, 0);
+	x(0 == ffhttp_ranges_resp(&r, &c, &ct));
+	x(c.code == 416 && c.cont_len == 0);
+	x(ffstr_eqcz(&c.buf, "Content-Range: bytes */50" FFCRLF));
+	ffhttp_cookdestroy(&c);
+
+	// 1 part
+	const char *data = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMN";
+	ffiovec iov[2 * 3 + 1];
+	ffarr body = {0};
+	x(FFHTTP_RANGE_OK == ffhttp_ranges_parse(&r, FFSTR("bytes=10-19"), 50));
+	ffhttp_cookinit(&c, NULL, 0);
+	x(0 == ffhttp_ranges_resp(&r, &c, &ct));
+	x(c.code == 206 && c.cont_len == 10 && ffstr_eqz(&c.cont_type, "text/plain"));
+	x(ffstr_eqcz(&c.buf, "Content-Range: bytes 10-19/50" FFCRLF));
+	ffhttp_cookdestroy(&c);
+	x(1 == ffhttp_ranges_iov(&r, data, iov));
+	x(iov[0].iov_len == 10 && !ffmemcmp(iov[0].iov_base, "abcdefghij", 10));
+
+	// N parts
+	r.coalesce_gap = 0;
+	x(FFHTTP_RANGE_OK == ffhttp_ranges_parse(&r, FFSTR("bytes=-2,0-1,10-11"), 50));
+	ffhttp_cookinit(&c, NULL, 0);
+	x(0 == ffhttp_ranges_resp(&r, &c, &ct));
+	x(c.code == 206 && c.cont_len == r.body_len);
+
+	char exp[1024];
+	const char *b = r.boundary;
+	size_t n = ffs_fmt(exp, exp + sizeof(exp),
+		"--%*s\r\nContent-Type: text/plain\r\nContent-Range: bytes 0-1/50\r\n\r\n01"
+		"\r\n--%*s\r\nContent-Type: text/plain\r\nContent-Range: bytes 10-11/50\r\n\r\nab"
+		"\r\n--%*s\r\nContent-Type: text/plain\r\nContent-Range: bytes 48-49/50\r\n\r\nMN"
+		"\r\n--%*s--\r\n"
+		, (size_t)16, b, (size_t)16, b, (size_t)16, b, (size_t)16, b);
+	x(c.cont_type.len == FFSLEN("multipart/byteranges; boundary=") + 16
+		&& ffs_matchz(c.cont_type.ptr, c.cont_type.len, "multipart/byteranges; boundary=")
+		&& !ffmemcmp(c.cont_type.ptr + c.cont_type.len - 16, b, 16));
+	x(c.buf.len == 0);
+	ffhttp_cookdestroy(&c);
+
+	uint k = ffhttp_ranges_iov(&r, data, iov);
+	x(k == FFCNT(iov));
+	for (uint i = 0;  i != k;  i++) {
+		ffarr_append(&body, iov[i].iov_base, iov[i].iov_len);
+	}
+	x(body.len == r.body_len && body.len == n && !ffmemcmp(body.ptr, exp, n));
+
+	// N parts from file: part header is in sf_hdtr, the closing boundary is in the trailers of the last part
+	ffsf sf, part;
+	ffsf_init(&sf);
+	fffile_mapset(&sf.fm, 64 * 1024, FF_BADFD, 0, 50);
+	body.len = 0;
+	k = 0;
+	while (0 != ffhttp_ranges_next(&r, &sf, &part)) {
+		x(part.ht.hdr_cnt == 1);
+		ffarr_append(&body, part.ht.headers[0].iov_base, part.ht.headers[0].iov_len);
+		ffarr_append(&body, data + part.fm.foff, part.fm.fsize);
+		if (part.ht.trl_cnt != 0)
+			ffarr_append(&body, part.ht.trailers[0].iov_base, part.ht.trailers[0].iov_len);
+		k++;
+	}
+	x(k == 3);
+	x(body.len == n && !ffmemcmp(body.ptr, exp, n));
+
+	ffarr_free(&body);
+	ffhttp_ranges_free(&r);
+	return 0;
+}
+
 int test_http()
 {
 	FFTEST_FUNC;
@@ -494,9 +728,109 @@ int test_http()
 	test_findhdr();
 	test_cook();
 	test_chunked();
+	test_chunked_v();
 	test_range();
+	test_ranges();
 	test_condnl();
 
 	ffhttp_freeheaders();
 	return 0;
 }
+
+/** Parse chunked body with 1-byte, 100-byte and 64KB chunks: ffhttp_chunkparse() vs ffhttp_chunkparse_v().
+Encode 64KB buffers as chunks: ffhttp_chunkbegin() per buffer vs ffhttp_chunkv() */
+int test_http_chunked_speed(void)
+{
+	FFTEST_FUNC;
+	enum { LEN = 16 * 1024 * 1024 };
+	static const uint chunks[] = { 1, 100, 64 * 1024 };
+	ffarr d = {}, enc = {};
+	fftime start, stop;
+	uint64 us, total = 0;
+	const uint *chunk;
+
+	ffarr_alloc(&d, LEN);
+	ffmem_fill(d.ptr, 'a', LEN);
+	d.len = LEN;
+
+	FFARRS_FOREACH(chunks, chunk) {
+		enc.len = 0;
+		chnk_encode(&enc, d.ptr, (*chunk == 1) ? LEN / 8 : LEN, *chunk, 0);
+
+		for (uint k = 0;  k != 2;  k++) {
+			ffhttp_chunked c;
+			ffiovec iov[64];
+			ffstr in, out;
+			int r;
+			total = 0;
+			ffhttp_chunkinit(&c);
+			ffstr_set2(&in, &enc);
+			fftime_now(&start);
+			if (k == 0) {
+				do {
+					r = ffhttp_chunkparse_str(&c, &in, &out);
+					if (r == FFHTTP_OK)
+						total += out.len;
+				} while (r == FFHTTP_OK);
+			} else {
+				do {
+					size_t n = in.len;
+					uint niov = FFCNT(iov);
+					r = ffhttp_chunkparse_v(&c, in.ptr, &n, iov, &niov);
+					ffstr_shift(&in, n);
+					for (uint i = 0;  i != niov;  i++) {
+						total += iov[i].iov_len;
+					}
+				} while (r == FFHTTP_OK);
+			}
+			fftime_now(&stop);
+			fftime_diff(&start, &stop);
+			us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+			x(r == FFHTTP_DONE);
+			x(total == ((*chunk == 1) ? LEN / 8 : LEN));
+			fffile_fmt(ffstdout, NULL, "%s: %u-byte chunks: %U bytes in %Uus: %U MB/sec\n"
+				, (k == 0) ? "ffhttp_chunkparse" : "ffhttp_chunkparse_v", *chunk
+				, (uint64)enc.len, us, (uint64)enc.len / ffmax(us, 1));
+		}
+	}
+
+	{
+	enum { N = 64, BUF = 64 * 1024, ROUNDS = 100000 };
+	char hdr[FFHTTP_CHUNKHDR_MAX];
+	ffiovec data[N], out[N * 2 + 1];
+	uint64 r = 0;
+	for (uint i = 0;  i != N;  i++) {
+		ffiov_set(&data[i], d.ptr, BUF);
+	}
+
+	for (uint k = 0;  k != 2;  k++) {
+		fftime_now(&start);
+		for (uint i = 0;  i != ROUNDS;  i++) {
+			if (k == 0) {
+				// a chunk for each buffer
+				const char *e;
+				uint n = 0;
+				for (uint j = 0;  j != N;  j++) {
+					ffiov_set(&out[n++], hdr, ffhttp_chunkbegin(hdr, sizeof(hdr), data[j].iov_len));
+					out[n++] = data[j];
+				}
+				ffiov_set(&out[n++], e, ffhttp_chunkfin(&e, FFHTTP_CHUNKFIN));
+				r += n;
+			} else {
+				r += ffhttp_chunkv(hdr, data, N, out, FFHTTP_CHUNKFIN);
+			}
+		}
+		fftime_now(&stop);
+		fftime_diff(&start, &stop);
+		us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+		fffile_fmt(ffstdout, NULL, "%s: %u x %u-byte buffers: %U frames/sec, %U iovec elements\n"
+			, (k == 0) ? "ffhttp_chunkbegin" : "ffhttp_chunkv", N, BUF
+			, (uint64)ROUNDS * 1000000 / ffmax(us, 1), r / ROUNDS);
+		r = 0;
+	}
+	}
+
+	ffarr_free(&d);
+	ffarr_free(&enc);
+	return 0;
+}
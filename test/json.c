@@ -6,6 +6,10 @@ Copyright (c) 2013 Simon Zolin
 #include <FFOS/file.h>
 #include <FFOS/process.h>
 #include <FF/data/json.h>
+#include <FF/data/json-tape.h>
+#include <FF/time.h>
+#include <FFOS/random.h>
+#include <math.h>
 #define TEST_JSON_SCHEME
 #include "schem.h"
 #include "all.h"
@@ -334,11 +338,579 @@ static int test_json_cook()
 
 	x(js.buf.cap == FFSLEN("{\"key1\":,\"key2\":\"my string\"}") + FFINT_MAXCHARS + 1);
 	x(ffstr_eqcz(&js.buf, "{\"key1\":123456789123456789,\"key2\":\"my string\"}"));
+
+	// the data is added to the free space of the buffer
+	size_t cap = js.buf.cap;
+	ffjson_cookreset(&js);
+	double f[] = { 0.1, -2.5, 1e30, 1.0 / 3 };
+	x(FFJSON_OK == ffjson_bufadd(&js, FFJSON_TARR, FFJSON_CTXOPEN));
+	for (uint i = 0;  i != FFCNT(f);  i++) {
+		x(FFJSON_OK == ffjson_bufadd(&js, FFJSON_FFLOAT, &f[i]));
+	}
+	x(FFJSON_OK == ffjson_bufadd(&js, FFJSON_TARR, FFJSON_CTXCLOSE));
+	x(js.buf.cap == cap);
+	x(ffstr_eqcz(&js.buf, "[0.1,-2.5,1e30,0.3333333333333333]"));
+
+	// non-finite values
+	ffjson_cookreset(&js);
+	double nf[] = { NAN, INFINITY, -INFINITY };
+	x(FFJSON_OK == ffjson_bufadd(&js, FFJSON_TARR, FFJSON_CTXOPEN));
+	for (uint i = 0;  i != FFCNT(nf);  i++) {
+		x(FFJSON_OK == ffjson_bufadd(&js, FFJSON_FFLOAT, &nf[i]));
+	}
+	x(FFJSON_OK == ffjson_bufadd(&js, FFJSON_TARR, FFJSON_CTXCLOSE));
+	x(ffstr_eqcz(&js.buf, "[null,null,null]"));
+
+	// long strings: the characters to escape are at the bounds of 16-byte blocks
+	ffjson_cookreset(&js);
+	ffstr_setcz(&s, "\"0123456789abcd\\\n0123456789abcdef\x01\x7f" "0123456789abcdef0123456789abcdef\t");
+	x(FFJSON_OK == ffjson_bufadd(&js, FFJSON_TSTR, &s));
+	x(ffstr_eqcz(&js.buf, "\"\\\"0123456789abcd\\\\\\n0123456789abcdef\\u0001\\u007F"
+		"0123456789abcdef0123456789abcdef\\t\""));
+	x(js.buf.cap > cap);
 	ffjson_cookfinbuf(&js);
 
 	return 0;
 }
 
+/** Convert the tape to text with ffjson_cook, as test_json_parse() does. */
+static void tape_cook(const ffjson_tape *t, ffjson_cook *ck)
+{
+	for (size_t i = 0;  i != t->tape.len;  ) {
+		uint type = ffjson_tape_type(t, i);
+		ffstr v;
+		int64 n;
+
+		if (ffjson_tape_isclose(t, i)) {
+			ffjson_bufadd(ck, type, FFJSON_CTXCLOSE);
+			i++;
+			continue;
+		}
+
+		switch (type) {
+		case FFJSON_TOBJ:
+		case FFJSON_TARR:
+			ffjson_bufadd(ck, type, FFJSON_CTXOPEN);
+			i++;
+			continue;
+
+		case FFJSON_TSTR:
+			v = ffjson_tape_str(t, i);
+			ffjson_bufadd(ck, FFJSON_TSTR, &v);
+			break;
+		case FFJSON_TINT:
+			n = ffjson_tape_int(t, i);
+			ffjson_bufadd(ck, type, &n);
+			break;
+		case FFJSON_TBOOL:
+			ffjson_bufadd(ck, type, ffjson_tape_bool(t, i) ? (void*)1 : NULL);
+			break;
+		default:
+			v = ffjson_tape_raw(t, i);
+			ffjson_bufadd(ck, type, &v);
+		}
+		i = ffjson_tape_next(t, i);
+	}
+}
+
+/** Get the events from ffjson_parse() in text form.
+Return 0 if the document is complete and valid. */
+static int json_events(const char *d, size_t len, ffarr *ev)
+{
+	ffjson js;
+	ffstr in;
+	int r = 0, depth = 0, done = 0;
+	uint fin = 0;
+
+	ffjson_parseinit(&js);
+	ffstr_set(&in, d, len);
+	for (;;) {
+		if (in.len == 0) {
+			if (fin++)
+				break;
+			ffstr_setcz(&in, " "); // complete a bare value at the end of data
+		}
+
+		r = ffjson_parsestr(&js, &in);
+		if (ffpars_iserr(r))
+			break;
+
+		switch (r) {
+		case FFPARS_OPEN:
+			ffstr_catfmt(ev, "O%u ", js.type);
+			depth++;
+			break;
+		case FFPARS_CLOSE:
+			ffstr_catfmt(ev, "C%u ", js.type);
+			done = (--depth == 0);
+			break;
+		case FFPARS_KEY:
+			ffstr_catfmt(ev, "K%S ", &js.val);
+			break;
+		case FFPARS_VAL:
+			if (js.type == FFJSON_TSTR)
+				ffstr_catfmt(ev, "S%S ", &js.val);
+			else if (js.type == FFJSON_TINT || js.type == FFJSON_TNUM)
+				ffstr_catfmt(ev, "I%u:%xU ", js.type, js.intval);
+			else
+				ffstr_catfmt(ev, "B%u:%U ", js.type, js.intval);
+			done = (depth == 0);
+			break;
+		}
+	}
+
+	ffjson_parseclose(&js);
+	if (ffpars_iserr(r))
+		return r;
+	return (done && depth == 0) ? 0 : FFPARS_ENOVAL;
+}
+
+static void tape_events(const ffjson_tape *t, ffarr *ev)
+{
+	for (size_t i = 0;  i != t->tape.len;  ) {
+		uint type = ffjson_tape_type(t, i);
+		ffstr v;
+
+		if (ffjson_tape_isclose(t, i)) {
+			ffstr_catfmt(ev, "C%u ", type);
+			i++;
+			continue;
+		}
+
+		switch (type) {
+		case FFJSON_TOBJ:
+		case FFJSON_TARR:
+			ffstr_catfmt(ev, "O%u ", type);
+			i++;
+			continue;
+		case FFJSON_TSTR:
+			v = ffjson_tape_str(t, i);
+			ffstr_catfmt(ev, "%c%S ", ffjson_tape_iskey(t, i) ? 'K' : 'S', &v);
+			break;
+		case FFJSON_TINT:
+		case FFJSON_TNUM:
+			ffstr_catfmt(ev, "I%u:%xU ", type, ffjson_tape_int(t, i));
+			break;
+		default:
+			ffstr_catfmt(ev, "B%u:%U ", type, (int64)((type == FFJSON_TBOOL) ? ffjson_tape_bool(t, i) : 0));
+		}
+		i = ffjson_tape_next(t, i);
+	}
+}
+
+static void gen_ws(ffarr *a)
+{
+	static const char *const ws[] = { "", "", "", " ", "\t", "\r\n", "\n\t\t", "/* c */", "//c\n" };
+	ffstr_catfmt(a, "%s", ws[ffrnd_get() % FFCNT(ws)]);
+}
+
+/** Generate random JSON value. */
+static void gen_val(ffarr *a, uint depth)
+{
+	static const char *const strs[] = { "a", "key", "\\\"", "\\\\", "\\\\\\\\\\\\\\\"", "\\n\\t", "\\u0444", "\\uD83D\\uDE02"
+		, "\xd1\x8f", "\\/", "                                                       ", ":,{}[]" };
+	static const char *const words[] = { "true", "false", "null", "0", "-1", "123.456e-5", "9223372036854775807", "-12345678901234567890", "1e10" };
+	uint n, t = ffrnd_get() % ((depth < 5) ? 5 : 3);
+
+	switch (t) {
+	case 0:
+		n = ffrnd_get() % 4;
+		ffstr_catfmt(a, "\"");
+		for (uint i = 0;  i != n;  i++) {
+			ffstr_catfmt(a, "%s", strs[ffrnd_get() % FFCNT(strs)]);
+		}
+		ffstr_catfmt(a, "\"");
+		break;
+
+	case 1:
+		ffstr_catfmt(a, "%s", words[ffrnd_get() % FFCNT(words)]);
+		break;
+
+	case 2:
+		ffstr_catfmt(a, "%D", (int64)ffrnd_get() - 0x7fffffff);
+		break;
+
+	case 3:
+		ffstr_catfmt(a, "[");
+		n = ffrnd_get() % 5;
+		for (uint i = 0;  i != n;  i++) {
+			gen_ws(a);
+			gen_val(a, depth + 1);
+			gen_ws(a);
+			if (i + 1 != n)
+				ffstr_catfmt(a, ",");
+		}
+		ffstr_catfmt(a, "]");
+		break;
+
+	case 4:
+		ffstr_catfmt(a, "{");
+		n = ffrnd_get() % 5;
+		for (uint i = 0;  i != n;  i++) {
+			gen_ws(a);
+			ffstr_catfmt(a, "\"%s\"", strs[ffrnd_get() % FFCNT(strs)]);
+			gen_ws(a);
+			ffstr_catfmt(a, ":");
+			gen_ws(a);
+			gen_val(a, depth + 1);
+			gen_ws(a);
+			if (i + 1 != n)
+				ffstr_catfmt(a, ",");
+		}
+		ffstr_catfmt(a, "}");
+		break;
+	}
+}
+
+/** Compare the results of ffjson_tape_parse() and ffjson_parse() on one document.
+Return 1 if the document is valid;  0 if it's invalid;  -1 if the results differ. */
+static int tape_cmp(ffjson_tape *t, const char *data, size_t len, ffarr *ev1, ffarr *ev2)
+{
+	ev1->len = ev2->len = 0;
+	int r1 = json_events(data, len, ev1);
+	int r2 = ffjson_tape_parse(t, data, len);
+	if (!x((r1 == 0) == (r2 == 0))) {
+		fffile_fmt(ffstdout, NULL, "ffjson_parse: %d  ffjson_tape_parse: %d  data: %*s\n"
+			, r1, r2, len, data);
+		return -1;
+	}
+	if (r1 != 0)
+		return 0;
+	tape_events(t, ev2);
+	if (!x(ffstr_eq2(ev1, ev2))) {
+		fffile_fmt(ffstdout, NULL, "data: %*s\nffjson_parse: %*s\nffjson_tape_parse: %*s\n"
+			, len, data, ev1->len, ev1->ptr, ev2->len, ev2->ptr);
+		return -1;
+	}
+	return 1;
+}
+
+/** Compare the results of ffjson_tape_parse() and ffjson_parse() on random documents and their corrupted copies. */
+static void test_json_tape_fuzz(ffjson_tape *t)
+{
+	static const char mut[] = "\"\\{}[]:, \n1ae-t";
+	static const ffstr edge[] = {
+		FFSTR_INIT("[\0]"), FFSTR_INIT("\0"), FFSTR_INIT("[1,\0]"), FFSTR_INIT("{\"a\":\0}"),
+		FFSTR_INIT("[-]"), FFSTR_INIT("[-\0]"),
+	};
+	ffarr d = {}, ev1 = {}, ev2 = {};
+	uint nvalid = 0;
+
+	for (uint k = 0;  k != FFCNT(edge);  k++) {
+		x(0 == tape_cmp(t, edge[k].ptr, edge[k].len, &ev1, &ev2));
+	}
+
+	for (uint k = 0;  k != 20000;  k++) {
+		d.len = 0;
+		gen_ws(&d);
+		gen_val(&d, 0);
+		gen_ws(&d);
+
+		if (k % 2) {
+			// corrupt 1..3 bytes (comments are left intact)
+			uint n = ffrnd_get() % 3 + 1;
+			for (uint i = 0;  i != n && d.len != 0;  i++) {
+				char *c = d.ptr + ffrnd_get() % d.len;
+				if (*c != '/' && *c != '*')
+					*c = mut[ffrnd_get() % FFSLEN(mut)];
+			}
+		}
+
+		int r = tape_cmp(t, d.ptr, d.len, &ev1, &ev2);
+		if (r < 0)
+			break;
+		nvalid += r;
+	}
+	x(nvalid > 10000);
+
+	ffarr_free(&d);
+	ffarr_free(&ev1);
+	ffarr_free(&ev2);
+}
+
+/* Objects with many keys: the key index of an argument list */
+enum { WIDE_N = 128 };
+struct wide_s {
+	int64 v[WIDE_N];
+	uint nother;
+	uint nobj;
+};
+static char wide_names[WIDE_N][8];
+static ffpars_arg wide_args[WIDE_N + 2];
+
+static int wide_other(ffparser_schem *ps, void *obj, const int64 *val)
+{
+	struct wide_s *w = obj;
+	w->nother++;
+	return 0;
+}
+
+static int wide_close(ffparser_schem *ps, void *obj)
+{
+	struct wide_s *w = obj;
+	w->nobj++;
+	return 0;
+}
+
+static int wide_obj(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	ffpars_setargs(ctx, obj, wide_args, FFCNT(wide_args));
+	return 0;
+}
+
+static const ffpars_arg wide_arr_args[] = {
+	{ NULL, FFPARS_TOBJ | FFPARS_FMULTI, FFPARS_DST(&wide_obj) },
+};
+
+static int wide_arr(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	ffpars_setargs(ctx, obj, wide_arr_args, FFCNT(wide_arr_args));
+	return 0;
+}
+
+static const ffpars_arg wide_top_args[] = {
+	{ "items", FFPARS_TARR, FFPARS_DST(&wide_arr) },
+};
+
+static int wide_top(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	ffpars_setargs(ctx, obj, wide_top_args, FFCNT(wide_top_args));
+	return 0;
+}
+
+static const ffpars_arg wide_ctx = { NULL, FFPARS_TOBJ, FFPARS_DST(&wide_top) };
+
+/** Prepare the argument list: "k000".."k127", "*", close handler. */
+static void wide_init(void)
+{
+	for (uint i = 0;  i != WIDE_N;  i++) {
+		ffs_fmt(wide_names[i], wide_names[i] + sizeof(wide_names[i]), "k%03u%Z", i);
+		wide_args[i].name = wide_names[i];
+		wide_args[i].flags = FFPARS_TINT64;
+		wide_args[i].dst.off = FFOFF(struct wide_s, v) + i * sizeof(int64);
+	}
+	wide_args[WIDE_N].name = "*";
+	wide_args[WIDE_N].flags = FFPARS_TINT64;
+	wide_args[WIDE_N].dst.f_int = &wide_other;
+	wide_args[WIDE_N + 1].flags = FFPARS_TCLOSE;
+	wide_args[WIDE_N + 1].dst.f_0 = &wide_close;
+}
+
+/** Generate {"items":[{...},...]}:  keys are in different order in each object, 1 unknown key. */
+static void wide_gen(ffarr *d, uint nobj)
+{
+	ffstr_catfmt(d, "{\"items\":[");
+	for (uint j = 0;  j != nobj;  j++) {
+		ffstr_catfmt(d, "%s{", (j != 0) ? "," : "");
+		for (uint k = 0;  k != WIDE_N;  k++) {
+			uint i = (k * 37 + j) % WIDE_N;
+			ffstr_catfmt(d, "\"k%03u\":%u,", i, j * 1000 + i);
+		}
+		ffstr_catfmt(d, "\"other\":0}");
+	}
+	ffstr_catfmt(d, "]}");
+}
+
+static int wide_parse(const char *data, size_t len, struct wide_s *w, uint flags)
+{
+	ffjson js;
+	ffparser_schem ps;
+	int r;
+	ffmem_tzero(w);
+	ffjson_scheminit2(&ps, &js, &wide_ctx, w);
+	ps.flags |= flags;
+	ffstr in;
+	ffstr_set(&in, data, len);
+	while (in.len != 0) {
+		r = ffjson_parsestr(&js, &in);
+		r = ffjson_schemrun(&ps);
+		if (ffpars_iserr(r))
+			goto end;
+	}
+	r = ffjson_schemfin(&ps);
+
+end:
+	ffjson_parseclose(&js);
+	ffpars_schemfree(&ps);
+	return r;
+}
+
+static void test_json_schem_wide(void)
+{
+	FFTEST_FUNC;
+	ffarr d = {};
+	struct wide_s w;
+	wide_init();
+
+	// search in context
+	ffpars_ctx ctx = {};
+	ffarr cache = {};
+	ffpars_setargs(&ctx, NULL, wide_args, FFCNT(wide_args));
+	x(&wide_args[100] == ffpars_ctx_findarg(&ctx, FFSTR("k100"), 0));
+	x(ctx.idx == NULL);
+	ctx.idxcache = &cache;
+	x(&wide_args[100] == ffpars_ctx_findarg(&ctx, FFSTR("k100"), 0));
+	x(ctx.idx != NULL);
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("K100"), 0));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("k10"), 0));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("*"), 0));
+	x(&wide_args[WIDE_N] == ffpars_ctx_findarg(&ctx, FFSTR("K100"), FFPARS_CTX_FANY));
+	x(&wide_args[100] == ffpars_ctx_findarg(&ctx, FFSTR("K100"), FFPARS_CTX_FKEYICASE));
+	x(&wide_args[5] == ffpars_ctx_findarg(&ctx, FFSTR("k005"), FFPARS_CTX_FDUP));
+	x((void*)-1 == ffpars_ctx_findarg(&ctx, FFSTR("k005"), FFPARS_CTX_FDUP));
+	x(cache.len == 2);
+	_ffpars_argidx_free(&cache);
+
+	// scheme
+	wide_gen(&d, 10);
+	x(0 == wide_parse(d.ptr, d.len, &w, 0));
+	for (uint i = 0;  i != WIDE_N;  i++) {
+		x(w.v[i] == 9 * 1000 + i);
+	}
+	x(w.nobj == 10);
+	x(w.nother == 2 * 10); // "*" handler is called for the key and for the value
+
+	x(FFPARS_EDUPKEY == wide_parse(FFSTR("{\"items\":[{\"k010\":1,\"k011\":1,\"k010\":2}]}"), &w, 0));
+
+	x(0 == wide_parse(FFSTR("{\"items\":[{\"K010\":5}]}"), &w, FFPARS_KEYICASE));
+	x(w.v[10] == 5 && w.nother == 0);
+	x(0 == wide_parse(FFSTR("{\"items\":[{\"K010\":5}]}"), &w, 0));
+	x(w.v[10] == 0 && w.nother == 2);
+
+	ffarr_free(&d);
+}
+
+static int test_json_tape(void)
+{
+	ffjson_tape t;
+	ffarr d = {}, out = {};
+	FFTEST_FUNC;
+
+	ffjson_tape_init(&t);
+
+	// all types, escape sequences, comments
+	x(0 == fffile_readall(&d, TESTDATADIR "/test.json", -1));
+	x(0 == ffjson_tape_parse(&t, d.ptr, d.len));
+	ffjson_cook ck;
+	ffjson_cookinit(&ck, NULL, 0);
+	ck.gflags = FFJSON_PRETTY4SPC;
+	tape_cook(&t, &ck);
+	x(0 == fffile_readall(&out, TESTDATADIR "/test-out.json", -1));
+	x(ffstr_eq2(&ck.buf, &out));
+	ffjson_cookfinbuf(&ck);
+
+	// cursor
+	size_t i, o;
+	ffstr s;
+	x(0 != (i = ffjson_tape_find(&t, 0, FFSTR("int"))) && ffjson_tape_int(&t, i) == 7777);
+	x(0 != (o = ffjson_tape_find(&t, 0, FFSTR("obj"))) && ffjson_tape_type(&t, o) == FFJSON_TOBJ);
+	x(0 != (i = ffjson_tape_find(&t, o, FFSTR("str"))));
+	s = ffjson_tape_str(&t, i);
+	x(ffstr_eqz(&s, "my obj string"));
+	x(0 != (i = ffjson_tape_find(&t, o, FFSTR("bool0"))) && !ffjson_tape_bool(&t, i));
+	x(0 == ffjson_tape_find(&t, o, FFSTR("int1")));
+	x(0 != (i = ffjson_tape_find(&t, o, FFSTR("emptyarr"))));
+	x(ffjson_tape_isclose(&t, ffjson_tape_child(&t, i)));
+	x(0 != (i = ffjson_tape_find(&t, 0, FFSTR("arr"))));
+	i = ffjson_tape_child(&t, i);
+	i = ffjson_tape_next(&t, i);
+	s = ffjson_tape_str(&t, i);
+	x(ffstr_eqz(&s, "my arr string"));
+	i = ffjson_tape_next(&t, i);
+	x(ffjson_tape_int(&t, i) == -123);
+	x(ffjson_tape_isclose(&t, ffjson_tape_next(&t, i)));
+
+	// scheme
+	obj_s obj;
+	ffjson js;
+	ffparser_schem ps;
+	ffmem_tzero(&obj);
+	ffjson_scheminit2(&ps, &js, &glob_ctx, &obj);
+	x(0 == fffile_readall(&d, TESTDATADIR "/schem.json", -1));
+	x(0 == ffjson_tape_parse(&t, d.ptr, d.len));
+	x(0 == ffjson_tape_schemrun(&t, &ps));
+	objChk(&obj);
+	x(obj.o[0]->have_objnull);
+	x(obj.arrCloseOk == 1);
+	ffstr_free(&obj.s);
+	ffmem_free(obj.o[0]);
+	ffmem_free(obj.o[1]);
+	ffjson_parseclose(&js);
+	ffpars_schemfree(&ps);
+
+	// errors
+	x(FFPARS_EBADCHAR == ffjson_tape_parse(&t, FFSTR("{,")));
+	x(FFPARS_EBADVAL == ffjson_tape_parse(&t, FFSTR("[123;]")));
+	x(FFPARS_EBADCHAR == ffjson_tape_parse(&t, FFSTR("\"val\n\"")) && t.err_off == 4);
+	x(FFPARS_EBADCHAR == ffjson_tape_parse(&t, FFSTR("\"val\",")));
+	x(FFPARS_EBADCHAR == ffjson_tape_parse(&t, FFSTR("[123],")));
+	x(FFPARS_EBADCHAR == ffjson_tape_parse(&t, FFSTR("[123]]")));
+	x(FFPARS_EKVSEP == ffjson_tape_parse(&t, FFSTR("{\"key\",")));
+	x(FFPARS_ENOVAL == ffjson_tape_parse(&t, FFSTR("{\"key\":,")));
+	x(FFPARS_ENOVAL == ffjson_tape_parse(&t, FFSTR("[1,]")));
+	x(FFPARS_ENOVAL == ffjson_tape_parse(&t, FFSTR(" ")));
+	x(FFPARS_ENOVAL == ffjson_tape_parse(&t, FFSTR("[\0]")));
+	x(FFPARS_EBADVAL == ffjson_tape_parse(&t, FFSTR("truE")));
+	x(FFPARS_EBADVAL == ffjson_tape_parse(&t, FFSTR("\"abc")));
+	x(FFPARS_EESC == ffjson_tape_parse(&t, FFSTR("\"\\1\"")));
+	x(FFPARS_EESC == ffjson_tape_parse(&t, FFSTR("\"\\uD83D\"")));
+	x(FFPARS_EBADBRACE == ffjson_tape_parse(&t, FFSTR("[123}")));
+	x(FFPARS_ENOBRACE == ffjson_tape_parse(&t, FFSTR("{\"a\":[1]")));
+	x(FFPARS_EBADCMT == ffjson_tape_parse(&t, FFSTR(" /z")) && t.err_off == 1);
+	x(FFPARS_EBADCMT == ffjson_tape_parse(&t, FFSTR("[1] /*")));
+	x(0 == ffjson_tape_parse(&t, FFSTR("123456789123456789123456789123456789"))
+		&& ffjson_tape_type(&t, 0) == FFJSON_TNUM);
+
+	test_json_tape_fuzz(&t);
+
+	ffarr_free(&d);
+	ffarr_free(&out);
+	ffjson_tape_free(&t);
+	return 0;
+}
+
+/** Values point to input data unless they have escape sequences or are split between input buffers. */
+static void test_json_borrowed(void)
+{
+	static const char data[] = "{\"key\":\"value\",\"esc\":\"v\\tal\",\"n\":1234}";
+	ffjson js;
+	ffstr d;
+
+	ffjson_parseinit(&js);
+	ffstr_setcz(&d, data);
+	x(FFPARS_OPEN == ffjson_parsestr(&js, &d));
+	x(FFPARS_KEY == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "key") && ffjson_val_borrowed(&js) && js.val.ptr == data + 2);
+	x(FFPARS_VAL == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "value") && ffjson_val_borrowed(&js) && js.val.ptr == data + 8);
+	x(FFPARS_KEY == ffjson_parsestr(&js, &d));
+	x(ffjson_val_borrowed(&js));
+	x(FFPARS_VAL == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "v\tal") && !ffjson_val_borrowed(&js));
+	x(FFPARS_KEY == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "n") && ffjson_val_borrowed(&js));
+	x(FFPARS_VAL == ffjson_parsestr(&js, &d));
+	x(js.type == FFJSON_TINT && js.intval == 1234);
+	x(ffstr_eqcz(&js.val, "1234") && ffjson_val_borrowed(&js));
+	x(FFPARS_CLOSE == ffjson_parsestr(&js, &d));
+	x(d.len == 0);
+
+	// the value is split between 2 buffers
+	ffjson_parsereset(&js);
+	ffstr_set(&d, data, FFSLEN("{\"key\":\"val"));
+	x(FFPARS_OPEN == ffjson_parsestr(&js, &d));
+	x(FFPARS_KEY == ffjson_parsestr(&js, &d));
+	x(FFPARS_MORE == ffjson_parsestr(&js, &d));
+	x(d.len == 0);
+	ffstr_set(&d, data + FFSLEN("{\"key\":\"val"), FFSLEN(data) - FFSLEN("{\"key\":\"val"));
+	x(FFPARS_VAL == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "value") && !ffjson_val_borrowed(&js));
+	x(FFPARS_KEY == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "esc") && ffjson_val_borrowed(&js) && js.val.ptr == data + 16);
+
+	ffjson_parseclose(&js);
+}
+
 int test_json()
 {
 	char buf[16];
@@ -355,5 +927,136 @@ int test_json()
 
 	test_json_generat(TESTDIR "/gen.json");
 	test_json_cook();
+	test_json_tape();
+	test_json_schem_wide();
+	test_json_borrowed();
+	return 0;
+}
+
+static void gen_twitter(ffarr *d, uint n)
+{
+	ffstr_catfmt(d, "{\"statuses\": [");
+	for (uint i = 0;  i != n;  i++) {
+		uint64 id = 505874924095815681ULL + i;
+		ffstr_catfmt(d, "%s\n  {\n    \"metadata\": {\"result_type\": \"recent\", \"iso_language_code\": \"ja\"},\n"
+			"    \"created_at\": \"Sun Aug 31 00:29:15 +0000 2014\",\n"
+			"    \"id\": %U,\n    \"id_str\": \"%U\",\n"
+			"    \"text\": \"@aym0566x \\n\\n\\u540d\\u524d:\\u524d\\u7530\\u3042\\u3086\\u307f\\n\\u7b2c\\u4e00\\u5370\\u8c61:\\u306a\\u3093\\u304b\\u6016\\u3063\\uff01 http:\\/\\/t.co\\/abc #%u\",\n"
+			"    \"source\": \"<a href=\\\"https:\\/\\/mobile.twitter.com\\\" rel=\\\"nofollow\\\">Mobile Web (M2)<\\/a>\",\n"
+			"    \"truncated\": false, \"in_reply_to_status_id\": null, \"in_reply_to_user_id\": %u,\n"
+			"    \"user\": {\n      \"id\": %u, \"name\": \"\xe3\x82\x8a\xe3\x81\x91\xe3\x81\x9f\", \"screen_name\": \"user%u\",\n"
+			"      \"location\": \"\", \"description\": \"Some text about the user, with some length to it.\",\n"
+			"      \"followers_count\": %u, \"friends_count\": 392, \"verified\": false, \"utc_offset\": -36000,\n"
+			"      \"profile_background_color\": \"C0DEED\", \"profile_image_url\": \"http:\\/\\/pbs.twimg.com\\/profile_images\\/%u\\/a.jpeg\"\n    },\n"
+			"    \"geo\": null, \"coordinates\": null, \"retweet_count\": %u, \"favorite_count\": 0,\n"
+			"    \"entities\": {\"hashtags\": [{\"text\": \"tag%u\", \"indices\": [%u, %u]}], \"urls\": [], \"user_mentions\": [{\"screen_name\": \"aym0566x\", \"id\": 1, \"indices\": [0, 9]}]},\n"
+			"    \"favorited\": false, \"retweeted\": false, \"lang\": \"ja\", \"score\": 0.%u\n  }"
+			, (i != 0) ? "," : "", id, id, i, i * 7, i * 13, i, i % 1000, i, i % 100, i, i % 50, i % 50 + 5, i);
+	}
+	ffstr_catfmt(d, "\n],\n\"search_metadata\": {\"completed_in\": 0.087, \"max_id\": 505874924095815681, \"count\": %u}}\n", n);
+}
+
+static void gen_loglines(ffarr *d, uint n)
+{
+	static const char *const lev[] = { "info", "warning", "error", "debug" };
+	for (uint i = 0;  i != n;  i++) {
+		ffstr_catfmt(d, "{\"ts\":\"2019-06-01T12:%02u:%02u.%03uZ\",\"level\":\"%s\",\"msg\":\"request completed\","
+			"\"method\":\"GET\",\"path\":\"/api/v1/items/%u\",\"status\":%u,\"bytes\":%u,\"latency\":0.%03u,"
+			"\"client\":\"10.0.%u.%u\",\"ua\":\"Mozilla/5.0 (X11; Linux x86_64)\",\"tags\":[\"web\",\"prod\"]}\n"
+			, (i / 60) % 60, i % 60, i % 1000, lev[i % 4], i, 200 + (i % 5) * 100, i * 17 % 100000, i % 1000
+			, (i >> 8) & 0xff, i & 0xff);
+	}
+}
+
+/** Parse twitter.json-like document and log lines (one document per line): ffjson_parse() vs ffjson_tape_parse(). */
+int test_json_tape_speed(void)
+{
+	FFTEST_FUNC;
+	enum { ROUNDS = 10 };
+	ffarr d = {};
+	ffjson js;
+	ffjson_tape t;
+	fftime start, stop;
+
+	ffjson_parseinit(&js);
+	ffjson_tape_init(&t);
+
+	for (uint corp = 0;  corp != 2;  corp++) {
+		d.len = 0;
+		if (corp == 0)
+			gen_twitter(&d, 8000);
+		else
+			gen_loglines(&d, 50000);
+
+		for (uint k = 0;  k != 2;  k++) {
+			uint64 nev = 0;
+			fftime_now(&start);
+			for (uint r = 0;  r != ROUNDS;  r++) {
+				ffstr in, line;
+				ffstr_set2(&in, &d);
+				while (in.len != 0) {
+					if (corp == 0)
+						line = in;
+					else
+						ffstr_set(&line, in.ptr, (char*)ffs_findc(in.ptr, in.len, '\n') + 1 - in.ptr);
+					ffstr_shift(&in, line.len);
+
+					if (k == 0) {
+						ffjson_parsereset(&js);
+						while (line.len != 0) {
+							int e = ffjson_parsestr(&js, &line);
+							x(!ffpars_iserr(e));
+							nev += (e != 0);
+						}
+					} else {
+						x(0 == ffjson_tape_parse(&t, line.ptr, line.len));
+						nev += t.tape.len;
+					}
+				}
+			}
+			fftime_now(&stop);
+			fftime_diff(&start, &stop);
+			uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+			fffile_fmt(ffstdout, NULL, "%s: %s: %U bytes in %Uus: %U MB/sec  (%U)\n"
+				, (corp == 0) ? "twitter" : "log lines"
+				, (k == 0) ? "ffjson_parse" : "ffjson_tape_parse"
+				, (uint64)d.len * ROUNDS, us, (uint64)d.len * ROUNDS / ffmax(us, 1), nev / ROUNDS);
+		}
+	}
+
+	ffarr_free(&d);
+	ffjson_parseclose(&js);
+	ffjson_tape_free(&t);
+	return 0;
+}
+
+/** Parse objects with 128 keys with a scheme: case-sensitive and case-insensitive key names. */
+int test_json_schem_speed(void)
+{
+	FFTEST_FUNC;
+	enum { ROUNDS = 10 };
+	ffarr d = {};
+	struct wide_s w;
+	fftime start, stop;
+
+	wide_init();
+	wide_gen(&d, 2000);
+
+	for (uint icase = 0;  icase != 2;  icase++) {
+		fftime_now(&start);
+		for (uint r = 0;  r != ROUNDS;  r++) {
+			x(0 == wide_parse(d.ptr, d.len, &w, (icase) ? FFPARS_KEYICASE : 0));
+		}
+		fftime_now(&stop);
+		fftime_diff(&start, &stop);
+		uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+		x(w.nobj == 2000);
+		uint64 nkeys = (uint64)2000 * (WIDE_N + 1) * ROUNDS;
+		fffile_fmt(ffstdout, NULL, "%s: %U keys in %Uus: %U ns/key\n"
+			, (icase) ? "case-insensitive" : "case-sensitive"
+			, nkeys, us, us * 1000 / nkeys);
+	}
+
+	ffarr_free(&d);
 	return 0;
 }
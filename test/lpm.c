@@ -0,0 +1,381 @@
+/**
+Copyright (c) 2018 Simon Zolin
+*/
+
+#include <FF/net/lpm.h>
+#include <FF/net/proto.h>
+#include <FF/number.h>
+#include <FF/time.h>
+#include <FFOS/random.h>
+#include <FFOS/thread.h>
+#include <FFOS/test.h>
+#include <test/all.h>
+
+#define x FFTEST_BOOL
+
+
+static const char lpm_text[] =
+"# ACL\n"
+"0.0.0.0/0 100\n"
+"10.0.0.0/8 1\n"
+"10.1.0.0/16 2\r\n"
+"10.1.2.0/24 3\n"
+"10.1.2.128/25\t4\n"
+"\n"
+"10.1.2.129 5\n"
+"192.168.1.1/16 6\n" // host bits are ignored
+"10.1.0.0/16 7\n" // overrides the previous value
+"2001:db8::/32 11\n"
+"2001:db8:1::/48 12\n"
+"2001:db8:1:2::1/128 13\n"
+"2001:db8:1:2::/63\n"
+;
+
+static int find4(const fflpm *t, const char *s)
+{
+	ffip4 ip;
+	if (0 != ffip4_parse(&ip, s, ffsz_len(s)))
+		return -2;
+	return fflpm_find4(t, &ip);
+}
+
+static int find6(const fflpm *t, const char *s)
+{
+	ffip6 ip;
+	if (0 != ffip6_parse(&ip, s, ffsz_len(s)))
+		return -2;
+	return fflpm_find6(t, &ip);
+}
+
+static void test_lpm_text(void)
+{
+	fflpm_build b;
+	fflpm *t;
+
+	fflpm_build_init(&b);
+	x(12 == fflpm_build_addtext(&b, lpm_text, FFSLEN(lpm_text), 99));
+	x(NULL != (t = fflpm_create(&b)));
+	fflpm_build_free(&b);
+
+	x(100 == find4(t, "1.2.3.4"));
+	x(1 == find4(t, "10.0.0.1"));
+	x(7 == find4(t, "10.1.0.1"));
+	x(3 == find4(t, "10.1.2.127"));
+	x(4 == find4(t, "10.1.2.128"));
+	x(5 == find4(t, "10.1.2.129"));
+	x(4 == find4(t, "10.1.2.255"));
+	x(7 == find4(t, "10.1.3.0"));
+	x(6 == find4(t, "192.168.255.255"));
+	x(100 == find4(t, "192.169.0.0"));
+
+	x(-1 == find6(t, "::1"));
+	x(11 == find6(t, "2001:db8::1"));
+	x(12 == find6(t, "2001:db8:1:ffff::1"));
+	x(13 == find6(t, "2001:db8:1:2::1"));
+	x(99 == find6(t, "2001:db8:1:2::2"));
+	x(99 == find6(t, "2001:db8:1:3::2"));
+	x(12 == find6(t, "2001:db8:1:4::"));
+	x(-1 == find6(t, "2001:db9::"));
+
+	uint ips[4];
+	int vals[4];
+	ffip4_parse((void*)&ips[0], FFSTR("10.1.2.129"));
+	ffip4_parse((void*)&ips[1], FFSTR("8.8.8.8"));
+	ffip4_parse((void*)&ips[2], FFSTR("10.1.2.200"));
+	ffip4_parse((void*)&ips[3], FFSTR("10.200.0.1"));
+	fflpm_find4_burst(t, ips, vals, 4);
+	x(vals[0] == 5 && vals[1] == 100 && vals[2] == 4 && vals[3] == 1);
+
+	fflpm_free(t);
+
+	fflpm_build_init(&b);
+	x(-2 == fflpm_build_addtext(&b, FFSTR("10.0.0.0/8\n10.0.0.0/33\n"), 0));
+	fflpm_build_free(&b);
+
+	fflpm_build_init(&b);
+	x(-1 == fflpm_build_addtext(&b, FFSTR("10.0.0.0/8 1 2\n"), 0));
+	x(-1 == fflpm_build_addtext(&b, FFSTR("10.0.0/8\n"), 0));
+	x(-1 == fflpm_build_addtext(&b, FFSTR("2001:db8::/129\n"), 0));
+	fflpm_build_free(&b);
+}
+
+
+struct pfx {
+	byte ip[16];
+	uint bits;
+	uint iplen;
+};
+
+static int pfx_match(const struct pfx *p, const byte *ip)
+{
+	uint n = p->bits / 8, rem = p->bits % 8;
+	if (0 != ffmemcmp(p->ip, ip, n))
+		return 0;
+	if (rem != 0 && ((p->ip[n] ^ ip[n]) & (0xff << (8 - rem)) & 0xff))
+		return 0;
+	return 1;
+}
+
+/* Linear search: the longest matching prefix;  the last added wins among equal prefixes */
+static int lpm_ref(const struct pfx *p, uint n, const byte *ip, uint iplen)
+{
+	int r = -1;
+	uint bits = 0;
+	for (uint i = 0;  i != n;  i++) {
+		if (p[i].iplen == iplen && pfx_match(&p[i], ip)
+			&& (r == -1 || p[i].bits >= bits)) {
+			r = i;
+			bits = p[i].bits;
+		}
+	}
+	return r;
+}
+
+static void rnd_addr(byte *ip, uint len, const struct pfx *p, uint np)
+{
+	// half of addresses are near existing prefixes
+	if (np != 0 && (ffrnd_get() & 1)) {
+		const struct pfx *pf = &p[ffrnd_get() % np];
+		ffmemcpy(ip, pf->ip, len);
+		ip[ffrnd_get() % len] ^= 1 << (ffrnd_get() % 8);
+		return;
+	}
+	for (uint i = 0;  i != len;  i++) {
+		ip[i] = ffrnd_get();
+	}
+}
+
+/* Compare with linear search on random prefixes */
+static void test_lpm_rnd(void)
+{
+	enum { N = 2000, NADDR = 50000 };
+	struct pfx *p = ffmem_callocT(N, struct pfx);
+	fflpm_build b;
+	fflpm *t;
+	uint *ips = ffmem_allocT(NADDR, uint);
+	int *vals = ffmem_allocT(NADDR, int);
+
+	fflpm_build_init(&b);
+	for (uint i = 0;  i != N;  i++) {
+		p[i].iplen = (i % 4 == 0) ? 16 : 4;
+		rnd_addr(p[i].ip, p[i].iplen, p, i);
+		p[i].bits = ffrnd_get() % (p[i].iplen * 8 + 1);
+		if (p[i].iplen == 4)
+			x(0 == fflpm_build_add4(&b, p[i].ip, p[i].bits, i));
+		else
+			x(0 == fflpm_build_add6(&b, p[i].ip, p[i].bits, i));
+	}
+	x(NULL != (t = fflpm_create(&b)));
+	fflpm_build_free(&b);
+
+	for (uint i = 0;  i != NADDR;  i++) {
+		byte ip[16];
+		uint iplen = (i % 4 == 0) ? 16 : 4;
+		rnd_addr(ip, iplen, p, N);
+		int r = (iplen == 4) ? fflpm_find4(t, ip) : fflpm_find6(t, ip);
+		x(r == lpm_ref(p, N, ip, iplen));
+		if (iplen == 4)
+			ffmemcpy(&ips[i], ip, 4);
+	}
+
+	// burst lookup gives the same results
+	for (uint i = 0;  i != NADDR;  i++) {
+		if (i % 4 == 0)
+			ips[i] = ips[i + 1];
+	}
+	fflpm_find4_burst(t, ips, vals, NADDR);
+	for (uint i = 0;  i != NADDR;  i++) {
+		x(vals[i] == fflpm_find4(t, &ips[i]));
+	}
+
+	fflpm_free(t);
+	ffmem_free(p);
+	ffmem_free(ips);
+	ffmem_free(vals);
+}
+
+
+enum { NREADERS = 3, NREPLACE = 50 };
+
+struct lpm_shared {
+	fflpm_ptr ptr;
+	ffatomic seen[NREADERS];
+	ffatomic stop;
+	ffatomic idx;
+	uint errors;
+};
+
+static fflpm* lpm_gen(uint gen)
+{
+	fflpm_build b;
+	fflpm *t;
+	char buf[64];
+	fflpm_build_init(&b);
+	size_t n = ffs_fmt2(buf, sizeof(buf), "10.0.0.0/8 %u\n10.1.0.0/16 %u\n", gen, gen);
+	fflpm_build_addtext(&b, buf, n, 0);
+	t = fflpm_create(&b);
+	fflpm_build_free(&b);
+	return t;
+}
+
+static int FFTHDCALL lpm_reader(void *param)
+{
+	struct lpm_shared *s = param;
+	uint i = ffatom_incret(&s->idx) - 1;
+	int last = 0;
+	ffip4 a, a2;
+	ffip4_parse(&a, FFSTR("10.0.0.1"));
+	ffip4_parse(&a2, FFSTR("10.1.0.1"));
+
+	while (!ffatom_get(&s->stop)) {
+		fflpm_ptr_quiesce(&s->ptr, &s->seen[i]);
+		const fflpm *t = fflpm_ptr_get(&s->ptr);
+		for (uint k = 0;  k != 1000;  k++) {
+			int v = fflpm_find4(t, &a), v2 = fflpm_find4(t, &a2);
+			// values are from the same table;  tables are never replaced backwards
+			if (v != v2 || v < last)
+				s->errors++;
+			last = v;
+		}
+	}
+	ffatom_set(&s->seen[i], FFLPM_OFFLINE);
+	return 0;
+}
+
+/* Readers use the table while it's being replaced */
+static void test_lpm_replace(void)
+{
+	struct lpm_shared s = {};
+	ffthd th[NREADERS];
+
+	ffatom_set(&s.ptr.tbl, (size_t)lpm_gen(0));
+	for (uint i = 0;  i != NREADERS;  i++) {
+		th[i] = ffthd_create(&lpm_reader, &s, 0);
+	}
+
+	for (uint gen = 1;  gen <= NREPLACE;  gen++) {
+		fflpm *old = fflpm_ptr_replace(&s.ptr, lpm_gen(gen), s.seen, NREADERS);
+		fflpm_free(old);
+	}
+
+	ffatom_set(&s.stop, 1);
+	for (uint i = 0;  i != NREADERS;  i++) {
+		ffthd_join(th[i], -1, NULL);
+	}
+	x(s.errors == 0);
+	fflpm_free((void*)ffatom_get(&s.ptr.tbl));
+}
+
+int test_lpm(void)
+{
+	FFTEST_FUNC;
+	test_lpm_text();
+	test_lpm_rnd();
+	test_lpm_replace();
+	return 0;
+}
+
+
+/* A BGP-like table: 900K IPv4 prefixes, mostly /24, and 200K IPv6 prefixes /28../48 */
+int test_lpm_speed(void)
+{
+	FFTEST_FUNC;
+	enum { N4 = 900000, N6 = 200000, NADDR = 1 << 20, BURST = 64, LOOPS = 16 };
+	fflpm_build b;
+	fflpm *t;
+	fftime start, stop;
+	uint64 us;
+	byte ip[16];
+
+	fflpm_build_init(&b);
+	for (uint i = 0;  i != N4;  i++) {
+		uint r = ffrnd_get() % 100;
+		uint bits = (r < 55) ? 24 : (r < 90) ? 16 + r % 8 : (r < 97) ? 8 + r % 8 : 25 + r % 8;
+		ffint_hton32(ip, (ffrnd_get() << 8) ^ ffrnd_get());
+		fflpm_build_add4(&b, ip, bits, i);
+	}
+	// IPv6: /32 allocations from a few RIR blocks, /48 sites inside them
+	uint blk6[64];
+	for (uint i = 0;  i != FFCNT(blk6);  i++) {
+		blk6[i] = 0x2001 + ffrnd_get() % 0xc00;
+	}
+	uint alloc6 = 0;
+	ffmem_zero(ip, sizeof(ip));
+	for (uint i = 0;  i != N6;  i++) {
+		if (i % 4 == 0) {
+			alloc6 = (blk6[ffrnd_get() % FFCNT(blk6)] << 16) | (ffrnd_get() & 0xfff0);
+			ffint_hton32(ip, alloc6);
+			ffint_hton32(ip + 4, 0);
+			fflpm_build_add6(&b, ip, 28 + ffrnd_get() % 5, i);
+		} else {
+			ffint_hton32(ip, alloc6 | (ffrnd_get() & 0x0f));
+			ffint_hton32(ip + 4, ffrnd_get() << 16);
+			fflpm_build_add6(&b, ip, (i % 4 == 1) ? 40 + ffrnd_get() % 5 : 48, i);
+		}
+	}
+
+	fftime_now(&start);
+	t = fflpm_create(&b);
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	fflpm_build_free(&b);
+	x(t != NULL);
+	fffile_fmt(ffstdout, NULL, "build: %u IPv4 + %u IPv6 prefixes in %Ums;  memory: %LMB\n"
+		, N4, N6, fftime_ms(&stop), fflpm_memsize(t) / (1024 * 1024));
+
+	uint *ips = ffmem_allocT(NADDR, uint);
+	int *vals = ffmem_allocT(NADDR, int);
+	for (uint i = 0;  i != NADDR;  i++) {
+		ips[i] = (ffrnd_get() << 8) ^ ffrnd_get();
+	}
+
+	uint64 sum = 0;
+	fftime_now(&start);
+	for (uint k = 0;  k != LOOPS;  k++) {
+		for (uint i = 0;  i != NADDR;  i++) {
+			sum += fflpm_find4(t, &ips[i]);
+		}
+	}
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "IPv4 lookup: %U/sec (%U)\n"
+		, (uint64)NADDR * LOOPS * 1000000 / ffmax(us, 1), sum);
+
+	fftime_now(&start);
+	for (uint k = 0;  k != LOOPS;  k++) {
+		for (uint i = 0;  i != NADDR;  i += BURST) {
+			fflpm_find4_burst(t, &ips[i], &vals[i], BURST);
+		}
+	}
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "IPv4 burst lookup: %U/sec\n"
+		, (uint64)NADDR * LOOPS * 1000000 / ffmax(us, 1));
+
+	ffip6 *ip6 = ffmem_allocT(NADDR / 4, ffip6);
+	for (uint i = 0;  i != NADDR / 4;  i++) {
+		ffint_hton32(ip6[i].a, (blk6[ffrnd_get() % FFCNT(blk6)] << 16) | (ffrnd_get() & 0xffff));
+		ffint_hton32(ip6[i].a + 4, ffrnd_get());
+		ffint_hton32(ip6[i].a + 8, ffrnd_get());
+		ffint_hton32(ip6[i].a + 12, ffrnd_get());
+	}
+	fftime_now(&start);
+	for (uint k = 0;  k != LOOPS;  k++) {
+		for (uint i = 0;  i != NADDR / 4;  i++) {
+			sum += fflpm_find6(t, &ip6[i]);
+		}
+	}
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "IPv6 lookup: %U/sec (%U)\n"
+		, (uint64)NADDR / 4 * LOOPS * 1000000 / ffmax(us, 1), sum);
+
+	ffmem_free(ip6);
+	ffmem_free(ips);
+	ffmem_free(vals);
+	fflpm_free(t);
+	return 0;
+}
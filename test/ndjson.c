@@ -0,0 +1,284 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/data/ndjson.h>
+#include <FF/time.h>
+#include <FFOS/file.h>
+#include <FFOS/atomic.h>
+#include <FFOS/test.h>
+#include <test/all.h>
+
+#define x FFTEST_BOOL
+
+
+struct ndj_exp {
+	uint64 off;
+	int id; // -1: invalid line
+};
+
+struct ndj_test {
+	struct ndj_exp *exp;
+	size_t nexp;
+	size_t n;
+	int stop_at;
+	uint threads;
+	ffatomic sum, recs, errs, bad;
+};
+
+/** Generate lines: valid documents, invalid documents, empty lines, CRLF. */
+static void ndj_gen(ffarr *d, ffarr *exp, uint n)
+{
+	struct ndj_exp *e;
+	for (uint i = 0;  i != n;  i++) {
+		if (i % 89 == 3)
+			ffstr_catfmt(d, "\n  \r\n");
+
+		e = ffarr_pushgrowT(exp, 256 | FFARR_GROWQUARTER, struct ndj_exp);
+		e->off = d->len;
+		if (i % 97 == 50) {
+			e->id = -1;
+			ffstr_catfmt(d, "{\"id\":%u,bad}\n", i);
+			continue;
+		}
+		e->id = i;
+		ffstr_catfmt(d, "{\"id\":%u,\"s\":\"x\\ty%u\",\"a\":[1,{\"b\":null}]}%s"
+			, i, i, (i % 2) ? "\r\n" : "\n");
+	}
+}
+
+/** Check the value of 's' field. */
+static int ndj_check_s(const ffjson_tape *t, int id)
+{
+	char buf[64];
+	size_t i = ffjson_tape_find(t, 0, "s", 1);
+	if (i == 0)
+		return 0;
+	ffstr s = ffjson_tape_str(t, i);
+	size_t n = ffs_fmt(buf, buf + sizeof(buf), "x\ty%u", id);
+	return ffstr_eq(&s, buf, n);
+}
+
+static int ndj_ordered(void *udata, const struct ffndjson_rec *r)
+{
+	struct ndj_test *t = udata;
+	if (!x(t->n != t->nexp))
+		return -2;
+	const struct ndj_exp *e = &t->exp[t->n++];
+	x(r->off == e->off);
+	x(r->worker < t->threads);
+
+	if (e->id < 0) {
+		x(r->tape == NULL && r->err != 0);
+		return 0;
+	}
+
+	x(r->err == 0);
+	x(r->line.len != 0 && r->line.ptr[r->line.len - 1] == '}');
+	size_t i = ffjson_tape_find(r->tape, 0, "id", 2);
+	x(i != 0 && ffjson_tape_int(r->tape, i) == e->id);
+	x(ndj_check_s(r->tape, e->id));
+
+	if (e->id == t->stop_at)
+		return 5;
+	return 0;
+}
+
+/** Called from several threads at once. */
+static int ndj_unordered(void *udata, const struct ffndjson_rec *r)
+{
+	struct ndj_test *t = udata;
+	ffatom_inc(&t->recs);
+	if (r->tape == NULL) {
+		ffatom_inc(&t->errs);
+		return 0;
+	}
+
+	size_t i = ffjson_tape_find(r->tape, 0, "id", 2);
+	if (i == 0 || r->worker >= t->threads) {
+		ffatom_inc(&t->bad);
+		return 0;
+	}
+	int id = (int)ffjson_tape_int(r->tape, i);
+	if (!ndj_check_s(r->tape, id))
+		ffatom_inc(&t->bad);
+	ffatom_add(&t->sum, id);
+	return 0;
+}
+
+static void ndj_test_reset(struct ndj_test *t)
+{
+	t->n = 0;
+	ffatom_set(&t->sum, 0);
+	ffatom_set(&t->recs, 0);
+	ffatom_set(&t->errs, 0);
+	ffatom_set(&t->bad, 0);
+}
+
+#define NDJ_FN  TESTDIR "/ndjson.tmp"
+
+int test_ndjson(void)
+{
+	FFTEST_FUNC;
+	enum { N = 20000 };
+	ffarr d = {}, exp = {};
+	struct ffndjson_conf conf;
+	struct ffndjson_stat st;
+	struct ndj_test t = {};
+	uint64 sum = 0, ninvalid = 0;
+
+	ndj_gen(&d, &exp, N);
+	t.exp = (void*)exp.ptr;
+	t.nexp = exp.len;
+	t.stop_at = -1;
+	const struct ndj_exp *e;
+	FFARR_WALKT(&exp, e, struct ndj_exp) {
+		if (e->id < 0)
+			ninvalid++;
+		else
+			sum += e->id;
+	}
+
+	ffndjson_conf_init(&conf);
+	conf.udata = &t;
+	conf.chunk_size = 1000; // many chunks with lines crossing their nominal bounds
+
+	static const uint threads[] = { 1, 2, 4 };
+	for (uint k = 0;  k != FFCNT(threads);  k++) {
+		conf.threads = threads[k];
+		t.threads = threads[k];
+
+		// ordered
+		ndj_test_reset(&t);
+		ffmem_tzero(&st);
+		conf.handler = &ndj_ordered;
+		conf.ordered = 1;
+		x(0 == ffndjson_run(&conf, d.ptr, d.len, &st));
+		x(t.n == t.nexp);
+		x(st.lines == N);
+		x(st.errors == ninvalid);
+
+		// unordered
+		ndj_test_reset(&t);
+		ffmem_tzero(&st);
+		conf.handler = &ndj_unordered;
+		conf.ordered = 0;
+		x(0 == ffndjson_run(&conf, d.ptr, d.len, &st));
+		x(ffatom_get(&t.recs) == N);
+		x(ffatom_get(&t.errs) == ninvalid);
+		x(ffatom_get(&t.bad) == 0);
+		x(ffatom_get(&t.sum) == sum);
+
+		// invalid lines aren't delivered
+		ndj_test_reset(&t);
+		conf.skip_errors = 1;
+		x(0 == ffndjson_run(&conf, d.ptr, d.len, NULL));
+		x(ffatom_get(&t.recs) == N - ninvalid);
+		x(ffatom_get(&t.sum) == sum);
+		conf.skip_errors = 0;
+
+		// the handler stops processing
+		ndj_test_reset(&t);
+		conf.handler = &ndj_ordered;
+		conf.ordered = 1;
+		t.stop_at = 12345;
+		x(5 == ffndjson_run(&conf, d.ptr, d.len, NULL));
+		x(t.n == 12345 + 1);
+		t.stop_at = -1;
+	}
+
+	// the last line without LF;  whitespace only
+	ndj_test_reset(&t);
+	ffmem_tzero(&st);
+	conf.handler = &ndj_unordered;
+	conf.threads = 2;
+	x(0 == ffndjson_run(&conf, FFSTR("{\"id\":1,\"s\":\"x\\ty1\"}\n\n{\"id\":2,\"s\":\"x\\ty2\"}"), &st));
+	x(ffatom_get(&t.recs) == 2 && ffatom_get(&t.sum) == 3);
+	x(0 == ffndjson_run(&conf, FFSTR(" \r\n\t\n"), &st));
+	x(0 == ffndjson_run(&conf, "", 0, &st));
+	x(st.lines == 2);
+
+	// file mapping: lines cross the bounds of 64k blocks
+	fffd f;
+	fffilemap fm;
+	x(0 == fffile_writeall(NDJ_FN, d.ptr, d.len, 0));
+	x(FF_BADFD != (f = fffile_open(NDJ_FN, O_RDONLY)));
+
+	for (uint ordered = 0;  ordered != 2;  ordered++) {
+		ndj_test_reset(&t);
+		ffmem_tzero(&st);
+		conf.handler = (ordered) ? &ndj_ordered : &ndj_unordered;
+		conf.ordered = ordered;
+		conf.threads = 4;
+		t.threads = 4;
+		fffile_mapinit(&fm);
+		fffile_mapset(&fm, 64 * 1024, f, 0, d.len);
+		x(0 == ffndjson_runmap(&conf, &fm, &st));
+		fffile_mapclose(&fm);
+		x(st.lines == N);
+		x(st.errors == ninvalid);
+		if (ordered)
+			x(t.n == t.nexp);
+		else
+			x(ffatom_get(&t.sum) == sum);
+	}
+
+	fffile_close(f);
+	fffile_rm(NDJ_FN);
+	ffarr_free(&exp);
+	ffarr_free(&d);
+	return 0;
+}
+
+
+static int ndj_speed_handler(void *udata, const struct ffndjson_rec *r)
+{
+	if (r->tape != NULL && 0 == ffjson_tape_find(r->tape, 0, "status", 6))
+		ffatom_inc((ffatomic*)udata);
+	return 0;
+}
+
+/** Parse log lines with 1..16 threads, ordered and unordered. */
+int test_ndjson_speed(void)
+{
+	FFTEST_FUNC;
+	enum { N = 400000 };
+	static const char *const lev[] = { "info", "warning", "error", "debug" };
+	ffarr d = {};
+	struct ffndjson_conf conf;
+	ffatomic nostatus = {};
+	fftime start, stop;
+
+	for (uint i = 0;  i != N;  i++) {
+		ffstr_catfmt(&d, "{\"ts\":\"2019-06-01T12:%02u:%02u.%03uZ\",\"level\":\"%s\",\"msg\":\"request completed\","
+			"\"method\":\"GET\",\"path\":\"/api/v1/items/%u\",\"status\":%u,\"bytes\":%u,\"latency\":0.%03u,"
+			"\"client\":\"10.0.%u.%u\",\"ua\":\"Mozilla/5.0 (X11; Linux x86_64)\",\"tags\":[\"web\",\"prod\"]}\n"
+			, (i / 60) % 60, i % 60, i % 1000, lev[i % 4], i, 200 + (i % 5) * 100, i * 17 % 100000, i % 1000
+			, (i >> 8) & 0xff, i & 0xff);
+	}
+
+	ffndjson_conf_init(&conf);
+	conf.handler = &ndj_speed_handler;
+	conf.udata = &nostatus;
+
+	for (uint ordered = 0;  ordered != 2;  ordered++) {
+		for (uint threads = 1;  threads <= 16;  threads *= 2) {
+			struct ffndjson_stat st = {};
+			conf.threads = threads;
+			conf.ordered = ordered;
+			fftime_now(&start);
+			x(0 == ffndjson_run(&conf, d.ptr, d.len, &st));
+			fftime_now(&stop);
+			fftime_diff(&start, &stop);
+			uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+			x(st.lines == N && st.errors == 0);
+			fffile_fmt(ffstdout, NULL, "%s, %u threads: %U bytes in %Uus: %U MB/sec\n"
+				, (ordered) ? "ordered" : "unordered", threads
+				, (uint64)d.len, us, (uint64)d.len / ffmax(us, 1));
+		}
+	}
+	x(ffatom_get(&nostatus) == 0);
+
+	ffarr_free(&d);
+	return 0;
+}
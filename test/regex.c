@@ -0,0 +1,344 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/regex.h>
+#include <FF/string.h>
+#include <FF/time.h>
+#include <FFOS/file.h>
+#include <FFOS/test.h>
+#include <test/all.h>
+
+#define x FFTEST_BOOL
+
+
+/** Match 1 pattern.
+Return 0 if match;  1 if non-match;  -1 if pattern is invalid. */
+static int rx1(const char *pattern, const char *s, uint flags)
+{
+	ffregex rx;
+	int r;
+	ffregex_init(&rx);
+	if (0 > ffregex_addz(&rx, pattern, flags)) {
+		ffregex_free(&rx);
+		return -1;
+	}
+	x(0 == ffregex_compile(&rx));
+	r = (0 == ffregex_match(&rx, s, ffsz_len(s))) ? 0 : 1;
+	ffregex_free(&rx);
+	return r;
+}
+
+/** The same result as ffs_regex(). */
+static int rx_compat(const char *pattern, const char *s)
+{
+	int r = ffs_regex(pattern, ffsz_len(pattern), s, ffsz_len(s), 0);
+	int r2 = rx1(pattern, s, FFREGEX_FULL);
+	r = (r < 0) ? -1 : (r > 0);
+	if (r != r2)
+		fffile_fmt(ffstdout, NULL, "rx_compat: %s %s: %d %d\n", pattern, s, r, r2);
+	return r == r2;
+}
+
+/** Reference wildcard matcher with backtracking. */
+static int rx_wc_ref(const char *p, size_t pn, const char *s, size_t n)
+{
+	if (pn == 0)
+		return n == 0;
+	if (p[0] == '*') {
+		for (size_t i = 0;  i <= n;  i++) {
+			if (rx_wc_ref(p + 1, pn - 1, s + i, n - i))
+				return 1;
+		}
+		return 0;
+	}
+	if (n == 0 || (p[0] != '?' && p[0] != s[0]))
+		return 0;
+	return rx_wc_ref(p + 1, pn - 1, s + 1, n - 1);
+}
+
+static void rx_rnd(char *buf, size_t n, const char *alphabet)
+{
+	size_t na = ffsz_len(alphabet);
+	for (size_t i = 0;  i != n;  i++) {
+		buf[i] = alphabet[random() % na];
+	}
+}
+
+static void test_regex_compat(void)
+{
+	static const char *const t[][2] = {
+		{ "ab", "ab" }, { "ab", "abc" }, { "abc", "ab" },
+		{ "a|b", "a" }, { "a|b", "aa" }, { "a|b", "b" }, { "a|bc", "b" }, { "a|bc", "bc" },
+		{ "a|", "" }, { "ab|abc|abcd", "abcd" }, { "ab|abc\\|abcd", "abcd" }, { "ab|abc\\|abcd", "abc|abcd" },
+		{ "a.", "ab" }, { "a\\..c", "a.bc" }, { "a\\..c", "a!bc" }, { "a\\!.c", "a!bc" },
+		{ "a?bc", "bcc" }, { "a?bc?", "b" }, { "a?bc?", "ab" }, { "a?bc?", "bc" }, { "a?bc?", "abc" },
+		{ "a\\??", "a?" }, { "a\\??", "a" }, { "\\|?bc", "|bc" },
+		{ "[123]", "1" }, { "[123]", "3" }, { "[123]", "4" }, { "[123]", "123" },
+		{ "[12\\?3]", "?" }, { "[12\\]3]", "]" }, { "[\\[-\\]]", "\\" }, { "[1-2-3]", "3" },
+		{ "[1-3]", "2" }, { "[1-3]", "4" },
+		{ "[a-z0-9]", "1" }, { "[a-z0-9]", "3" }, { "[a-z0-9]", "w" }, { "[a-z0-9]", "z" }, { "[a-z0-9]", "Z" },
+		{ "[]", "" }, { "[[", "" }, { "[", "" }, { "]", "" }, { "[1--", "1" }, { "[3-1]", "3" },
+		{ "[-1]", "1" }, { "[1-]", "1" },
+	};
+	for (uint i = 0;  i != FFCNT(t);  i++) {
+		x(rx_compat(t[i][0], t[i][1]));
+	}
+
+	static const char *const wc[][2] = {
+		{ "", "" }, { "", "a" }, { "*", "" }, { "*", "abc" }, { "?", "" }, { "?", "a" },
+		{ "a*", "abc" }, { "a*c", "abbc" }, { "*ab*", "ac.abc" }, { "a*a*bb*c", "aabcabbc" },
+		{ "a*a*bbc*c", "aabcabbc" }, { "*ab*", "ac.ac" },
+	};
+	for (uint i = 0;  i != FFCNT(wc);  i++) {
+		int r = ffs_wildcard(wc[i][0], ffsz_len(wc[i][0]), wc[i][1], ffsz_len(wc[i][1]), 0);
+		x((r == 0) == (0 == rx1(wc[i][0], wc[i][1], FFREGEX_WILDCARD)));
+	}
+	x(0 == rx1("*aB*", "ac.Abc", FFREGEX_WILDCARD | FFREGEX_ICASE));
+	x(1 == rx1("*aB*", "ac.Abc", FFREGEX_WILDCARD));
+	x(0 == rx1("a.[b]", "a.[b]", FFREGEX_WILDCARD));
+
+	// random wildcards
+	char p[8], s[16];
+	for (uint i = 0;  i != 2000;  i++) {
+		size_t pn = random() % sizeof(p), n = random() % sizeof(s);
+		rx_rnd(p, pn, "ab*?");
+		rx_rnd(s, n, "ab");
+		ffregex rx;
+		ffregex_init(&rx);
+		x(0 == ffregex_add(&rx, p, pn, FFREGEX_WILDCARD));
+		x(0 == ffregex_compile(&rx));
+		if (!x(rx_wc_ref(p, pn, s, n) == (0 == ffregex_match(&rx, s, n))))
+			fffile_fmt(ffstdout, NULL, "%*s %*s\n", pn, p, n, s);
+		ffregex_free(&rx);
+	}
+}
+
+static void test_regex_syntax(void)
+{
+	// search
+	x(0 == rx1("bc", "abcd", 0));
+	x(1 == rx1("bd", "abcd", 0));
+	x(0 == rx1("", "abc", 0));
+	x(0 == rx1("^ab", "abc", 0));
+	x(1 == rx1("^bc", "abc", 0));
+	x(0 == rx1("bc$", "abc", 0));
+	x(1 == rx1("ab$", "abc", 0));
+	x(0 == rx1("^abc$", "abc", 0));
+	x(1 == rx1("^abc$", "abcabc", 0));
+	x(0 == rx1("^$", "", 0));
+	x(1 == rx1("^$", "a", 0));
+	x(0 == rx1("x|^a", "abc", 0));
+	x(1 == rx1("x|^b", "abc", 0));
+	x(0 == rx1("a$|c$", "abc", 0));
+	x(1 == rx1("a^", "aa", 0));
+
+	// repetition
+	x(0 == rx1("ab*c", "ac", FFREGEX_FULL));
+	x(0 == rx1("ab*c", "abbbc", FFREGEX_FULL));
+	x(1 == rx1("ab+c", "ac", FFREGEX_FULL));
+	x(0 == rx1("ab+c", "abbc", FFREGEX_FULL));
+	x(0 == rx1("a(bc)*d", "abcbcd", FFREGEX_FULL));
+	x(1 == rx1("a(bc)*d", "abcbd", FFREGEX_FULL));
+	x(0 == rx1("a(b|cd)+e", "abcdbe", FFREGEX_FULL));
+	x(0 == rx1("(a|ab)(c|bcd)", "abcd", FFREGEX_FULL));
+	x(0 == rx1("a?ab", "ab", FFREGEX_FULL));
+	x(0 == rx1(".*x.*", "aaxaa", FFREGEX_FULL));
+	x(0 == rx1("a{3}", "aaa", FFREGEX_FULL));
+	x(1 == rx1("a{3}", "aa", FFREGEX_FULL));
+	x(1 == rx1("a{3}", "aaaa", FFREGEX_FULL));
+	x(0 == rx1("a{2,}", "aaaaa", FFREGEX_FULL));
+	x(1 == rx1("a{2,}", "a", FFREGEX_FULL));
+	x(0 == rx1("a{0,2}", "", FFREGEX_FULL));
+	x(0 == rx1("a{1,3}b", "aaab", FFREGEX_FULL));
+	x(1 == rx1("a{1,3}b", "aaaab", FFREGEX_FULL));
+	x(0 == rx1("(ab){2}c{0}", "abab", FFREGEX_FULL));
+	x(0 == rx1("[0-9]{1,3}(\\.[0-9]{1,3}){3}", "192.168.0.1", FFREGEX_FULL));
+	x(1 == rx1("[0-9]{1,3}(\\.[0-9]{1,3}){3}", "192.168.0.1000", FFREGEX_FULL));
+
+	// brackets
+	x(0 == rx1("[^a-z]", "A", FFREGEX_FULL));
+	x(1 == rx1("[^a-z]", "q", FFREGEX_FULL));
+	x(0 == rx1("[a-z]", "Q", FFREGEX_FULL | FFREGEX_ICASE));
+	x(0 == rx1("[*+(){}^$]+", "*+(){}^$", FFREGEX_FULL));
+	x(0 == rx1("GeT", "gEt", FFREGEX_FULL | FFREGEX_ICASE));
+	x(0 == rx1("\\*\\(\\{\\^\\$", "*({^$", FFREGEX_FULL));
+	x(0 == rx1(".", "\n", FFREGEX_FULL));
+	x(0 == rx1("\xff+", "\xff\xff", FFREGEX_FULL));
+
+	// invalid
+	static const char *const inv[] = {
+		"(", ")", "a)", "(a", "*", "+a", "a**", "a??", "a{", "a{1", "a{1,", "a{,1}", "a{2,1}", "a{1001}",
+		"{1}", "}", "^*", "$?", "a\\", "\\a", "[^]", "[a-]", "[a", "a|*",
+		"((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((((a))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))))",
+	};
+	for (uint i = 0;  i != FFCNT(inv);  i++) {
+		x(-1 == rx1(inv[i], "", 0));
+	}
+	x(0 == rx1("((((((((((a))))))))))", "a", 0));
+}
+
+static void test_regex_multi(void)
+{
+	ffregex rx;
+	uint m[2];
+	static const char *const pats[] = {
+		"^GET ", "^POST ", " /api/", "\\.(jpg|png)( |$)", "HTTP/1\\.[01]$", "^[A-Z]+ /static/.*",
+	};
+	uint seen = 0;
+
+	ffregex_init(&rx);
+	for (uint i = 0;  i != FFCNT(pats);  i++) {
+		x(i == (uint)ffregex_addz(&rx, pats[i], 0));
+	}
+	x(-1 == ffregex_addz(&rx, "[", 0));
+	// patterns #6..#45: "/u<N>$"
+	for (uint i = 0;  i != 40;  i++) {
+		char buf[16];
+		ffs_fmt(buf, buf + sizeof(buf), "/u%u$%Z", i);
+		x(FFCNT(pats) + i == (uint)ffregex_addz(&rx, buf, 0));
+	}
+	x(rx.npatterns == FFCNT(pats) + 40);
+	x(0 == ffregex_compile(&rx));
+
+	x(4 == ffregex_matchall(&rx, FFSTR("GET /api/x.png HTTP/1.1"), m));
+	x(ffbit_testarr(m, 0) && ffbit_testarr(m, 2) && ffbit_testarr(m, 3) && ffbit_testarr(m, 4));
+	x(0 == ffregex_match(&rx, FFSTR("GET /api/x.png HTTP/1.1")));
+
+	x(3 == ffregex_matchall(&rx, FFSTR("POST /static/a.jpg"), m));
+	x(ffbit_testarr(m, 1) && ffbit_testarr(m, 3) && ffbit_testarr(m, 5));
+
+	x(1 == ffregex_matchall(&rx, FFSTR("/u/u17/u39"), m));
+	x(ffbit_testarr(m, 6 + 39));
+	x(6 + 39 == ffregex_match(&rx, FFSTR("/u/u17/u39")));
+	x(-1 == ffregex_match(&rx, FFSTR("get /API/")));
+	x(0 == ffregex_matchall(&rx, FFSTR(""), m));
+	ffregex_free(&rx);
+
+	// the same results with a small cache
+	ffregex rx2;
+	ffregex_init(&rx);
+	ffregex_init(&rx2);
+	rx2.max_states = 2;
+	for (uint i = 0;  i != FFCNT(pats);  i++) {
+		ffregex_addz(&rx, pats[i], FFREGEX_ICASE);
+		ffregex_addz(&rx2, pats[i], FFREGEX_ICASE);
+	}
+	x(0 == ffregex_compile(&rx));
+	x(0 == ffregex_compile(&rx2));
+	static const char *const tokens[] = {
+		"GET ", "post ", "/api/", "/static/", ".jpg", ".PNG", " ", "HTTP/1.1", "x", "A",
+	};
+	char s[64];
+	for (uint i = 0;  i != 5000;  i++) {
+		size_t n = 0;
+		for (uint k = random() % 6;  k != 0;  k--) {
+			const char *t = tokens[random() % FFCNT(tokens)];
+			n = ffs_copyz(s + n, s + sizeof(s), t) - s;
+		}
+		uint m2[1];
+		x(ffregex_matchall(&rx, s, n, m) == ffregex_matchall(&rx2, s, n, m2));
+		x(m[0] == m2[0]);
+		seen |= m[0];
+	}
+	x(seen == (1 << FFCNT(pats)) - 1);
+	x(rx.flushes == 0);
+	x(rx2.flushes != 0);
+	ffregex_free(&rx);
+	ffregex_free(&rx2);
+}
+
+int test_regex_dfa(void)
+{
+	FFTEST_FUNC;
+
+	test_regex_compat();
+	test_regex_syntax();
+	test_regex_multi();
+	return 0;
+}
+
+
+static uint64 rx_usec(const fftime *start)
+{
+	fftime stop;
+	fftime_now(&stop);
+	fftime_diff(start, &stop);
+	return fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+}
+
+/** Match N strings against P patterns:
+ the patterns one by one with ffs_regex() or ffs_wildcard(),
+ all patterns at once with ffregex. */
+int test_regex_speed(void)
+{
+	FFTEST_FUNC;
+	enum { P = 200, N = 20000 };
+	ffarr pats = {}, strs = {};
+	ffstr *ps, *ss;
+	fftime start;
+	uint64 us, us2, n, n2;
+	ffregex rx;
+	uint *m = ffmem_alloc((P + 31) / 32 * sizeof(uint));
+
+	ps = ffarr_allocT(&pats, P, ffstr);
+	ss = ffarr_allocT(&strs, N, ffstr);
+	for (uint i = 0;  i != N;  i++) {
+		ffstr_alloc(&ss[i], 64);
+		ss[i].len = ffs_fmt(ss[i].ptr, ss[i].ptr + 64, "/svc%u/v%u/%s/%u"
+			, (uint)random() % (P * 2), (uint)random() % 3 + 1
+			, (random() % 2) ? "user" : "item", (uint)random() % 1000);
+	}
+
+	for (uint k = 0;  k != 2;  k++) {
+		const char *name = (k == 0) ? "ffs_regex" : "ffs_wildcard";
+		uint flags = (k == 0) ? FFREGEX_FULL : FFREGEX_WILDCARD;
+
+		ffregex_init(&rx);
+		for (uint i = 0;  i != P;  i++) {
+			ffstr_alloc(&ps[i], 64);
+			if (k == 0)
+				ps[i].len = ffs_fmt(ps[i].ptr, ps[i].ptr + 64, "/svc%u/v[12]/user/[0-9]|/svc%u/v[12]/item/[0-9][0-9]?", i, i);
+			else
+				ps[i].len = ffs_fmt(ps[i].ptr, ps[i].ptr + 64, "/svc%u/v?/item/*", i);
+			x(0 <= ffregex_add(&rx, ps[i].ptr, ps[i].len, flags));
+		}
+		x(0 == ffregex_compile(&rx));
+
+		fftime_now(&start);
+		n = 0;
+		for (uint i = 0;  i != N;  i++) {
+			for (uint j = 0;  j != P;  j++) {
+				int r = (k == 0)
+					? ffs_regex(ps[j].ptr, ps[j].len, ss[i].ptr, ss[i].len, 0)
+					: ffs_wildcard(ps[j].ptr, ps[j].len, ss[i].ptr, ss[i].len, 0);
+				n += (r == 0);
+			}
+		}
+		us = rx_usec(&start);
+
+		fftime_now(&start);
+		n2 = 0;
+		for (uint i = 0;  i != N;  i++) {
+			n2 += ffregex_matchall(&rx, ss[i].ptr, ss[i].len, m);
+		}
+		us2 = rx_usec(&start);
+		x(n == n2);
+
+		fffile_fmt(ffstdout, NULL, "%s: %u strings * %u patterns: %U matches in %Uus;  ffregex: %U matches in %Uus (%u states, %u flushes)\n"
+			, name, N, P, n, us, n2, us2, rx.nstates, rx.flushes);
+
+		ffregex_free(&rx);
+		for (uint i = 0;  i != P;  i++) {
+			ffstr_free(&ps[i]);
+		}
+	}
+
+	for (uint i = 0;  i != N;  i++) {
+		ffstr_free(&ss[i]);
+	}
+	ffarr_free(&pats);
+	ffarr_free(&strs);
+	ffmem_free(m);
+	return 0;
+}
@@ -5,7 +5,14 @@ Copyright (c) 2018 Simon Zolin
 #include <FF/net/ssl.h>
 #include <FF/time.h>
 #include <FFOS/file.h>
+#include <FFOS/socket.h>
 #include <FFOS/test.h>
+#ifdef FF_UNIX
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#endif
 
 #define x FFTEST_BOOL
 
@@ -55,11 +62,419 @@ void test_ssl(void)
 	ffssl_cert_free(cert);
 }
 
+
+/* Perform handshake for both sides of a loopback connection */
+static int ssl_handshake2(SSL *srv, SSL *cli)
+{
+	int rs = -1, rc = -1;
+	for (uint i = 0;  i != 10000;  i++) {
+		if (rc != 0)
+			rc = ffssl_handshake(cli);
+		if (rs != 0)
+			rs = ffssl_handshake(srv);
+		if (rs == 0 && rc == 0)
+			return 0;
+		if (!(rs == 0 || rs == FFSSL_WANTREAD || rs == FFSSL_WANTWRITE)
+			|| !(rc == 0 || rc == FFSSL_WANTREAD || rc == FFSSL_WANTWRITE))
+			break;
+	}
+	return -1;
+}
+
+/** Serve a file over TLS on loopback: userspace encryption vs kernel TLS.
+Return the number of bytes received. */
+static uint64 ssl_servefile(SSL_CTX *sctx, SSL_CTX *cctx, fffd f, uint64 fsize, uint ktls)
+{
+	ffaddr adr;
+	ffskt lsn, csk, ssk;
+	SSL *srv, *cli;
+	ffssl_opt opt = {};
+	ffsf sf;
+	ffiovec hdr;
+	char *buf;
+	enum { BUFSIZE = 64 * 1024 };
+	uint64 total = 0, nsent = 0;
+
+	ffaddr_init(&adr);
+	x(0 == ffaddr_set(&adr, FFSTR("127.0.0.1"), NULL, 0));
+	ffip_setport(&adr, 64001);
+	lsn = ffskt_create(AF_INET, SOCK_STREAM, 0);
+	x(lsn != FF_BADSKT);
+	ffskt_setopt(lsn, SOL_SOCKET, SO_REUSEADDR, 1);
+	x(0 == ffskt_bind(lsn, &adr.a, adr.len));
+	x(0 == ffskt_listen(lsn, SOMAXCONN));
+	csk = ffskt_create(AF_INET, SOCK_STREAM, 0);
+	x(csk != FF_BADSKT);
+	x(0 == ffskt_connect(csk, &adr.a, adr.len));
+	ssk = ffskt_accept(lsn, NULL, NULL, 0);
+	x(ssk != FF_BADSKT);
+	ffskt_close(lsn);
+	x(0 == ffskt_nblock(ssk, 1));
+	x(0 == ffskt_nblock(csk, 1));
+
+	opt.sk = ssk;
+	x(0 == ffssl_create(&srv, sctx, FFSSL_ACCEPT | FFSSL_SOCKET, &opt));
+	opt.sk = csk;
+	x(0 == ffssl_create(&cli, cctx, FFSSL_CONNECT | FFSSL_SOCKET, &opt));
+	x(0 == ssl_handshake2(srv, cli));
+	const char *mode = "userspace TLS";
+	if (ktls) {
+		// falls back to userspace encryption if kernel doesn't support TLS
+		mode = "kTLS (not supported: fallback)";
+		if (ffssl_get(srv, FFSSL_KTLS_SEND))
+			mode = (ffssl_get(cli, FFSSL_KTLS_RECV)) ? "kTLS TX+RX" : "kTLS TX";
+	}
+
+	ffsf_init(&sf);
+	fffile_mapset(&sf.fm, BUFSIZE, f, 0, fsize);
+	ffiov_set(&hdr, FFSTR("HTTP/1.1 200 OK\r\n\r\n"));
+	ffsf_sethdtr(&sf.ht, &hdr, 1, NULL, 0);
+	uint64 size = ffsf_len(&sf);
+	buf = ffmem_alloc(BUFSIZE);
+	x(buf != NULL);
+
+	fftime start, stop;
+	fftime_now(&start);
+
+	while (total != size) {
+		if (nsent != size) {
+			int64 n = ffssl_sendfile(srv, &sf, 0);
+			if (n > 0) {
+				nsent += n;
+				ffsf_shift(&sf, n);
+			} else if (n != -FFSSL_WANTWRITE && n != -FFSSL_WANTREAD) {
+				x(0);
+				break;
+			}
+		}
+
+		for (;;) {
+			int r = ffssl_read(cli, buf, BUFSIZE);
+			if (r == -FFSSL_WANTREAD || r == -FFSSL_WANTWRITE)
+				break;
+			if (r <= 0) {
+				x(0);
+				goto done;
+			}
+			if (total == 0)
+				x(r >= 2 && buf[0] == 'H' && buf[1] == 'T');
+			total += r;
+		}
+	}
+
+done:
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	x(total == size);
+	uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "%s: %U bytes in %Uus: %U MB/sec\n"
+		, mode, total, us, total / ffmax(us, 1));
+
+	ffmem_free(buf);
+	ffsf_close(&sf);
+	ffssl_free(srv);
+	ffssl_free(cli);
+	ffskt_close(ssk);
+	ffskt_close(csk);
+	return total;
+}
+
+void test_ssl_ktls(void)
+{
+	void *key;
+	X509 *cert;
+	SSL_CTX *sctx, *cctx;
+	enum { M = 1024 * 1024, FSIZE = 64 * M };
+
+	x(!ffssl_cert_create_key(&key, 2048, FFSSL_PKEY_RSA));
+	struct ffssl_cert_newinfo ci = {};
+	ffstr_setz(&ci.subject, "/CN=localhost");
+	fftime t;
+	fftime_now(&t);
+	ci.from_time = t.sec;
+	ci.until_time = t.sec + FFTIME_DAY_SECS;
+	ci.pkey = key;
+	ci.pkey_type = FFSSL_PKEY_RSA;
+	x(!ffssl_cert_create(&cert, &ci));
+
+	const char *fn = "./ktls.tmp";
+	fffd f = fffile_createtemp(fn, O_RDWR);
+	x(f != FF_BADFD);
+	x(0 == fffile_trunc(f, FSIZE));
+
+	for (uint ktls = 0;  ktls != 2;  ktls++) {
+		struct ffssl_ctx_conf conf = {};
+		conf.cert = cert;
+		conf.pkey = key;
+		conf.ktls = ktls;
+		x(0 == ffssl_ctx_create(&sctx));
+		x(0 == ffssl_ctx_conf(sctx, &conf));
+
+		struct ffssl_ctx_conf cconf = {};
+		cconf.ktls = ktls;
+		x(0 == ffssl_ctx_create(&cctx));
+		x(0 == ffssl_ctx_conf(cctx, &cconf));
+
+		SSL *s;
+		ffssl_opt opt = {};
+		x(0 != ffssl_create(&s, sctx, FFSSL_SOCKET | FFSSL_IOBUF, &opt));
+
+		x(FSIZE + FFSLEN("HTTP/1.1 200 OK\r\n\r\n") == ssl_servefile(sctx, cctx, f, FSIZE, ktls));
+
+		ffssl_ctx_free(sctx);
+		ffssl_ctx_free(cctx);
+	}
+
+	fffile_close(f);
+	fffile_rm(fn);
+	ffssl_cert_key_free(key);
+	ffssl_cert_free(cert);
+}
+
+
+static void test_sesscache_store(void)
+{
+	struct ffssl_sesscache_conf conf = {};
+	conf.max_sessions = 4;
+	conf.max_sess_size = 64;
+	size_t size = ffssl_sesscache_size(&conf);
+	void *mem = ffmem_alloc(size);
+	x(NULL == ffssl_sesscache_init(mem, size - 1, &conf));
+	ffssl_sesscache *sc = ffssl_sesscache_init(mem, size, &conf);
+	x(sc != NULL);
+
+	char id[32], buf[64];
+	uint64 now = 1000;
+	ffmem_zero(id, sizeof(id));
+	for (uint i = 0;  i != 4;  i++) {
+		id[0] = i;
+		x(0 == ffssl_sesscache_store(sc, id, sizeof(id), "data0123", 4 + i, now + 10));
+	}
+	x(0 != ffssl_sesscache_store(sc, id, sizeof(id), buf, sizeof(buf) + 1, now + 10));
+
+	id[0] = 0;
+	x(4 == ffssl_sesscache_fetch(sc, id, sizeof(id), buf, sizeof(buf), now));
+	x(!ffmemcmp(buf, "data", 4));
+	x(-1 == ffssl_sesscache_fetch(sc, id, sizeof(id), buf, 3, now));
+
+	// #1 is the least recently used
+	id[0] = 4;
+	x(0 == ffssl_sesscache_store(sc, id, sizeof(id), "data", 4, now + 10));
+	id[0] = 1;
+	x(0 == ffssl_sesscache_fetch(sc, id, sizeof(id), buf, sizeof(buf), now));
+	id[0] = 0;
+	x(4 == ffssl_sesscache_fetch(sc, id, sizeof(id), buf, sizeof(buf), now));
+	id[0] = 2;
+	x(6 == ffssl_sesscache_fetch(sc, id, sizeof(id), buf, sizeof(buf), now));
+
+	// expired
+	x(0 == ffssl_sesscache_fetch(sc, id, sizeof(id), buf, sizeof(buf), now + 10));
+
+	id[0] = 3;
+	ffssl_sesscache_del(sc, id, sizeof(id));
+	x(0 == ffssl_sesscache_fetch(sc, id, sizeof(id), buf, sizeof(buf), now));
+
+	struct ffssl_sesscache_stat st;
+	ffssl_sesscache_stat(sc, &st);
+	x(st.sessions == 2);
+	x(st.hits == 3);
+	x(st.misses == 3);
+	x(st.evictions == 1);
+	x(st.expired == 1);
+	x(st.stores == 5);
+	ffmem_free(mem);
+}
+
+#ifdef FF_UNIX
+
+enum SESS_MODE {
+	SESS_INTERNAL, // OpenSSL cache in each process
+	SESS_SHARED,
+	SESS_SHARED_TICKETS,
+};
+
+/* Worker process: accept connections and perform TLS handshake */
+static void sess_worker(ffskt lsn, SSL_CTX *ctx)
+{
+	for (;;) {
+		ffskt sk = ffskt_accept(lsn, NULL, NULL, 0);
+		if (sk == FF_BADSKT)
+			continue;
+		SSL *c;
+		ffssl_opt opt = {};
+		opt.sk = sk;
+		if (0 == ffssl_create(&c, ctx, FFSSL_ACCEPT | FFSSL_SOCKET, &opt)) {
+			if (0 == ffssl_handshake(c))
+				ffssl_shut(c);
+			ffssl_free(c);
+		}
+		ffskt_close(sk);
+	}
+}
+
+/** Connect to worker processes sharing one listening socket.
+Return the number of resumed sessions. */
+static uint sess_resume(void *cert, void *key, uint mode, ffssl_sesscache *sc, uint nworkers, uint nconn)
+{
+	ffaddr adr;
+	ffskt lsn;
+	pid_t pids[16];
+	SSL_CTX *cctx;
+	SSL_SESSION *sess = NULL;
+	uint reused = 0;
+
+	ffaddr_init(&adr);
+	x(0 == ffaddr_set(&adr, FFSTR("127.0.0.1"), NULL, 0));
+	ffip_setport(&adr, 64002);
+	lsn = ffskt_create(AF_INET, SOCK_STREAM, 0);
+	x(lsn != FF_BADSKT);
+	ffskt_setopt(lsn, SOL_SOCKET, SO_REUSEADDR, 1);
+	x(0 == ffskt_bind(lsn, &adr.a, adr.len));
+	x(0 == ffskt_listen(lsn, SOMAXCONN));
+
+	for (uint i = 0;  i != nworkers;  i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			SSL_CTX *ctx;
+			struct ffssl_ctx_conf conf = {};
+			conf.cert = cert;
+			conf.pkey = key;
+			if (0 != ffssl_ctx_create(&ctx) || 0 != ffssl_ctx_conf(ctx, &conf))
+				_exit(1);
+			if (mode == SESS_INTERNAL) {
+				ffssl_ctx_cache(ctx, 0);
+				SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+			} else {
+				ffssl_ctx_sesscache(ctx, sc);
+			}
+			sess_worker(lsn, ctx);
+			_exit(0);
+		}
+		x(pids[i] > 0);
+	}
+
+	x(0 == ffssl_ctx_create(&cctx));
+	SSL_CTX_set_max_proto_version(cctx, TLS1_2_VERSION);
+
+	fftime start, stop;
+	fftime_now(&start);
+
+	for (uint i = 0;  i != nconn;  i++) {
+		ffskt sk = ffskt_create(AF_INET, SOCK_STREAM, 0);
+		x(sk != FF_BADSKT);
+		x(0 == ffskt_connect(sk, &adr.a, adr.len));
+
+		SSL *c;
+		ffssl_opt opt = {};
+		opt.sk = sk;
+		x(0 == ffssl_create(&c, cctx, FFSSL_CONNECT | FFSSL_SOCKET, &opt));
+		if (sess != NULL)
+			SSL_set_session(c, sess);
+		x(0 == ffssl_handshake(c));
+		reused += ffssl_get(c, FFSSL_SESS_REUSED);
+
+		// wait until the worker has finished the handshake and stored the session
+		char b;
+		x(0 == ffssl_read(c, &b, 1));
+
+		if (sess != NULL)
+			SSL_SESSION_free(sess);
+		sess = SSL_get1_session(c);
+		ffssl_shut(c);
+		ffssl_free(c);
+		ffskt_close(sk);
+	}
+
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+
+	for (uint i = 0;  i != nworkers;  i++) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+	ffskt_close(lsn);
+	if (sess != NULL)
+		SSL_SESSION_free(sess);
+	ffssl_ctx_free(cctx);
+
+	static const char *const modes[] = { "per-process cache", "shared cache", "shared cache+tickets" };
+	uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "%s: resumed %u/%u, %Uus per handshake\n"
+		, modes[mode], reused, nconn, us / nconn);
+	return reused;
+}
+
+/* Measure resumption rate and the workers' CPU time */
+static void test_sesscache_workers(void)
+{
+	void *key;
+	X509 *cert;
+	enum { NWORKERS = 4, NCONN = 200 };
+
+	x(!ffssl_cert_create_key(&key, 2048, FFSSL_PKEY_RSA));
+	struct ffssl_cert_newinfo ci = {};
+	ffstr_setz(&ci.subject, "/CN=localhost");
+	fftime t;
+	fftime_now(&t);
+	ci.from_time = t.sec;
+	ci.until_time = t.sec + FFTIME_DAY_SECS;
+	ci.pkey = key;
+	ci.pkey_type = FFSSL_PKEY_RSA;
+	x(!ffssl_cert_create(&cert, &ci));
+
+	for (uint mode = SESS_INTERNAL;  mode <= SESS_SHARED_TICKETS;  mode++) {
+		struct ffssl_sesscache_conf conf = {};
+		conf.max_sessions = 1024;
+		conf.ticket_key_lifetime = (mode == SESS_SHARED_TICKETS) ? 3600 : 0;
+		size_t size = ffssl_sesscache_size(&conf);
+		void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		x(mem != MAP_FAILED);
+		ffssl_sesscache *sc = ffssl_sesscache_init(mem, size, &conf);
+		x(sc != NULL);
+
+		struct rusage ru1, ru2;
+		getrusage(RUSAGE_CHILDREN, &ru1);
+		uint reused = sess_resume(cert, key, mode, sc, NWORKERS, NCONN);
+		getrusage(RUSAGE_CHILDREN, &ru2);
+		uint64 cpu = (ru2.ru_utime.tv_sec - ru1.ru_utime.tv_sec) * 1000000 + (ru2.ru_utime.tv_usec - ru1.ru_utime.tv_usec)
+			+ (ru2.ru_stime.tv_sec - ru1.ru_stime.tv_sec) * 1000000 + (ru2.ru_stime.tv_usec - ru1.ru_stime.tv_usec);
+		fffile_fmt(ffstdout, NULL, "  workers CPU: %Uus per handshake\n", cpu / NCONN);
+
+		if (mode != SESS_INTERNAL)
+			x(reused == NCONN - 1); // all but the first one
+
+		struct ffssl_sesscache_stat st;
+		ffssl_sesscache_stat(sc, &st);
+		if (mode == SESS_SHARED) {
+			x(st.hits == NCONN - 1);
+			x(st.sessions == 1);
+		} else if (mode == SESS_SHARED_TICKETS) {
+			x(st.hits == 0); // resumed by tickets
+			x(st.ticket_keys == 1);
+		}
+		munmap(mem, size);
+	}
+
+	ffssl_cert_key_free(key);
+	ffssl_cert_free(cert);
+}
+#endif
+
+void test_ssl_sesscache(void)
+{
+	test_sesscache_store();
+#ifdef FF_UNIX
+	test_sesscache_workers();
+#endif
+}
+
 int main()
 {
 	ffmem_init();
 	ffssl_init();
 	FFTEST_TIMECALL( test_ssl() );
+	FFTEST_TIMECALL( test_ssl_ktls() );
+	FFTEST_TIMECALL( test_ssl_sesscache() );
 	ffssl_uninit();
 	return 0;
 }
@@ -213,6 +213,72 @@ int test_inttostr()
 	ss.len = ffs_fromint(999, s, FFCNT(s), FFINT_SEP1000);
 	x(ffstr_eqcz(&ss, "999"));
 
+	ss.len = ffs_fromint(1234567890, s, FFCNT(s), 0);
+	x(ffstr_eqcz(&ss, "1234567890"));
+
+	ss.len = ffs_fromint(-9223372036854775807LL - 1, s, FFCNT(s), FFINT_SIGNED);
+	x(ffstr_eqcz(&ss, "-9223372036854775808"));
+
+	ss.len = ffs_fromint(7, s, FFCNT(s), 0);
+	x(ffstr_eqcz(&ss, "7"));
+
+	return 0;
+}
+
+#define XORSHIFT_SEED  0x9e3779b97f4a7c15ULL
+
+/** xorshift64: reproducible pseudo-random numbers.
+*r: state, initially XORSHIFT_SEED */
+static uint64 xorshift64(uint64 *r)
+{
+	*r ^= *r << 13;
+	*r ^= *r >> 7;
+	*r ^= *r << 17;
+	return *r;
+}
+
+static int test_flttostr()
+{
+	char s[FFS_FLTMAXCHARS + 1];
+	ffstr ss;
+	ss.ptr = s;
+
+	ss.len = ffs_fromfloat(123.456, s, FFCNT(s), FFS_INT_WFRAC(2));
+	x(ffstr_eqcz(&ss, "123.46"));
+
+	static const struct {
+		double d;
+		const char *s;
+	} shrt[] = {
+		{ 0, "0.0" }, { -0.0, "-0.0" }, { 100, "100.0" }, { -2.5, "-2.5" },
+		{ 0.1, "0.1" }, { 0.3, "0.3" }, { 1.0 / 3, "0.3333333333333333" },
+		{ 123.456, "123.456" }, { 0.000001, "0.000001" }, { 1.5e-7, "1.5e-7" },
+		{ 1e21, "1e21" }, { 1.2345e30, "1.2345e30" },
+		{ 5e-324, "5e-324" }, { 1.7976931348623157e308, "1.7976931348623157e308" },
+		{ 2.2250738585072014e-308, "2.2250738585072014e-308" },
+	};
+	for (uint i = 0;  i != FFCNT(shrt);  i++) {
+		ss.len = ffs_fromfloat(shrt[i].d, s, FFCNT(s), FFS_FLTSHORT);
+		x(ffstr_eqz(&ss, shrt[i].s));
+	}
+
+	// the text is converted back to the same value
+	uint64 r = XORSHIFT_SEED;
+	for (uint i = 0;  i != 100000;  i++) {
+		union {
+			uint64 i;
+			double d;
+		} u;
+		u.i = xorshift64(&r);
+		if ((u.i & 0x7ff0000000000000ULL) == 0x7ff0000000000000ULL)
+			continue; // inf, nan
+		ss.len = ffs_fromfloat(u.d, s, FFCNT(s) - 1, FFS_FLTSHORT);
+		s[ss.len] = '\0';
+		if (!x(strtod(s, NULL) == u.d))
+			break;
+	}
+
+	x(3 == ffs_fromfloat(1.5e-7, s, 3, FFS_FLTSHORT));
 	return 0;
 }
 
@@ -716,6 +782,173 @@ int test_regex(void)
 	return 0;
 }
 
+/* Scalar versions of the functions which have SIMD implementations. */
+
+static int utf_ref_valid(const char *d, size_t len)
+{
+	uint val;
+	int r;
+	for (size_t i = 0;  i != len;  i += r) {
+		if (0 >= (r = ffutf8_decode1(d + i, len - i, &val)))
+			return 0;
+	}
+	return 1;
+}
+
+static size_t utf_ref_len(const char *d, size_t len)
+{
+	size_t i = 0, n = 0;
+	while (i < len) {
+		uint c = (byte)d[i];
+		uint k = ffbit_find32(~(c << 24) & 0xfe000000);
+		i += (!(c & 0x80) || k < 3 || k == 8) ? 1 : k - 1;
+		n++;
+	}
+	return n;
+}
+
+static size_t utf_ref_from16(char *dst, size_t cap, const char *src, size_t *len, uint be)
+{
+	size_t i, n = 0;
+	for (i = 0;  i + 2 <= *len;  i += 2) {
+		uint c = (be) ? ffint_ntoh16(src + i) : ffint_ltoh16(src + i);
+		if (dst == NULL) {
+			n += ffutf8_size(c);
+			continue;
+		}
+		uint r = (n < cap) ? ffutf8_encode1(dst + n, cap - n, c) : 0;
+		if (r == 0)
+			break;
+		n += r;
+	}
+	*len = i;
+	return n;
+}
+
+/** SIMD code paths produce the same results as the scalar code:
+ all 1- and 2-byte values, 3-byte prefixes at every offset around 16- and 32-byte block bounds;
+ random data. */
+static void test_utf_simd(void)
+{
+	char buf[128], out[512], out2[512];
+	size_t n, n2, len, len2;
+	uint64 rnd = XORSHIFT_SEED;
+	FFTEST_FUNC;
+
+	for (uint v = 0;  v != 0x10000;  v++) {
+		for (uint off = 0;  off != 66;  off++) {
+			memset(buf, 'a', sizeof(buf));
+			buf[off] = (char)v;
+			buf[off + 1] = (char)(v >> 8);
+			if (!x(ffutf8_valid(buf, 96) == utf_ref_valid(buf, 96))
+				|| !x(ffutf8_len(buf, 96) == utf_ref_len(buf, 96)))
+				return;
+			if (v >= 0x100)
+				continue;
+			// a character ending at the end of data
+			if (!x(ffutf8_valid(buf, off + 1) == utf_ref_valid(buf, off + 1)))
+				return;
+		}
+	}
+
+	static const byte b3[] = { 0x00, 0x41, 0x7f, 0x80, 0xbf, 0xc0, 0xe0, 0xff };
+	static const uint offs[] = { 13, 14, 15, 29, 30, 31, 61, 62, 63 };
+	for (uint v = 0xc000;  v != 0x10000;  v++) {
+		for (uint k = 0;  k != FFCNT(b3);  k++) {
+			for (uint i = 0;  i != FFCNT(offs);  i++) {
+				memset(buf, 'a', sizeof(buf));
+				buf[offs[i]] = (char)(v >> 8);
+				buf[offs[i] + 1] = (char)v;
+				buf[offs[i] + 2] = b3[k];
+				buf[offs[i] + 3] = (char)0x80;
+				buf[offs[i] + 4] = (char)0x80;
+				if (!x(ffutf8_valid(buf, 96) == utf_ref_valid(buf, 96)))
+					return;
+			}
+		}
+	}
+
+	// random sequences of valid characters with some bytes corrupted
+	for (uint i = 0;  i != 200000;  i++) {
+		len = xorshift64(&rnd) % sizeof(buf);
+		for (n = 0;  n < len;  ) {
+			uint r = xorshift64(&rnd);
+			uint c = (r % 4 != 0) ? r % 0x80 : r % 0x7fffffff;
+			if (ffutf8_size(c) > len - n)
+				c = 'a';
+			n += ffutf8_encode1(buf + n, len - n, c);
+		}
+		if (i % 2)
+			buf[xorshift64(&rnd) % sizeof(buf)] = (char)xorshift64(&rnd);
+		if (!x(ffutf8_valid(buf, len) == utf_ref_valid(buf, len))
+			|| !x(ffutf8_len(buf, len) == utf_ref_len(buf, len)))
+			return;
+	}
+
+	// UTF-16 -> UTF-8
+	for (uint i = 0;  i != 100000;  i++) {
+		len = xorshift64(&rnd) % sizeof(buf);
+		for (n = 0;  n != sizeof(buf);  n++) {
+			uint r = xorshift64(&rnd);
+			// mostly 0..0x7f
+			if (n % 2 != i % 2)
+				buf[n] = (r % 8 != 0) ? 0 : (char)(r >> 8);
+			else
+				buf[n] = (r % 16 != 0) ? (r >> 8) & 0x7f : (char)(r >> 8);
+		}
+		uint be = i % 2;
+		uint cap = (i % 3 == 0) ? xorshift64(&rnd) % sizeof(out) : sizeof(out);
+
+		len2 = len;
+		n = (be) ? ffutf8_from_utf16be(NULL, 0, buf, &len2, 0) : ffutf8_from_utf16le(NULL, 0, buf, &len2, 0);
+		size_t l = len;
+		if (!x(n == utf_ref_from16(NULL, 0, buf, &l, be) && len2 == l))
+			return;
+
+		len2 = len;
+		n = (be) ? ffutf8_from_utf16be(out, cap, buf, &len2, 0) : ffutf8_from_utf16le(out, cap, buf, &len2, 0);
+		l = len;
+		n2 = utf_ref_from16(out2, cap, buf, &l, be);
+		if (!x(n == n2 && len2 == l && !memcmp(out, out2, n)))
+			return;
+	}
+
+	// UTF-8 -> UTF-16BE
+	for (uint i = 0;  i != 100000;  i++) {
+		len = xorshift64(&rnd) % sizeof(buf);
+		for (n = 0;  n < len;  ) {
+			uint r = xorshift64(&rnd);
+			uint c = (r % 8 != 0) ? r % 0x80 : r % 0xd800;
+			if (ffutf8_size(c) > len - n)
+				c = 'a';
+			n += ffutf8_encode1(buf + n, len - n, c);
+		}
+		if (i % 8 == 0)
+			buf[xorshift64(&rnd) % sizeof(buf)] = (char)xorshift64(&rnd);
+
+		uint val;
+		int r;
+		n2 = 0;
+		for (size_t k = 0;  k != len;  k += r) {
+			r = ffutf8_decode1(buf + k, len - k, &val);
+			if (r <= 0 || !ffutf16_basic(val) || val > 0xffff) {
+				n2 = 0;
+				break;
+			}
+			ffint_hton16(out2 + n2, val);
+			n2 += 2;
+		}
+
+		len2 = len;
+		if (!x(n2 == ffutf8_to_utf16(NULL, 0, buf, &len2, FFU_FWHOLE | FFU_UTF16BE)))
+			return;
+		len2 = len;
+		n = ffutf8_to_utf16(out, sizeof(out), buf, &len2, FFU_FWHOLE | FFU_UTF16BE);
+		if (!x(n == n2 && !memcmp(out, out2, n)))
+			return;
+	}
+}
+
 static void test_utf(void)
 {
 	char utf8[FFUTF8_MAXCHARLEN];
@@ -763,6 +996,8 @@ static void test_utf(void)
 	x(4 == ffutf8_to_utf16(utf16, sizeof(utf16), "\xd1\x8f\xd1\x8f", &r, FFU_FWHOLE | FFU_UTF16BE)
 		&& r == 4);
 	x(!memcmp(utf16, "\x04\x4f\x04\x4f", 4));
+
+	test_utf_simd();
 }
 
 static void test_str_fromsize(void)
@@ -970,6 +1205,7 @@ int test_str()
 	test_inttostr();
 	test_strtoint();
 	test_strtoflt();
+	test_flttostr();
 	test_strf();
 	test_fmatch();
 	test_arr();
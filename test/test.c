@@ -146,16 +146,38 @@ FF_EXTN int test_regex(void);
 FF_EXTN int test_num(void);
 extern int test_sort(void);
 FF_EXTN int test_inchk_speed(void);
+extern int test_url_speed(void);
 FF_EXTN int test_cue(void);
 extern int test_iso(void);
 extern int test_tls(void);
+extern int test_tls_sni_speed(void);
 extern int test_webskt(void);
+extern int test_webskt_mask_speed(void);
+extern int test_webskt_deflate_speed(void);
 extern int test_path(void);
 extern int test_bits(void);
 extern int test_sig(void);
 extern void test_conf_write(void);
 extern void test_dns_client(void);
+extern void test_dns_client_load(void);
+extern void test_dns_client_tcp(void);
 extern int test_cache(void);
+extern int test_lpm(void);
+extern int test_lpm_speed(void);
+extern int test_http_server(void);
+extern int test_http_server_speed(void);
+extern int test_http_chunked_speed(void);
+extern int test_json_tape_speed(void);
+extern int test_ndjson(void);
+extern int test_ndjson_speed(void);
+extern int test_json_schem_speed(void);
+extern int test_conf_cache_speed(void);
+extern int test_xml(void);
+extern int test_xml_speed(void);
+extern int test_csv(void);
+extern int test_csv_speed(void);
+extern int test_regex_dfa(void);
+extern int test_regex_speed(void);
 
 struct test_s {
 	const char *nm;
@@ -171,7 +193,14 @@ static const struct test_s _fftests[] = {
 	, F(json), F(conf), F(conf_write), F(args), F(cue),
 	F(iso),
 	F(dns_client),
+	F(dns_client_tcp),
 	F(cache),
+	F(lpm),
+	F(http_server),
+	F(ndjson),
+	F(xml),
+	F(csv),
+	F(regex_dfa),
 };
 #undef F
 
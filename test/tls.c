@@ -4,6 +4,8 @@ Copyright (c) 2018 Simon Zolin
 
 #include <FFOS/test.h>
 #include <FF/net/tls.h>
+#include <FF/number.h>
+#include <FF/time.h>
 
 #define x FFTEST_BOOL
 
@@ -72,6 +74,108 @@ static const char tls13_serverhello[] =
 "\x1c\x44\x1e\x22\x98\x7a\x46\x08\x31\x8e\x98\xc1\x0f\x11\x01\x41"
 "\xc8\xe9\xed\x72\xf8\x64\x76\x3c\x65\x00\x2b\x00\x02\x7f\x17";
 
+static const char tls13_clienthello_ja3[] =
+"771,4865-4867-4866-49195-49199-52393-52392-49196-49200-49171-49172-47-53"
+",0-23-65281-10-11-35-16-5-51-43-13-45-21,29-23-24-25-256-257,0";
+
+static const char tls13_clienthello_ja4r[] =
+"t00d1313h2"
+"_002f,0035,1301,1302,1303,c013,c014,c02b,c02c,c02f,c030,cca8,cca9"
+"_0005,000a,000b,000d,0015,0017,0023,002b,002d,0033,ff01"
+"_0403,0503,0603,0804,0805,0806,0401,0501,0601,0203,0201";
+
+/* Split Client Hello into 2 records */
+static size_t tls_hello_split(char *dst, const char *hello, size_t len, size_t at)
+{
+	size_t n = len - 5;
+	ffmemcpy(dst, hello, 5);
+	ffint_hton16(dst + 3, at);
+	ffmemcpy(dst + 5, hello + 5, at);
+	ffmemcpy(dst + 5 + at, hello, 5);
+	ffint_hton16(dst + 5 + at + 3, n - at);
+	ffmemcpy(dst + 5 + at + 5, hello + 5 + at, n - at);
+	return len + 5;
+}
+
+static void test_tls_peek(void)
+{
+	fftls_hello h;
+	char buf[1024], rec[1024], fp[1024];
+	size_t n;
+
+	x(FFTLS_RMORE == fftls_peek_hello(&h, tls13_clienthello, 4, NULL, 0));
+	x(FFTLS_RMORE == fftls_peek_hello(&h, tls13_clienthello, 100, NULL, 0));
+	x(FFTLS_RERR == fftls_peek_hello(&h, "\x17\x03\x03\x00\x01\x00", 6, NULL, 0));
+
+	x(FFTLS_RCLIENT_HELLO == fftls_peek_hello(&h, tls13_clienthello, FFSLEN(tls13_clienthello), NULL, 0));
+	x(h.size == FFSLEN(tls13_clienthello));
+	x(h.version == 0x0303);
+	x(h.max_version == 0x7f17);
+	x(ffstr_eq(&h.session_id, tls13_clienthello_sessiondata, FFSLEN(tls13_clienthello_sessiondata)));
+	x(ffstr_eq(&h.ciphers, tls13_clienthello_ciphers, FFSLEN(tls13_clienthello_ciphers)));
+	x(ffstr_eqz(&h.hostname, "www.google.com"));
+	x(ffstr_eq(&h.alpn_protos, tls13_clienthello_alpn, FFSLEN(tls13_clienthello_alpn)));
+
+	n = fftls_ja3(&h, fp, sizeof(fp));
+	x(n == FFSLEN(tls13_clienthello_ja3) && !memcmp(fp, tls13_clienthello_ja3, n));
+	x(0 == fftls_ja3(&h, fp, 20));
+	n = fftls_ja4r(&h, fp, sizeof(fp));
+	x(n == FFSLEN(tls13_clienthello_ja4r) && !memcmp(fp, tls13_clienthello_ja4r, n));
+	x(0 == fftls_ja4r(&h, fp, 40));
+
+	// handshake message is split into 2 records;  the first one is split even inside the header
+	static const uint splits[] = { 2, 100, 400 };
+	for (uint i = 0;  i != FFCNT(splits);  i++) {
+		n = tls_hello_split(rec, tls13_clienthello, FFSLEN(tls13_clienthello), splits[i]);
+		x(FFTLS_RMORE == fftls_peek_hello(&h, rec, n - 1, buf, sizeof(buf)));
+		x(FFTLS_RERR == fftls_peek_hello(&h, rec, n, NULL, 0));
+		x(FFTLS_RCLIENT_HELLO == fftls_peek_hello(&h, rec, n, buf, sizeof(buf)));
+		x(h.size == n);
+		x(ffstr_eqz(&h.hostname, "www.google.com"));
+		x(fftls_ja3(&h, fp, sizeof(fp)) == FFSLEN(tls13_clienthello_ja3));
+	}
+}
+
+static void test_tls_sniroute(void)
+{
+	fftls_sniroute sr;
+	static const char *const names[] = {
+		"example.com", "*.example.com", "www.example.com", "*.a.example.com", "Host.Org.",
+	};
+	ffstr nm[FFCNT(names)];
+	void *vals[FFCNT(names)];
+	for (uint i = 0;  i != FFCNT(names);  i++) {
+		ffstr_setz(&nm[i], names[i]);
+		vals[i] = (void*)(size_t)(i + 1);
+	}
+
+	x(0 == fftls_sniroute_init(&sr, nm, vals, FFCNT(names)));
+	sr.dflt = (void*)100;
+	x((void*)1 == fftls_sniroute_find(&sr, FFSTR("example.com")));
+	x((void*)1 == fftls_sniroute_find(&sr, FFSTR("EXAMPLE.com.")));
+	x((void*)3 == fftls_sniroute_find(&sr, FFSTR("www.example.com")));
+	x((void*)2 == fftls_sniroute_find(&sr, FFSTR("mail.example.com")));
+	x((void*)2 == fftls_sniroute_find(&sr, FFSTR("x.www.example.com")));
+	x((void*)4 == fftls_sniroute_find(&sr, FFSTR("x.a.example.com")));
+	x((void*)4 == fftls_sniroute_find(&sr, FFSTR("y.x.A.example.com")));
+	x((void*)2 == fftls_sniroute_find(&sr, FFSTR("a.example.com")));
+	x((void*)5 == fftls_sniroute_find(&sr, FFSTR("host.org")));
+	x((void*)100 == fftls_sniroute_find(&sr, FFSTR("example.org")));
+	x((void*)100 == fftls_sniroute_find(&sr, FFSTR("")));
+	fftls_sniroute_free(&sr);
+
+	// no names:  the default value is returned
+	x(0 == fftls_sniroute_init(&sr, NULL, NULL, 0));
+	sr.dflt = (void*)100;
+	x((void*)100 == fftls_sniroute_find(&sr, FFSTR("example.com")));
+	fftls_sniroute_free(&sr);
+
+	ffstr_setz(&nm[2], "Example.com");
+	x(3 == fftls_sniroute_init(&sr, nm, vals, FFCNT(names)));
+	ffstr_setz(&nm[2], "*");
+	x(3 == fftls_sniroute_init(&sr, nm, vals, FFCNT(names)));
+}
+
 int test_tls(void)
 {
 	FFTEST_FUNC;
@@ -116,5 +220,101 @@ int test_tls(void)
 	x(FFTLS_RDONE == fftls_read(&tls));
 	x(fftls_ver(&tls) == 0x7f17);
 
+	test_tls_peek();
+	test_tls_sniroute();
+	return 0;
+}
+
+/* Build Client Hello with SNI, ALPN and a few other extensions */
+static size_t tls_hello_build(char *buf, const char *host, uint seed)
+{
+	char *p = buf;
+	size_t hl = ffsz_len(host);
+	p = ffmem_copycz(p, "\x16\x03\x01\x00\x00" "\x01\x00\x00\x00" "\x03\x03");
+	for (uint i = 0;  i != 32;  i++) {
+		*p++ = seed + i;
+	}
+	p = ffmem_copycz(p, "\x00" "\x00\x08\x13\x01\x13\x02\xc0\x2b\xc0\x2f" "\x01\x00");
+	char *exts = p;
+	p += 2;
+
+	ffint_hton16(p, 0);  ffint_hton16(p + 2, hl + 5);  ffint_hton16(p + 4, hl + 3);
+	p[6] = 0;  ffint_hton16(p + 7, hl);
+	p = ffmem_copy(p + 9, host, hl);
+	p = ffmem_copycz(p, "\x00\x10\x00\x0e\x00\x0c\x02h2\x08http/1.1");
+	p = ffmem_copycz(p, "\x00\x0a\x00\x06\x00\x04\x00\x1d\x00\x17");
+	p = ffmem_copycz(p, "\x00\x2b\x00\x05\x04\x03\x04\x03\x03");
+	p = ffmem_copycz(p, "\x00\x0d\x00\x06\x00\x04\x04\x03\x08\x04");
+
+	ffint_hton16(exts, p - exts - 2);
+	ffint_hton16(buf + 3, p - buf - 5);
+	ffint_hton24(buf + 6, p - buf - 9);
+	return p - buf;
+}
+
+/** Parse Client Hello, compute fingerprint and route it by SNI. */
+int test_tls_sni_speed(void)
+{
+	enum { NHOSTS = 1000, NDOMAINS = 50, NHELLO = 4096, ITERS = 256 };
+	ffarr names = {}, corpus = {};
+	ffstr *nm = ffmem_tcalloc(ffstr, NHOSTS + NDOMAINS);
+	void **vals = ffmem_tcalloc(void*, NHOSTS + NDOMAINS);
+	size_t *off = ffmem_tcalloc(size_t, NHELLO + 1);
+	x(nm != NULL && vals != NULL && off != NULL);
+	ffarr_alloc(&names, (NHOSTS + NDOMAINS) * 32);
+	ffarr_alloc(&corpus, NHELLO * 256);
+
+	for (uint i = 0;  i != NHOSTS + NDOMAINS;  i++) {
+		char *p = ffarr_end(&names);
+		if (i < NHOSTS)
+			names.len += ffs_fmt(p, ffarr_edge(&names), "www.site%u.org", i);
+		else
+			names.len += ffs_fmt(p, ffarr_edge(&names), "*.svc%u.example.com", i - NHOSTS);
+		ffstr_set(&nm[i], p, ffarr_end(&names) - p);
+		vals[i] = (void*)(size_t)(i + 1);
+	}
+	fftls_sniroute sr;
+	x(0 == fftls_sniroute_init(&sr, nm, vals, NHOSTS + NDOMAINS));
+
+	// 3/4 of the hosts are exact names, others match wildcards
+	for (uint i = 0;  i != NHELLO;  i++) {
+		char host[64];
+		if (i % 4 != 3)
+			ffs_fmt(host, host + sizeof(host), "www.site%u.org%Z", (i * 7) % NHOSTS);
+		else
+			ffs_fmt(host, host + sizeof(host), "node%u.svc%u.example.com%Z", i, i % NDOMAINS);
+		off[i] = corpus.len;
+		corpus.len += tls_hello_build(ffarr_end(&corpus), host, i);
+	}
+	off[NHELLO] = corpus.len;
+
+	fftime start, stop;
+	uint found = 0;
+	char fp[512];
+	fftime_now(&start);
+	for (uint k = 0;  k != ITERS;  k++) {
+		for (uint i = 0;  i != NHELLO;  i++) {
+			fftls_hello h;
+			if (FFTLS_RCLIENT_HELLO != fftls_peek_hello(&h, corpus.ptr + off[i], off[i + 1] - off[i], NULL, 0))
+				break;
+			fftls_ja3(&h, fp, sizeof(fp));
+			if (NULL != fftls_sniroute_find(&sr, h.hostname.ptr, h.hostname.len))
+				found++;
+		}
+	}
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	x(found == NHELLO * ITERS);
+
+	uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "TLS SNI routing: %u Client Hello in %Uus: %U/sec\n"
+		, NHELLO * ITERS, us, (uint64)NHELLO * ITERS * 1000000 / ffmax(us, 1));
+
+	fftls_sniroute_free(&sr);
+	ffarr_free(&names);
+	ffarr_free(&corpus);
+	ffmem_free(nm);
+	ffmem_free(vals);
+	ffmem_free(off);
 	return 0;
 }
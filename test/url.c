@@ -8,6 +8,8 @@ Copyright (c) 2013 Simon Zolin
 #include <FFOS/random.h>
 #include <FF/net/url.h>
 #include <FF/data/parse.h>
+#include <FF/time.h>
+#include <test/all.h>
 
 
 #define x FFTEST_BOOL
@@ -280,6 +282,290 @@ static int test_qs_parse(void)
 	return 0;
 }
 
+/* Parse URL by feeding the data byte by byte: the state machine does all the work */
+static int url_parse_bytes(ffurl *u, const char *s, size_t len)
+{
+	int r = FFURL_EMORE;
+	ffurl_init(u);
+	for (size_t i = 1;  i <= len;  i++) {
+		r = ffurl_parse(u, s, i);
+		if (!(r == FFURL_EOK || r == FFURL_EMORE))
+			break;
+	}
+	return r;
+}
+
+static int url_eq(const ffurl *a, const ffurl *b, int r)
+{
+	return a->offhost == b->offhost && a->port == b->port
+		&& a->hostlen == b->hostlen && a->portlen == b->portlen
+		&& a->len == b->len
+		&& (a->offpath == b->offpath || r == FFURL_EMORE) // not updated while there's more data
+		&& a->pathlen == b->pathlen && a->decoded_pathlen == b->decoded_pathlen
+		&& a->idx == b->idx && a->ipv4 == b->ipv4 && a->ipv6 == b->ipv6
+		&& a->querystr == b->querystr && a->complex == b->complex;
+}
+
+/* Random URL-like data */
+static size_t url_gen(char *buf, size_t cap)
+{
+	static const char *const parts[] = {
+		"http://", "https://", "host", "www.example.com", "127.0.0.1", "10.0", "[::1]", ":", ":8080", ":99999",
+		"/", "/", "/", "//", "/.", "/..", ".", "path", "long-path-segment_0123456789", "%20", "%2f", "%2", "%zz", "%",
+		"?", "?q=1&b=2", "&", "=", "+", "#", " ", " HTTP/1.1\r\n", "\x00", "\x7f", "\xd1\x8f", "\t", "-", "_", "[", "]", "a", "0",
+	};
+	size_t n = 0;
+	uint k = ffrnd_get() % 12;
+	for (uint i = 0;  i != k;  i++) {
+		const char *p = parts[ffrnd_get() % FFCNT(parts)];
+		size_t len = ffsz_len(p);
+		if (n + len > cap)
+			break;
+		memcpy(buf + n, p, len);
+		n += len;
+	}
+	return n;
+}
+
+/* The plain version of ffuri_decode() without path normalization */
+static size_t uri_decode_ref(char *dst, size_t cap, const char *d, size_t len, uint flags)
+{
+	size_t n = 0;
+	for (size_t i = 0;  i != len && n != cap;  i++) {
+		if (d[i] == '%') {
+			if (i + 2 >= len)
+				return 0;
+			int h = ffchar_tohex(d[i + 1]), l = ffchar_tohex(d[i + 2]);
+			if (h < 0 || l < 0 || (h | l) == 0)
+				return 0;
+			dst[n++] = (h << 4) | l;
+			i += 2;
+		} else if ((flags & FFURI_DEC_HTTPREQ) && (ffchar_isansiwhite(d[i]) || d[i] == '#'))
+			return 0;
+		else
+			dst[n++] = d[i];
+	}
+	return n;
+}
+
+/* Return the number of key-value pairs; sequence of keys and values is written to 'out' */
+static uint qs_parse_all(const char *d, size_t len, size_t step, ffarr *out)
+{
+	ffurlqs p;
+	uint n = 0;
+	ffurlqs_parseinit(&p);
+	ffarr_free(out);
+	while (len != 0) {
+		size_t k = ffmin(step, len);
+		int r = ffurlqs_parse(&p, d, &k);
+		d += k;
+		len -= k;
+		if (r == FFPARS_KEY || (r == FFPARS_VAL && (len == 0 || d[-1] == '&'))) {
+			ffarr_append(out, p.val.ptr, p.val.len);
+			ffarr_append(out, "\n", 1);
+			n++;
+		}
+	}
+	ffurlqs_parseclose(&p);
+	return n;
+}
+
+/* The result of vectorized parsers must be the same as of byte-by-byte processing */
+static void test_url_fuzz(void)
+{
+	FFTEST_FUNC;
+	char buf[256], dec[256], dec2[256];
+	ffurl u, u2;
+	ffarr qs = {}, qs2 = {};
+
+	for (uint i = 0;  i != 200000;  i++) {
+		size_t n = url_gen(buf, sizeof(buf));
+
+		ffurl_init(&u);
+		int r = ffurl_parse(&u, buf, n);
+		int r2 = url_parse_bytes(&u2, buf, n);
+		if (!x(r == r2 && url_eq(&u, &u2, r)))
+			fffile_fmt(ffstdout, NULL, "url: '%*s': %d/%d\n", n, buf, r, r2);
+
+		uint flags = (i & 1) ? FFURI_DEC_HTTPREQ : 0;
+		size_t cap = (i & 2) ? sizeof(dec) : ffrnd_get() % (n + 1);
+		size_t nd = ffuri_decode(dec, cap, buf, n, flags);
+		size_t nd2 = uri_decode_ref(dec2, cap, buf, n, flags);
+		if (!x(nd == nd2 && !ffmemcmp(dec, dec2, nd)))
+			fffile_fmt(ffstdout, NULL, "decode: '%*s': %L/%L\n", n, buf, nd, nd2);
+
+		if (NULL == memchr(buf, '%', n)) {
+			// %XX can't be split between chunks
+			uint nqs = qs_parse_all(buf, n, n, &qs);
+			uint nqs2 = qs_parse_all(buf, n, 1, &qs2);
+			x(nqs == nqs2 && ffstr_eq2(&qs, &qs2));
+		}
+	}
+
+	ffarr_free(&qs);
+	ffarr_free(&qs2);
+}
+
+/* Checksum of 16-bit words in network byte order */
+static uint inchk_ref(const byte *d, size_t len)
+{
+	uint64 sum = 0;
+	for (size_t i = 0;  i < len;  i += 2) {
+		sum += (d[i] << 8) | ((i + 1 < len) ? d[i + 1] : 0);
+	}
+	while (sum >> 16)
+		sum = (sum >> 16) + (sum & 0xffff);
+	return ~sum & 0xffff;
+}
+
+static void test_inchk(void)
+{
+	FFTEST_FUNC;
+	enum { CAP = 70000 };
+	byte *d = ffmem_alloc(CAP);
+	x(d != NULL);
+	for (uint i = 0;  i != CAP;  i++) {
+		d[i] = ffrnd_get();
+	}
+
+	// SIMD code paths with any length and alignment
+	for (uint len = 0;  len != 600;  len++) {
+		for (uint off = 0;  off != 4;  off++) {
+			byte crc[2];
+			ffint_set_unaligned16(crc, ffip_chksum(d + off, len));
+			if (!x(ffint_ntoh16(crc) == inchk_ref(d + off, len)))
+				goto end;
+		}
+	}
+	static const uint lens[] = { 1499, 1500, 9000, 65535, CAP - 1 };
+	for (uint i = 0;  i != FFCNT(lens);  i++) {
+		byte crc[2];
+		ffint_set_unaligned16(crc, ffip_chksum(d + 1, lens[i]));
+		x(ffint_ntoh16(crc) == inchk_ref(d + 1, lens[i]));
+	}
+
+	// partial sums
+	uint sum = ffip_sum(d, 1000, 0);
+	sum = ffip_sum(d + 1000, 501, sum);
+	x(ffip_sum_fold(sum) == ffip_chksum(d, 1501));
+
+	// all 0xff
+	ffmem_fill(d, 0xff, 1000);
+	x(0 == ffip_chksum(d, 1000));
+
+end:
+	ffmem_free(d);
+}
+
+/* Get packets from pcap data */
+static uint pcap_read(const char *data, size_t len, const void **pkts, uint *lens, uint cap)
+{
+	uint n = 0;
+	if (len < 24 || ffint_ltoh32(data) != 0xa1b2c3d4)
+		return 0;
+
+	for (size_t off = 24;  off + 16 <= len && n != cap;  n++) {
+		uint caplen = ffint_ltoh32(data + off + 8);
+		if (off + 16 + caplen > len)
+			break;
+		pkts[n] = data + off + 16;
+		lens[n] = caplen;
+		off += 16 + caplen;
+	}
+	return n;
+}
+
+static void test_pkt(void)
+{
+	FFTEST_FUNC;
+	char buf[4096];
+	const void *pkts[16];
+	uint lens[16];
+	ffpkt_burst b;
+
+	size_t n = _test_readfile(TESTDATADIR "/packets.pcap", buf, sizeof(buf));
+	x(10 == pcap_read(buf, n, pkts, lens, 16));
+	x(10 == ffpkt_parse_burst(&b, pkts, lens, 10, FFPKT_VERIFY_CHKSUM));
+
+	// IPv4 TCP SYN
+	x(b.flags[0] == (FFPKT_IP4 | FFPKT_TCP));
+	x(b.eth_type[0] == FFETH_IP4 && b.vlan[0] == 0);
+	x(b.l3_off[0] == 14 && b.l4_off[0] == 34 && b.data_off[0] == 58 && b.data_len[0] == 0);
+	x(b.sport[0] == 40000 && b.dport[0] == 443 && b.tcp_flags[0] == FFTCP_SYN);
+	x(!ffmemcmp(&b.ip4_src[0], "\xc0\xa8\x01\x0a", 4));
+	// IPv4 UDP
+	x(b.flags[1] == (FFPKT_IP4 | FFPKT_UDP));
+	x(b.dport[1] == 53 && b.data_off[1] == 42 && b.data_len[1] == 29);
+	// VLAN, IPv4 UDP
+	x(b.flags[2] == (FFPKT_IP4 | FFPKT_UDP));
+	x(b.vlan[2] == 100 && b.l3_off[2] == 18 && b.data_len[2] == 5);
+	// IPv6 TCP
+	x(b.flags[3] == (FFPKT_IP6 | FFPKT_TCP));
+	x(b.l4_off[3] == 54 && b.dport[3] == 80 && b.data_len[3] == 37);
+	// IPv6 hop-by-hop options, UDP
+	x(b.flags[4] == (FFPKT_IP6 | FFPKT_UDP));
+	x(b.l4_off[4] == 62 && b.sport[4] == 546 && b.dport[4] == 547);
+	// IPv4 fragment
+	x(b.flags[5] == (FFPKT_IP4 | FFPKT_FRAG) && b.l4_off[5] == 0 && b.l4_proto[5] == FFIP_UDP);
+	// ICMP
+	x(b.flags[6] == (FFPKT_IP4 | FFPKT_ICMP));
+	// ARP
+	x(b.flags[7] == 0 && b.eth_type[7] == FFETH_ARP);
+	// truncated
+	x(b.flags[8] == FFPKT_EBAD);
+	// bad IP header checksum
+	x(b.flags[9] == (FFPKT_IP4 | FFPKT_TCP | FFPKT_ECHKSUM));
+
+	// verify L4 checksums
+	for (uint i = 0;  i != b.n;  i++) {
+		const byte *p = pkts[i];
+		if (b.l4_off[i] == 0)
+			continue;
+		uint l4len = lens[i] - b.l4_off[i];
+		if (b.flags[i] & FFPKT_ICMP)
+			x(0 == ffip_chksum(p + b.l4_off[i], l4len));
+		else if (b.flags[i] & FFPKT_IP4)
+			x(0 == ffip4_l4_chksum((void*)(p + b.l3_off[i]), p + b.l4_off[i], l4len));
+		else
+			x(0 == ffip6_l4_chksum((void*)(p + b.l3_off[i]), b.l4_proto[i], p + b.l4_off[i], l4len));
+	}
+
+	// NAT: rewrite source address and port, update checksums incrementally
+	{
+	byte pkt[128];
+	ffmemcpy(pkt, pkts[0], lens[0]);
+	ffip4hdr *ip = (void*)(pkt + 14);
+	fftcphdr *tcp = (void*)(pkt + 34);
+	uint oldaddr = ffint_unaligned32(&ip->saddr), newaddr;
+	ffmemcpy(&newaddr, "\xcb\x00\x71\x05", 4);
+	uint oldport = (ushort)ffint_unaligned16(tcp->sport);
+	uint newport = ffhton16(61000);
+
+	ffint_set_unaligned32(&ip->saddr, newaddr);
+	ffint_set_unaligned16(ip->crc, ffip_chksum_update32((ushort)ffint_unaligned16(ip->crc), oldaddr, newaddr));
+	ffint_set_unaligned16(tcp->sport, newport);
+	uint crc = (ushort)ffint_unaligned16(tcp->crc);
+	crc = ffip_chksum_update32(crc, oldaddr, newaddr);
+	crc = ffip_chksum_update16(crc, oldport, newport);
+	ffint_set_unaligned16(tcp->crc, crc);
+
+	x(0 == ffip4_chksum(ip, ip->ihl));
+	x(0 == ffip4_l4_chksum(ip, tcp, lens[0] - 34));
+	}
+
+	{
+	byte pkt[128];
+	ffmemcpy(pkt, pkts[3], lens[3]);
+	ffip6hdr *ip = (void*)(pkt + 14);
+	fftcphdr *tcp = (void*)(pkt + 54);
+	ffip6 old = ip->saddr;
+	x(0 == ffip6_parse(&ip->saddr, FFSTR("2001:db8:ffff::1234")));
+	uint crc = ffip_chksum_update((ushort)ffint_unaligned16(tcp->crc), &old, &ip->saddr, sizeof(ffip6));
+	ffint_set_unaligned16(tcp->crc, crc);
+	x(0 == ffip6_l4_chksum(ip, FFIP_TCP, tcp, lens[3] - 54));
+	}
+}
+
 static void test_eth(void)
 {
 	FFTEST_FUNC;
@@ -525,6 +811,9 @@ int test_url()
 	}
 
 	test_urldecode();
+	test_url_fuzz();
+	test_inchk();
+	test_pkt();
 	test_ip4();
 	test_ip6();
 	test_addr();
@@ -534,10 +823,114 @@ int test_url()
 	return 0;
 }
 
+int test_url_speed(void)
+{
+	FFTEST_FUNC;
+	static const char *const urls[] = {
+		"/api/v1/users/12345/profile?fields=name,email,avatar&lang=en HTTP/1.1\r\n",
+		"http://www.example.com:8080/static/js/vendor/app.bundle.min.js?v=3.2.1 HTTP/1.1\r\n",
+		"/download/My%20Documents/report%202018.pdf HTTP/1.1\r\n",
+	};
+	enum { N = 1000000 };
+	fftime start, stop;
+	uint64 us, total = 0;
+	ffurl u;
+	uint r = 0;
+
+	for (uint k = 0;  k != 2;  k++) {
+		fftime_now(&start);
+		for (uint i = 0;  i != N;  i++) {
+			const char *s = urls[i % FFCNT(urls)];
+			size_t n = ffsz_len(s);
+			ffurl_init(&u);
+			if (k == 1)
+				ffurl_parse(&u, s, 1); // the rest is processed by the state machine
+			r += ffurl_parse(&u, s, n);
+			total += n;
+		}
+		fftime_now(&stop);
+		fftime_diff(&start, &stop);
+		us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+		fffile_fmt(ffstdout, NULL, "ffurl_parse(%s): %u URLs in %Uus: %U URLs/sec, %U MB/sec\n"
+			, (k == 0) ? "one pass" : "state machine", N, us
+			, (uint64)N * 1000000 / ffmax(us, 1), total / ffmax(us, 1));
+		total = 0;
+	}
+
+	{
+	enum { LEN = 1024 };
+	char *d = ffmem_alloc(LEN), *dst = ffmem_alloc(LEN);
+	for (uint i = 0;  i != LEN;  i++) {
+		d[i] = 'a' + i % 26;
+	}
+	for (uint i = 64;  i < LEN - 3;  i += 128) {
+		ffmemcpy(d + i, "%2F", 3);
+	}
+	fftime_now(&start);
+	for (uint i = 0;  i != N;  i++) {
+		r += ffuri_decode(dst, LEN, d, LEN, FFURI_DEC_HTTPREQ);
+	}
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "ffuri_decode: %u * %ubytes in %Uus: %U MB/sec (%u)\n"
+		, N, LEN, us, (uint64)N * LEN / ffmax(us, 1), r);
+	ffmem_free(d);
+	ffmem_free(dst);
+	}
+	return 0;
+}
+
 int test_inchk_speed(void)
 {
 	FFTEST_FUNC;
 
+	{
+	enum { N = 1000000, PKTLEN = 1500 };
+	char *d = ffmem_alloc(PKTLEN);
+	for (uint i = 0;  i != PKTLEN;  i++) {
+		d[i] = ffrnd_get();
+	}
+	fftime start, stop;
+	fftime_now(&start);
+	uint r = 0;
+	for (uint i = 0;  i != N;  i++) {
+		r += ffip_chksum(d + (i & 1), PKTLEN - 1);
+	}
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "checksum: %u * %ubytes in %Uus: %U MB/sec (%xu)\n"
+		, N, PKTLEN, us, (uint64)N * PKTLEN / ffmax(us, 1), r);
+	ffmem_free(d);
+	}
+
+	{
+	char buf[4096];
+	const void *pkts[FFPKT_BURST_MAX];
+	uint lens[FFPKT_BURST_MAX];
+	size_t n = _test_readfile(TESTDATADIR "/packets.pcap", buf, sizeof(buf));
+	uint npkts = pcap_read(buf, n, pkts, lens, 16);
+	for (uint i = npkts;  i != FFPKT_BURST_MAX;  i++) {
+		pkts[i] = pkts[i % npkts];
+		lens[i] = lens[i % npkts];
+	}
+
+	enum { N = 200000 };
+	ffpkt_burst b;
+	fftime start, stop;
+	fftime_now(&start);
+	uint r = 0;
+	for (uint i = 0;  i != N;  i++) {
+		r += ffpkt_parse_burst(&b, pkts, lens, FFPKT_BURST_MAX, FFPKT_VERIFY_CHKSUM);
+	}
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "burst parse: %u packets in %Uus: %U packets/sec\n"
+		, r, us, (uint64)r * 1000000 / ffmax(us, 1));
+	}
+
 	ffarr m = {0};
 	ffarr_alloc(&m, 20);
 
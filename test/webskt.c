@@ -3,6 +3,7 @@ Copyright (c) 2018 Simon Zolin
 */
 
 #include <FF/net/websocket.h>
+#include <FF/time.h>
 #include <FFOS/test.h>
 
 #define x FFTEST_BOOL
@@ -61,9 +62,425 @@ static void test_webskt_writer()
 	x(FFWEBSKT_RDATA_FIN == ffwebskt_writenext(&w));
 }
 
+/* Byte-wise reference implementation */
+static void xor4_ref(byte *dst, const byte *src, size_t len, uint key, uint off)
+{
+	const byte *k = (byte*)&key;
+	for (size_t i = 0;  i != len;  i++) {
+		dst[i] = src[i] ^ k[(off + i) % 4];
+	}
+}
+
+static void test_webskt_xor4()
+{
+	byte src[300], dst[300], ref[300];
+	uint key = 0xe5a7b129;
+	for (uint i = 0;  i != sizeof(src);  i++) {
+		src[i] = i * 7;
+	}
+
+	// unaligned starts and arbitrary lengths
+	for (uint start = 0;  start != 8;  start++) {
+		for (uint n = 0;  n + start <= 280;  n += 1 + n / 8) {
+			xor4_ref(ref, src + start, n, key, 0);
+			ffmem_xor4(dst + (start ^ 3), src + start, n, key);
+			x(!memcmp(dst + (start ^ 3), ref, n));
+		}
+	}
+
+	// data split at any position:  the returned key continues the first part
+	xor4_ref(ref, src, 290, key, 0);
+	for (uint n = 0;  n != 290;  n++) {
+		uint k = ffmem_xor4(dst, src, n, key);
+		ffmem_xor4(dst + n, src + n, 290 - n, k);
+		x(!memcmp(dst, ref, 290));
+	}
+
+	// in-place
+	ffmemcpy(dst, src, 290);
+	ffmem_xor4(dst + 1, dst + 1, 289, key);
+	xor4_ref(ref, src + 1, 289, key, 0);
+	x(!memcmp(dst + 1, ref, 289));
+}
+
+/* Masked frame received in small pieces, unmasked in the parser's buffer and in place */
+static void test_webskt_reader_masked()
+{
+	char frame[8], data[200];
+	uint key = 0x29b117e5;
+	frame[0] = (char)0x82, frame[1] = (char)(0x80 | 126);
+	frame[2] = 0, frame[3] = (char)sizeof(data);
+	ffmemcpy(frame + 4, &key, 4);
+	for (uint i = 0;  i != sizeof(data);  i++) {
+		data[i] = i;
+	}
+	ffarr out = {};
+	ffarr_alloc(&out, sizeof(data));
+
+	for (uint inplace = 0;  inplace != 2;  inplace++) {
+		char in[sizeof(frame) + sizeof(data)];
+		ffmemcpy(in, frame, 8);
+		xor4_ref((byte*)in + 8, (byte*)data, sizeof(data), key, 0);
+
+		ffwebskt w = {};
+		w.inplace = inplace;
+		out.len = 0;
+		for (uint off = 0;  off != 8 + sizeof(data);  ) {
+			uint n = ffmin(7, 8 + sizeof(data) - off);
+			ffwebskt_input(&w, in + off, n);
+			off += n;
+			for (;;) {
+				int r = ffwebskt_parse(&w);
+				if (r == FFWEBSKT_RDATA) {
+					if (inplace)
+						x(w.out.ptr >= in && w.out.ptr < in + sizeof(in));
+					ffarr_append(&out, w.out.ptr, w.out.len);
+					continue;
+				} else if (r == FFWEBSKT_RMSG) {
+					x(ffwebskt_datalen(&w) == sizeof(data));
+					continue;
+				}
+				break;
+			}
+		}
+		x(out.len == sizeof(data) && !memcmp(out.ptr, data, sizeof(data)));
+	}
+	ffarr_free(&out);
+}
+
+static void test_webskt_writer_masked()
+{
+	char data[5000], in[5000];
+	uint key = 0x11223344;
+	for (uint i = 0;  i != sizeof(data);  i++) {
+		data[i] = i;
+	}
+	ffarr out = {};
+	ffarr_alloc(&out, sizeof(data) + 16);
+
+	for (uint inplace = 0;  inplace != 2;  inplace++) {
+		ffwebskt_cook w = {};
+		w.inplace = inplace;
+		ffmemcpy(in, data, sizeof(data));
+		ffwebskt_input(&w, in, sizeof(in));
+		x(FFWEBSKT_RDATA == ffwebskt_newmsg(&w, key, FFWEBSKT_OP_BIN));
+		x(w.out.len == 2 + 2 + 4
+			&& (byte)w.out.ptr[1] == (0x80 | 126));
+		out.len = 0;
+		int r;
+		while (FFWEBSKT_RDATA == (r = ffwebskt_writenext(&w))) {
+			if (inplace)
+				x(w.out.ptr == in);
+			ffarr_append(&out, w.out.ptr, w.out.len);
+		}
+		x(r == FFWEBSKT_RDATA_FIN);
+		xor4_ref((byte*)data, (byte*)data, sizeof(data), key, 0);
+		x(out.len == sizeof(data) && !memcmp(out.ptr, data, sizeof(data)));
+		xor4_ref((byte*)data, (byte*)data, sizeof(data), key, 0);
+	}
+	ffarr_free(&out);
+}
+
+static void test_webskt_ext()
+{
+	ffwebskt w = {};
+	ffstr ext;
+
+	ffstr_setz(&ext, "x-foo, permessage-deflate; server_max_window_bits=10"
+		", permessage-deflate; client_max_window_bits; client_no_context_takeover");
+	x(0 == ffwebskt_accept_ext(&w, &ext, FFWEBSKT_DEFL_SERV_NOCTX));
+	x(ffstr_eqz(&w.out, "permessage-deflate; server_no_context_takeover; client_no_context_takeover"));
+	x(w.defl_flags == (FFWEBSKT_DEFL_SERV_NOCTX | FFWEBSKT_DEFL_CLI_NOCTX));
+	ffwebskt_close(&w);
+
+	ffwebskt w2 = {};
+	ffstr_setz(&ext, "permessage-deflate; server_no_context_takeover; server_no_context_takeover"
+		", permessage-deflate; foo");
+	x(1 == ffwebskt_accept_ext(&w2, &ext, 0));
+	ffwebskt_close(&w2);
+}
+
+/* Cook a message into 'frame' */
+static void ws_cook(ffwebskt_cook *c, ffarr *frame, const char *data, size_t len, uint mask)
+{
+	frame->len = 0;
+	ffwebskt_input(c, data, len);
+	x(FFWEBSKT_RDATA == ffwebskt_newmsg(c, mask, FFWEBSKT_OP_TEXT));
+	ffarr_append(frame, c->out.ptr, c->out.len);
+	while (FFWEBSKT_RDATA == ffwebskt_writenext(c)) {
+		ffarr_append(frame, c->out.ptr, c->out.len);
+	}
+}
+
+/* Parse messages from 'frame' passed in pieces of 'piece' bytes
+@out: (optional) message bodies */
+static void ws_read(ffwebskt *w, const ffarr *frame, ffarr *out, uint piece)
+{
+	if (out != NULL)
+		out->len = 0;
+	for (size_t off = 0;  off != frame->len;  ) {
+		size_t n = ffmin(piece, frame->len - off);
+		ffwebskt_input(w, frame->ptr + off, n);
+		off += n;
+		for (;;) {
+			int r = ffwebskt_parse(w);
+			if (r == FFWEBSKT_RDATA) {
+				if (out != NULL)
+					ffarr_append(out, w->out.ptr, w->out.len);
+			} else if (r == FFWEBSKT_RERR) {
+				x(0);
+				return;
+			} else if (r != FFWEBSKT_RMSG && r != FFWEBSKT_RDATA_FIN)
+				break;
+		}
+	}
+}
+
+static void test_webskt_deflate()
+{
+	char data[20000];
+	static const char json[] = "{\"key\":\"value\",\"n\":1}";
+	for (uint i = 0;  i != sizeof(data);  i++) {
+		data[i] = json[i % FFSLEN(json)];
+	}
+	ffarr frame = {}, out = {};
+	ffarr_alloc(&frame, sizeof(data) + 64);
+	ffarr_alloc(&out, sizeof(data));
+
+	// client -> server with context takeover
+	ffwebskt_cook c = {};
+	x(0 == ffwebskt_wdeflate_init(&c, 0, 0));
+	ffwebskt w = {};
+	ffstr ext;
+	ffstr_setz(&ext, "permessage-deflate");
+	x(0 == ffwebskt_accept_ext(&w, &ext, 0));
+	size_t first = 0;
+	for (uint i = 0;  i != 3;  i++) {
+		ws_cook(&c, &frame, data, sizeof(data) - i, 0x11223344);
+		if (i == 0)
+			first = frame.len;
+		else
+			x(frame.len < first); //previous message is used as dictionary
+		ws_read(&w, &frame, &out, 13);
+		x(out.len == sizeof(data) - i && !memcmp(out.ptr, data, out.len));
+	}
+	ffwebskt_wclose(&c);
+	ffwebskt_close(&w);
+
+	// server -> 2 clients:  compress once, both clients decompress the same frame
+	ffwebskt_cook bc = {};
+	x(0 == ffwebskt_wdeflate_init(&bc, 0, 1));
+	ffwebskt cl[2] = {};
+	for (uint k = 0;  k != 2;  k++) {
+		x(0 == ffwebskt_inflate_init(&cl[k]));
+	}
+	for (uint i = 0;  i != 2;  i++) {
+		ws_cook(&bc, &frame, data + i, sizeof(data) - i, 0);
+		for (uint k = 0;  k != 2;  k++) {
+			ws_read(&cl[k], &frame, &out, 1000);
+			x(out.len == sizeof(data) - i && !memcmp(out.ptr, data + i, out.len));
+		}
+	}
+	ffwebskt_close(&cl[0]);
+	ffwebskt_close(&cl[1]);
+	ffwebskt_wclose(&bc);
+
+	ffarr_free(&frame);
+	ffarr_free(&out);
+}
+
+static uint bcast_freed;
+static void bcast_onfree(void *udata)
+{
+	bcast_freed++;
+}
+
+static void test_webskt_bcast()
+{
+	static const uint sizes[] = { 5, 200, 70000 };
+	char *data = ffmem_alloc(70000);
+	x(data != NULL);
+	for (uint i = 0;  i != 70000;  i++) {
+		data[i] = i;
+	}
+	ffarr frame = {}, out = {};
+
+	for (uint i = 0;  i != FFCNT(sizes);  i++) {
+		uint n = sizes[i];
+		ffwebskt_bcast *b = ffwebskt_bcast_new(data, n, FFWEBSKT_OP_BIN, 0);
+		x(b != NULL);
+		b->onfree = &bcast_onfree;
+		x(b->iov[1].iov_base == data); //not copied
+
+		// the header is the same as produced by ffwebskt_cook
+		ffwebskt_cook c = {};
+		ffwebskt_input(&c, data, n);
+		x(FFWEBSKT_RDATA == ffwebskt_newmsg(&c, 0, FFWEBSKT_OP_BIN));
+		x(c.out.len == b->iov[0].iov_len && !memcmp(c.out.ptr, b->iov[0].iov_base, c.out.len));
+		x(b->size == c.out.len + n);
+
+		// 2 connections:  one sends everything at once, another one - in pieces
+		ffwebskt_bcast_ref(b);
+		ffiovec iov[2];
+		x(2 == ffwebskt_bcast_iov(b, 0, iov));
+		x(iov[0].iov_len + iov[1].iov_len == b->size);
+
+		frame.len = 0;
+		for (uint64 off = 0;  ;  off += 3) {
+			uint k = ffwebskt_bcast_iov(b, off, iov);
+			if (k == 0)
+				break;
+			ffarr_append(&frame, iov[0].iov_base, ffmin(iov[0].iov_len, 3));
+			if (iov[0].iov_len < 3 && k == 2)
+				ffarr_append(&frame, iov[1].iov_base, ffmin(iov[1].iov_len, 3 - iov[0].iov_len));
+		}
+		x(frame.len == b->size);
+
+		ffwebskt w = {};
+		ws_read(&w, &frame, &out, 1000);
+		x(out.len == n && !memcmp(out.ptr, data, n));
+
+		bcast_freed = 0;
+		ffwebskt_bcast_unref(b);
+		x(bcast_freed == 0);
+		ffwebskt_bcast_unref(b);
+		x(bcast_freed == 1);
+	}
+
+	// compressed, copied payload
+	ffwebskt_cook c = {};
+	x(0 == ffwebskt_wdeflate_init(&c, 0, 1));
+	ffwebskt_bcast *b = ffwebskt_bcast_deflate(&c, data, 70000, FFWEBSKT_OP_BIN);
+	x(b != NULL);
+	x(b->size < 70000);
+	frame.len = 0;
+	ffarr_append(&frame, b->iov[0].iov_base, b->iov[0].iov_len);
+	ffarr_append(&frame, b->iov[1].iov_base, b->iov[1].iov_len);
+	ffwebskt_bcast_unref(b);
+	ffwebskt_wclose(&c);
+	ffwebskt w = {};
+	x(0 == ffwebskt_inflate_init(&w));
+	ws_read(&w, &frame, &out, 1000);
+	x(out.len == 70000 && !memcmp(out.ptr, data, 70000));
+	ffwebskt_close(&w);
+
+	ffarr_free(&frame);
+	ffarr_free(&out);
+	ffmem_free(data);
+}
+
 int test_webskt()
 {
 	test_webskt_reader();
 	test_webskt_writer();
+	test_webskt_xor4();
+	test_webskt_reader_masked();
+	test_webskt_writer_masked();
+	test_webskt_ext();
+	test_webskt_deflate();
+	test_webskt_bcast();
+	return 0;
+}
+
+static uint64 xor4_time_us(const fftime *start)
+{
+	fftime stop;
+	fftime_now(&stop);
+	fftime_diff(start, &stop);
+	return (uint64)fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+}
+
+/** Compare frame masking speed against the byte-wise loop for different frame sizes. */
+int test_webskt_mask_speed()
+{
+	static const uint sizes[] = { 16, 125, 1024, 16*1024, 64*1024, 1024*1024 };
+	const size_t total = 256 * 1024 * 1024;
+	byte *buf = ffmem_alloc(1024 * 1024 + 1);
+	x(buf != NULL);
+	ffmem_zero(buf, 1024 * 1024 + 1);
+	uint key = 0x12345678;
+
+	for (uint i = 0;  i != FFCNT(sizes);  i++) {
+		size_t n = sizes[i], iters = total / n;
+		fftime start;
+
+		fftime_now(&start);
+		for (size_t k = 0;  k != iters;  k++) {
+			xor4_ref(buf + 1, buf + 1, n, key, 0);
+		}
+		uint64 ref = xor4_time_us(&start);
+
+		fftime_now(&start);
+		for (size_t k = 0;  k != iters;  k++) {
+			key = ffmem_xor4(buf + 1, buf + 1, n, key);
+		}
+		uint64 vec = xor4_time_us(&start);
+
+		fffile_fmt(ffstdout, NULL, "webskt mask: frame:%L  bytes:%UMB  loop:%Ums  ffmem_xor4:%Ums  (%U MB/s)\n"
+			, n, (uint64)(iters * n) / (1024 * 1024), ref / 1000, vec / 1000
+			, (uint64)(iters * n) / ffmax(vec, 1));
+	}
+
+	ffmem_free(buf);
+	return 0;
+}
+
+
+/** Measure compression ratio and time per message for JSON-like messages of different size. */
+int test_webskt_deflate_speed()
+{
+	static const uint sizes[] = { 64, 512, 4096, 64*1024 };
+	const uint total = 4 * 1024 * 1024;
+	static const char json[] = "{\"id\":12345,\"user\":\"name0\",\"text\":\"some message\",\"t\":1500000000}";
+	char *data = ffmem_alloc(64 * 1024);
+	x(data != NULL);
+	uint rnd = 1;
+	for (uint i = 0;  i != 64 * 1024;  i++) {
+		char c = json[i % FFSLEN(json)];
+		rnd = rnd * 1103515245 + 12345;
+		if (c >= '0' && c <= '9')
+			c = '0' + (rnd >> 16) % 10;
+		data[i] = c;
+	}
+	ffarr frames = {};
+	ffarr_alloc(&frames, total + total / 8);
+
+	for (uint noctx = 0;  noctx != 2;  noctx++) {
+		for (uint i = 0;  i != FFCNT(sizes);  i++) {
+			ffwebskt_cook c = {};
+			ffwebskt w = {};
+			x(0 == ffwebskt_wdeflate_init(&c, 0, noctx));
+			x(0 == ffwebskt_inflate_init(&w));
+			uint n = sizes[i], nmsg = total / n;
+			uint64 plain = 0;
+			fftime start;
+
+			frames.len = 0;
+			fftime_now(&start);
+			for (uint k = 0;  k != nmsg;  k++) {
+				ffwebskt_input(&c, data + (k * 61) % (64 * 1024 - n + 1), n);
+				ffwebskt_newmsg(&c, 0, FFWEBSKT_OP_TEXT);
+				ffarr_append(&frames, c.out.ptr, c.out.len);
+				while (FFWEBSKT_RDATA == ffwebskt_writenext(&c)) {
+					ffarr_append(&frames, c.out.ptr, c.out.len);
+				}
+				plain += n + 2 + ((n >= 126) ? 2 : 0) + ((n > 0xffff) ? 6 : 0);
+			}
+			uint64 t_defl = xor4_time_us(&start);
+
+			fftime_now(&start);
+			ws_read(&w, &frames, NULL, 64 * 1024);
+			uint64 t_infl = xor4_time_us(&start);
+
+			fffile_fmt(ffstdout, NULL, "webskt deflate: ctx-takeover:%u  msg:%u  sent:%U/%U (-%U%%)  deflate:%Uns/msg  inflate:%Uns/msg\n"
+				, !noctx, n, (uint64)frames.len, plain, 100 - (uint64)frames.len * 100 / plain
+				, t_defl * 1000 / nmsg, t_infl * 1000 / nmsg);
+			ffwebskt_wclose(&c);
+			ffwebskt_close(&w);
+		}
+	}
+
+	ffarr_free(&frames);
+	ffmem_free(data);
 	return 0;
 }
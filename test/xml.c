@@ -0,0 +1,466 @@
+/** Test XML parser.
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/data/xml.h>
+#include <FF/time.h>
+#include <FFOS/test.h>
+#include <test/all.h>
+
+#ifdef FF_TEST_LIBXML2
+#include <libxml/parser.h>
+#endif
+
+#define x FFTEST_BOOL
+
+
+/** Parse data split into 2 parts at 'split' (or byte by byte if 'split' is -1),
+ print the events to 'out'.
+Return enum FFPARS_E. */
+static int xml_trace(ffarr *out, const char *data, size_t len, size_t split)
+{
+	ffxml p;
+	int r = 0;
+	size_t off = 0, end;
+
+	ffxml_parseinit(&p);
+	out->len = 0;
+
+	while (off != len) {
+		if (split == (size_t)-1)
+			end = off + 1;
+		else
+			end = (off < split) ? split : len;
+
+		ffstr d;
+		ffstr_set(&d, data + off, end - off);
+		while (d.len != 0) {
+			const char *ptr = d.ptr;
+			r = ffxml_parsestr(&p, &d);
+			off += d.ptr - ptr;
+
+			switch (r) {
+			case FFPARS_OPEN:
+				x(p.type == FFXML_TTAG);
+				ffstr_catfmt(out, "<%S>", &p.val);
+				break;
+			case FFPARS_KEY:
+				x(p.type == FFXML_TATTR);
+				ffstr_catfmt(out, "%S=", &p.val);
+				break;
+			case FFPARS_VAL:
+				x(p.type == FFXML_TATTRVAL || p.type == FFXML_TTEXT);
+				ffstr_catfmt(out, (p.type == FFXML_TTEXT) ? "[%S]" : "'%S'", &p.val);
+				break;
+			case FFPARS_CLOSE:
+				x(p.type == FFXML_TTAGCLOSE);
+				ffstr_catfmt(out, "</%S>", &p.val);
+				break;
+			case FFPARS_MORE:
+				break;
+			default:
+				ffstr_catfmt(out, "E%d@%u:%u", r, p.line, p.ch);
+				ffxml_parseclose(&p);
+				return r;
+			}
+		}
+	}
+
+	ffxml_parseclose(&p);
+	return 0;
+}
+
+static const char xml_doc[] =
+"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+"<!DOCTYPE note [ <!ENTITY x \"y\"> ]>\n"
+"<!-- comment - with -- dashes -->\n"
+"<root a=\"1\" b = 'x&lt;&#x41;&#66;'>\n"
+"\t<item id=\"1\">text &amp; more</item>\n"
+"\t<empty/><e2 k=\"\" />\n"
+"\t<c><![CDATA[<a>]]]>&gt;]]></c>\n"
+"\tmixed<?pi ?>\n"
+"\t<u>\xd0\x90&#x410;</u>\n"
+"</root >\n";
+
+static const char xml_doc_trace[] =
+"<root>a='1'b='x<AB'"
+"<item>id='1'[text & more]</item>"
+"<empty></empty>"
+"<e2>k=''</e2>"
+"<c>[<a>]>]]>]</c>"
+"[\n\tmixed]"
+"<u>[\xd0\x90\xd0\x90]</u>"
+"</root>";
+
+static void test_xml_tokens(void)
+{
+	ffarr out = {};
+	size_t n = FFSLEN(xml_doc);
+
+	x(0 == xml_trace(&out, xml_doc, n, 0));
+	x(ffstr_eqz(&out, xml_doc_trace));
+
+	// input data is split at every position
+	for (size_t i = 1;  i != n;  i++) {
+		x(0 == xml_trace(&out, xml_doc, n, i));
+		if (!x(ffstr_eqz(&out, xml_doc_trace)))
+			fffile_fmt(ffstdout, NULL, "split at %L: %S\n", i, &out);
+	}
+
+	x(0 == xml_trace(&out, xml_doc, n, (size_t)-1));
+	x(ffstr_eqz(&out, xml_doc_trace));
+
+	// the value points to input data
+	ffxml p;
+	ffstr d;
+	ffxml_parseinit(&p);
+	ffstr_setz(&d, "<a>long text value</a>");
+	x(FFPARS_OPEN == ffxml_parsestr(&p, &d));
+	x(FFPARS_VAL == ffxml_parsestr(&p, &d));
+	x(ffstr_eqz(&p.val, "long text value") && ffxml_val_borrowed(&p));
+	x(FFPARS_CLOSE == ffxml_parsestr(&p, &d));
+	x(p.line == 1 && p.ch == FFSLEN("<a>long text value</a>"));
+	ffxml_parseclose(&p);
+
+	ffarr_free(&out);
+}
+
+static void test_xml_errors(void)
+{
+	static const struct {
+		const char *data;
+		int err;
+		uint line;
+	} errs[] = {
+		{ "<a>\n</b>", FFPARS_EBADBRACE, 2 },
+		{ "</a>", FFPARS_EBADBRACE, 1 },
+		{ "<a b></a>", FFPARS_EKVSEP, 1 },
+		{ "<a b=1></a>", FFPARS_EBADCHAR, 1 },
+		{ "<a b=\"<\"></a>", FFPARS_EBADCHAR, 1 },
+		{ "<a>&unknown;</a>", FFPARS_EESC, 1 },
+		{ "<a>&#0;</a>", FFPARS_EESC, 1 },
+		{ "<a>&ampampampamp;</a>", FFPARS_EESC, 1 },
+		{ "< a/>", FFPARS_EBADCHAR, 1 },
+		{ "<a/ >", FFPARS_EBADCHAR, 1 },
+		{ "<!-x-->", FFPARS_EBADCMT, 1 },
+		{ "<![CDAT[x]]>", FFPARS_EBADCHAR, 1 },
+		{ "text<a/>", FFPARS_EBADCHAR, 1 },
+		{ "<a>&#xD800;</a>", FFPARS_EBADVAL, 1 },
+		{ "<a b='&#57343;'/>", FFPARS_EBADVAL, 1 },
+		{ "<a>&#x110000;</a>", FFPARS_EBADVAL, 1 },
+		{ "<a/>\n<b/>", FFPARS_EBADVAL, 2 },
+		{ "<a></a><!-- c --><a></a>", FFPARS_EBADVAL, 1 },
+	};
+	ffarr out = {};
+	for (uint i = 0;  i != FFCNT(errs);  i++) {
+		int r = xml_trace(&out, errs[i].data, ffsz_len(errs[i].data), 0);
+		if (!x(r == errs[i].err))
+			fffile_fmt(ffstdout, NULL, "%s: %S\n", errs[i].data, &out);
+
+		// the line number is correct after the input is processed in parts
+		ffxml p;
+		ffstr d;
+		ffstr_setz(&d, errs[i].data);
+		ffxml_parseinit(&p);
+		while (d.len != 0 && 0 >= ffxml_parsestr(&p, &d)) {
+		}
+		x(p.line == errs[i].line);
+		ffxml_parseclose(&p);
+	}
+	ffarr_free(&out);
+}
+
+
+struct xml_url {
+	ffstr loc;
+	ffstr lastmod;
+	double prio;
+	uint64 sum;
+};
+
+struct xml_urlset {
+	ffstr ns;
+	uint urls;
+	ffarr text;
+	uint64 sum;
+	struct xml_url url;
+};
+
+static int xml_url_close(ffparser_schem *ps, void *obj)
+{
+	struct xml_urlset *o = ps->udata;
+	struct xml_url *u = obj;
+	o->urls++;
+	o->sum += u->loc.len + u->lastmod.len + (uint64)(u->prio * 10 + 0.5) + u->sum;
+	ffstr_free(&u->loc);
+	ffstr_free(&u->lastmod);
+	ffmem_tzero(u);
+	return 0;
+}
+static int xml_url_id(ffparser_schem *ps, void *obj, const int64 *val)
+{
+	struct xml_url *u = obj;
+	u->sum += *val;
+	return 0;
+}
+static const ffpars_arg xml_url_args[] = {
+	{ "id", FFPARS_TINT | FFPARS_F64BIT, FFPARS_DST(&xml_url_id) },
+	{ "loc", FFPARS_TSTR | FFPARS_FCOPY | FFPARS_FREQUIRED, FFPARS_DSTOFF(struct xml_url, loc) },
+	{ "lastmod", FFPARS_TSTR | FFPARS_FCOPY, FFPARS_DSTOFF(struct xml_url, lastmod) },
+	{ "priority", FFPARS_TFLOAT | FFPARS_F64BIT, FFPARS_DSTOFF(struct xml_url, prio) },
+	{ NULL, FFPARS_TCLOSE, FFPARS_DST(&xml_url_close) },
+};
+static int xml_url(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	struct xml_urlset *o = obj;
+	ffpars_setargs(ctx, &o->url, xml_url_args, FFCNT(xml_url_args));
+	return 0;
+}
+static int xml_text(ffparser_schem *ps, void *obj, const ffstr *val)
+{
+	struct xml_urlset *o = obj;
+	ffstr_catfmt(&o->text, "%S;", val);
+	return 0;
+}
+static const ffpars_arg xml_urlset_args[] = {
+	{ "xmlns", FFPARS_TSTR | FFPARS_FCOPY, FFPARS_DSTOFF(struct xml_urlset, ns) },
+	{ "url", FFPARS_TOBJ | FFPARS_FMULTI, FFPARS_DST(&xml_url) },
+	{ "#text", FFPARS_TSTR | FFPARS_FMULTI, FFPARS_DST(&xml_text) },
+};
+static int xml_urlset(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	ffpars_setargs(ctx, obj, xml_urlset_args, FFCNT(xml_urlset_args));
+	return 0;
+}
+static const ffpars_arg xml_top_args[] = {
+	{ "urlset", FFPARS_TOBJ | FFPARS_FREQUIRED, FFPARS_DST(&xml_urlset) },
+};
+
+/** Parse the document with the scheme.
+Return 0 on success. */
+static int xml_schem_parse(struct xml_urlset *o, const char *data, size_t len, size_t bufsize, uint flags)
+{
+	ffxml p;
+	ffparser_schem ps;
+	ffpars_ctx ctx = {};
+	int r;
+
+	ffmem_tzero(o);
+	ffpars_setargs(&ctx, o, xml_top_args, FFCNT(xml_top_args));
+	if (0 != (r = ffxml_scheminit(&ps, &p, &ctx)))
+		goto end;
+	ps.udata = o;
+	ps.flags |= flags;
+
+	while (len != 0) {
+		size_t n = ffmin(len, bufsize);
+		r = ffxml_parse(&p, data, &n);
+		data += n;
+		len -= n;
+		r = ffxml_schemrun(&ps);
+		if (r > 0)
+			goto end;
+	}
+
+	r = ffxml_schemfin(&ps);
+
+end:
+	ffxml_parseclose(&p);
+	ffpars_schemfree(&ps);
+	return r;
+}
+
+static void xml_gen_sitemap(ffarr *d, uint n, uint64 *sum)
+{
+	*sum = 0;
+	ffstr_catfmt(d, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<urlset xmlns=\"http://www.sitemaps.org/schemas/sitemap/0.9\">\n");
+	for (uint i = 0;  i != n;  i++) {
+		ffstr_catfmt(d, "<url id=\"%u\">\n\t<loc>https://www.example.com/catalog/item-%u.html?a=1&amp;b=%u</loc>\n"
+			"\t<lastmod>2019-%02u-%02uT10:00:00+00:00</lastmod>\n"
+			"\t<changefreq>weekly</changefreq>\n"
+			"\t<priority>0.%u</priority>\n"
+			"</url>\n"
+			, i, i, i % 7, i % 12 + 1, i % 28 + 1, i % 10);
+		char buf[32];
+		*sum += i
+			+ FFSLEN("https://www.example.com/catalog/item-.html?a=1&b=") + ffs_fmt(buf, buf + sizeof(buf), "%u%u", i, i % 7)
+			+ FFSLEN("2019-00-00T10:00:00+00:00")
+			+ i % 10;
+	}
+	ffstr_catfmt(d, "</urlset>\n");
+}
+
+static void test_xml_schem(void)
+{
+	struct xml_urlset o;
+	ffarr d = {};
+	uint64 sum;
+
+	xml_gen_sitemap(&d, 100, &sum);
+
+	// "changefreq" is unknown
+	x(FFPARS_EUKNKEY == xml_schem_parse(&o, d.ptr, d.len, d.len, 0));
+	ffstr_free(&o.ns);
+	ffstr_free(&o.url.loc);
+	ffstr_free(&o.url.lastmod);
+	ffarr_free(&o.text);
+
+	static const uint bufsizes[] = { 1, 7, 4096, (uint)-1 };
+	for (uint i = 0;  i != FFCNT(bufsizes);  i++) {
+		x(0 == xml_schem_parse(&o, d.ptr, d.len, bufsizes[i], FFXML_SCHEM_FSKIPUNK));
+		x(o.urls == 100);
+		x(o.sum == sum);
+		x(ffstr_eqz(&o.ns, "http://www.sitemaps.org/schemas/sitemap/0.9"));
+		ffstr_free(&o.ns);
+		ffarr_free(&o.text);
+	}
+
+	static const struct {
+		const char *data;
+		int r;
+		const char *text;
+	} docs[] = {
+		{ "<urlset>a<!---->b<skip>c<x/></skip>d&amp;<url><loc/></url></urlset>", 0, "a;b;d&;" },
+		{ "<urlset><url></url></urlset>", FFPARS_ENOREQ, NULL },
+		{ "<urlset><url><loc>x<y/></loc></url></urlset>", FFPARS_EVALTYPE, NULL },
+		{ "<urlset><url><priority>abc</priority></url></urlset>", FFPARS_EBADVAL, NULL },
+		{ "<urlset xmlns='a' xmlns='b'/>", FFPARS_EDUPKEY, NULL },
+		{ "<urlset><url>", FFPARS_ENOBRACE, NULL },
+		{ "<other/>", FFPARS_EUKNKEY, NULL },
+		{ "", FFPARS_ENOREQ, NULL },
+	};
+	for (uint i = 0;  i != FFCNT(docs);  i++) {
+		uint f = (i == 0) ? FFXML_SCHEM_FSKIPUNK : 0;
+		int r = xml_schem_parse(&o, docs[i].data, ffsz_len(docs[i].data), (size_t)-1, f);
+		if (!x(r == docs[i].r))
+			fffile_fmt(ffstdout, NULL, "%s: %d\n", docs[i].data, r);
+		if (docs[i].text != NULL)
+			x(ffstr_eqz(&o.text, docs[i].text));
+		ffstr_free(&o.ns);
+		ffstr_free(&o.url.loc);
+		ffstr_free(&o.url.lastmod);
+		ffarr_free(&o.text);
+	}
+
+	ffarr_free(&d);
+}
+
+int test_xml(void)
+{
+	FFTEST_FUNC;
+	char buf[256];
+
+	x(ffsz_len(ffxml_errmsg(&(ffxml){ .line = 1 }, FFPARS_EBADCHAR, buf, sizeof(buf))) != 0);
+	test_xml_tokens();
+	test_xml_errors();
+	test_xml_schem();
+	return 0;
+}
+
+
+#ifdef FF_TEST_LIBXML2
+static void lx_start(void *ctx, const xmlChar *name, const xmlChar **attrs)
+{
+	uint *events = ctx;
+	*events += 1;
+	for (uint i = 0;  attrs != NULL && attrs[i] != NULL;  i += 2) {
+		*events += 2;
+	}
+}
+
+static void lx_end(void *ctx, const xmlChar *name)
+{
+	uint *events = ctx;
+	*events += 1;
+}
+
+static void lx_text(void *ctx, const xmlChar *ch, int len)
+{
+	uint *events = ctx;
+	*events += 1;
+}
+
+/** Parse the same data with libxml2 SAX push parser for comparison. */
+static void xml_speed_libxml2(const ffarr *d, size_t block)
+{
+	xmlSAXHandler sax = {};
+	sax.startElement = &lx_start;
+	sax.endElement = &lx_end;
+	sax.characters = &lx_text;
+	uint events = 0;
+	fftime start, stop;
+
+	fftime_now(&start);
+	xmlParserCtxtPtr ctx = xmlCreatePushParserCtxt(&sax, &events, NULL, 0, NULL);
+	for (size_t off = 0;  off != d->len; ) {
+		size_t n = ffmin(d->len - off, block);
+		if (!x(0 == xmlParseChunk(ctx, d->ptr + off, n, 0)))
+			break;
+		off += n;
+	}
+	x(0 == xmlParseChunk(ctx, NULL, 0, 1));
+	xmlFreeParserCtxt(ctx);
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "libxml2 SAX: %U bytes, %u events in %Uus: %U MB/sec\n"
+		, (uint64)d->len, events, us, (uint64)d->len / ffmax(us, 1));
+}
+#endif
+
+/** Tokenize and parse with the scheme a large sitemap file in 64k blocks.
+With FF_TEST_LIBXML2 the data is also parsed by libxml2 (make LIBXML2=1). */
+int test_xml_speed(void)
+{
+	FFTEST_FUNC;
+	enum { N = 500000, BLOCK = 64 * 1024 };
+	ffarr d = {};
+	uint64 sum;
+	fftime start, stop;
+
+	xml_gen_sitemap(&d, N, &sum);
+
+	fftime_now(&start);
+	ffxml p;
+	uint events = 0;
+	ffxml_parseinit(&p);
+	for (size_t off = 0;  off != d.len; ) {
+		size_t n = ffmin(d.len - off, BLOCK);
+		ffstr blk;
+		ffstr_set(&blk, d.ptr + off, n);
+		off += n;
+		while (blk.len != 0) {
+			int r = ffxml_parsestr(&p, &blk);
+			if (r < 0)
+				events++;
+			else if (!x(r == 0))
+				break;
+		}
+	}
+	ffxml_parseclose(&p);
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	uint64 us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	fffile_fmt(ffstdout, NULL, "tokenizer: %U bytes, %u events in %Uus: %U MB/sec\n"
+		, (uint64)d.len, events, us, (uint64)d.len / ffmax(us, 1));
+
+	struct xml_urlset o;
+	fftime_now(&start);
+	x(0 == xml_schem_parse(&o, d.ptr, d.len, BLOCK, FFXML_SCHEM_FSKIPUNK));
+	fftime_now(&stop);
+	fftime_diff(&start, &stop);
+	us = fftime_sec(&stop) * 1000000 + fftime_usec(&stop);
+	x(o.urls == N && o.sum == sum);
+	ffstr_free(&o.ns);
+	ffarr_free(&o.text);
+	fffile_fmt(ffstdout, NULL, "scheme: %U bytes in %Uus: %U MB/sec\n"
+		, (uint64)d.len, us, (uint64)d.len / ffmax(us, 1));
+
+#ifdef FF_TEST_LIBXML2
+	xml_speed_libxml2(&d, BLOCK);
+#endif
+
+	ffarr_free(&d);
+	return 0;
+}